@@ -70,64 +70,59 @@ def calcurse_wipe():
     subprocess.call(command)
 
 
-def calcurse_import(icaldata):
-    command = calcurse + [
-        '-i', '-',
-        '--dump-imported',
-        '-q',
-        '--format-apt=%(hash)\\n',
-        '--format-recur-apt=%(hash)\\n',
-        '--format-event=%(hash)\\n',
-        '--format-recur-event=%(hash)\\n',
-        '--format-todo=%(hash)\\n'
-    ]
+def calcurse_batch_start():
+    global batch
+
+    command = calcurse + ['--batch']
 
     if debug:
         print('Running command: {}'.format(command))
 
-    p = subprocess.Popen(command, stdin=subprocess.PIPE, stdout=subprocess.PIPE)
-    return p.communicate(icaldata.encode('utf-8'))[0].decode('utf-8').rstrip()
-
+    batch = subprocess.Popen(command, stdin=subprocess.PIPE,
+                             stdout=subprocess.PIPE)
 
-def calcurse_export(objhash):
-    command = calcurse + [
-        '-xical',
-        '--export-uid',
-        '--filter-hash=' + objhash
-    ]
 
+def calcurse_batch(cmd, data=None):
     if debug:
-        print('Running command: {}'.format(command))
+        print('Running batch command: {}'.format(cmd))
 
-    p = subprocess.Popen(command, stdout=subprocess.PIPE)
-    return p.communicate()[0].decode('utf-8').rstrip()
+    batch.stdin.write((cmd + '\n').encode('utf-8'))
+    if data is not None:
+        batch.stdin.write(data)
+    batch.stdin.flush()
 
+    reply = batch.stdout.readline().decode('utf-8').rstrip('\n')
+    if reply.startswith('OK '):
+        return batch.stdout.read(int(reply[3:])).decode('utf-8')
+    elif reply.startswith('ERR '):
+        return None
+    die('Unexpected reply from calcurse: {}'.format(reply))
 
-def calcurse_hashset():
-    command = calcurse + [
-        '-G',
-        '--filter-type', sync_filter,
-        '--format-apt=%(hash)\\n',
-        '--format-recur-apt=%(hash)\\n',
-        '--format-event=%(hash)\\n',
-        '--format-recur-event=%(hash)\\n',
-        '--format-todo=%(hash)\\n'
-    ]
 
-    if debug:
-        print('Running command: {}'.format(command))
+def calcurse_batch_stop():
+    if calcurse_batch('quit') is None:
+        die('Failed to save the calcurse data files.')
+    batch.wait()
 
-    p = subprocess.Popen(command, stdout=subprocess.PIPE)
-    return set(p.communicate()[0].decode('utf-8').rstrip().splitlines())
+
+def calcurse_import(icaldata):
+    icaldata = icaldata.encode('utf-8')
+    result = calcurse_batch('import {}'.format(len(icaldata)), icaldata)
+    return result.rstrip() if result is not None else ''
 
 
-def calcurse_remove(objhash):
-    command = calcurse + ['-F', '--filter-hash=!' + objhash]
+def calcurse_export(objhash):
+    result = calcurse_batch('export ' + objhash)
+    return result.rstrip() if result is not None else ''
 
-    if debug:
-        print('Running command: {}'.format(command))
 
-    subprocess.call(command)
+def calcurse_hashset():
+    result = calcurse_batch('hashes ' + sync_filter)
+    return set(result.rstrip().splitlines()) if result is not None else set()
+
+
+def calcurse_remove(objhash):
+    calcurse_batch('remove ' + objhash)
 
 
 def calcurse_version():
@@ -765,6 +760,10 @@ try:
             modified.add(href)
     orphan = set(syncdb.keys()) - set(etagdict.keys())
 
+    # Keep the local data loaded in a single calcurse instance while
+    # synchronizing.
+    calcurse_batch_start()
+
     objhashes = calcurse_hashset()
     new = objhashes - set([entry[1] for entry in syncdb.values()])
     gone = set([entry[1] for entry in syncdb.values()]) - objhashes
@@ -781,6 +780,9 @@ try:
     # Remove items from the server if they no longer exist locally.
     remote_del = remove_remote_objects(gone, conn, syncdb, etagdict)
 
+    # Write the local data files.
+    calcurse_batch_stop()
+
     # Write the synchronization database.
     save_syncdb(syncdbfn, syncdb)
 
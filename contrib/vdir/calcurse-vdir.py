@@ -70,34 +70,40 @@ def calcurse_export():
     return [x for x in io.TextIOWrapper(proc.stdout, encoding="utf-8")]
 
 
+def calcurse_batch(cmd, data=None):
+    """Run a command in the calcurse batch process, return its result"""
+    batch.stdin.write((cmd + '\n').encode('utf-8'))
+    if data is not None:
+        batch.stdin.write(data)
+    batch.stdin.flush()
+
+    reply = batch.stdout.readline().decode('utf-8').rstrip('\n')
+    if reply.startswith('OK '):
+        return batch.stdout.read(int(reply[3:])).decode('utf-8')
+    elif reply.startswith('ERR '):
+        return None
+    die("unexpected reply from calcurse: {0}".format(reply))
+
+
 def calcurse_remove(uid):
     """Remove calcurse event by uid"""
     if verbose:
         log("Removing event {0} from calcurse".format(uid))
-    command = calcurse + ['-P', '--filter-hash=' + uid]
-    subprocess.call(command)
+    calcurse_batch('remove ' + uid)
 
 
 def calcurse_import(file):
     """Import ics file to calcurse"""
     if verbose:
         log("Importing event {0} to calcurse".format(file_to_uid(file)))
-    command = calcurse + ['-i', file]
-    subprocess.call(command, stdout=subprocess.DEVNULL)
+    with open(file, 'rb') as f:
+        data = f.read()
+    calcurse_batch('import {0}'.format(len(data)), data)
 
 
 def calcurse_list():
     """Return all calcurse item uids"""
-    command = calcurse + [
-        '-G',
-        '--format-apt=%(hash)\\n',
-        '--format-recur-apt=%(hash)\\n',
-        '--format-event=%(hash)\\n',
-        '--format-recur-event=%(hash)\\n',
-        '--format-todo=%(hash)\\n'
-    ]
-    proc = subprocess.Popen(command, stdout=subprocess.PIPE)
-    return [x.strip() for x in io.TextIOWrapper(proc.stdout, encoding="utf-8")]
+    return calcurse_batch('hashes').split()
 
 
 def parse_calcurse_data(raw):
@@ -136,6 +142,10 @@ def calcurse_to_vdir():
 
 def vdir_to_calcurse():
     """Import vdir data to calcurse"""
+    global batch
+    batch = subprocess.Popen(calcurse + ['--batch'], stdin=subprocess.PIPE,
+                             stdout=subprocess.PIPE)
+
     files_calc = [x + '.ics' for x in calcurse_list()]
     files_vdir = [x for x in os.listdir(vdir) if x.endswith('.ics')]
 
@@ -146,6 +156,10 @@ def vdir_to_calcurse():
         for file in [f for f in files_calc if f not in files_vdir]:
             calcurse_remove(file[:-4])
 
+    if calcurse_batch('quit') is None:
+        die("failed to save the calcurse data files")
+    batch.wait()
+
 
 parser = argparse.ArgumentParser('calcurse-vdir')
 parser.add_argument('action', choices=['import', 'export'],
@@ -60,10 +60,7 @@ struct apoint *apoint_dup(struct apoint *in)
 	apt->dur = in->dur;
 	apt->state = in->state;
 	apt->mesg = mem_strdup(in->mesg);
-	if (in->note)
-		apt->note = mem_strdup(in->note);
-	else
-		apt->note = NULL;
+	apt->note = note_dup(in->note);
 
 	return apt;
 }
@@ -98,21 +95,35 @@ static int apoint_cmp(struct apoint *a, struct apoint *b)
 	return strcmp(a->mesg, b->mesg);
 }
 
-struct apoint *apoint_new(char *mesg, char *note, time_t start, long dur,
-			  char state)
+static struct apoint *apoint_alloc(char *mesg, char *note, time_t start,
+				   long dur, char state)
 {
 	struct apoint *apt;
 
 	apt = mem_malloc(sizeof(struct apoint));
 	apt->mesg = mem_strdup(mesg);
-	apt->note = (note != NULL) ? mem_strdup(note) : NULL;
+	apt->note = note_dup(note);
 	apt->state = state;
 	apt->start = start;
 	apt->dur = dur;
 
+	return apt;
+}
+
+/* Insert an appointment into the appointment list. */
+void apoint_add(struct apoint *apt)
+{
 	LLIST_TS_LOCK(&alist_p);
 	LLIST_TS_ADD_SORTED(&alist_p, apt, apoint_cmp);
 	LLIST_TS_UNLOCK(&alist_p);
+}
+
+struct apoint *apoint_new(char *mesg, char *note, time_t start, long dur,
+			  char state)
+{
+	struct apoint *apt = apoint_alloc(mesg, note, start, dur, state);
+
+	apoint_add(apt);
 
 	return apt;
 }
@@ -147,76 +158,116 @@ void apoint_sec2str(struct apoint *o, time_t day, char *start, char *end)
 	}
 }
 
-char *apoint_tostr(struct apoint *o)
+/* Append the data file line of an appointment to a string. */
+void apoint_serialize(struct apoint *o, struct string *s)
 {
-	struct string s;
 	struct tm lt;
 	time_t t;
 
-	string_init(&s);
-
 	t = o->start;
 	localtime_r(&t, &lt);
-	string_catf(&s, "%02u/%02u/%04u @ %02u:%02u", lt.tm_mon + 1,
-		lt.tm_mday, 1900 + lt.tm_year, lt.tm_hour, lt.tm_min);
+	string_catdate(s, &lt);
+	string_catn(s, " @ ", 3);
+	string_cattime(s, &lt);
 
 	t = o->start + o->dur;
 	localtime_r(&t, &lt);
-	string_catf(&s, " -> %02u/%02u/%04u @ %02u:%02u", lt.tm_mon + 1,
-		lt.tm_mday, 1900 + lt.tm_year, lt.tm_hour, lt.tm_min);
+	string_catn(s, " -> ", 4);
+	string_catdate(s, &lt);
+	string_catn(s, " @ ", 3);
+	string_cattime(s, &lt);
+
+	if (o->note) {
+		string_catc(s, '>');
+		string_cats(s, o->note);
+		string_catc(s, ' ');
+	}
 
-	if (o->note)
-		string_catf(&s, ">%s ", o->note);
+	string_catc(s, (o->state & APOINT_NOTIFY) ? '!' : '|');
+	string_cats(s, o->mesg);
+}
 
-	if (o->state & APOINT_NOTIFY)
-		string_catf(&s, "%c", '!');
-	else
-		string_catf(&s, "%c", '|');
+char *apoint_tostr(struct apoint *o)
+{
+	struct string s;
 
-	string_catf(&s, "%s", o->mesg);
+	string_init(&s);
+	apoint_serialize(o, &s);
 
 	return string_buf(&s);
 }
 
 char *apoint_hash(struct apoint *apt)
 {
-	char *raw = apoint_tostr(apt);
-	char *sha1 = mem_malloc(SHA1_DIGESTLEN * 2 + 1);
-	sha1_digest(raw, sha1);
-	mem_free(raw);
+	char buf[STRING_LOCAL_BUFSIZE];
+	char *sha1 = item_hash_lookup(apt);
+	struct string s;
+
+	if (sha1)
+		return sha1;
+	sha1 = mem_malloc(SHA1_DIGESTLEN * 2 + 1);
+	string_init_buf(&s, buf, sizeof(buf));
+	apoint_serialize(apt, &s);
+	sha1_digest(string_buf(&s), sha1);
+	string_free(&s);
 
 	return sha1;
 }
 
 void apoint_write(struct apoint *o, FILE * f)
 {
-	char *str = apoint_tostr(o);
-	fprintf(f, "%s\n", str);
-	mem_free(str);
+	char buf[STRING_LOCAL_BUFSIZE];
+	struct string s;
+
+	string_init_buf(&s, buf, sizeof(buf));
+	apoint_serialize(o, &s);
+	string_catc(&s, '\n');
+	fwrite(string_buf(&s), 1, s.len, f);
+	string_free(&s);
 }
 
-char *apoint_scan(FILE * f, struct tm start, struct tm end,
-			   char state, char *note, struct item_filter *filter)
+/* Check whether an appointment is selected by a filter. */
+int apoint_filter(struct apoint *apt, struct item_filter *filter)
 {
-	char buf[BUFSIZ], *newline;
-	time_t tstart, tend;
-	struct apoint *apt = NULL;
+	time_t tstart = apt->start, tend = apt->start + apt->dur;
 	int cond;
 
+	cond = (
+	    !(filter->type_mask & TYPE_MASK_APPT) ||
+	    (filter->regex && regexec(filter->regex, apt->mesg, 0, 0, 0)) ||
+	    (filter->start_from != -1 && tstart < filter->start_from) ||
+	    (filter->start_to != -1 && tstart > filter->start_to) ||
+	    (filter->end_from != -1 && tend < filter->end_from) ||
+	    (filter->end_to != -1 && tend > filter->end_to)
+	);
+	if (!cond && filter->hash) {
+		char *hash = apoint_hash(apt);
+		cond = !hash_matches(filter->hash, hash);
+		mem_free(hash);
+	}
+
+	return filter->invert ? cond : !cond;
+}
+
+/*
+ * Build an appointment from its parsed fields and description. The item is
+ * returned in *res without being added to the appointment list; *res is set
+ * to NULL if the item is rejected by the filter.
+ */
+char *apoint_scan(char *buf, struct tm start, struct tm end,
+			   char state, char *note, struct item_filter *filter,
+			   struct apoint **res)
+{
+	time_t tstart, tend;
+
+	*res = NULL;
+
 	if (!check_date(start.tm_year, start.tm_mon, start.tm_mday) ||
 	    !check_date(end.tm_year, end.tm_mon, end.tm_mday) ||
 	    !check_time(start.tm_hour, start.tm_min) ||
 	    !check_time(end.tm_hour, end.tm_min))
 		return _("illegal date in appointment");
 
-	/* Read the appointment description */
-	if (!fgets(buf, sizeof buf, f))
-		return _("error in appointment description");
-
-	newline = strchr(buf, '\n');
-	if (newline)
-		*newline = '\0';
-
 	start.tm_sec = end.tm_sec = 0;
 	start.tm_isdst = end.tm_isdst = -1;
 	start.tm_year -= 1900;
@@ -231,30 +282,17 @@ char *apoint_scan(FILE * f, struct tm start, struct tm end,
 
 	/* Filter item. */
 	if (filter) {
-		cond = (
-		    !(filter->type_mask & TYPE_MASK_APPT) ||
-		    (filter->regex && regexec(filter->regex, buf, 0, 0, 0)) ||
-		    (filter->start_from != -1 && tstart < filter->start_from) ||
-		    (filter->start_to != -1 && tstart > filter->start_to) ||
-		    (filter->end_from != -1 && tend < filter->end_from) ||
-		    (filter->end_to != -1 && tend > filter->end_to)
-		);
-		if (filter->hash) {
-			apt = apoint_new(
-				buf, note, tstart, tend - tstart, state);
-			char *hash = apoint_hash(apt);
-			cond = cond || !hash_matches(filter->hash, hash);
-			mem_free(hash);
-		}
-
-		if ((!filter->invert && cond) || (filter->invert && !cond)) {
-			if (filter->hash)
-				apoint_delete(apt);
+		struct apoint tmp;
+
+		tmp.start = tstart;
+		tmp.dur = tend - tstart;
+		tmp.state = state;
+		tmp.mesg = buf;
+		tmp.note = note;
+		if (!apoint_filter(&tmp, filter))
 			return NULL;
-		}
 	}
-	if (!apt)
-		apt = apoint_new(buf, note, tstart, tend - tstart, state);
+	*res = apoint_alloc(buf, note, tstart, tend - tstart, state);
 	return NULL;
 }
 
@@ -38,12 +38,17 @@
 #include <string.h>
 #include <ctype.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <limits.h>
 #include <getopt.h>
 #include <time.h>
 
 #include "calcurse.h"
 
+/* Size of the output buffer for JSON Lines. */
+#define JSONL_BUFSIZE (64 * 1024)
+
 /* Input types for parse_datetimearg() */
 enum {
 	ARG_DATE,
@@ -84,10 +89,53 @@ enum {
 	OPT_READ_ONLY,
 	OPT_STATUS,
 	OPT_DAEMON,
+	OPT_ARCHIVE,
 	OPT_INPUT_DATEFMT,
-	OPT_OUTPUT_DATEFMT
+	OPT_OUTPUT_DATEFMT,
+	OPT_BATCH,
+	OPT_OUTPUT
 };
 
+/* Set while the daemon answers a query from the data in memory. */
+static int args_in_memory;
+
+/* The configuration and data files the daemon has loaded. */
+static struct stat args_dmon_conf, args_dmon_apts, args_dmon_todo;
+
+static void args_stat(const char *path, struct stat *st)
+{
+	if (stat(path, st) < 0)
+		memset(st, 0, sizeof(*st));
+}
+
+static int args_same_file(const char *path, const struct stat *loaded)
+{
+	struct stat st;
+
+	args_stat(path, &st);
+	return st.st_dev == loaded->st_dev && st.st_ino == loaded->st_ino;
+}
+
+/*
+ * Check whether the files selected by the client are those the daemon has
+ * loaded. A query about any other data set must not be answered from memory.
+ */
+static int args_same_data(void)
+{
+	return args_same_file(path_conf, &args_dmon_conf) &&
+	       args_same_file(path_apts, &args_dmon_apts) &&
+	       args_same_file(path_todo, &args_dmon_todo);
+}
+
+/*
+ * Hand a read-only query over to the daemon, if it is listening. Return 1 if
+ * the query has been answered.
+ */
+static int args_query_dmon(int argc, char **argv)
+{
+	return !args_in_memory && dmon_query(argc, argv);
+}
+
 /*
  * Print Calcurse usage and exit.
  */
@@ -97,7 +145,8 @@ static void usage(void)
 			 "calcurse [-D <directory>] [-C <directory>] [-c <calendar file>]\n"
 			 "calcurse -Q [--from <date>] [--to <date>] [--days <number>]\n"
 			 "calcurse -a | -d <date> | -d <number> | -n | -r[<number>] | -s[<date>] | -t[<number>]\n"
-			 "calcurse -h | -v | --status | -G | -P | -g | -i <file> | -x[<format>] | --daemon"));
+			 "calcurse -h | -v | --status | -G | -P | -g | -i <file> | -x[<format>] | --daemon\n"
+			 "calcurse --archive[=<days>] | --batch"));
 }
 
 static void usage_try(void)
@@ -133,6 +182,7 @@ static void help_arg(void)
 	printf("%s\n", _("Note that filter, format and day-range options affect input or output:"));
 	printf("%s\n", _("  --filter-*              Filter items loaded by -Q, -G, -P and -x"));
 	printf("%s\n", _("  --format-*              Rewrite output from -Q, -G and --dump-imported"));
+	printf("%s\n", _("  --output=jsonl          Print one JSON object per item instead"));
 	printf("%s\n", _("  --from <date>           Limit day range of -Q."));
 	printf("%s\n", _("  --to <date>             Limit day range of -Q."));
 	printf("%s\n", _("  --days <number>         Limit day range of -Q."));
@@ -142,6 +192,8 @@ static void help_arg(void)
 	printf("%s\n", _("Consult the man page for details."));
 	putchar('\n');
 	printf("%s\n", _("Miscellaneous:"));
+	printf("%s\n", _("  --archive[=<days>]      Archive items that ended that many days ago"));
+	printf("%s\n", _("  --batch                 Run commands read from stdin, see the man page"));
 	printf("%s\n", _("  -c, --calendar <file>   The calendar data file to use"));
 	printf("%s\n", _("  -C, --confdir <dir>     The configuration directory to use"));
 	printf("%s\n", _("  --daemon                Run notification daemon in the background"));
@@ -194,12 +246,16 @@ static void status_arg(void)
 		puts(_("calcurse is not running"));
 }
 
-/* Print TODO list and return the number of printed items. */
-static int todo_arg(const char *format, int *limit, struct item_filter *filter)
+/*
+ * Print TODO list and return the number of printed items. The title is left
+ * out unless headings is set.
+ */
+static int todo_arg(const struct format *format, int *limit,
+		    struct item_filter *filter, int headings)
 {
 	const char *titlestr =
 		filter->completed ? _("completed tasks:\n") : _("to do:\n");
-	int title = 1;
+	int title = headings;
 	int n = 0;
 	llist_item_t *i;
 
@@ -266,11 +322,13 @@ static void arg_print_date(long date)
  * Print appointments inside the given query range.
  * If no start day is given (-1), today is considered.
  * If no end date is given (-1), a range of 1 day is considered.
+ * Unless headings is set, the days are not introduced by their date.
  */
 static void
-date_arg_from_to(long from, long to, int add_line, const char *fmt_apt,
-		 const char *fmt_rapt, const char *fmt_ev, const char *fmt_rev,
-		 int *limit)
+date_arg_from_to(long from, long to, int add_line,
+		 const struct format *fmt_apt, const struct format *fmt_rapt,
+		 const struct format *fmt_ev, const struct format *fmt_rev,
+		 int *limit, int headings)
 {
 	long date;
 
@@ -278,9 +336,11 @@ date_arg_from_to(long from, long to, int add_line, const char *fmt_apt,
 		day_store_items(date, 0, 1);
 		if (day_item_count(0) == 0)
 			continue;
-		if (add_line)
-			fputs("\n", stdout);
-		arg_print_date(date);
+		if (headings) {
+			if (add_line)
+				fputs("\n", stdout);
+			arg_print_date(date);
+		}
 		day_write_stdout(date, fmt_apt, fmt_rapt, fmt_ev,
 				 fmt_rev, limit);
 		add_line = 1;
@@ -364,7 +424,7 @@ cleanup:
 	return ret;
 }
 
-static int parse_type_mask(const char *str)
+int parse_type_mask(const char *str)
 {
 	char *buf = mem_strdup(str), *p;
 	int mask = 0;
@@ -405,6 +465,7 @@ int parse_args(int argc, char **argv)
 	/* Command-line flags - NOTE that read_only is global */
 	int grep = 0, grep_filter = 0, purge = 0, query = 0, next = 0;
 	int status = 0, gc = 0, import = 0, export = 0, daemon = 0;
+	int archive = 0, archive_days = -1, batch = 0;
 	/* Command line invocation */
 	int filter_opt = 0, format_opt = 0, query_range = 0, cmd_line = 0;
 	int start_from = 0, start_to = 0, end_from = 0, end_to = 0;
@@ -420,9 +481,13 @@ int parse_args(int argc, char **argv)
 	const char *fmt_ev = NULL;
 	const char *fmt_rev = NULL;
 	const char *fmt_todo = NULL;
+	/* Compiled format strings */
+	struct format cfmt_apt, cfmt_rapt, cfmt_ev, cfmt_rev, cfmt_todo;
 	/* Import and export parameters */
 	int xfmt = IO_EXPORT_ICAL;
 	int dump_imported = 0, export_uid = 0;
+	/* Output format */
+	int jsonl = 0;
 	/* Data file locations */
 	const char *datadir = NULL;
 	const char *cfile = NULL, *confdir = NULL;
@@ -495,8 +560,11 @@ int parse_args(int argc, char **argv)
 		{"read-only", no_argument, NULL, OPT_READ_ONLY},
 		{"status", no_argument, NULL, OPT_STATUS},
 		{"daemon", no_argument, NULL, OPT_DAEMON},
+		{"archive", optional_argument, NULL, OPT_ARCHIVE},
 		{"input-datefmt", required_argument, NULL, OPT_INPUT_DATEFMT},
 		{"output-datefmt", required_argument, NULL, OPT_OUTPUT_DATEFMT},
+		{"batch", no_argument, NULL, OPT_BATCH},
+		{"output", required_argument, NULL, OPT_OUTPUT},
 		{NULL, no_argument, NULL, 0}
 	};
 
@@ -522,6 +590,8 @@ int parse_args(int argc, char **argv)
 		}
 	}
 	io_init(cfile, datadir, confdir);
+	if (args_in_memory && !args_same_data())
+		exit(EXIT_FAILURE);
 	vars_init();
 	notify_init_vars();
 	if (io_file_exists(path_conf))
@@ -847,6 +917,16 @@ int parse_args(int argc, char **argv)
 			daemon = 1;
 			filter.type_mask = TYPE_MASK_APPT | TYPE_MASK_RECUR_APPT;
 			break;
+		case OPT_ARCHIVE:
+			archive = 1;
+			if (optarg) {
+				archive_days = atoi(optarg);
+				EXIT_IF(archive_days < 0 ||
+					!is_all_digit(optarg),
+					_("invalid number of days: %s"),
+					optarg);
+			}
+			break;
 		case OPT_INPUT_DATEFMT:
 			conf.input_datefmt = atoi(optarg);
 			EXIT_IF(conf.input_datefmt < 1 || conf.input_datefmt > 4,
@@ -864,18 +944,33 @@ int parse_args(int argc, char **argv)
 				'\0';
 			cmd_line = 1;
 			break;
+		case OPT_BATCH:
+			batch = 1;
+			break;
+		case OPT_OUTPUT:
+			if (!strcmp(optarg, "jsonl"))
+				jsonl = 1;
+			else if (!strcmp(optarg, "text"))
+				jsonl = 0;
+			else
+				EXIT(_("invalid output format: %s"), optarg);
+			break;
 		}
 	}
 
 	if (filter.type_mask == 0)
 		filter.type_mask = TYPE_MASK_ALL;
 
-	if (status + grep + query + next + gc + import + export + daemon > 1 ||
+	if (status + grep + query + next + gc + import + export + daemon +
+	    archive + batch > 1 ||
 	    optind < argc ||
 	    (filter_opt && !(grep + query + export)) ||
 	    (format_opt && !(grep + query + dump_imported)) ||
+	    (jsonl && (format_opt || purge || grep_filter ||
+		       !(grep + query + dump_imported))) ||
 	    (query_range && !query) ||
-	    (purge && !filter.invert)
+	    (purge && !filter.invert) ||
+	    (args_in_memory && !(query + next + (grep && !purge && !grep_filter)))
 	   )
 		EXIT(_("invalid argument combination"));
 
@@ -895,78 +990,110 @@ int parse_args(int argc, char **argv)
 	io_check_dir(path_cdir);
 	io_check_dir(path_hooks);
 
+	/*
+	 * Use default values for non-specified format strings, and compile
+	 * them once before printing any item. JSON Lines are written in large
+	 * blocks, one object per item.
+	 */
+	if (query) {
+		fmt_apt = fmt_apt ? fmt_apt : " - %S -> %E\n\t%m\n";
+		fmt_rapt = fmt_rapt ? fmt_rapt : " - %S -> %E\n\t%m\n";
+		fmt_ev = fmt_ev ? fmt_ev : " * %m\n";
+		fmt_rev = fmt_rev ? fmt_rev : " * %m\n";
+		fmt_todo = fmt_todo ? fmt_todo : "%p. %m\n";
+	} else {
+		fmt_apt = fmt_apt ? fmt_apt : "%(raw)";
+		fmt_rapt = fmt_rapt ? fmt_rapt : "%(raw)";
+		fmt_ev = fmt_ev ? fmt_ev : "%(raw)";
+		fmt_rev = fmt_rev ? fmt_rev : "%(raw)";
+		fmt_todo = fmt_todo ? fmt_todo : "%(raw)";
+	}
+	if (jsonl) {
+		setvbuf(stdout, NULL, _IOFBF, JSONL_BUFSIZE);
+		format_compile_json(&cfmt_apt);
+		format_compile_json(&cfmt_rapt);
+		format_compile_json(&cfmt_ev);
+		format_compile_json(&cfmt_rev);
+		format_compile_json(&cfmt_todo);
+	} else {
+		format_compile(&cfmt_apt, fmt_apt);
+		format_compile(&cfmt_rapt, fmt_rapt);
+		format_compile(&cfmt_ev, fmt_ev);
+		format_compile(&cfmt_rev, fmt_rev);
+		format_compile(&cfmt_todo, fmt_todo);
+	}
+
+	if (args_in_memory)
+		io_filter_data(&filter);
+
 	if (status) {
 		status_arg();
 	} else if (grep) {
-		io_check_file(path_apts);
-		io_check_file(path_todo);
-		io_check_file(path_conf);
-		io_load_data(&filter, FORCE);
+		if (!purge && !grep_filter && args_query_dmon(argc, argv))
+			goto cleanup;
+		if (!args_in_memory) {
+			io_check_file(path_apts);
+			io_check_file(path_todo);
+			io_check_file(path_conf);
+			io_load_data(&filter, FORCE);
+		}
 		if (purge || grep_filter) {
-			io_save_todo(path_todo);
-			io_save_apts(path_apts);
+			io_save_todo(path_todo, NULL);
+			io_save_apts(path_apts, NULL);
 		} else {
-			/*
-			 * Use default values for non-specified format strings.
-			 */
-			fmt_apt = fmt_apt ? fmt_apt : "%(raw)";
-			fmt_rapt = fmt_rapt ? fmt_rapt : "%(raw)";
-			fmt_ev = fmt_ev ? fmt_ev : "%(raw)";
-			fmt_rev = fmt_rev ? fmt_rev : "%(raw)";
-			fmt_todo = fmt_todo ? fmt_todo : "%(raw)";
-
-			io_dump_todo(fmt_todo);
-			io_dump_apts(fmt_apt, fmt_rapt, fmt_ev, fmt_rev);
+			if (jsonl || strstr(fmt_todo, "%(hash)") ||
+			    strstr(fmt_apt, "%(hash)") ||
+			    strstr(fmt_rapt, "%(hash)") ||
+			    strstr(fmt_ev, "%(hash)") ||
+			    strstr(fmt_rev, "%(hash)"))
+				item_hashes_prefetch();
+			io_dump_todo(&cfmt_todo);
+			io_dump_apts(&cfmt_apt, &cfmt_rapt, &cfmt_ev,
+				     &cfmt_rev);
+			item_hashes_free();
 		}
 	} else if (query) {
-		io_check_file(path_apts);
-		io_check_file(path_todo);
-		io_check_file(path_conf);
-		io_load_data(&filter, FORCE);
-
-		/* Use default values for non-specified format strings. */
-		fmt_apt = fmt_apt ? fmt_apt : " - %S -> %E\n\t%m\n";
-		fmt_rapt = fmt_rapt ? fmt_rapt : " - %S -> %E\n\t%m\n";
-		fmt_ev = fmt_ev ? fmt_ev : " * %m\n";
-		fmt_rev = fmt_rev ? fmt_rev : " * %m\n";
-		fmt_todo = fmt_todo ? fmt_todo : "%p. %m\n";
+		if (args_query_dmon(argc, argv))
+			goto cleanup;
+		if (!args_in_memory) {
+			io_check_file(path_apts);
+			io_check_file(path_todo);
+			io_check_file(path_conf);
+			io_load_on_demand();
+			io_load_data(&filter, FORCE);
+		}
 
-		int add_line = todo_arg(fmt_todo, &limit, &filter);
-		date_arg_from_to(from, to, add_line, fmt_apt, fmt_rapt, fmt_ev,
-				 fmt_rev, &limit);
+		int add_line = todo_arg(&cfmt_todo, &limit, &filter, !jsonl);
+		date_arg_from_to(from, to, add_line, &cfmt_apt, &cfmt_rapt,
+				 &cfmt_ev, &cfmt_rev, &limit, !jsonl);
 	} else if (next) {
-		io_check_file(path_apts);
-		io_load_app(&filter);
+		if (args_query_dmon(argc, argv))
+			goto cleanup;
+		if (!args_in_memory) {
+			io_check_file(path_apts);
+			io_load_app(&filter);
+		}
 		next_arg();
 	} else if (gc) {
 		io_check_file(path_apts);
 		io_check_file(path_todo);
 		io_load_data(NULL, FORCE);
-		note_gc();
+		note_gc(1);
 	} else if (import) {
 		io_check_file(path_apts);
 		io_check_file(path_todo);
 		io_load_data(NULL, FORCE);
 		if (dump_imported) {
-			/*
-			 * Use default values for non-specified format strings.
-			 */
-			fmt_apt = fmt_apt ? fmt_apt : "%(raw)";
-			fmt_rapt = fmt_rapt ? fmt_rapt : "%(raw)";
-			fmt_ev = fmt_ev ? fmt_ev : "%(raw)";
-			fmt_rev = fmt_rev ? fmt_rev : "%(raw)";
-			fmt_todo = fmt_todo ? fmt_todo : "%(raw)";
+			ret = io_import_data(IO_IMPORT_ICAL, ifile, &cfmt_ev,
+					     &cfmt_rev, &cfmt_apt, &cfmt_rapt,
+					     &cfmt_todo);
 		} else {
-			/*
-			 * Do not dump items, unset format strings explicitly.
-			 */
-			fmt_apt = fmt_rapt = fmt_ev = fmt_rev = NULL;
-			fmt_todo = NULL;
+			/* Do not dump items, pass no format strings. */
+			ret = io_import_data(IO_IMPORT_ICAL, ifile, NULL, NULL,
+					     NULL, NULL, NULL);
 		}
-		ret = io_import_data(IO_IMPORT_ICAL, ifile, fmt_ev, fmt_rev,
-				     fmt_apt, fmt_rapt, fmt_todo);
-		io_save_apts(path_apts);
-		io_save_todo(path_todo);
+		io_save_apts(path_apts, NULL);
+		io_save_todo(path_todo, NULL);
 		if (!ret)
 			exit_calcurse(EXIT_FAILURE);
 	} else if (export) {
@@ -974,6 +1101,20 @@ int parse_args(int argc, char **argv)
 		io_check_file(path_todo);
 		io_load_data(&filter, FORCE);
 		io_export_data(xfmt, export_uid);
+	} else if (archive) {
+		io_check_file(path_apts);
+		io_check_file(path_todo);
+		io_load_data(NULL, FORCE);
+		if (archive_days < 0)
+			archive_days = conf.archive_age;
+		io_archive(date_sec_change(get_today(), 0, -archive_days));
+		io_save_apts(path_apts, NULL);
+	} else if (batch) {
+		io_check_file(path_apts);
+		io_check_file(path_todo);
+		io_load_data(NULL, FORCE);
+		if (!batch_run(stdin, stdout))
+			exit_calcurse(EXIT_FAILURE);
 	} else if (daemon) {
 		dmon_stop();
 		dmon_start(0);
@@ -982,9 +1123,34 @@ int parse_args(int argc, char **argv)
 		non_interactive = 0;
 	}
 
+	format_free(&cfmt_apt);
+	format_free(&cfmt_rapt);
+	format_free(&cfmt_ev);
+	format_free(&cfmt_rev);
+	format_free(&cfmt_todo);
+
+cleanup:
 	/* Free filter parameters. */
 	if (filter.regex)
 		regfree(filter.regex);
 
 	return non_interactive;
 }
+
+/*
+ * Answer a query on behalf of a client with the data that are already in
+ * memory. The command-line arguments and the working directory are those of
+ * the client.
+ */
+void args_serve(const char *cwd, int argc, char **argv)
+{
+	args_stat(path_conf, &args_dmon_conf);
+	args_stat(path_apts, &args_dmon_apts);
+	args_stat(path_todo, &args_dmon_todo);
+	if (chdir(cwd) < 0)
+		exit(EXIT_FAILURE);
+
+	args_in_memory = 1;
+	optind = 1;
+	parse_args(argc, argv);
+}
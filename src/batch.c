@@ -0,0 +1,527 @@
+/*
+ * Calcurse - text-based organizer
+ *
+ * Copyright (c) 2004-2020 calcurse Development Team <misc@calcurse.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the
+ *        following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the
+ *        following disclaimer in the documentation and/or other
+ *        materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Send your feedback or comments to : misc@calcurse.org
+ * Calcurse home page : http://calcurse.org
+ *
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "calcurse.h"
+#include "sha1.h"
+
+/*
+ * Batch mode. Commands are read from a stream, one per line, and run against
+ * the items loaded once at the start; the data files are written once at the
+ * end, or whenever a save is requested. Each command gets one reply:
+ *
+ *   OK <length>\n<length bytes of payload>
+ *   ERR <message>\n
+ *
+ * The commands are:
+ *
+ *   hashes [<types>]   print the hashes of the items of the given types
+ *   export <hash>      export the items with the given hash to iCal
+ *   remove <hash>      remove the items with the given hash
+ *   import <length>    import the iCal data of the following <length> bytes,
+ *                      print the hashes of the new items
+ *   save               write the data files, print the hashes of the items
+ *                      whose changes were dropped, see below
+ *   quit               write the data files and stop
+ *
+ * The items are indexed by hash and by list item, so that a command does not
+ * need to look at every item. Removed items are only cleared from the lists,
+ * which are swept before they are walked.
+ *
+ * If the data files were changed by another instance in the meantime, the
+ * changes are merged item by item when saving. Items changed on both sides
+ * keep the version of the data files; the hashes of the versions that were
+ * dropped are printed, so that the caller can apply them again.
+ */
+
+#define BATCH_TABLE_MIN 1024
+
+struct batch_item {
+	char *hash;
+	enum item_type type;
+	llist_item_t *i;	/* NULL once removed */
+};
+
+struct batch_slot {
+	uint64_t key;
+	unsigned idx;		/* index of the item plus one, 0 if free */
+};
+
+struct batch_table {
+	struct batch_slot *slot;
+	unsigned size;		/* a power of two */
+	unsigned used;
+};
+
+struct batch {
+	struct batch_item *items;
+	unsigned n, size;
+	struct batch_table by_hash;
+	struct batch_table by_list;
+	int cleared;		/* items have been cleared from the lists */
+	int modified;
+};
+
+static uint64_t batch_hash_key(const char *hash)
+{
+	uint64_t key = 14695981039346656037ULL;
+
+	for (; *hash; hash++)
+		key = (key ^ (unsigned char)*hash) * 1099511628211ULL;
+	return key;
+}
+
+static uint64_t batch_list_key(const llist_item_t *i)
+{
+	return ((uintptr_t)i >> 4) * 11400714819323198485ULL;
+}
+
+static void batch_table_put(struct batch_table *t, uint64_t key, unsigned idx)
+{
+	unsigned k;
+
+	for (k = key & (t->size - 1); t->slot[k].idx; k = (k + 1) & (t->size - 1))
+		;
+	t->slot[k].key = key;
+	t->slot[k].idx = idx + 1;
+}
+
+static void batch_table_add(struct batch_table *t, uint64_t key, unsigned idx)
+{
+	struct batch_slot *slot = t->slot;
+	unsigned size = t->size, k;
+
+	if (2 * (t->used + 1) > t->size) {
+		t->size = size ? size * 2 : BATCH_TABLE_MIN;
+		t->slot = mem_calloc(t->size, sizeof(struct batch_slot));
+		for (k = 0; k < size; k++) {
+			if (slot[k].idx)
+				batch_table_put(t, slot[k].key, slot[k].idx - 1);
+		}
+		if (slot)
+			mem_free(slot);
+	}
+	batch_table_put(t, key, idx);
+	t->used++;
+}
+
+static void batch_table_free(struct batch_table *t)
+{
+	if (t->slot)
+		mem_free(t->slot);
+}
+
+/*
+ * Find the next item stored under a key, starting at slot *k. Start with *k
+ * set to the key itself. Return the index of the item plus one, or 0.
+ */
+static unsigned batch_table_next(struct batch_table *t, uint64_t key,
+				 unsigned *k)
+{
+	unsigned idx;
+
+	if (!t->size)
+		return 0;
+	for (*k &= t->size - 1; (idx = t->slot[*k].idx);
+	     *k = (*k + 1) & (t->size - 1)) {
+		if (t->slot[*k].key == key) {
+			*k = (*k + 1) & (t->size - 1);
+			return idx;
+		}
+	}
+	return 0;
+}
+
+static char *batch_item_hash(enum item_type type, void *data)
+{
+	switch (type) {
+	case TYPE_EVNT:
+		return event_hash(data);
+	case TYPE_APPT:
+		return apoint_hash(data);
+	case TYPE_RECUR_EVNT:
+		return recur_event_hash(data);
+	case TYPE_RECUR_APPT:
+		return recur_apoint_hash(data);
+	default:
+		return todo_hash(data);
+	}
+}
+
+/* Index a list item, unless it is indexed already. */
+static struct batch_item *batch_add(struct batch *b, enum item_type type,
+				    llist_item_t *i)
+{
+	uint64_t key = batch_list_key(i);
+	unsigned k = key, idx;
+	struct batch_item *item;
+
+	while ((idx = batch_table_next(&b->by_list, key, &k))) {
+		if (b->items[idx - 1].i == i)
+			return NULL;
+	}
+
+	if (b->n == b->size) {
+		b->size = b->size ? b->size * 2 : BATCH_TABLE_MIN;
+		b->items = mem_realloc(b->items, b->size,
+				       sizeof(struct batch_item));
+	}
+	item = &b->items[b->n];
+	item->hash = batch_item_hash(type, LLIST_GET_DATA(i));
+	item->type = type;
+	item->i = i;
+	batch_table_add(&b->by_hash, batch_hash_key(item->hash), b->n);
+	batch_table_add(&b->by_list, key, b->n);
+	b->n++;
+	return item;
+}
+
+static void batch_scan_list(struct batch *b, llist_item_t *i,
+			    enum item_type type, struct string *s)
+{
+	struct batch_item *item;
+
+	for (; i; i = LLIST_NEXT(i)) {
+		if ((item = batch_add(b, type, i)) && s)
+			string_catf(s, "%s\n", item->hash);
+	}
+}
+
+/*
+ * Index the items of all lists that are not indexed yet. If s is set, the
+ * hashes of the new items are appended there.
+ */
+static void batch_scan(struct batch *b, struct string *s)
+{
+	batch_scan_list(b, LLIST_FIRST(&recur_elist), TYPE_RECUR_EVNT, s);
+	batch_scan_list(b, LLIST_TS_FIRST(&recur_alist_p), TYPE_RECUR_APPT, s);
+	batch_scan_list(b, LLIST_TS_FIRST(&alist_p), TYPE_APPT, s);
+	batch_scan_list(b, LLIST_FIRST(&eventlist), TYPE_EVNT, s);
+	batch_scan_list(b, LLIST_FIRST(&todolist), TYPE_TODO, s);
+}
+
+/* Remove the cleared items from the lists. */
+static void batch_sweep(struct batch *b)
+{
+	if (!b->cleared)
+		return;
+	LLIST_REMOVE_CLEARED(&recur_elist);
+	LLIST_TS_REMOVE_CLEARED(&recur_alist_p);
+	LLIST_TS_REMOVE_CLEARED(&alist_p);
+	LLIST_REMOVE_CLEARED(&eventlist);
+	LLIST_REMOVE_CLEARED(&todolist);
+	b->cleared = 0;
+}
+
+/* Forget about the indexed items, which have been replaced. */
+static void batch_reset(struct batch *b)
+{
+	while (b->n > 0)
+		mem_free(b->items[--b->n].hash);
+	batch_table_free(&b->by_hash);
+	batch_table_free(&b->by_list);
+	memset(&b->by_hash, 0, sizeof(struct batch_table));
+	memset(&b->by_list, 0, sizeof(struct batch_table));
+}
+
+static int batch_save(struct batch *b, struct string *s)
+{
+	struct string dropped;
+	char sha1[SHA1_DIGESTLEN * 2 + 1];
+	char *p, *eol, *end;
+	int ret;
+
+	if (read_only) {
+		string_cats(s, _("read-only mode"));
+		return 0;
+	}
+	batch_sweep(b);
+	string_init(&dropped);
+	if (!(ret = io_save_batch(&dropped))) {
+		string_free(&dropped);
+		string_cats(s, _("cannot write data files"));
+		return 0;
+	}
+
+	p = string_buf(&dropped);
+	for (end = p + dropped.len; p < end; p = eol + 1) {
+		eol = memchr(p, '\n', end - p);
+		*eol = '\0';
+		sha1_digest(p, sha1);
+		string_catf(s, "%s\n", sha1);
+	}
+	string_free(&dropped);
+
+	/* The items were loaded again by the merge. */
+	if (ret == 2) {
+		batch_reset(b);
+		batch_scan(b, NULL);
+	}
+	b->modified = 0;
+	return 1;
+}
+
+static int batch_hashes(struct batch *b, const char *arg, struct string *s)
+{
+	int mask = TYPE_MASK_ALL;
+	unsigned k;
+
+	if (arg && !(mask = parse_type_mask(arg))) {
+		string_cats(s, _("invalid type mask"));
+		return 0;
+	}
+	for (k = 0; k < b->n; k++) {
+		if (b->items[k].i && (mask & (1 << b->items[k].type)))
+			string_catf(s, "%s\n", b->items[k].hash);
+	}
+	return 1;
+}
+
+static int batch_export(struct batch *b, const char *hash, struct string *s)
+{
+	struct batch_item *item;
+	uint64_t key = batch_hash_key(hash);
+	unsigned k = key, idx;
+	FILE *fp;
+	char *buf = NULL;
+	size_t len = 0;
+	int found = 0;
+
+	if (!(fp = open_memstream(&buf, &len))) {
+		string_cats(s, strerror(errno));
+		return 0;
+	}
+	ical_export_header(fp);
+	while ((idx = batch_table_next(&b->by_hash, key, &k))) {
+		item = &b->items[idx - 1];
+		if (!item->i || strcmp(item->hash, hash))
+			continue;
+		ical_export_item(fp, item->type, LLIST_GET_DATA(item->i), 1);
+		found = 1;
+	}
+	ical_export_footer(fp);
+	fclose(fp);
+
+	if (found)
+		string_catn(s, buf, len);
+	else
+		string_cats(s, _("no such item"));
+	free(buf);
+	return found;
+}
+
+static int batch_remove(struct batch *b, const char *hash, struct string *s)
+{
+	struct batch_item *item;
+	uint64_t key = batch_hash_key(hash);
+	unsigned k = key, idx;
+	int found = 0;
+
+	while ((idx = batch_table_next(&b->by_hash, key, &k))) {
+		item = &b->items[idx - 1];
+		if (!item->i || strcmp(item->hash, hash))
+			continue;
+		switch (item->type) {
+		case TYPE_EVNT:
+			event_free(item->i->data);
+			break;
+		case TYPE_APPT:
+			apoint_free(item->i->data);
+			break;
+		case TYPE_RECUR_EVNT:
+			recur_event_free(item->i->data);
+			break;
+		case TYPE_RECUR_APPT:
+			recur_apoint_free(item->i->data);
+			break;
+		default:
+			todo_free(item->i->data);
+			break;
+		}
+		item->i->data = NULL;
+		item->i = NULL;
+		found = 1;
+	}
+
+	if (!found) {
+		string_cats(s, _("no such item"));
+		return 0;
+	}
+	b->cleared = b->modified = 1;
+	return 1;
+}
+
+static int batch_import(struct batch *b, const char *arg, FILE *in,
+			struct string *s)
+{
+	struct io_file *log;
+	FILE *fp;
+	char *buf;
+	size_t len;
+	unsigned events = 0, apoints = 0, todos = 0, lines = 0, skipped = 0;
+
+	if (!arg || !is_all_digit(arg) || !(len = strtoul(arg, NULL, 10))) {
+		string_cats(s, _("invalid length"));
+		return 0;
+	}
+	buf = mem_malloc(len);
+	if (fread(buf, 1, len, in) != len) {
+		mem_free(buf);
+		string_cats(s, _("unexpected end of input"));
+		return 0;
+	}
+	if (!(fp = fmemopen(buf, len, "r")) || !(log = io_log_init())) {
+		if (fp)
+			fclose(fp);
+		mem_free(buf);
+		string_cats(s, _("cannot read iCal data"));
+		return 0;
+	}
+
+	/* The new items are inserted into the lists. */
+	batch_sweep(b);
+	ical_import_data("-", fp, log->fd, &events, &apoints, &todos, &lines,
+			 &skipped, NULL, NULL, NULL, NULL, NULL);
+	fclose(fp);
+	mem_free(buf);
+	file_close(log->fd, __FILE_POS__);
+	io_log_free(log);
+
+	batch_scan(b, s);
+	if (events + apoints + todos > 0)
+		b->modified = 1;
+	return 1;
+}
+
+/*
+ * Run one command. The payload or the error message is stored in s. Return 1
+ * on success, 0 on error, and -1 if the batch is to be stopped.
+ */
+static int batch_command(struct batch *b, char *line, FILE *in,
+			 struct string *s)
+{
+	char *arg;
+
+	if ((arg = strchr(line, ' '))) {
+		*arg++ = '\0';
+		while (*arg == ' ')
+			arg++;
+		if (*arg == '\0')
+			arg = NULL;
+	}
+
+	if (!strcmp(line, "hashes"))
+		return batch_hashes(b, arg, s);
+	if (!strcmp(line, "import"))
+		return batch_import(b, arg, in, s);
+	if (!strcmp(line, "save") && !arg)
+		return batch_save(b, s);
+	if (!strcmp(line, "quit") && !arg)
+		return -1;
+	if (!arg) {
+		string_cats(s, _("invalid command"));
+		return 0;
+	}
+	if (!strcmp(line, "export"))
+		return batch_export(b, arg, s);
+	if (!strcmp(line, "remove"))
+		return batch_remove(b, arg, s);
+	string_cats(s, _("invalid command"));
+	return 0;
+}
+
+static void batch_reply(FILE *out, int ret, struct string *s)
+{
+	if (ret)
+		fprintf(out, "OK %d\n", s->len);
+	else
+		fputs("ERR ", out);
+	if (s->len > 0)
+		fwrite(string_buf(s), 1, s->len, out);
+	if (!ret)
+		fputc('\n', out);
+	fflush(out);
+}
+
+/*
+ * Run the commands read from a stream against the loaded items, replying to
+ * another stream. The data files are written at the end of the stream or on
+ * quit if anything changed. Return 0 if they could not be written.
+ */
+int batch_run(FILE *in, FILE *out)
+{
+	struct batch b;
+	struct string s;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	int ret = 1, quit = 0;
+
+	memset(&b, 0, sizeof(b));
+	io_batch_base();
+	item_hashes_prefetch();
+	batch_scan(&b, NULL);
+	item_hashes_free();
+
+	string_init(&s);
+	while ((len = getline(&line, &size, in)) > 0) {
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (len == 0)
+			continue;
+		s.len = 0;
+		if ((ret = batch_command(&b, line, in, &s)) < 0) {
+			quit = 1;
+			break;
+		}
+		batch_reply(out, ret, &s);
+	}
+
+	s.len = 0;
+	ret = !b.modified || read_only || batch_save(&b, &s);
+	if (quit)
+		batch_reply(out, ret, &s);
+
+	free(line);
+	string_free(&s);
+	batch_reset(&b);
+	if (b.items)
+		mem_free(b.items);
+	return ret;
+}
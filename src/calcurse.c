@@ -274,16 +274,34 @@ static inline void key_generic_help(void)
 	wins_update(FLAG_ALL);
 }
 
+/* Report the items that were changed on both sides of a merge. */
+static const char *merge_conflicts_mesg(void)
+{
+	static char buf[BUFSIZ];
+	int n = io_merge_conflicts();
+
+	if (n == 0)
+		return "";
+	snprintf(buf, BUFSIZ,
+		 ngettext("%d conflict was resolved with the merge tool.",
+			  "%d conflicts were resolved with the merge tool.", n),
+		 n);
+	return buf;
+}
+
 static inline void key_generic_save(void)
 {
+	char *hash = ui_todo_selhash();
 	char *msg = NULL;
 	int ret;
 
-	ret = io_save_cal(interactive);
+	ret = io_save_cal_background();
 
-	if (ret == IO_SAVE_RELOAD) {
+	if (ret == IO_SAVE_RELOAD || ret == IO_SAVE_MERGE) {
 		ui_todo_load_items();
 		ui_todo_sel_reset();
+		if (hash)
+			ui_todo_set_selhash(hash);
 		do_storage(0);
 		notify_check_next_app(1);
 		ui_calendar_monthly_view_cache_set_invalid();
@@ -304,12 +322,34 @@ static inline void key_generic_save(void)
 		break;
 	case IO_SAVE_ERROR:
 		EXIT(_("Cannot open data file"));
+	case IO_SAVE_BACKGROUND:
+		msg = _("Saving data...");
+		break;
+	case IO_SAVE_MERGE:
+		msg = _("Data were merged/saved successfully");
+		break;
+	}
+	status_mesg(msg, ret == IO_SAVE_MERGE ? merge_conflicts_mesg() : "");
+	if (hash)
+		mem_free(hash);
+}
+
+/* Report the outcome of a background save. */
+static inline void key_generic_save_done(void)
+{
+	switch (io_save_result()) {
+	case IO_SAVE_CTINUE:
+		status_mesg(_("Data were saved successfully"), "");
+		break;
+	case IO_SAVE_ERROR:
+		status_mesg(_("Data could not be saved"), "");
+		break;
 	}
-	status_mesg(msg, "");
 }
 
 static inline void key_generic_reload(void)
 {
+	char *hash = ui_todo_selhash();
 	char *msg = NULL;
 	int ret;
 
@@ -319,6 +359,8 @@ static inline void key_generic_reload(void)
 	    ret == IO_RELOAD_MERGE) {
 		ui_todo_load_items();
 		ui_todo_sel_reset();
+		if (hash)
+			ui_todo_set_selhash(hash);
 		do_storage(0);
 		notify_check_next_app(1);
 		ui_calendar_monthly_view_cache_set_invalid();
@@ -341,7 +383,9 @@ static inline void key_generic_reload(void)
 	case IO_RELOAD_ERROR:
 		EXIT(_("Cannot open data file"));
 	}
-	status_mesg(msg, "");
+	status_mesg(msg, ret == IO_RELOAD_MERGE ? merge_conflicts_mesg() : "");
+	if (hash)
+		mem_free(hash);
 }
 
 static inline void key_generic_import(void)
@@ -522,6 +566,7 @@ static inline void key_generic_scroll_down(void)
 
 static inline void key_generic_quit(void)
 {
+	io_stop_save_thread();
 	/* In read-only mode, quit unconditionally without saving. */
 	if (!read_only &&
 	    (conf.auto_save || (io_get_modified() &&
@@ -533,7 +578,7 @@ static inline void key_generic_quit(void)
 			return;
 		}
 	if (conf.auto_gc)
-		note_gc();
+		note_gc(0);
 
 	if (conf.confirm_quit) {
 		if (status_ask_bool(_("Do you really want to quit?")) == 1)
@@ -796,6 +841,7 @@ int main(int argc, char **argv)
 	config_load();
 	wins_erase_status_bar();
 	io_load_keys(conf.pager);
+	io_load_on_demand();
 	io_load_data(NULL, FORCE);
 	wins_slctd_set(conf.default_panel);
 	wins_resize();
@@ -816,6 +862,8 @@ int main(int argc, char **argv)
 	ui_calendar_start_date_thread();
 	if (conf.periodic_save > 0)
 		io_start_psave_thread();
+	if (conf.autoreload)
+		io_start_watch_thread();
 
 	/* User input */
 	for (;;) {
@@ -831,6 +879,8 @@ int main(int argc, char **argv)
 			que_rem();
 		}
 
+		key_generic_save_done();
+
 		if (resize) {
 			resize = 0;
 			wins_reset();
@@ -845,6 +895,12 @@ int main(int argc, char **argv)
 			key_generic_reload();
 		}
 
+		if (io_load_pending()) {
+			ui_calendar_monthly_view_cache_set_invalid();
+			do_storage(0);
+			wins_update(FLAG_ALL);
+		}
+
 		/* Check input loop once every minute. */
 		wtimeout(win[KEY].p, 60000);
 		key = keys_get(win[KEY].p, &count, &reg);
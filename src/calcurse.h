@@ -54,6 +54,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <regex.h>
+#include <sys/stat.h>
 
 #include "llist.h"
 #include "vector.h"
@@ -88,12 +89,17 @@
 #define DIR_NAME_LEGACY  ".calcurse/"
 #define TODO_PATH_NAME   "todo"
 #define APTS_PATH_NAME   "apts"
+#define SHARDS_DIR_EXT   ".d"
+#define ARCHIVE_EXT      ".archive"
 #define CONF_PATH_NAME   "conf"
 #define KEYS_PATH_NAME   "keys"
 #define CPID_PATH_NAME   ".calcurse.pid"
 #define DPID_PATH_NAME   ".daemon.pid"
+#define DSOCK_PATH_NAME  ".daemon.sock"
 #define DLOG_PATH_NAME   "daemon.log"
 #define NOTES_DIR_NAME   "notes/"
+#define NOTES_PACK_NAME  "notes.pack"
+#define NOTES_INDEX_NAME "notes.idx"
 #define HOOKS_DIR_NAME   "hooks/"
 
 #define DEFAULT_EDITOR     "vi"
@@ -178,6 +184,11 @@
 /* Size of the hash table the note garbage collector uses. */
 #define NOTE_GC_HSIZE 1024
 
+/* Size of the hash table and limits of the note contents cache. */
+#define NOTE_CACHE_HSIZE   1024
+#define NOTE_CACHE_SIZE    (1 << 20)
+#define NOTE_CACHE_ENTRIES 4096
+
 /* Mnemonics */
 #define NOHILT		0 	/* 'No highlight' argument */
 #define NOFORCE		0
@@ -288,6 +299,16 @@ struct conf {
 	unsigned auto_save;
 	unsigned auto_gc;
 	unsigned periodic_save;
+	unsigned periodic_save_idle;
+	unsigned periodic_save_edits;
+	unsigned load_threads;
+	unsigned snapshot;
+	unsigned journal;
+	unsigned journal_size;
+	unsigned year_shards;
+	unsigned archive_age;
+	unsigned note_pack;
+	unsigned autoreload;
 	unsigned systemevents;
 	unsigned confirm_quit;
 	unsigned confirm_delete;
@@ -314,6 +335,7 @@ struct conf {
 struct dmon_conf {
 	unsigned enable;	/* launch daemon automatically when exiting */
 	unsigned log;		/* log daemon activity */
+	unsigned socket;	/* answer queries on a local socket */
 };
 
 /* Input date formats. */
@@ -515,6 +537,54 @@ struct io_file {
 	char *name;
 };
 
+/* Data file contents mapped into memory for parsing. */
+struct io_map {
+	char *data;
+	size_t len;
+	int mapped;		/* mmap(2)ed rather than read into memory */
+	struct stat st;		/* status of the file when it was opened */
+};
+
+/* Sub-second part of file timestamps, where available. */
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+#define ST_MTIME_NSEC(st) ((st)->st_mtim.tv_nsec)
+#define ST_CTIME_NSEC(st) ((st)->st_ctim.tv_nsec)
+#else
+#define ST_MTIME_NSEC(st) 0
+#define ST_CTIME_NSEC(st) 0
+#endif
+
+/*
+ * Status of a file whose contents are known, used to tell that it did not
+ * change without reading it.
+ */
+struct io_stamp {
+	int valid;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	long mtime_nsec;
+	time_t ctime;
+	long ctime_nsec;
+};
+
+/* Data files that can be cached in a binary snapshot. */
+enum snapshot_type {
+	SNAPSHOT_APTS,
+	SNAPSHOT_TODO
+};
+
+struct snapshot;
+
+#define JOURNAL_EXT ".journal"
+
+/* Data files that can have a change journal. */
+enum journal_type {
+	JOURNAL_APTS,
+	JOURNAL_TODO
+};
+
 /* Available keys. */
 enum key {
 	KEY_GENERIC_CANCEL,
@@ -681,6 +751,17 @@ struct string {
 	char *buf;
 	int bufsize;
 	int len;
+	char *local;		/* caller-provided storage, never freed */
+};
+
+/* Size of the stack buffers used to serialize single items. */
+#define STRING_LOCAL_BUFSIZE 512
+
+/* Format string compiled for printing items, see format_compile(). */
+struct format {
+	struct format_op *ops;
+	int n;
+	char *buf;		/* literal text and extended formats */
 };
 
 /* Return codes for the getstring() function. */
@@ -704,7 +785,9 @@ enum {
 	IO_SAVE_RELOAD,
 	IO_SAVE_CANCEL,
 	IO_SAVE_NOOP,
-	IO_SAVE_ERROR
+	IO_SAVE_ERROR,
+	IO_SAVE_BACKGROUND,
+	IO_SAVE_MERGE
 };
 
 /* Return codes for the io_reload_data() function. */
@@ -780,22 +863,30 @@ struct apoint *apoint_dup(struct apoint *);
 void apoint_free(struct apoint *);
 void apoint_llist_init(void);
 void apoint_llist_free(void);
+void apoint_add(struct apoint *);
+int apoint_filter(struct apoint *, struct item_filter *);
 struct apoint *apoint_new(char *, char *, time_t, long, char);
 unsigned apoint_inday(struct apoint *, time_t *);
 void apoint_sec2str(struct apoint *, time_t, char *, char *);
+void apoint_serialize(struct apoint *, struct string *);
 char *apoint_tostr(struct apoint *);
 char *apoint_hash(struct apoint *);
 void apoint_write(struct apoint *, FILE *);
-char *apoint_scan(FILE *, struct tm, struct tm, char, char *,
-			   struct item_filter *);
+char *apoint_scan(char *, struct tm, struct tm, char, char *,
+			   struct item_filter *, struct apoint **);
 void apoint_delete(struct apoint *);
 struct notify_app *apoint_check_next(struct notify_app *, time_t);
 void apoint_switch_notify(struct apoint *);
 void apoint_paste_item(struct apoint *, time_t);
 
 /* args.c */
+int parse_type_mask(const char *);
+void args_serve(const char *, int, char **);
 int parse_args(int, char **);
 
+/* batch.c */
+int batch_run(FILE *, FILE *);
+
 /* calendar.c */
 extern struct day_item empty_day;
 
@@ -854,8 +945,8 @@ void day_item_fork(struct day_item *, struct day_item *);
 void day_store_items(time_t, int, int);
 void day_display_item_date(struct day_item *, WINDOW *, int, time_t, int, int);
 void day_display_item(struct day_item *, WINDOW *, int, int, int, int);
-void day_write_stdout(time_t, const char *, const char *, const char *,
-		      const char *, int *);
+void day_write_stdout(time_t, const struct format *, const struct format *,
+		      const struct format *, const struct format *, int *);
 void day_popup_item(struct day_item *);
 int day_check_if_item(struct date);
 unsigned day_chk_busy_slices(struct date, int, int *);
@@ -870,6 +961,7 @@ void day_item_switch_notify(struct day_item *);
 /* dmon.c */
 void dmon_start(int);
 void dmon_stop(void);
+int dmon_query(int, char **);
 
 /* event.c */
 extern llist_t eventlist;
@@ -879,12 +971,16 @@ struct event *event_dup(struct event *);
 void event_free(struct event *);
 void event_llist_init(void);
 void event_llist_free(void);
+void event_add(struct event *);
+int event_filter(struct event *, struct item_filter *);
 struct event *event_new(char *, char *, time_t, int);
 unsigned event_inday(struct event *, time_t *);
+void event_serialize(struct event *, struct string *);
 char *event_tostr(struct event *);
 char *event_hash(struct event *);
 void event_write(struct event *, FILE *);
-char *event_scan(FILE *, struct tm, int, char *, struct item_filter *);
+char *event_scan(char *, struct tm, int, char *, struct item_filter *,
+		 struct event **);
 void event_delete(struct event *);
 void event_paste_item(struct event *, time_t);
 int event_dummy(struct day_item *);
@@ -901,24 +997,55 @@ int run_hook(const char *);
 
 /* ical.c */
 void ical_import_data(const char *, FILE *, FILE *, unsigned *, unsigned *,
-		      unsigned *, unsigned *, unsigned *, const char *,
-		      const char *, const char *, const char *, const char *);
+		      unsigned *, unsigned *, unsigned *,
+		      const struct format *, const struct format *,
+		      const struct format *, const struct format *,
+		      const struct format *);
+void ical_export_header(FILE *);
+void ical_export_footer(FILE *);
+void ical_export_item(FILE *, enum item_type, void *, int);
 void ical_export_data(FILE *, int);
 
 /* io.c */
 unsigned io_fprintln(const char *, const char *, ...);
 void io_init(const char *, const char *, const char *);
 void io_extract_data(char *, const char *, int);
-void io_dump_apts(const char *, const char *, const char *, const char *);
-unsigned io_save_apts(const char *);
-void io_dump_todo(const char *);
-unsigned io_save_todo(const char *);
+void io_dump_apts(const struct format *, const struct format *,
+		  const struct format *, const struct format *);
+int io_replace_file(const char *, const char *, size_t);
+unsigned io_save_apts(const char *, char *);
+void io_dump_todo(const struct format *);
+unsigned io_save_todo(const char *, char *);
 unsigned io_save_keys(void);
 int io_save_cal(enum save_type);
+int io_save_cal_background(void);
+int io_save_result(void);
+void io_stop_save_thread(void);
+void io_map_hash(struct io_map *, char *);
+int io_map_file(const char *, struct io_map *, char *);
+void io_stamp_set(struct io_stamp *, const struct stat *);
+void io_stamp_clear(struct io_stamp *);
+int io_stamp_match(const struct io_stamp *, const struct stat *);
+void io_unmap_file(struct io_map *);
+char *io_map_getline(struct io_map *, char **);
+void io_scan_space(char **);
+int io_scan_char(char **, int);
+int io_scan_int(char **, int *);
+int io_scan_date(char **, int *, int *, int *);
 void io_load_app(struct item_filter *);
 void io_load_todo(struct item_filter *);
+void io_load_date(time_t);
+int io_load_pending(void);
+void io_archive(time_t);
+void io_load_on_demand(void);
+void io_free_shards(void);
 int io_load_data(struct item_filter *, int);
+int io_data_changed(void);
+void io_filter_data(struct item_filter *);
 int io_reload_data(void);
+int io_merge_conflicts(void);
+void io_batch_base(void);
+int io_save_batch(struct string *);
 void io_load_keys(const char *);
 int io_check_dir(const char *);
 unsigned io_dir_exists(const char *);
@@ -926,14 +1053,18 @@ unsigned io_file_exists(const char *);
 int io_check_file(const char *);
 int io_check_data_files(void);
 void io_export_data(enum export_type, int);
-int io_import_data(enum import_type, char *, const char *, const char *,
-		    const char *, const char *, const char *);
+int io_import_data(enum import_type, char *, const struct format *,
+		   const struct format *, const struct format *,
+		   const struct format *, const struct format *);
 struct io_file *io_log_init(void);
 void io_log_print(struct io_file *, int, const char *);
 void io_log_display(struct io_file *, const char *, const char *);
 void io_log_free(struct io_file *);
 void io_start_psave_thread(void);
 void io_stop_psave_thread(void);
+void io_stop_compact_thread(void);
+void io_start_watch_thread(void);
+void io_stop_watch_thread(void);
 void io_set_lock(void);
 unsigned io_dump_pid(char *);
 unsigned io_get_pid(char *);
@@ -943,6 +1074,20 @@ void io_unset_modified(void);
 void io_set_modified(void);
 int io_get_modified(void);
 
+/* journal.c */
+void journal_clear(enum journal_type);
+int journal_exists(const char *);
+void journal_replay(enum journal_type, const char *, struct io_map *,
+		    const char *, int);
+int journal_orphaned(enum journal_type);
+int journal_changed(enum journal_type, const char *);
+int journal_indexed(enum journal_type);
+off_t journal_size(enum journal_type);
+int journal_save(enum journal_type, const char *, const char *, off_t);
+void journal_remove(const char *);
+void journal_reset(enum journal_type);
+int journal_compact(enum journal_type, const char *, char *);
+
 /* keys.c */
 void keys_init(void);
 void keys_free(void);
@@ -1019,9 +1164,14 @@ char *generate_note(const char *);
 void edit_note(char **, const char *);
 void view_note(const char *, const char *);
 void erase_note(char **);
-void note_read(char *, FILE *);
-void note_read_contents(char *, size_t, FILE *);
-void note_gc(void);
+void note_ref(const char *);
+void note_unref(const char *);
+char *note_dup(const char *);
+char *note_read(char **);
+void note_read_contents(char *, size_t, const char *);
+const char *note_get(const char *, size_t *);
+int note_load(const char *, struct string *);
+void note_gc(int);
 
 /* notify.c */
 int notify_time_left(void);
@@ -1055,6 +1205,7 @@ extern llist_t recur_elist;
 void recur_free_int_list(llist_t *);
 void recur_int_list_dup(llist_t *, llist_t *);
 void recur_free_exc_list(llist_t *);
+void recur_free_rpt_lists(struct rpt *);
 void recur_exc_dup(llist_t *, llist_t *);
 int recur_str2exc(llist_t *, char *);
 char *recur_exc2str(llist_t *);
@@ -1068,24 +1219,30 @@ void recur_apoint_llist_init(void);
 void recur_event_llist_init(void);
 void recur_apoint_llist_free(void);
 void recur_event_llist_free(void);
+void recur_apoint_add(struct recur_apoint *);
+int recur_apoint_filter(struct recur_apoint *, struct item_filter *);
 struct recur_apoint *recur_apoint_new(char *, char *, time_t, long, char,
 				      struct rpt *);
+void recur_event_add(struct recur_event *);
+int recur_event_filter(struct recur_event *, struct item_filter *);
 struct recur_event *recur_event_new(char *, char *, time_t, int,
 				     struct rpt *);
 char recur_def2char(enum recur_type);
 int recur_char2def(char);
-char *recur_apoint_scan(FILE *, struct tm, struct tm, char,
+char *recur_apoint_scan(char *, struct tm, struct tm, char,
 				       char *, struct item_filter *,
-				       struct rpt *);
-char *recur_event_scan(FILE *, struct tm, int, char *,
-				     struct item_filter *, struct rpt *);
+				       struct rpt *, struct recur_apoint **);
+char *recur_event_scan(char *, struct tm, int, char *,
+				     struct item_filter *, struct rpt *,
+				     struct recur_event **);
+void recur_apoint_serialize(struct recur_apoint *, struct string *);
 char *recur_apoint_tostr(struct recur_apoint *);
 char *recur_apoint_hash(struct recur_apoint *);
 void recur_apoint_write(struct recur_apoint *, FILE *);
+void recur_event_serialize(struct recur_event *, struct string *);
 char *recur_event_tostr(struct recur_event *);
 char *recur_event_hash(struct recur_event *);
 void recur_event_write(struct recur_event *, FILE *);
-void recur_save_data(FILE *);
 unsigned recur_item_find_occurrence(time_t, long, struct rpt *, llist_t *,
 				    time_t, time_t *);
 unsigned recur_apoint_find_occurrence(struct recur_apoint *, time_t, time_t *);
@@ -1097,10 +1254,10 @@ void recur_event_add_exc(struct recur_event *, time_t);
 void recur_apoint_add_exc(struct recur_apoint *, time_t);
 void recur_event_erase(struct recur_event *);
 void recur_apoint_erase(struct recur_apoint *);
-void recur_bymonth(llist_t *, FILE *);
-void recur_bywday(enum recur_type, llist_t *, FILE *);
-void recur_bymonthday(llist_t *, FILE *);
-void recur_exc_scan(llist_t *, FILE *);
+char *recur_bymonth(llist_t *, char **);
+char *recur_bywday(enum recur_type, llist_t *, char **);
+char *recur_bymonthday(llist_t *, char **);
+char *recur_exc_scan(llist_t *, char **);
 void recur_apoint_check_next(struct notify_app *, time_t, time_t);
 void recur_apoint_switch_notify(struct recur_apoint *);
 void recur_event_paste_item(struct recur_event *, time_t);
@@ -1116,8 +1273,24 @@ unsigned sigs_set_hdlr(int, void (*)(int));
 void sigs_ignore(void);
 void sigs_unignore(void);
 
+/* snapshot.c */
+struct snapshot *snapshot_create(enum snapshot_type, const char *,
+				 struct stat *, const char *);
+void snapshot_abort(struct snapshot *);
+int snapshot_commit(struct snapshot *);
+void snapshot_add_apoint(struct snapshot *, struct apoint *);
+void snapshot_add_event(struct snapshot *, struct event *);
+void snapshot_add_recur_apoint(struct snapshot *, struct recur_apoint *);
+void snapshot_add_recur_event(struct snapshot *, struct recur_event *);
+void snapshot_add_todo(struct snapshot *, struct todo *);
+void snapshot_save(enum snapshot_type, const char *, const char *);
+int snapshot_load(enum snapshot_type, const char *, struct item_filter *,
+		  char *);
+
 /* strings.c */
 void string_init(struct string *);
+void string_init_buf(struct string *, char *, int);
+void string_free(struct string *);
 void string_reset(struct string *);
 int string_grow(struct string *, int);
 char *string_buf(struct string *);
@@ -1126,11 +1299,20 @@ int string_vcatf(struct string *, const char *, va_list);
 int string_printf(struct string *, const char *, ...);
 int string_catftime(struct string *, const char *, const struct tm *);
 int string_strftime(struct string *, const char *, const struct tm *);
+void string_catc(struct string *, char);
+void string_catn(struct string *, const char *, int);
+void string_cats(struct string *, const char *);
+void string_catuint(struct string *, unsigned, int);
+void string_catint(struct string *, int);
+void string_catdate(struct string *, const struct tm *);
+void string_cattime(struct string *, const struct tm *);
 
 /* todo.c */
 extern llist_t todolist;
 struct todo *todo_get_item(int, int);
 struct todo *todo_add(char *, int, int, char *);
+int todo_filter(struct todo *, struct item_filter *);
+void todo_serialize(struct todo *, struct string *);
 char *todo_tostr(struct todo *);
 char *todo_hash(struct todo *);
 void todo_write(struct todo *, FILE *);
@@ -1174,6 +1356,10 @@ void ui_day_view_note(void);
 void ui_day_edit_note(void);
 
 /* ui-todo.c */
+struct todo *ui_todo_selitem(void);
+void ui_todo_set_selitem(struct todo *);
+char *ui_todo_selhash(void);
+void ui_todo_set_selhash(const char *);
 void ui_todo_add(void);
 void ui_todo_delete(void);
 void ui_todo_edit(void);
@@ -1255,16 +1441,23 @@ int fork_exec(int *, int *, const char *, const char *const *);
 int shell_exec(int *, int *, const char *, const char *const *);
 int child_wait(int *, int *, int);
 void press_any_key(void);
-void print_apoint(const char *, time_t, struct apoint *);
-void print_event(const char *, time_t, struct event *);
-void print_recur_apoint(const char *, time_t, time_t, struct recur_apoint *);
-void print_recur_event(const char *, time_t, struct recur_event *);
-void print_todo(const char *, struct todo *);
+void format_compile(struct format *, const char *);
+void format_compile_json(struct format *);
+void format_free(struct format *);
+void print_apoint(const struct format *, time_t, struct apoint *);
+void print_event(const struct format *, time_t, struct event *);
+void print_recur_apoint(const struct format *, time_t, time_t,
+			struct recur_apoint *);
+void print_recur_event(const struct format *, time_t, struct recur_event *);
+void print_todo(const struct format *, struct todo *);
 int vasprintf(char **, const char *, va_list);
 int asprintf(char **, const char *, ...);
 int starts_with(const char *, const char *);
 int starts_with_ci(const char *, const char *);
 int hash_matches(const char *, const char *);
+void item_hashes_prefetch(void);
+void item_hashes_free(void);
+char *item_hash_lookup(const void *);
 long overflow_add(long, long, long *);
 long overflow_mul(long, long, long *);
 time_t next_wday(time_t, int);
@@ -1287,11 +1480,16 @@ extern char *path_ddir;
 extern char *path_cdir;
 extern char *path_todo;
 extern char *path_apts;
+extern char *path_shards;
+extern char *path_archive;
 extern char *path_conf;
 extern char *path_keys;
 extern char *path_notes;
+extern char *path_notes_pack;
+extern char *path_notes_index;
 extern char *path_cpid;
 extern char *path_dpid;
+extern char *path_dsock;
 extern char *path_dmon_log;
 extern char *path_hooks;
 extern struct conf conf;
@@ -1299,7 +1497,7 @@ extern struct pad apad;
 extern struct nbar nbar;
 extern struct dmon_conf dmon;
 void vars_init(void);
-extern pthread_t notify_t_main, io_t_psave, ui_calendar_t_date;
+extern pthread_t notify_t_main, io_t_psave, io_t_watch, ui_calendar_t_date;
 
 /* wins.c */
 extern struct window win[NBWINS];
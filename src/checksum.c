@@ -0,0 +1,299 @@
+/*
+ * Calcurse - text-based organizer
+ *
+ * Copyright (c) 2004-2020 calcurse Development Team <misc@calcurse.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the
+ *        following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the
+ *        following disclaimer in the documentation and/or other
+ *        materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Send your feedback or comments to : misc@calcurse.org
+ * Calcurse home page : http://calcurse.org
+ *
+ */
+
+/*
+ * Fast non-cryptographic checksum, used to tell whether a data file changed.
+ *
+ * This follows the design of XXH3: the input is cut into stripes of 64 bytes
+ * that are mixed into eight 64-bit accumulators, each lane keyed by a secret
+ * and multiplied 32 by 32 bits, which maps to a single vector instruction.
+ * Each accumulator also takes the data of the lane four places away, so that
+ * the two halves of the accumulators can be held in two vectors.
+ * Every 16 stripes, the accumulators are scrambled. At the end, they are
+ * folded into a 128-bit value. It is not compatible with XXH3 and must not
+ * be used where collisions could be forced, such as for note names.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_SHA1_X86
+#include <immintrin.h>
+#endif
+
+#include "checksum.h"
+
+#define PRIME32_1 0x9E3779B1U
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+
+/* The first values of splitmix64, seeded with 0. */
+static const uint64_t checksum_key[24] = {
+	0xE220A8397B1DCDAFULL, 0x6E789E6AA1B965F4ULL, 0x06C45D188009454FULL,
+	0xF88BB8A8724C81ECULL, 0x1B39896A51A8749BULL, 0x53CB9F0C747EA2EAULL,
+	0x2C829ABE1F4532E1ULL, 0xC584133AC916AB3CULL, 0x3EE5789041C98AC3ULL,
+	0xF3B8488C368CB0A6ULL, 0x657EECDD3CB13D09ULL, 0xC2D326E0055BDEF6ULL,
+	0x8621A03FE0BBDB7BULL, 0x8E1F7555983AA92FULL, 0xB54E0F1600CC4D19ULL,
+	0x84BB3F97971D80ABULL, 0x7D29825C75521255ULL, 0xC3CF17102B7F7F86ULL,
+	0x3466E9A083914F64ULL, 0xD81A8D2B5A4485ACULL, 0xDB01602B100B9ED7ULL,
+	0xA9038A921825F10DULL, 0xEDF5F1D90DCA2F6AULL, 0x54496AD67BD2634CULL
+};
+
+static uint64_t checksum_read64(const uint8_t *p)
+{
+	return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 |
+	       (uint64_t)p[3] << 24 | (uint64_t)p[4] << 32 |
+	       (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 |
+	       (uint64_t)p[7] << 56;
+}
+
+/* Mix a stripe into the accumulators, using the keys starting at key. */
+static __inline__ void checksum_stripe(uint64_t *acc, const uint8_t *p,
+				       const uint64_t *key)
+{
+	uint64_t d[8], k;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		d[i] = checksum_read64(p + 8 * i);
+	for (i = 0; i < 8; i++) {
+		k = d[i] ^ key[i];
+		acc[i] += d[i ^ 4] + (k & 0xFFFFFFFF) * (k >> 32);
+	}
+}
+
+static __inline__ void checksum_scramble(uint64_t *acc)
+{
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		acc[i] ^= acc[i] >> 47;
+		acc[i] ^= checksum_key[16 + i];
+		acc[i] *= PRIME32_1;
+	}
+}
+
+static void checksum_blocks_generic(uint64_t *acc, const uint8_t *p, size_t n)
+{
+	int s;
+
+	for (; n > 0; n--, p += CHECKSUM_BLOCKLEN) {
+		for (s = 0; s < 16; s++)
+			checksum_stripe(acc, p + s * CHECKSUM_STRIPELEN,
+					checksum_key + s);
+		checksum_scramble(acc);
+	}
+}
+
+/*
+ * The same with AVX2, holding the accumulators in two vectors of four lanes.
+ * HAVE_SHA1_X86 tells that the compiler supports x86 intrinsics and target
+ * attributes.
+ */
+#ifdef HAVE_SHA1_X86
+
+#define LOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+#define MUL32(a, b) _mm256_mul_epu32((a), (b))
+
+__attribute__((target("avx2")))
+static void checksum_blocks_avx2(uint64_t *acc, const uint8_t *p, size_t n)
+{
+	__m256i a0 = LOAD(acc), a1 = LOAD(acc + 4);
+	__m256i d0, d1, k0, k1;
+	const __m256i prime = _mm256_set1_epi64x(PRIME32_1);
+	int s;
+
+	for (; n > 0; n--, p += CHECKSUM_BLOCKLEN) {
+		for (s = 0; s < 16; s++) {
+			d0 = LOAD(p + s * CHECKSUM_STRIPELEN);
+			d1 = LOAD(p + s * CHECKSUM_STRIPELEN + 32);
+			k0 = _mm256_xor_si256(d0, LOAD(checksum_key + s));
+			k1 = _mm256_xor_si256(d1, LOAD(checksum_key + s + 4));
+			k0 = MUL32(k0, _mm256_srli_epi64(k0, 32));
+			k1 = MUL32(k1, _mm256_srli_epi64(k1, 32));
+			a0 = _mm256_add_epi64(a0, _mm256_add_epi64(d1, k0));
+			a1 = _mm256_add_epi64(a1, _mm256_add_epi64(d0, k1));
+		}
+
+		a0 = _mm256_xor_si256(a0, _mm256_srli_epi64(a0, 47));
+		a1 = _mm256_xor_si256(a1, _mm256_srli_epi64(a1, 47));
+		a0 = _mm256_xor_si256(a0, LOAD(checksum_key + 16));
+		a1 = _mm256_xor_si256(a1, LOAD(checksum_key + 20));
+		a0 = _mm256_add_epi64(MUL32(a0, prime), _mm256_slli_epi64(
+			MUL32(_mm256_srli_epi64(a0, 32), prime), 32));
+		a1 = _mm256_add_epi64(MUL32(a1, prime), _mm256_slli_epi64(
+			MUL32(_mm256_srli_epi64(a1, 32), prime), 32));
+	}
+
+	_mm256_storeu_si256((__m256i *)acc, a0);
+	_mm256_storeu_si256((__m256i *)(acc + 4), a1);
+}
+
+#undef LOAD
+#undef MUL32
+
+#endif
+static void checksum_blocks(uint64_t *acc, const uint8_t *p, size_t n)
+{
+#ifdef HAVE_SHA1_X86
+	if (__builtin_cpu_supports("avx2")) {
+		checksum_blocks_avx2(acc, p, n);
+		return;
+	}
+#endif
+	checksum_blocks_generic(acc, p, n);
+}
+
+/* Fold the 128-bit product of two 64-bit values into 64 bits. */
+static uint64_t checksum_fold(uint64_t a, uint64_t b)
+{
+	uint64_t al = a & 0xFFFFFFFF, ah = a >> 32;
+	uint64_t bl = b & 0xFFFFFFFF, bh = b >> 32;
+	uint64_t ll = al * bl, lh = al * bh, hl = ah * bl, hh = ah * bh;
+	uint64_t cross = (ll >> 32) + (lh & 0xFFFFFFFF) + hl;
+
+	return ((cross << 32) | (ll & 0xFFFFFFFF)) ^
+	       ((lh >> 32) + (cross >> 32) + hh);
+}
+
+static uint64_t checksum_avalanche(uint64_t h)
+{
+	h ^= h >> 37;
+	h *= PRIME64_3;
+	return h ^ (h >> 32);
+}
+
+void checksum_init(checksum_ctx_t *ctx)
+{
+	ctx->acc[0] = PRIME32_1;
+	ctx->acc[1] = PRIME64_1;
+	ctx->acc[2] = PRIME64_2;
+	ctx->acc[3] = PRIME64_3;
+	ctx->acc[4] = ~PRIME64_1;
+	ctx->acc[5] = ~PRIME64_2;
+	ctx->acc[6] = ~PRIME64_3;
+	ctx->acc[7] = ~(uint64_t)PRIME32_1;
+	ctx->len = 0;
+	ctx->buflen = 0;
+}
+
+void checksum_update(checksum_ctx_t *ctx, const uint8_t *data, size_t len)
+{
+	size_t n;
+
+	ctx->len += len;
+
+	if (ctx->buflen > 0) {
+		n = CHECKSUM_BLOCKLEN - ctx->buflen;
+		if (n > len)
+			n = len;
+		memcpy(ctx->buf + ctx->buflen, data, n);
+		ctx->buflen += n;
+		data += n;
+		len -= n;
+		if (ctx->buflen < CHECKSUM_BLOCKLEN)
+			return;
+		checksum_blocks(ctx->acc, ctx->buf, 1);
+		ctx->buflen = 0;
+	}
+
+	n = len / CHECKSUM_BLOCKLEN;
+	if (n > 0) {
+		checksum_blocks(ctx->acc, data, n);
+		data += n * CHECKSUM_BLOCKLEN;
+		len -= n * CHECKSUM_BLOCKLEN;
+	}
+
+	memcpy(ctx->buf, data, len);
+	ctx->buflen = len;
+}
+
+/* Store the checksum in h, as two 64-bit values. */
+void checksum_final(checksum_ctx_t *ctx, uint64_t *h)
+{
+	const uint64_t *k = checksum_key;
+	uint64_t *acc = ctx->acc;
+	size_t s, rem = ctx->buflen % CHECKSUM_STRIPELEN;
+	int i;
+
+	/* The last stripe is padded with zeros; the length sets it apart. */
+	for (s = 0; s < ctx->buflen / CHECKSUM_STRIPELEN; s++)
+		checksum_stripe(acc, ctx->buf + s * CHECKSUM_STRIPELEN, k + s);
+	if (rem > 0) {
+		memset(ctx->buf + ctx->buflen, 0, CHECKSUM_STRIPELEN - rem);
+		checksum_stripe(acc, ctx->buf + s * CHECKSUM_STRIPELEN, k + s);
+	}
+
+	h[0] = ctx->len * PRIME64_1;
+	h[1] = ~ctx->len * PRIME64_2;
+	for (i = 0; i < 4; i++) {
+		h[0] += checksum_fold(acc[2 * i] ^ k[2 * i],
+				      acc[2 * i + 1] ^ k[2 * i + 1]);
+		h[1] += checksum_fold(acc[2 * i] ^ k[8 + 2 * i],
+				      acc[2 * i + 1] ^ k[9 + 2 * i]);
+	}
+	h[0] = checksum_avalanche(h[0]);
+	h[1] = checksum_avalanche(h[1]);
+}
+
+void checksum_final_hex(checksum_ctx_t *ctx, char *out)
+{
+	static const char hex[] = "0123456789abcdef";
+	uint64_t h[2];
+	int i, j;
+
+	checksum_final(ctx, h);
+	for (i = 0; i < 2; i++) {
+		for (j = 15; j >= 0; j--, h[i] >>= 4)
+			out[16 * i + j] = hex[h[i] & 15];
+	}
+	out[CHECKSUM_LEN * 2] = '\0';
+}
+
+void checksum_stream(FILE *fp, char *out)
+{
+	checksum_ctx_t ctx;
+	uint8_t data[16 * CHECKSUM_BLOCKLEN];
+	size_t n;
+
+	checksum_init(&ctx);
+	while ((n = fread(data, 1, sizeof(data), fp)) > 0)
+		checksum_update(&ctx, data, n);
+	checksum_final_hex(&ctx, out);
+}
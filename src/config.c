@@ -106,6 +106,7 @@ static const struct confvar confmap[] = {
 	{"appearance.headingpos", config_parse_heading_pos, config_serialize_heading_pos, NULL},
 	{"daemon.enable", CONFIG_HANDLER_BOOL(dmon.enable)},
 	{"daemon.log", CONFIG_HANDLER_BOOL(dmon.log)},
+	{"daemon.socket", CONFIG_HANDLER_BOOL(dmon.socket)},
 	{"format.inputdate", config_parse_input_datefmt, config_serialize_input_datefmt, NULL},
 	{"format.notifydate", CONFIG_HANDLER_STR(nbar.datefmt)},
 	{"format.notifytime", CONFIG_HANDLER_STR(nbar.timefmt)},
@@ -116,8 +117,18 @@ static const struct confvar confmap[] = {
 	{"general.confirmdelete", CONFIG_HANDLER_BOOL(conf.confirm_delete)},
 	{"general.confirmquit", CONFIG_HANDLER_BOOL(conf.confirm_quit)},
 	{"general.firstdayofweek", config_parse_first_day_of_week, config_serialize_first_day_of_week, NULL},
+	{"general.loadthreads", CONFIG_HANDLER_UNSIGNED(conf.load_threads)},
 	{"general.multipledays", CONFIG_HANDLER_BOOL(conf.multiple_days)},
 	{"general.periodicsave", CONFIG_HANDLER_UNSIGNED(conf.periodic_save)},
+	{"general.periodicsaveidle", CONFIG_HANDLER_UNSIGNED(conf.periodic_save_idle)},
+	{"general.periodicsaveedits", CONFIG_HANDLER_UNSIGNED(conf.periodic_save_edits)},
+	{"general.snapshot", CONFIG_HANDLER_BOOL(conf.snapshot)},
+	{"general.journal", CONFIG_HANDLER_BOOL(conf.journal)},
+	{"general.journalsize", CONFIG_HANDLER_UNSIGNED(conf.journal_size)},
+	{"general.yearshards", CONFIG_HANDLER_BOOL(conf.year_shards)},
+	{"general.archiveage", CONFIG_HANDLER_UNSIGNED(conf.archive_age)},
+	{"general.notepack", CONFIG_HANDLER_BOOL(conf.note_pack)},
+	{"general.autoreload", CONFIG_HANDLER_BOOL(conf.autoreload)},
 	{"general.systemevents", CONFIG_HANDLER_BOOL(conf.systemevents)},
 	{"notification.command", CONFIG_HANDLER_STR(nbar.cmd)},
 	{"notification.notifyall", config_parse_notifyall, config_serialize_notifyall, NULL},
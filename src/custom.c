@@ -537,6 +537,16 @@ enum {
 	AUTO_SAVE,
 	AUTO_GC,
 	PERIODIC_SAVE,
+	PERIODIC_SAVE_IDLE,
+	PERIODIC_SAVE_EDITS,
+	LOAD_THREADS,
+	SNAPSHOT,
+	JOURNAL,
+	JOURNAL_SIZE,
+	YEAR_SHARDS,
+	ARCHIVE_AGE,
+	NOTE_PACK,
+	AUTO_RELOAD,
 	SYSTEM_EVENTS,
 	CONFIRM_QUIT,
 	CONFIRM_DELETE,
@@ -566,6 +576,16 @@ static void print_general_option(int i, WINDOW *win, int y, int hilt, void *cb_d
 		"general.autosave = ",
 		"general.autogc = ",
 		"general.periodicsave = ",
+		"general.periodicsaveidle = ",
+		"general.periodicsaveedits = ",
+		"general.loadthreads = ",
+		"general.snapshot = ",
+		"general.journal = ",
+		"general.journalsize = ",
+		"general.yearshards = ",
+		"general.archiveage = ",
+		"general.notepack = ",
+		"general.autoreload = ",
 		"general.systemevents = ",
 		"general.confirmquit = ",
 		"general.confirmdelete = ",
@@ -677,6 +697,85 @@ static void print_general_option(int i, WINDOW *win, int y, int hilt, void *cb_d
 			  _("(if not null, automatically save data every "
 			  "'periodic_save' minutes)"));
 		break;
+	case PERIODIC_SAVE_IDLE:
+		custom_apply_attr(win, ATTR_HIGHEST);
+		mvwprintw(win, y, XPOS + strlen(opt[PERIODIC_SAVE_IDLE]), "%d",
+			  conf.periodic_save_idle);
+		custom_remove_attr(win, ATTR_HIGHEST);
+		mvwaddstr(win, y + 1, XPOS,
+			  _("(if not null, save earlier once no changes have "
+			  "been made for that many seconds)"));
+		break;
+	case PERIODIC_SAVE_EDITS:
+		custom_apply_attr(win, ATTR_HIGHEST);
+		mvwprintw(win, y, XPOS + strlen(opt[PERIODIC_SAVE_EDITS]),
+			  "%d", conf.periodic_save_edits);
+		custom_remove_attr(win, ATTR_HIGHEST);
+		mvwaddstr(win, y + 1, XPOS,
+			  _("(if not null, save earlier once that many changes "
+			  "are pending)"));
+		break;
+	case LOAD_THREADS:
+		custom_apply_attr(win, ATTR_HIGHEST);
+		mvwprintw(win, y, XPOS + strlen(opt[LOAD_THREADS]), "%d",
+			  conf.load_threads);
+		custom_remove_attr(win, ATTR_HIGHEST);
+		mvwaddstr(win, y + 1, XPOS,
+			  _("(threads used to load the appointment file, "
+			  "0 for one per processor)"));
+		break;
+	case SNAPSHOT:
+		print_bool_option_incolor(win, conf.snapshot, y,
+					  XPOS + strlen(opt[SNAPSHOT]));
+		mvwaddstr(win, y + 1, XPOS,
+			  _("(if set to YES, keep a binary snapshot of the "
+			  "data files for faster startup)"));
+		break;
+	case JOURNAL:
+		print_bool_option_incolor(win, conf.journal, y,
+					  XPOS + strlen(opt[JOURNAL]));
+		mvwaddstr(win, y + 1, XPOS,
+			  _("(if set to YES, append changes to a journal "
+			  "instead of rewriting the data files)"));
+		break;
+	case JOURNAL_SIZE:
+		custom_apply_attr(win, ATTR_HIGHEST);
+		mvwprintw(win, y, XPOS + strlen(opt[JOURNAL_SIZE]), "%d",
+			  conf.journal_size);
+		custom_remove_attr(win, ATTR_HIGHEST);
+		mvwaddstr(win, y + 1, XPOS,
+			  _("(size in kilobytes above which the journal is "
+			  "folded into the data files)"));
+		break;
+	case YEAR_SHARDS:
+		print_bool_option_incolor(win, conf.year_shards, y,
+					  XPOS + strlen(opt[YEAR_SHARDS]));
+		mvwaddstr(win, y + 1, XPOS,
+			  _("(if set to YES, store appointments and events in "
+			  "one file per year)"));
+		break;
+	case ARCHIVE_AGE:
+		custom_apply_attr(win, ATTR_HIGHEST);
+		mvwprintw(win, y, XPOS + strlen(opt[ARCHIVE_AGE]), "%d",
+			  conf.archive_age);
+		custom_remove_attr(win, ATTR_HIGHEST);
+		mvwaddstr(win, y + 1, XPOS,
+			  _("(if not null, archive items that ended that many "
+			  "days ago)"));
+		break;
+	case NOTE_PACK:
+		print_bool_option_incolor(win, conf.note_pack, y,
+					  XPOS + strlen(opt[NOTE_PACK]));
+		mvwaddstr(win, y + 1, XPOS,
+			  _("(if set to YES, store notes in a single pack file)"));
+		break;
+	case AUTO_RELOAD:
+		print_bool_option_incolor(win, conf.autoreload, y,
+					  XPOS + strlen(opt[AUTO_RELOAD]));
+		mvwaddstr(win, y + 1, XPOS,
+			  _("(if set to YES, reload the data files when they "
+			  "are changed by another program)"));
+		break;
 	case SYSTEM_EVENTS:
 		print_bool_option_incolor(win, conf.systemevents, y,
 					  XPOS + strlen(opt[SYSTEM_EVENTS]));
@@ -774,6 +873,16 @@ static void general_option_edit(int i)
 	const char *input_datefmt_prefix = _("Enter the date format: ");
 	const char *periodic_save_str =
 	    _("Enter the delay, in minutes, between automatic saves (0 to disable) ");
+	const char *periodic_save_idle_str =
+	    _("Enter the idle time, in seconds, after which changes are saved (0 to disable) ");
+	const char *periodic_save_edits_str =
+	    _("Enter the number of changes that triggers a save (0 to disable) ");
+	const char *load_threads_str =
+	    _("Enter the number of loader threads (0 for one per processor) ");
+	const char *journal_size_str =
+	    _("Enter the journal size, in kilobytes, that triggers compaction ");
+	const char *archive_age_str =
+	    _("Enter the age, in days, of the items to archive (0 to disable) ");
 	int val;
 	char *buf;
 
@@ -855,6 +964,69 @@ static void general_option_edit(int i)
 			}
 		}
 		break;
+	case PERIODIC_SAVE_IDLE:
+		status_mesg(periodic_save_idle_str, "");
+		snprintf(buf, BUFSIZ, "%d", conf.periodic_save_idle);
+		if (updatestring(win[STA].p, &buf, 0, 1) == 0) {
+			val = atoi(buf);
+			if (val >= 0)
+				conf.periodic_save_idle = val;
+		}
+		break;
+	case PERIODIC_SAVE_EDITS:
+		status_mesg(periodic_save_edits_str, "");
+		snprintf(buf, BUFSIZ, "%d", conf.periodic_save_edits);
+		if (updatestring(win[STA].p, &buf, 0, 1) == 0) {
+			val = atoi(buf);
+			if (val >= 0)
+				conf.periodic_save_edits = val;
+		}
+		break;
+	case LOAD_THREADS:
+		status_mesg(load_threads_str, "");
+		snprintf(buf, BUFSIZ, "%d", conf.load_threads);
+		if (updatestring(win[STA].p, &buf, 0, 1) == 0) {
+			val = atoi(buf);
+			if (val >= 0)
+				conf.load_threads = val;
+		}
+		break;
+	case SNAPSHOT:
+		conf.snapshot = !conf.snapshot;
+		break;
+	case JOURNAL:
+		conf.journal = !conf.journal;
+		break;
+	case JOURNAL_SIZE:
+		status_mesg(journal_size_str, "");
+		snprintf(buf, BUFSIZ, "%d", conf.journal_size);
+		if (updatestring(win[STA].p, &buf, 0, 1) == 0) {
+			val = atoi(buf);
+			if (val >= 0)
+				conf.journal_size = val;
+		}
+		break;
+	case YEAR_SHARDS:
+		conf.year_shards = !conf.year_shards;
+		break;
+	case ARCHIVE_AGE:
+		status_mesg(archive_age_str, "");
+		snprintf(buf, BUFSIZ, "%d", conf.archive_age);
+		if (updatestring(win[STA].p, &buf, 0, 1) == 0) {
+			val = atoi(buf);
+			if (val >= 0)
+				conf.archive_age = val;
+		}
+		break;
+	case NOTE_PACK:
+		conf.note_pack = !conf.note_pack;
+		break;
+	case AUTO_RELOAD:
+		conf.autoreload = !conf.autoreload;
+		io_stop_watch_thread();
+		if (conf.autoreload)
+			io_start_watch_thread();
+		break;
 	case SYSTEM_EVENTS:
 		conf.systemevents = !conf.systemevents;
 		break;
@@ -454,6 +454,7 @@ day_store_items(time_t date, int include_captions, int n)
 	for (i = 0; i < n; i++, date = NEXTDAY(date)) {
 		if (YEAR1902_2037 && !check_sec(&date))
 			break;
+		io_load_date(date);
 
 		if (include_captions)
 			day_add_item(DAY_HEADING, 0, date, p);
@@ -546,8 +547,10 @@ day_display_item(struct day_item *day, WINDOW *win, int incolor, int width,
 }
 
 /* Write the appointments and events for the selected day to stdout. */
-void day_write_stdout(time_t date, const char *fmt_apt, const char *fmt_rapt,
-		      const char *fmt_ev, const char *fmt_rev, int *limit)
+void day_write_stdout(time_t date, const struct format *fmt_apt,
+		      const struct format *fmt_rapt,
+		      const struct format *fmt_ev,
+		      const struct format *fmt_rev, int *limit)
 {
 	int i;
 
@@ -587,14 +590,9 @@ void day_popup_item(struct day_item *day)
 	if (day->type == EVNT || day->type == RECUR_EVNT) {
 		if (day_item_get_note(day)) {
 			char note[note_size];
-			char *notepath, *msg;
-			FILE *fp;
+			char *msg;
 
-			asprintf(&notepath, "%s%s", path_notes, day_item_get_note(day));
-			fp = fopen(notepath, "r");
-			note_read_contents(note, note_size, fp);
-			fclose(fp);
-			mem_free(notepath);
+			note_read_contents(note, note_size, day_item_get_note(day));
 
 			asprintf(&msg, "%s\n\n%s\n%s", day_item_get_mesg(day), note_heading, note);
 			item_in_popup(NULL, NULL, msg, _("Event:"));
@@ -614,14 +612,9 @@ void day_popup_item(struct day_item *day)
 
 		if (day_item_get_note(day)) {
 			char note[note_size];
-			char *notepath, *msg;
-			FILE *fp;
+			char *msg;
 
-			asprintf(&notepath, "%s%s", path_notes, day_item_get_note(day));
-			fp = fopen(notepath, "r");
-			note_read_contents(note, note_size, fp);
-			fclose(fp);
-			mem_free(notepath);
+			note_read_contents(note, note_size, day_item_get_note(day));
 
 			asprintf(&msg, "%s\n\n%s\n%s", day_item_get_mesg(day), note_heading, note);
 			item_in_popup(a_st, a_end, msg, _("Appointment:"));
@@ -646,6 +639,7 @@ int day_check_if_item(struct date day)
 {
 	const time_t t = date2sec(day, 0, 0);
 
+	io_load_date(t);
 	if (LLIST_FIND_FIRST(&eventlist, (time_t *)&t, event_inday))
 		return ATTR_TRUE;
 
@@ -698,6 +692,7 @@ unsigned day_chk_busy_slices(struct date day, int slicesno, int *slices)
 	int slicelen;
 
 	slicelen = DAYINSEC / slicesno;
+	io_load_date(t);
 
 #define  SLICENUM(tsec)  ((tsec) / slicelen % slicesno)
 
@@ -36,6 +36,9 @@
 
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <paths.h>
 #include <fcntl.h>
@@ -46,6 +49,7 @@
 #include "calcurse.h"
 
 #define DMON_SLEEP_TIME  60
+#define DMON_QUERY_TIME  10
 
 #define DMON_LOG(...) do {                                      \
   if (dmon.log)                                                 \
@@ -63,6 +67,7 @@
 } while (0)
 
 static unsigned data_loaded;
+static int dmon_sock = -1;
 
 static void dmon_sigs_hdlr(int sig)
 {
@@ -76,6 +81,9 @@ static void dmon_sigs_hdlr(int sig)
 
 	DMON_LOG(_("terminated at %s with signal %d\n"), nowstr(), sig);
 
+	if (dmon_sock >= 0)
+		unlink(path_dsock);
+
 	if (unlink(path_dpid) != 0) {
 		DMON_LOG(_("Could not remove daemon lock file: %s\n"),
 			 strerror(errno));
@@ -149,6 +157,163 @@ static unsigned daemonize(int status)
 	return 1;
 }
 
+/* Sleep, but wake up early if a reload is requested. */
+static void dmon_sleep(unsigned secs)
+{
+	unsigned unslept;
+
+	for (unslept = sleep(secs); unslept && !want_reload;
+	     unslept = sleep(unslept)) ;
+}
+
+static int dmon_sock_addr(struct sockaddr_un *addr)
+{
+	if (strlen(path_dsock) >= sizeof(addr->sun_path))
+		return 0;
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	strcpy(addr->sun_path, path_dsock);
+	return 1;
+}
+
+/* Create the socket that queries are answered on. */
+static int dmon_listen(void)
+{
+	struct sockaddr_un addr;
+	mode_t mask;
+	int fd, ret;
+
+	if (!dmon_sock_addr(&addr)) {
+		DMON_LOG(_("Socket path too long: %s\n"), path_dsock);
+		return -1;
+	}
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		DMON_LOG(_("Could not create socket: %s\n"), strerror(errno));
+		return -1;
+	}
+
+	/* Remove a leftover of a daemon that was killed. */
+	unlink(path_dsock);
+	mask = umask(0077);
+	ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+	if (ret < 0 || listen(fd, SOMAXCONN) < 0) {
+		DMON_LOG(_("Could not listen on \"%s\": %s\n"), path_dsock,
+			 strerror(errno));
+		close(fd);
+		return -1;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	return fd;
+}
+
+/*
+ * Answer a query in a child process, which is free to filter the data in
+ * memory and exits afterwards. The request consists of the working directory
+ * and the command-line arguments of the client, each terminated by a null
+ * character. The output of the query is sent back as is.
+ */
+static void dmon_answer(int fd)
+{
+	struct string s;
+	char buf[BUFSIZ], **argv, *p;
+	int argc, n;
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGALRM, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+	signal(SIGUSR1, SIG_DFL);
+	alarm(DMON_QUERY_TIME);
+	close(dmon_sock);
+
+	string_init(&s);
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		string_catn(&s, buf, n);
+	if (n < 0 || s.len == 0 || s.buf[s.len - 1] != '\0')
+		_exit(EXIT_FAILURE);
+
+	for (argc = -1, p = s.buf; p < s.buf + s.len; p += strlen(p) + 1)
+		argc++;
+	if (argc < 1)
+		_exit(EXIT_FAILURE);
+	argv = mem_calloc(argc + 1, sizeof(char *));
+	p = s.buf + strlen(s.buf) + 1;
+	for (n = 0; n < argc; n++, p += strlen(p) + 1)
+		argv[n] = p;
+
+	dup2(fd, STDOUT_FILENO);
+	close(fd);
+	args_serve(s.buf, argc, argv);
+	exit(EXIT_SUCCESS);
+}
+
+/*
+ * Accept a query and answer it. A trailing byte tells the client whether the
+ * query succeeded.
+ */
+static void dmon_serve(void)
+{
+	int fd, status;
+	pid_t pid;
+	char ret = 1;
+
+	if ((fd = accept(dmon_sock, NULL, NULL)) < 0)
+		return;
+
+	fflush(stdout);
+	switch ((pid = fork())) {
+	case -1:
+		DMON_LOG(_("Could not fork: %s\n"), strerror(errno));
+		break;
+	case 0:
+		dmon_answer(fd);
+		break;
+	default:
+		if (waitpid(pid, &status, 0) == pid && WIFEXITED(status))
+			ret = WEXITSTATUS(status) != EXIT_SUCCESS;
+		break;
+	}
+	DMON_LOG(ret ? _("declined query at %s\n") :
+		 _("answered query at %s\n"), nowstr());
+
+	send(fd, &ret, 1, MSG_DONTWAIT);
+	close(fd);
+}
+
+/*
+ * Like dmon_sleep(), but answer queries in the meantime. Changes made to the
+ * data files by other instances are picked up before answering; return early
+ * then, so that the next appointment is looked up again.
+ */
+static void dmon_wait(unsigned secs)
+{
+	time_t end = time(NULL) + secs;
+	struct timeval tv;
+	fd_set fds;
+
+	if (dmon_sock < 0) {
+		dmon_sleep(secs);
+		return;
+	}
+
+	while (!want_reload && (tv.tv_sec = end - time(NULL)) > 0) {
+		tv.tv_usec = 0;
+		FD_ZERO(&fds);
+		FD_SET(dmon_sock, &fds);
+		if (select(dmon_sock + 1, &fds, NULL, NULL, &tv) <= 0)
+			continue;
+
+		if (io_data_changed()) {
+			io_reload_data();
+			dmon_serve();
+			return;
+		}
+		dmon_serve();
+	}
+}
+
 void dmon_start(int parent_exit_status)
 {
 	if (!daemonize(parent_exit_status))
@@ -171,7 +336,13 @@ void dmon_start(int parent_exit_status)
 	recur_event_llist_init();
 	todo_init_list();
 	io_load_app(NULL);
+	if (dmon.socket) {
+		io_load_todo(NULL);
+		dmon_sock = dmon_listen();
+	}
 	data_loaded = 1;
+	if (conf.autoreload)
+		io_start_watch_thread();
 
 	DMON_LOG(_("started at %s\n"), nowstr());
 	for (;;) {
@@ -179,8 +350,8 @@ void dmon_start(int parent_exit_status)
 
 		if (want_reload) {
 			want_reload = 0;
+			/* The next appointment is looked up below. */
 			io_reload_data();
-			notify_check_next_app(1);
 		}
 
 		if (!notify_get_next_bkgd())
@@ -200,7 +371,7 @@ void dmon_start(int parent_exit_status)
 				  "sleeping at %s for %d seconds\n",
 				  DMON_SLEEP_TIME), nowstr(),
 			 DMON_SLEEP_TIME);
-		psleep(DMON_SLEEP_TIME);
+		dmon_wait(DMON_SLEEP_TIME);
 		DMON_LOG(_("awakened at %s\n"), nowstr());
 		/* Reap the user-defined notifications. */
 		while (waitpid(0, NULL, WNOHANG) > 0)
@@ -208,6 +379,60 @@ void dmon_start(int parent_exit_status)
 	}
 }
 
+/*
+ * Have a query answered by the daemon, if it is listening. The output is
+ * only printed once the daemon reports success; return 0 otherwise so that
+ * the caller can load the data files and answer the query itself.
+ */
+int dmon_query(int argc, char **argv)
+{
+	struct sockaddr_un addr;
+	struct timeval tv = { DMON_QUERY_TIME, 0 };
+	struct string s;
+	void (*pipe_hdlr)(int);
+	char buf[BUFSIZ], *cwd;
+	int fd, n, i, ret = 0;
+
+	if (!dmon_sock_addr(&addr))
+		return 0;
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return 0;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    !(cwd = getcwd(NULL, 0))) {
+		close(fd);
+		return 0;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	string_init(&s);
+	string_catn(&s, cwd, strlen(cwd) + 1);
+	free(cwd);
+	for (i = 0; i < argc; i++)
+		string_catn(&s, argv[i], strlen(argv[i]) + 1);
+
+	/* Do not get killed if the daemon goes away. */
+	pipe_hdlr = signal(SIGPIPE, SIG_IGN);
+	for (i = 0; i < s.len; i += n) {
+		if ((n = write(fd, s.buf + i, s.len - i)) <= 0)
+			goto cleanup;
+	}
+	shutdown(fd, SHUT_WR);
+
+	s.len = 0;
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		string_catn(&s, buf, n);
+	if (n == 0 && s.len > 0 && s.buf[s.len - 1] == 0) {
+		fwrite(s.buf, 1, s.len - 1, stdout);
+		ret = 1;
+	}
+
+cleanup:
+	signal(SIGPIPE, pipe_hdlr);
+	string_free(&s);
+	close(fd);
+	return ret;
+}
+
 /*
  * Check if calcurse is running in background, and if yes, send a SIGINT
  * signal to stop it.
@@ -61,10 +61,7 @@ struct event *event_dup(struct event *in)
 	ev->id = in->id;
 	ev->day = in->day;
 	ev->mesg = mem_strdup(in->mesg);
-	if (in->note)
-		ev->note = mem_strdup(in->note);
-	else
-		ev->note = NULL;
+	ev->note = note_dup(in->note);
 
 	return ev;
 }
@@ -91,7 +88,7 @@ static int event_cmp(struct event *a, struct event *b)
 }
 
 /* Create a new event */
-struct event *event_new(char *mesg, char *note, time_t day, int id)
+static struct event *event_alloc(char *mesg, char *note, time_t day, int id)
 {
 	struct event *ev;
 
@@ -99,9 +96,22 @@ struct event *event_new(char *mesg, char *note, time_t day, int id)
 	ev->mesg = mem_strdup(mesg);
 	ev->day = day;
 	ev->id = id;
-	ev->note = (note != NULL) ? mem_strdup(note) : NULL;
+	ev->note = note_dup(note);
 
+	return ev;
+}
+
+/* Insert an event into the event list. */
+void event_add(struct event *ev)
+{
 	LLIST_ADD_SORTED(&eventlist, ev, event_cmp);
+}
+
+struct event *event_new(char *mesg, char *note, time_t day, int id)
+{
+	struct event *ev = event_alloc(mesg, note, day, id);
+
+	event_add(ev);
 
 	return ev;
 }
@@ -112,63 +122,103 @@ unsigned event_inday(struct event *i, time_t *start)
 	return (date_cmp_day(i->day, *start) == 0);
 }
 
-char *event_tostr(struct event *o)
+/* Append the data file line of an event to a string. */
+void event_serialize(struct event *o, struct string *s)
 {
-	struct string s;
 	struct tm lt;
 	time_t t;
 
-	string_init(&s);
-
 	t = o->day;
 	localtime_r(&t, &lt);
-	string_catf(&s, "%02u/%02u/%04u [%d] ", lt.tm_mon + 1, lt.tm_mday,
-		1900 + lt.tm_year, o->id);
-	if (o->note != NULL)
-		string_catf(&s, ">%s ", o->note);
-	string_catf(&s, "%s", o->mesg);
+	string_catdate(s, &lt);
+	string_catn(s, " [", 2);
+	string_catint(s, o->id);
+	string_catn(s, "] ", 2);
+	if (o->note != NULL) {
+		string_catc(s, '>');
+		string_cats(s, o->note);
+		string_catc(s, ' ');
+	}
+	string_cats(s, o->mesg);
+}
+
+char *event_tostr(struct event *o)
+{
+	struct string s;
+
+	string_init(&s);
+	event_serialize(o, &s);
 
 	return string_buf(&s);
 }
 
 char *event_hash(struct event *ev)
 {
-	char *raw = event_tostr(ev);
-	char *sha1 = mem_malloc(SHA1_DIGESTLEN * 2 + 1);
-	sha1_digest(raw, sha1);
-	mem_free(raw);
+	char buf[STRING_LOCAL_BUFSIZE];
+	char *sha1 = item_hash_lookup(ev);
+	struct string s;
+
+	if (sha1)
+		return sha1;
+	sha1 = mem_malloc(SHA1_DIGESTLEN * 2 + 1);
+	string_init_buf(&s, buf, sizeof(buf));
+	event_serialize(ev, &s);
+	sha1_digest(string_buf(&s), sha1);
+	string_free(&s);
 
 	return sha1;
 }
 
 void event_write(struct event *o, FILE * f)
 {
-	char *str = event_tostr(o);
-	fprintf(f, "%s\n", str);
-	mem_free(str);
+	char buf[STRING_LOCAL_BUFSIZE];
+	struct string s;
+
+	string_init_buf(&s, buf, sizeof(buf));
+	event_serialize(o, &s);
+	string_catc(&s, '\n');
+	fwrite(string_buf(&s), 1, s.len, f);
+	string_free(&s);
 }
 
-/* Load the events from file */
-char *event_scan(FILE * f, struct tm start, int id, char *note,
-			 struct item_filter *filter)
+/* Check whether an event is selected by a filter. */
+int event_filter(struct event *ev, struct item_filter *filter)
 {
-	char buf[BUFSIZ], *nl;
-	time_t tstart, tend;
-	struct event *ev = NULL;
+	time_t tstart = ev->day, tend = ENDOFDAY(ev->day);
 	int cond;
 
+	cond = (
+	    !(filter->type_mask & TYPE_MASK_EVNT) ||
+	    (filter->regex && regexec(filter->regex, ev->mesg, 0, 0, 0)) ||
+	    (filter->start_from != -1 && tstart < filter->start_from) ||
+	    (filter->start_to != -1 && tstart > filter->start_to) ||
+	    (filter->end_from != -1 && tend < filter->end_from) ||
+	    (filter->end_to != -1 && tend > filter->end_to)
+	);
+	if (!cond && filter->hash) {
+		char *hash = event_hash(ev);
+		cond = !hash_matches(filter->hash, hash);
+		mem_free(hash);
+	}
+
+	return filter->invert ? cond : !cond;
+}
+
+/*
+ * Build an event from its parsed fields and description. As with
+ * apoint_scan(), the item is returned in *res and not added to the list.
+ */
+char *event_scan(char *buf, struct tm start, int id, char *note,
+			 struct item_filter *filter, struct event **res)
+{
+	time_t tstart;
+
+	*res = NULL;
+
 	if (!check_date(start.tm_year, start.tm_mon, start.tm_mday) ||
 	    !check_time(start.tm_hour, start.tm_min))
 		return _("illegal date in event");
 
-	/* Read the event description */
-	if (!fgets(buf, sizeof buf, f))
-		return _("error in appointment description");
-
-	nl = strchr(buf, '\n');
-	if (nl) {
-		*nl = '\0';
-	}
 	start.tm_hour = 0;
 	start.tm_min = 0;
 	start.tm_sec = 0;
@@ -179,33 +229,19 @@ char *event_scan(FILE * f, struct tm start, int id, char *note,
 	tstart = mktime(&start);
 	if (tstart == -1)
 		return _("date error in event\n");
-	tend = ENDOFDAY(tstart);
 
 	/* Filter item. */
 	if (filter) {
-		cond = (
-		    !(filter->type_mask & TYPE_MASK_EVNT) ||
-		    (filter->regex && regexec(filter->regex, buf, 0, 0, 0)) ||
-		    (filter->start_from != -1 && tstart < filter->start_from) ||
-		    (filter->start_to != -1 && tstart > filter->start_to) ||
-		    (filter->end_from != -1 && tend < filter->end_from) ||
-		    (filter->end_to != -1 && tend > filter->end_to)
-		);
-		if (filter->hash) {
-			ev = event_new(buf, note, tstart, id);
-			char *hash = event_hash(ev);
-			cond = cond || !hash_matches(filter->hash, hash);
-			mem_free(hash);
-		}
-
-		if ((!filter->invert && cond) || (filter->invert && !cond)) {
-			if (filter->hash)
-				event_delete(ev);
+		struct event tmp;
+
+		tmp.id = id;
+		tmp.day = tstart;
+		tmp.mesg = buf;
+		tmp.note = note;
+		if (!event_filter(&tmp, filter))
 			return NULL;
-		}
 	}
-	if (!ev)
-		ev = event_new(buf, note, tstart, id);
+	*res = event_alloc(buf, note, tstart, id);
 	return NULL;
 }
 
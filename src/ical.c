@@ -65,13 +65,11 @@ typedef enum {
 	COMMENT
 } ical_property_e;
 
-static void ical_export_header(FILE *);
 static void ical_export_recur_events(FILE *, int);
 static void ical_export_events(FILE *, int);
 static void ical_export_recur_apoints(FILE *, int);
 static void ical_export_apoints(FILE *, int);
 static void ical_export_todo(FILE *, int);
-static void ical_export_footer(FILE *);
 
 static const char *ical_recur_type[NBRECUR] =
     { "DAILY", "WEEKLY", "MONTHLY", "YEARLY" };
@@ -197,7 +195,7 @@ static char *ical_unindent(char *a, char *z)
 
 static void ical_export_note(FILE *stream, char *name)
 {
-	char *note_file, *p, *q, *r, *rest;
+	char *p, *q, *r, *rest;
 	char *property[] = {
 		"Location: ",
 		"Comment: ",
@@ -208,19 +206,13 @@ static void ical_export_note(FILE *stream, char *name)
 		"COMMENT:"
 	};
 	struct string note;
-	char lbuf[BUFSIZ];
-	FILE *fp;
 	int has_desc, has_prop, i;
 
-	asprintf(&note_file, "%s/%s", path_notes, name);
-	if (!(fp = fopen(note_file, "r")) || ungetc(getc(fp), fp) == EOF) {
-		fclose(fp);
+	string_init(&note);
+	if (!note_load(name, &note) || note.len == 0) {
+		string_free(&note);
 		return;
 	}
-	string_init(&note);
-	while (fgets(lbuf, BUFSIZ, fp))
-		string_catf(&note, "%s", lbuf);
-	fclose(fp);
 
 	has_desc = has_prop = 0;
 	rest = note.buf;
@@ -260,7 +252,7 @@ cleanup:
 }
 
 /* Export header. */
-static void ical_export_header(FILE * stream)
+void ical_export_header(FILE * stream)
 {
 	fputs("BEGIN:VCALENDAR\n", stream);
 	fputs("VERSION:2.0\n", stream);
@@ -268,182 +260,239 @@ static void ical_export_header(FILE * stream)
 }
 
 /* Export footer. */
-static void ical_export_footer(FILE * stream)
+void ical_export_footer(FILE * stream)
 {
 	fputs("END:VCALENDAR\n", stream);
 }
 
+/* Export a recurrent event. */
+static void ical_export_recur_event(FILE * stream, struct recur_event *rev,
+				    int export_uid)
+{
+	llist_item_t *j;
+	char ical_date[BUFSIZ], *hash;
+
+	fputs("BEGIN:VEVENT\n", stream);
+	if (export_uid) {
+		hash = recur_event_hash(rev);
+		fprintf(stream, "UID:%s\n", hash);
+		mem_free(hash);
+	}
+	date_sec2date_fmt(rev->day, ICALDATEFMT, ical_date);
+	fprintf(stream, "DTSTART;VALUE=DATE:%s\n", ical_date);
+	ical_export_rrule(stream, rev->rpt, EVENT, ical_date);
+	if (LLIST_FIRST(&rev->exc)) {
+		fputs("EXDATE;VALUE=DATE:", stream);
+		LLIST_FOREACH(&rev->exc, j) {
+			struct excp *exc = LLIST_GET_DATA(j);
+			date_sec2date_fmt(exc->st, ICALDATETIMEFMT,
+					  ical_date);
+			fprintf(stream, "%s", ical_date);
+			fputc(LLIST_NEXT(j) ? ',' : '\n', stream);
+		}
+	}
+	ical_format_line(stream, "SUMMARY:", rev->mesg);
+	if (rev->note)
+		ical_export_note(stream, rev->note);
+	fputs("END:VEVENT\n", stream);
+}
+
 /* Export recurrent events. */
 static void ical_export_recur_events(FILE * stream, int export_uid)
 {
-	llist_item_t *i, *j;
+	llist_item_t *i;
+
+	LLIST_FOREACH(&recur_elist, i)
+		ical_export_recur_event(stream, LLIST_GET_DATA(i), export_uid);
+}
+
+/* Export an event. */
+static void ical_export_event(FILE * stream, struct event *ev, int export_uid)
+{
 	char ical_date[BUFSIZ], *hash;
 
-	LLIST_FOREACH(&recur_elist, i) {
-		struct recur_event *rev = LLIST_GET_DATA(i);
-		fputs("BEGIN:VEVENT\n", stream);
-		if (export_uid) {
-			hash = recur_event_hash(rev);
-			fprintf(stream, "UID:%s\n", hash);
-			mem_free(hash);
-		}
-		date_sec2date_fmt(rev->day, ICALDATEFMT, ical_date);
-		fprintf(stream, "DTSTART;VALUE=DATE:%s\n", ical_date);
-		ical_export_rrule(stream, rev->rpt, EVENT, ical_date);
-		if (LLIST_FIRST(&rev->exc)) {
-			fputs("EXDATE;VALUE=DATE:", stream);
-			LLIST_FOREACH(&rev->exc, j) {
-				struct excp *exc = LLIST_GET_DATA(j);
-				date_sec2date_fmt(exc->st, ICALDATETIMEFMT,
-						  ical_date);
-				fprintf(stream, "%s", ical_date);
-				fputc(LLIST_NEXT(j) ? ',' : '\n', stream);
-			}
-		}
-		ical_format_line(stream, "SUMMARY:", rev->mesg);
-		if (rev->note)
-			ical_export_note(stream, rev->note);
-		fputs("END:VEVENT\n", stream);
+	fputs("BEGIN:VEVENT\n", stream);
+	if (export_uid) {
+		hash = event_hash(ev);
+		fprintf(stream, "UID:%s\n", hash);
+		mem_free(hash);
 	}
+	date_sec2date_fmt(ev->day, ICALDATEFMT, ical_date);
+	fprintf(stream, "DTSTART;VALUE=DATE:%s\n", ical_date);
+	ical_format_line(stream, "SUMMARY:", ev->mesg);
+	if (ev->note)
+		ical_export_note(stream, ev->note);
+	fputs("END:VEVENT\n", stream);
 }
 
 /* Export events. */
 static void ical_export_events(FILE * stream, int export_uid)
 {
 	llist_item_t *i;
-	char ical_date[BUFSIZ], *hash;
 
-	LLIST_FOREACH(&eventlist, i) {
-		struct event *ev = LLIST_TS_GET_DATA(i);
-		fputs("BEGIN:VEVENT\n", stream);
-		if (export_uid) {
-			hash = event_hash(ev);
-			fprintf(stream, "UID:%s\n", hash);
-			mem_free(hash);
+	LLIST_FOREACH(&eventlist, i)
+		ical_export_event(stream, LLIST_TS_GET_DATA(i), export_uid);
+}
+
+/* Export a recurrent appointment. */
+static void ical_export_recur_apoint(FILE * stream, struct recur_apoint *rapt,
+				     int export_uid)
+{
+	llist_item_t *j;
+	char ical_datetime[BUFSIZ], *hash;
+	time_t tod;
+
+	date_sec2date_fmt(rapt->start, ICALDATETIMEFMT, ical_datetime);
+	fputs("BEGIN:VEVENT\n", stream);
+	if (export_uid) {
+		hash = recur_apoint_hash(rapt);
+		fprintf(stream, "UID:%s\n", hash);
+		mem_free(hash);
+	}
+	fprintf(stream, "DTSTART:%s\n", ical_datetime);
+	if (rapt->dur > 0) {
+		fprintf(stream, "DURATION:P%ldDT%ldH%ldM%ldS\n",
+			rapt->dur / DAYINSEC,
+			(rapt->dur / HOURINSEC) % DAYINHOURS,
+			(rapt->dur / MININSEC) % HOURINMIN,
+			rapt->dur % MININSEC);
+	}
+	/*
+	 * Add time-of-day to UNTIL/EXDATE.
+	 * In calcurse until/exception is a date (midnight), but in
+	 * RFC 5545 UNTIL/EXDATE is a DATE-TIME value type by default.
+	 * The item is left unchanged, since it may be exported again.
+	 */
+	tod = get_item_time(rapt->start);
+	if (rapt->rpt->until)
+		rapt->rpt->until += tod;
+	ical_export_rrule(stream, rapt->rpt, APPOINTMENT, ical_datetime);
+	if (rapt->rpt->until)
+		rapt->rpt->until -= tod;
+	if (LLIST_FIRST(&rapt->exc)) {
+		fputs("EXDATE:", stream);
+		LLIST_FOREACH(&rapt->exc, j) {
+			struct excp *exc = LLIST_GET_DATA(j);
+			date_sec2date_fmt(exc->st + tod, ICALDATETIMEFMT,
+					  ical_datetime);
+			fprintf(stream, "%s", ical_datetime);
+			fputc(LLIST_NEXT(j) ? ',' : '\n', stream);
 		}
-		date_sec2date_fmt(ev->day, ICALDATEFMT, ical_date);
-		fprintf(stream, "DTSTART;VALUE=DATE:%s\n", ical_date);
-		ical_format_line(stream, "SUMMARY:", ev->mesg);
-		if (ev->note)
-			ical_export_note(stream, ev->note);
-		fputs("END:VEVENT\n", stream);
 	}
+	ical_format_line(stream, "SUMMARY:", rapt->mesg);
+	if (rapt->note)
+		ical_export_note(stream, rapt->note);
+	if (rapt->state & APOINT_NOTIFY)
+		ical_export_valarm(stream);
+	fputs("END:VEVENT\n", stream);
 }
 
 /* Export recurrent appointments. */
 static void ical_export_recur_apoints(FILE * stream, int export_uid)
 {
-	llist_item_t *i, *j;
-	char ical_datetime[BUFSIZ], *hash;
-	time_t tod;
+	llist_item_t *i;
 
 	LLIST_TS_LOCK(&recur_alist_p);
-	LLIST_TS_FOREACH(&recur_alist_p, i) {
-		struct recur_apoint *rapt = LLIST_TS_GET_DATA(i);
+	LLIST_TS_FOREACH(&recur_alist_p, i)
+		ical_export_recur_apoint(stream, LLIST_TS_GET_DATA(i),
+					 export_uid);
+	LLIST_TS_UNLOCK(&recur_alist_p);
+}
 
-		/*
-		 * Add time-of-day to UNTIL/EXDATE.
-		 * In calcurse until/exception is a date (midnight), but in
-		 * RFC 5545 UNTIL/EXDATE is a DATE-TIME value type by default.
-		 */
-		tod = get_item_time(rapt->start);
-		if (rapt->rpt->until)
-			rapt->rpt->until += tod;
-
-		date_sec2date_fmt(rapt->start, ICALDATETIMEFMT,
-				  ical_datetime);
-		fputs("BEGIN:VEVENT\n", stream);
-		if (export_uid) {
-			hash = recur_apoint_hash(rapt);
-			fprintf(stream, "UID:%s\n", hash);
-			mem_free(hash);
-		}
-		fprintf(stream, "DTSTART:%s\n", ical_datetime);
-		if (rapt->dur > 0) {
-			fprintf(stream, "DURATION:P%ldDT%ldH%ldM%ldS\n",
-				rapt->dur / DAYINSEC,
-				(rapt->dur / HOURINSEC) % DAYINHOURS,
-				(rapt->dur / MININSEC) % HOURINMIN,
-				rapt->dur % MININSEC);
-		}
-		ical_export_rrule(stream, rapt->rpt, APPOINTMENT, ical_datetime);
-		if (LLIST_FIRST(&rapt->exc)) {
-			fputs("EXDATE:", stream);
-			LLIST_FOREACH(&rapt->exc, j) {
-				struct excp *exc = LLIST_GET_DATA(j);
-				date_sec2date_fmt(exc->st + tod, ICALDATETIMEFMT,
-						  ical_datetime);
-				fprintf(stream, "%s", ical_datetime);
-				fputc(LLIST_NEXT(j) ? ',' : '\n', stream);
-			}
-		}
-		ical_format_line(stream, "SUMMARY:", rapt->mesg);
-		if (rapt->note)
-			ical_export_note(stream, rapt->note);
-		if (rapt->state & APOINT_NOTIFY)
-			ical_export_valarm(stream);
-		fputs("END:VEVENT\n", stream);
+/* Export an appointment. */
+static void ical_export_apoint(FILE * stream, struct apoint *apt,
+			       int export_uid)
+{
+	char ical_datetime[BUFSIZ], *hash;
+
+	fputs("BEGIN:VEVENT\n", stream);
+	if (export_uid) {
+		hash = apoint_hash(apt);
+		fprintf(stream, "UID:%s\n", hash);
+		mem_free(hash);
 	}
-	LLIST_TS_UNLOCK(&recur_alist_p);
+	date_sec2date_fmt(apt->start, ICALDATETIMEFMT, ical_datetime);
+	fprintf(stream, "DTSTART:%s\n", ical_datetime);
+	if (apt->dur > 0) {
+		fprintf(stream, "DURATION:P%ldDT%ldH%ldM%ldS\n",
+			apt->dur / DAYINSEC,
+			(apt->dur / HOURINSEC) % DAYINHOURS,
+			(apt->dur / MININSEC) % HOURINMIN,
+			apt->dur % MININSEC);
+	}
+	ical_format_line(stream, "SUMMARY:", apt->mesg);
+	if (apt->note)
+		ical_export_note(stream, apt->note);
+	if (apt->state & APOINT_NOTIFY)
+		ical_export_valarm(stream);
+	fputs("END:VEVENT\n", stream);
 }
 
 /* Export appointments. */
 static void ical_export_apoints(FILE * stream, int export_uid)
 {
 	llist_item_t *i;
-	char ical_datetime[BUFSIZ], *hash;
 
 	LLIST_TS_LOCK(&alist_p);
-	LLIST_TS_FOREACH(&alist_p, i) {
-		struct apoint *apt = LLIST_TS_GET_DATA(i);
-		fputs("BEGIN:VEVENT\n", stream);
-		if (export_uid) {
-			hash = apoint_hash(apt);
-			fprintf(stream, "UID:%s\n", hash);
-			mem_free(hash);
-		}
-		date_sec2date_fmt(apt->start, ICALDATETIMEFMT,
-				  ical_datetime);
-		fprintf(stream, "DTSTART:%s\n", ical_datetime);
-		if (apt->dur > 0) {
-			fprintf(stream, "DURATION:P%ldDT%ldH%ldM%ldS\n",
-				apt->dur / DAYINSEC,
-				(apt->dur / HOURINSEC) % DAYINHOURS,
-				(apt->dur / MININSEC) % HOURINMIN,
-				apt->dur % MININSEC);
-		}
-		ical_format_line(stream, "SUMMARY:", apt->mesg);
-		if (apt->note)
-			ical_export_note(stream, apt->note);
-		if (apt->state & APOINT_NOTIFY)
-			ical_export_valarm(stream);
-		fputs("END:VEVENT\n", stream);
-	}
+	LLIST_TS_FOREACH(&alist_p, i)
+		ical_export_apoint(stream, LLIST_TS_GET_DATA(i), export_uid);
 	LLIST_TS_UNLOCK(&alist_p);
 }
 
+/* Export a todo item. */
+static void ical_export_todo_item(FILE * stream, struct todo *todo,
+				  int export_uid)
+{
+	char *hash;
+
+	fputs("BEGIN:VTODO\n", stream);
+	if (export_uid) {
+		hash = todo_hash(todo);
+		fprintf(stream, "UID:%s\n", hash);
+		mem_free(hash);
+	}
+	fprintf(stream, "PRIORITY:%d\n", todo->id);
+	ical_format_line(stream, "SUMMARY:", todo->mesg);
+	if (todo->note)
+		ical_export_note(stream, todo->note);
+	if (todo->completed)
+		fprintf(stream, "STATUS:COMPLETED\n");
+	fputs("END:VTODO\n", stream);
+}
+
 /* Export todo items. */
 static void ical_export_todo(FILE * stream, int export_uid)
 {
 	llist_item_t *i;
-	char *hash;
 
-	LLIST_FOREACH(&todolist, i) {
-		struct todo *todo = LLIST_TS_GET_DATA(i);
+	LLIST_FOREACH(&todolist, i)
+		ical_export_todo_item(stream, LLIST_TS_GET_DATA(i),
+				      export_uid);
+}
 
-		fputs("BEGIN:VTODO\n", stream);
-		if (export_uid) {
-			hash = todo_hash(todo);
-			fprintf(stream, "UID:%s\n", hash);
-			mem_free(hash);
-		}
-		fprintf(stream, "PRIORITY:%d\n", todo->id);
-		ical_format_line(stream, "SUMMARY:", todo->mesg);
-		if (todo->note)
-			ical_export_note(stream, todo->note);
-		if (todo->completed)
-			fprintf(stream, "STATUS:COMPLETED\n");
-		fputs("END:VTODO\n", stream);
+/*
+ * Export a single item of the given type. The item is not wrapped in a
+ * calendar object, see ical_export_header() and ical_export_footer().
+ */
+void ical_export_item(FILE * stream, enum item_type type, void *item,
+		      int export_uid)
+{
+	switch (type) {
+	case TYPE_EVNT:
+		ical_export_event(stream, item, export_uid);
+		break;
+	case TYPE_APPT:
+		ical_export_apoint(stream, item, export_uid);
+		break;
+	case TYPE_RECUR_EVNT:
+		ical_export_recur_event(stream, item, export_uid);
+		break;
+	case TYPE_RECUR_APPT:
+		ical_export_recur_apoint(stream, item, export_uid);
+		break;
+	case TYPE_TODO:
+		ical_export_todo_item(stream, item, export_uid);
+		break;
 	}
 }
 
@@ -498,13 +547,14 @@ static void ical_log(FILE * log, ical_types_e type, unsigned lineno,
 }
 
 static void ical_store_todo(int priority, int completed, char *mesg,
-			    char *note, const char *fmt_todo)
+			    char *note, const struct format *fmt_todo)
 {
 	struct todo *todo = todo_add(mesg, priority, completed, note);
 	if (fmt_todo)
 		print_todo(fmt_todo, todo);
 	mem_free(mesg);
-	erase_note(&note);
+	if (note)
+		mem_free(note);
 }
 
 /*
@@ -513,8 +563,8 @@ static void ical_store_todo(int priority, int completed, char *mesg,
  */
 static void
 ical_store_event(char *mesg, char *note, time_t day, time_t end,
-		 struct rpt *rpt, llist_t *exc, const char *fmt_ev,
-		 const char *fmt_rev)
+		 struct rpt *rpt, llist_t *exc, const struct format *fmt_ev,
+		 const struct format *fmt_rev)
 {
 	const int EVENTID = 1;
 	struct event *ev;
@@ -559,13 +609,14 @@ ical_store_event(char *mesg, char *note, time_t day, time_t end,
 
 cleanup:
 	mem_free(mesg);
-	erase_note(&note);
+	if (note)
+		mem_free(note);
 }
 
 static void
 ical_store_apoint(char *mesg, char *note, time_t start, long dur,
 		  struct rpt *rpt, llist_t *exc, int has_alarm,
-		  const char *fmt_apt, const char *fmt_rapt)
+		  const struct format *fmt_apt, const struct format *fmt_rapt)
 {
 	char state = 0L;
 	struct apoint *apt;
@@ -602,7 +653,8 @@ ical_store_apoint(char *mesg, char *note, time_t start, long dur,
 			print_apoint(fmt_apt, start, apt);
 	}
 	mem_free(mesg);
-	erase_note(&note);
+	if (note)
+		mem_free(note);
 }
 
 /*
@@ -1344,8 +1396,9 @@ static char *ical_read_summary(char *line, unsigned *noskipped,
 static void
 ical_read_event(FILE * fdi, FILE * log, unsigned *noevents,
 		unsigned *noapoints, unsigned *noskipped, char *buf,
-		char *lstore, unsigned *lineno, const char *fmt_ev,
-		const char *fmt_rev, const char *fmt_apt, const char *fmt_rapt)
+		char *lstore, unsigned *lineno, const struct format *fmt_ev,
+		const struct format *fmt_rev, const struct format *fmt_apt,
+		const struct format *fmt_rapt)
 {
 	const int ITEMLINE = *lineno - !feof(fdi);
 	ical_vevent_e vevent_type;
@@ -1711,7 +1764,8 @@ cleanup:
 
 static void
 ical_read_todo(FILE * fdi, FILE * log, unsigned *notodos, unsigned *noskipped,
-	       char *buf, char *lstore, unsigned *lineno, const char *fmt_todo)
+	       char *buf, char *lstore, unsigned *lineno,
+	       const struct format *fmt_todo)
 {
 	const int ITEMLINE = *lineno - !feof(fdi);
 	ical_property_e property;
@@ -1862,9 +1916,9 @@ cleanup:
 void
 ical_import_data(const char *file, FILE * stream, FILE * log, unsigned *events,
 		 unsigned *apoints, unsigned *todos, unsigned *lines,
-		 unsigned *skipped, const char *fmt_ev, const char *fmt_rev,
-		 const char *fmt_apt, const char *fmt_rapt,
-		 const char *fmt_todo)
+		 unsigned *skipped, const struct format *fmt_ev,
+		 const struct format *fmt_rev, const struct format *fmt_apt,
+		 const struct format *fmt_rapt, const struct format *fmt_todo)
 {
 	char buf[BUFSIZ], lstore[BUFSIZ];
 	int major, minor;
@@ -1892,6 +1946,8 @@ ical_import_data(const char *file, FILE * stream, FILE * log, unsigned *events,
 /* Export calcurse data. */
 void ical_export_data(FILE * stream, int export_uid)
 {
+	if (export_uid)
+		item_hashes_prefetch();
 	ical_export_header(stream);
 	ical_export_recur_events(stream, export_uid);
 	ical_export_events(stream, export_uid);
@@ -1899,4 +1955,5 @@ void ical_export_data(FILE * stream, int export_uid)
 	ical_export_apoints(stream, export_uid);
 	ical_export_todo(stream, export_uid);
 	ical_export_footer(stream);
+	item_hashes_free();
 }
@@ -39,15 +39,26 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <signal.h>
 #include <time.h>
 #include <math.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <ctype.h>
+#include <dirent.h>
 
 #include "calcurse.h"
+#include "checksum.h"
 #include "sha1.h"
 
+#ifdef HAVE_SYS_INOTIFY_H
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
 struct ht_keybindings_s {
 	const char *label;
 	enum key key;
@@ -60,14 +71,37 @@ static int load_keys_ht_compare(struct ht_keybindings_s *,
 				struct ht_keybindings_s *);
 
 #define HSIZE 256
+
+/* Limits for splitting the appointment file between loader threads. */
+#define IO_LOAD_MAX_THREADS 64
+#define IO_LOAD_CHUNK_MIN (256 * 1024)
+
+/* Amount of serialized data collected before writing it to a stream. */
+#define IO_WRITE_BUFSIZE (64 * 1024)
+
+/* Age in seconds below which the status of a file is not trusted. */
+#define IO_STAMP_SLACK 2
+
+/*
+ * A data file is reloaded in full rather than incrementally if more than one
+ * line in IO_RELOAD_RATIO does not match an item in memory.
+ */
+#define IO_RELOAD_RATIO 4
+
+/* Time in milliseconds to wait for a burst of changes to the data files. */
+#define IO_WATCH_DELAY 500
 HTABLE_HEAD(ht_keybindings, HSIZE, ht_keybindings_s);
 HTABLE_PROTOTYPE(ht_keybindings, ht_keybindings_s)
     HTABLE_GENERATE(ht_keybindings, ht_keybindings_s, load_keys_ht_getkey,
 		load_keys_ht_compare)
 
 static int modified = 0;
-static char apts_sha1[SHA1_DIGESTLEN * 2 + 1];
-static char todo_sha1[SHA1_DIGESTLEN * 2 + 1];
+static char apts_sum[CHECKSUM_LEN * 2 + 1];
+static char todo_sum[CHECKSUM_LEN * 2 + 1];
+static struct io_stamp apts_stamp, todo_stamp;
+
+/* File mode creation mask, read once before any thread is started. */
+static mode_t io_umask;
 
 /* Ask user for a file name to export data to. */
 static FILE *get_export_stream(enum export_type type)
@@ -147,6 +181,9 @@ void io_init(const char *cfile, const char *datadir, const char *confdir)
 	char* home_dir = getenv("HOME");
 	char* legacy_dir = NULL;
 
+	io_umask = umask(0);
+	umask(io_umask);
+
 	if (home_dir) {
 		asprintf(&legacy_dir, "%s%s", home_dir, "/" DIR_NAME_LEGACY);
 		if (!io_dir_exists(legacy_dir)) {
@@ -191,10 +228,15 @@ void io_init(const char *cfile, const char *datadir, const char *confdir)
 	} else {
 		asprintf(&path_apts, "%s%s", path_ddir, APTS_PATH_NAME);
 	}
+	asprintf(&path_shards, "%s%s", path_apts, SHARDS_DIR_EXT);
+	asprintf(&path_archive, "%s%s", path_apts, ARCHIVE_EXT);
 	asprintf(&path_todo, "%s%s", path_ddir, TODO_PATH_NAME);
 	asprintf(&path_cpid, "%s%s", path_ddir, CPID_PATH_NAME);
 	asprintf(&path_dpid, "%s%s", path_ddir, DPID_PATH_NAME);
+	asprintf(&path_dsock, "%s%s", path_ddir, DSOCK_PATH_NAME);
 	asprintf(&path_notes, "%s%s", path_ddir, NOTES_DIR_NAME);
+	asprintf(&path_notes_pack, "%s%s", path_ddir, NOTES_PACK_NAME);
+	asprintf(&path_notes_index, "%s%s", path_ddir, NOTES_INDEX_NAME);
 	asprintf(&path_dmon_log, "%s%s", path_ddir, DLOG_PATH_NAME);
 
 	/* Configuration files */
@@ -218,10 +260,135 @@ void io_extract_data(char *dst_data, const char *org, int len)
 
 static pthread_mutex_t io_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t io_periodic_save_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t io_t_compact;
+static int io_compact_started, io_compact_done;
+
+/* The contents of a data file about to be written. */
+struct io_save_file {
+	const char *path;
+	char *sum;		/* hash of the file as last loaded or saved */
+	struct string s;
+};
+
+/*
+ * The items of the data files as last loaded or saved, which are the common
+ * base of an item-level merge with the data files. Items are identified by
+ * the hash of their line, and counted on each side in an open addressing hash
+ * table; an edited item is thus a removed item and an added one. Each entry
+ * also holds the keys of the item, see io_item_keys(), which tie the versions
+ * of an edited item together. The base is only recorded in the
+ * user interface and in batch mode, while all appointments are stored in the
+ * apts data file. It is protected by the I/O mutex.
+ */
+enum io_base_side {
+	IO_BASE,
+	IO_LOCAL,
+	IO_REMOTE
+};
+
+struct io_base_entry {
+	uint64_t hash;		/* 0 if the entry is free */
+	uint64_t key[2];	/* start and description, 0 if none */
+	int count[3];
+	int conflict;		/* changed on both sides */
+};
+
+struct io_base {
+	struct io_base_entry *entry;
+	unsigned size;		/* a power of two */
+	unsigned used;
+	int valid;
+};
+
+#define IO_BASE_MIN 1024
+
+/*
+ * A save running in the background. The items are serialized by the thread
+ * requesting the save, which is fast and yields a consistent copy of the
+ * lists; the worker thread hashes and writes that copy and runs the hooks.
+ */
+struct io_save_job {
+	struct io_save_file *files;
+	unsigned nfiles;
+	struct io_base base;	/* base of the next merge once saved */
+	pthread_t target;	/* thread notified on completion */
+	int ret;
+};
+
+static pthread_t io_t_save;
+static pthread_cond_t io_save_cond = PTHREAD_COND_INITIALIZER;
+static struct io_save_job *io_save_job;
+static int io_save_started, io_save_done, io_save_pending;
+
+/*
+ * Year shards. With the yearshards option, non-recurring items that start and
+ * end in the same year are stored in one file per year (path_shards/2019,
+ * ...), and the apts data file only holds the other items. Each shard is
+ * hashed and checked for changes on its own. When loading on demand, shards
+ * are only loaded once a day of their year is looked at.
+ *
+ * The shards that have been loaded are kept sorted by year. They are
+ * protected by their own mutex rather than the I/O mutex, since they are
+ * loaded while the user interface is being drawn.
+ */
+struct io_shard {
+	int year;
+	char *path;
+	char sum[CHECKSUM_LEN * 2 + 1];
+	struct io_stamp stamp;
+};
+
+static pthread_mutex_t io_shard_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct io_shard **io_shards;
+static unsigned io_nshards, io_shards_size;
+static struct item_filter *io_shard_filter;
+static int io_shard_on_demand;
+
+/*
+ * Items are only loaded on demand by the thread that enabled it. Other threads
+ * record the days they looked at, which are loaded by io_load_pending().
+ */
+static pthread_t io_shard_thread;
+static time_t io_date_pending[2];
+
+/*
+ * The archive. Non-recurring items that ended before io_archive_end are moved
+ * to a separate file (path_archive), either by hand or once they are older
+ * than the archiveage option. The archive starts with a header line holding
+ * that date, and is only loaded when a day before that date is looked at or
+ * when all items are needed. Until then, its hash is unknown and changes are
+ * detected by its status alone. It is protected by the shard mutex. Items
+ * that are old enough to be archived by age are only moved on the next save,
+ * which is then due to write the files up to io_archive_due.
+ */
+#define ARCHIVE_MAGIC "calcurse-archive"
+
+static time_t io_archive_end;
+static time_t io_archive_due;
+static int io_archive_loaded;
+static char archive_sum[CHECKSUM_LEN * 2 + 1];
+static struct io_stamp archive_stamp;
+
+static struct io_base io_base;
+static int io_conflicts;
+
+static void io_load_shard(int);
+static void io_load_shards(struct item_filter *);
+static void io_load_other_files(struct item_filter *);
+static void io_load_archive(void);
+static void io_archive_old_items(void);
+static int io_load_missing(int);
+static int io_merge_items(int, struct string *);
 
 static void io_mutex_lock(void)
 {
 	pthread_mutex_lock(&io_mutex);
+	/*
+	 * The data handed to a background save are written first, so that
+	 * they cannot overwrite anything that is saved or loaded later.
+	 */
+	while (io_save_pending)
+		pthread_cond_wait(&io_save_cond, &io_mutex);
 }
 
 static void io_mutex_unlock(void)
@@ -230,8 +397,8 @@ static void io_mutex_unlock(void)
 }
 
 /* Print all appointments and events to stdout. */
-void io_dump_apts(const char *fmt_apt, const char *fmt_rapt,
-		  const char *fmt_ev, const char *fmt_rev)
+void io_dump_apts(const struct format *fmt_apt, const struct format *fmt_rapt,
+		  const struct format *fmt_ev, const struct format *fmt_rev)
 {
 	llist_item_t *i;
 
@@ -260,50 +427,477 @@ void io_dump_apts(const char *fmt_apt, const char *fmt_rapt,
 	}
 }
 
+/* Follow symbolic links so that the file they point to can be replaced. */
+static char *io_resolve_links(const char *path)
+{
+	char *target = mem_strdup(path), *next, *slash;
+	char buf[PATH_MAX];
+	struct stat st;
+	ssize_t n;
+	int depth;
+
+	for (depth = 0; depth < 16; depth++) {
+		if (lstat(target, &st) != 0 || !S_ISLNK(st.st_mode))
+			break;
+		if ((n = readlink(target, buf, sizeof(buf) - 1)) < 0)
+			break;
+		buf[n] = '\0';
+
+		if (buf[0] != '/' && (slash = strrchr(target, '/')))
+			asprintf(&next, "%.*s/%s", (int)(slash - target),
+				 target, buf);
+		else
+			next = mem_strdup(buf);
+		mem_free(target);
+		target = next;
+	}
+
+	return target;
+}
+
+/* Sync the directory holding a file, so that a rename in it is durable. */
+static void io_sync_dir(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	char *dir;
+	int fd;
+
+	if (!slash)
+		dir = mem_strdup(".");
+	else if (slash == path)
+		dir = mem_strdup("/");
+	else
+		asprintf(&dir, "%.*s", (int)(slash - path), path);
+
+	if ((fd = open(dir, O_RDONLY)) >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+	mem_free(dir);
+}
+
+/*
+ * Replace a file with the given contents atomically: the contents are written
+ * to a temporary file in the same directory, synced to disk and renamed over
+ * the file, so that the file is never left truncated. The directory is synced
+ * afterwards. Symbolic links are followed and the mode, owner and group of the
+ * file are preserved; a new file is created according to the umask. Return 0
+ * on failure, in which case the file is left untouched.
+ */
+int io_replace_file(const char *path, const char *data, size_t len)
+{
+	struct stat st;
+	char *target = io_resolve_links(path);
+	char *tmppath;
+	size_t done;
+	ssize_t n = 0;
+	int fd, ret = 0;
+
+	asprintf(&tmppath, "%s.XXXXXX", target);
+	if ((fd = mkstemp(tmppath)) < 0)
+		goto cleanup;
+	if (stat(target, &st) == 0) {
+		fchmod(fd, st.st_mode & 07777);
+		/* Only root can give the file to another user. */
+		if (fchown(fd, st.st_uid, st.st_gid) != 0)
+			fchown(fd, (uid_t)-1, st.st_gid);
+	} else {
+		fchmod(fd, 0666 & ~io_umask);
+	}
+
+	for (done = 0; done < len; done += n) {
+		if ((n = write(fd, data + done, len - done)) < 0) {
+			if (errno != EINTR)
+				break;
+			n = 0;
+		}
+	}
+	ret = done == len && fsync(fd) == 0;
+	ret = close(fd) == 0 && ret;
+	ret = ret && rename(tmppath, target) == 0;
+	if (ret)
+		io_sync_dir(target);
+	else
+		unlink(tmppath);
+
+cleanup:
+	mem_free(tmppath);
+	mem_free(target);
+	return ret;
+}
+
+/*
+ * Terminate a line in the output buffer. If fp is not NULL, the buffer is
+ * written out in large chunks whenever it fills up.
+ */
+static void io_end_line(struct string *s, FILE *fp)
+{
+	string_catc(s, '\n');
+	if (fp && s->len >= IO_WRITE_BUFSIZE) {
+		fwrite(string_buf(s), 1, s->len, fp);
+		s->len = 0;
+	}
+}
+
+/* Write out whatever is left in the output buffer. */
+static void io_flush_lines(struct string *s, FILE *fp)
+{
+	if (s->len > 0)
+		fwrite(string_buf(s), 1, s->len, fp);
+	s->len = 0;
+}
+
+/*
+ * Write the serialized contents of a data file, see io_save_file() for sum.
+ * The item lists are not accessed, so that this can run in the background.
+ */
+static unsigned io_save_string(const char *path, struct string *s, char *sum)
+{
+	struct io_map map;
+	char digest[CHECKSUM_LEN * 2 + 1];
+	int ret;
+
+	map.data = string_buf(s);
+	map.len = s->len;
+	map.mapped = 0;
+	io_map_hash(&map, digest);
+
+	if (sum && !strcmp(digest, sum))
+		ret = 1;
+	else
+		ret = io_replace_file(path, string_buf(s), s->len);
+
+	if (ret) {
+		journal_remove(path);
+		if (sum)
+			strcpy(sum, digest);
+	}
+
+	return ret;
+}
+
+/*
+ * Save a data file whose contents are produced by serialize(). The contents
+ * are built in memory and hashed before anything is written. If sum is not
+ * NULL, it holds the hash of the data file as last loaded or saved; the file
+ * is only written if its contents changed, and the hash is updated. Writing
+ * a data file in full supersedes its journal.
+ */
+static unsigned io_save_file(const char *path,
+			     void (*serialize)(struct string *, FILE *),
+			     char *sum)
+{
+	struct string s;
+	int ret;
+
+	if (read_only)
+		return 1;
+
+	string_init(&s);
+	serialize(&s, NULL);
+	ret = io_save_string(path, &s, sum);
+	string_free(&s);
+
+	return ret;
+}
+
 /*
- * Save the apts data file, which contains the
+ * Serialize the contents of the apts data file, which contains the
  * appointments first, and then the events.
  * Recursive items are written first.
  */
-unsigned io_save_apts(const char *aptsfile)
+static void io_write_apts(struct string *s, FILE *fp)
 {
 	llist_item_t *i;
-	FILE *fp;
 
-	if (aptsfile) {
-		if (read_only)
-			return 1;
+	LLIST_FOREACH(&recur_elist, i) {
+		struct recur_event *rev = LLIST_GET_DATA(i);
+		recur_event_serialize(rev, s);
+		io_end_line(s, fp);
+	}
 
-		if ((fp = fopen(aptsfile, "w")) == NULL)
-			return 0;
-	} else {
-		fp = stdout;
+	LLIST_TS_LOCK(&recur_alist_p);
+	LLIST_TS_FOREACH(&recur_alist_p, i) {
+		struct recur_apoint *rapt = LLIST_GET_DATA(i);
+		recur_apoint_serialize(rapt, s);
+		io_end_line(s, fp);
+	}
+	LLIST_TS_UNLOCK(&recur_alist_p);
+
+	if (ui_mode == UI_CURSES)
+		LLIST_TS_LOCK(&alist_p);
+	LLIST_TS_FOREACH(&alist_p, i) {
+		struct apoint *apt = LLIST_TS_GET_DATA(i);
+		apoint_serialize(apt, s);
+		io_end_line(s, fp);
+	}
+	if (ui_mode == UI_CURSES)
+		LLIST_TS_UNLOCK(&alist_p);
+
+	LLIST_FOREACH(&eventlist, i) {
+		struct event *ev = LLIST_TS_GET_DATA(i);
+		event_serialize(ev, s);
+		io_end_line(s, fp);
+	}
+}
+
+/*
+ * Year of the shard holding an item that starts at start and ends at end, or
+ * -1 if the item is stored in the apts data file.
+ */
+static int io_shard_year(time_t start, time_t end)
+{
+	struct tm lt;
+	int year;
+
+	localtime_r(&start, &lt);
+	year = lt.tm_year + 1900;
+	localtime_r(&end, &lt);
+
+	return lt.tm_year + 1900 == year ? year : -1;
+}
+
+/* Check whether an item belongs in the archive. */
+static int io_apoint_archived(struct apoint *apt)
+{
+	return apt->start + apt->dur < io_archive_end;
+}
+
+static int io_event_archived(struct event *ev)
+{
+	return ev->day < io_archive_end;
+}
+
+/* Check whether the appointments are spread over several files. */
+static int io_split_apts(void)
+{
+	return conf.year_shards || io_nshards > 0 || io_archive_end > 0 ||
+	       io_archive_due > 0;
+}
+
+/*
+ * Position of the shard of a year among the loaded shards, or where it would
+ * be inserted. Must be called with the shard mutex held.
+ */
+static unsigned io_shard_search(int year)
+{
+	unsigned lo = 0, hi = io_nshards, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (io_shards[mid]->year < year)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Index of a loaded shard, or -1. Must be called with the shard mutex held. */
+static int io_shard_index(int year)
+{
+	unsigned k = io_shard_search(year);
+
+	return k < io_nshards && io_shards[k]->year == year ? (int)k : -1;
+}
+
+/* Create the directory holding the shards. */
+static void io_make_shard_dir(void)
+{
+	if (mkdir(path_shards, 0700) != 0 && errno != EEXIST)
+		ERROR_MSG(_("Could not create directory \"%s\": %s"),
+			  path_shards, strerror(errno));
+}
+
+/*
+ * Output buffer for an item of the given shard year, see below. The archive
+ * comes last, at index n.
+ */
+static struct string *io_item_output(struct io_save_file *files, unsigned n,
+				     int archived, int year)
+{
+	if (archived)
+		return &files[n].s;
+	if (!conf.year_shards || year < 0)
+		return &files[0].s;
+	return &files[io_shard_index(year) + 1].s;
+}
+
+/*
+ * Serialize the appointment data into the files they are saved to: the apts
+ * data file, followed by the loaded shards if year shards are enabled, and by
+ * the archive once it has been loaded. Items of years that have not been
+ * loaded go to the apts data file. Return the number of files. Must be called
+ * with the shard mutex held.
+ */
+static unsigned io_write_app_files(struct io_save_file **files)
+{
+	struct io_save_file *f;
+	struct string *s;
+	llist_item_t *i;
+	unsigned n, k;
+
+	n = conf.year_shards ? io_nshards + 1 : 1;
+	f = mem_calloc(n + 1, sizeof(struct io_save_file));
+	for (k = 0; k < n; k++) {
+		f[k].path = k ? io_shards[k - 1]->path : path_apts;
+		f[k].sum = k ? io_shards[k - 1]->sum : apts_sum;
+		string_init(&f[k].s);
 	}
+	f[n].path = path_archive;
+	f[n].sum = archive_sum;
+	string_init(&f[n].s);
+	string_printf(&f[n].s, "%s %ld\n", ARCHIVE_MAGIC, (long)io_archive_end);
+	*files = f;
 
-	recur_save_data(fp);
+	LLIST_FOREACH(&recur_elist, i) {
+		recur_event_serialize(LLIST_GET_DATA(i), &f[0].s);
+		io_end_line(&f[0].s, NULL);
+	}
+
+	LLIST_TS_LOCK(&recur_alist_p);
+	LLIST_TS_FOREACH(&recur_alist_p, i) {
+		recur_apoint_serialize(LLIST_GET_DATA(i), &f[0].s);
+		io_end_line(&f[0].s, NULL);
+	}
+	LLIST_TS_UNLOCK(&recur_alist_p);
 
 	if (ui_mode == UI_CURSES)
 		LLIST_TS_LOCK(&alist_p);
 	LLIST_TS_FOREACH(&alist_p, i) {
 		struct apoint *apt = LLIST_TS_GET_DATA(i);
-		apoint_write(apt, fp);
+		s = io_item_output(f, n,
+				   io_archive_loaded && io_apoint_archived(apt),
+				   io_shard_year(apt->start,
+						 apt->start + apt->dur));
+		apoint_serialize(apt, s);
+		io_end_line(s, NULL);
 	}
 	if (ui_mode == UI_CURSES)
 		LLIST_TS_UNLOCK(&alist_p);
 
 	LLIST_FOREACH(&eventlist, i) {
 		struct event *ev = LLIST_TS_GET_DATA(i);
-		event_write(ev, fp);
+		s = io_item_output(f, n,
+				   io_archive_loaded && io_event_archived(ev),
+				   io_shard_year(ev->day, ev->day));
+		event_serialize(ev, s);
+		io_end_line(s, NULL);
 	}
 
-	if (aptsfile)
-		file_close(fp, __FILE_POS__);
+	if (io_archive_loaded && io_archive_end > 0)
+		return n + 1;
+	string_free(&f[n].s);
+	return n;
+}
 
-	return 1;
+/*
+ * Write data files. If check is set, only the files whose contents changed are
+ * written, see io_save_file(). Return 0 if a file could not be written.
+ */
+static int io_save_files_write(struct io_save_file *files, unsigned n,
+			       int check)
+{
+	unsigned k;
+	int ret = 1;
+
+	for (k = 0; k < n; k++) {
+		/* Years without items do not get a file. */
+		if (k > 0 && files[k].s.len == 0 &&
+		    !io_file_exists(files[k].path))
+			continue;
+		ret = io_save_string(files[k].path, &files[k].s,
+				     check ? files[k].sum : NULL) && ret;
+	}
+
+	return ret;
+}
+
+static void io_save_files_free(struct io_save_file *files, unsigned n)
+{
+	unsigned k;
+
+	for (k = 0; k < n; k++)
+		string_free(&files[k].s);
+	mem_free(files);
+}
+
+static void io_shard_free(struct io_shard *shard)
+{
+	mem_free(shard->path);
+	mem_free(shard);
+}
+
+/*
+ * Remove the shards that were loaded, once year shards have been disabled and
+ * their items have been saved to the apts data file. Must be called with the
+ * shard mutex held.
+ */
+static void io_remove_shards(void)
+{
+	unsigned k;
+
+	for (k = 0; k < io_nshards; k++) {
+		unlink(io_shards[k]->path);
+		io_shard_free(io_shards[k]);
+	}
+	io_nshards = 0;
+	rmdir(path_shards);
+}
+
+/*
+ * Save the apts data file along with the year shards and the archive. If check
+ * is set, only the files whose contents changed are written.
+ */
+static unsigned io_save_app_files(int check)
+{
+	struct io_save_file *files;
+	unsigned n;
+	int ret;
+
+	io_archive_old_items();
+	io_load_missing(0);
+	if (conf.year_shards)
+		io_make_shard_dir();
+
+	pthread_mutex_lock(&io_shard_mutex);
+	n = io_write_app_files(&files);
+	if ((ret = io_save_files_write(files, n, check)) && !conf.year_shards &&
+	    io_nshards > 0)
+		io_remove_shards();
+	pthread_mutex_unlock(&io_shard_mutex);
+	io_save_files_free(files, n);
+
+	return ret;
+}
+
+/*
+ * Save the apts data file, or print it to stdout if aptsfile is NULL. See
+ * io_save_file() for sum. Saving to the apts data file also saves the year
+ * shards, or removes the shards that were loaded if they have been disabled,
+ * and the archive.
+ */
+unsigned io_save_apts(const char *aptsfile, char *sum)
+{
+	struct string s;
+
+	if (!aptsfile) {
+		string_init(&s);
+		io_write_apts(&s, stdout);
+		io_flush_lines(&s, stdout);
+		string_free(&s);
+		return 1;
+	}
+
+	if (aptsfile == path_apts && !read_only && io_split_apts())
+		return io_save_app_files(sum != NULL);
+
+	return io_save_file(aptsfile, io_write_apts, sum);
 }
 
 /* Print all todo items to stdout. */
-void io_dump_todo(const char *fmt_todo)
+void io_dump_todo(const struct format *fmt_todo)
 {
 	llist_item_t *i;
 
@@ -313,31 +907,35 @@ void io_dump_todo(const char *fmt_todo)
 	}
 }
 
-/* Save the todo data file. */
-unsigned io_save_todo(const char *todofile)
+/* Serialize the contents of the todo data file. */
+static void io_write_todo(struct string *s, FILE *fp)
 {
 	llist_item_t *i;
-	FILE *fp;
-
-	if (todofile) {
-		if (read_only)
-			return 1;
-
-		if ((fp = fopen(todofile, "w")) == NULL)
-			return 0;
-	} else {
-		fp = stdout;
-	}
 
 	LLIST_FOREACH(&todolist, i) {
 		struct todo *todo = LLIST_TS_GET_DATA(i);
-		todo_write(todo, fp);
+		todo_serialize(todo, s);
+		io_end_line(s, fp);
 	}
+}
+
+/*
+ * Save the todo data file, or print it to stdout if todofile is NULL. See
+ * io_save_file() for sum.
+ */
+unsigned io_save_todo(const char *todofile, char *sum)
+{
+	struct string s;
 
-	if (todofile)
-		file_close(fp, __FILE_POS__);
+	if (!todofile) {
+		string_init(&s);
+		io_write_todo(&s, stdout);
+		io_flush_lines(&s, stdout);
+		string_free(&s);
+		return 1;
+	}
 
-	return 1;
+	return io_save_file(todofile, io_write_todo, sum);
 }
 
 /* Save user-defined keys */
@@ -357,51 +955,274 @@ unsigned io_save_keys(void)
 	return 1;
 }
 
-static int io_compute_hash(const char *path, char *buf)
+/* Hash a file, and store its status as of before it was read in st. */
+static int io_compute_hash(const char *path, char *buf, struct stat *st)
 {
 	FILE *fp = fopen(path, "r");
 
 	if (!fp)
 		return 0;
-	sha1_stream(fp, buf);
+	if (fstat(fileno(fp), st) != 0) {
+		fclose(fp);
+		return 0;
+	}
+	checksum_stream(fp, buf);
 	fclose(fp);
 
 	return 1;
 }
 
-/* A merge implies a save operation and must be followed by reload of data. */
-static void io_merge_data(void)
+static uint64_t io_line_hash(const char *s, size_t len)
 {
-	char *path_apts_new, *path_todo_new;
-	const char *new_ext = ".new";
+	checksum_ctx_t ctx;
+	uint64_t h[2];
 
-	asprintf(&path_apts_new, "%s%s", path_apts, new_ext);
-	asprintf(&path_todo_new, "%s%s", path_todo, new_ext);
+	checksum_init(&ctx);
+	checksum_update(&ctx, (const uint8_t *)s, len);
+	checksum_final(&ctx, h);
+	return h[0] ? h[0] : 1;
+}
 
-	io_save_apts(path_apts_new);
-	io_save_todo(path_todo_new);
+static void io_base_free(struct io_base *base)
+{
+	if (base->entry)
+		mem_free(base->entry);
+	base->entry = NULL;
+	base->size = base->used = 0;
+	base->valid = 0;
+}
 
-	/*
-	 * We do not directly write to the data files here; however, the
-	 * external merge tool might incorporate changes from the new file into
-	 * the main data files.
-	 */
-	run_hook("pre-save");
+/* Entry of an item in the table, or the free entry it would go into. */
+static struct io_base_entry *io_base_slot(struct io_base_entry *entry,
+					  unsigned size, uint64_t hash)
+{
+	unsigned k = hash & (size - 1);
 
-	if (!io_files_equal(path_apts, path_apts_new)) {
-		const char *arg_apts[] = { conf.mergetool, path_apts,
-					   path_apts_new, NULL };
-		wins_launch_external(arg_apts);
-	}
+	while (entry[k].hash && entry[k].hash != hash)
+		k = (k + 1) & (size - 1);
+	return &entry[k];
+}
+
+static struct io_base_entry *io_base_find(struct io_base *base, uint64_t hash)
+{
+	struct io_base_entry *e;
+
+	if (!base->size)
+		return NULL;
+	e = io_base_slot(base->entry, base->size, hash);
+	return e->hash ? e : NULL;
+}
+
+static void io_base_grow(struct io_base *base)
+{
+	struct io_base_entry *entry;
+	unsigned size, k;
+
+	size = base->size ? base->size * 2 : IO_BASE_MIN;
+	entry = mem_calloc(size, sizeof(struct io_base_entry));
+	for (k = 0; k < base->size; k++) {
+		if (base->entry[k].hash)
+			*io_base_slot(entry, size, base->entry[k].hash) =
+				base->entry[k];
+	}
+	if (base->entry)
+		mem_free(base->entry);
+	base->entry = entry;
+	base->size = size;
+}
+
+/* Count an item on one side of the merge, given its hash and keys. */
+static void io_base_add(struct io_base *base, uint64_t hash,
+			const uint64_t key[2], enum io_base_side side, int n)
+{
+	struct io_base_entry *e;
+
+	if (2 * (base->used + 1) > base->size)
+		io_base_grow(base);
+	e = io_base_slot(base->entry, base->size, hash);
+	if (!e->hash) {
+		e->hash = hash;
+		e->key[0] = key[0];
+		e->key[1] = key[1];
+		base->used++;
+	}
+	e->count[side] += n;
+}
+
+/*
+ * Compute the keys of an item: the start of an appointment, and the
+ * description of any item, both along with its type. Two versions of an item
+ * that share a key are taken to be the same item. Events only have a day,
+ * which many of them share, and todo items have no start at all.
+ */
+static void io_item_keys(enum item_type type, time_t start, const char *mesg,
+			 uint64_t key[2])
+{
+	checksum_ctx_t ctx;
+	uint64_t h[2];
+	char buf[BUFSIZ];
+	int n;
+
+	key[0] = 0;
+	if (type == TYPE_APPT || type == TYPE_RECUR_APPT) {
+		n = snprintf(buf, sizeof(buf), "%d %ld", type, (long)start);
+		key[0] = io_line_hash(buf, n);
+	}
+
+	n = snprintf(buf, sizeof(buf), "%d ", type);
+	checksum_init(&ctx);
+	checksum_update(&ctx, (const uint8_t *)buf, n);
+	checksum_update(&ctx, (const uint8_t *)mesg, strlen(mesg));
+	checksum_final(&ctx, h);
+	key[1] = h[0] ? h[0] : 1;
+}
+
+/*
+ * Count the item serialized into the line buffer and clear the buffer. If
+ * keep is set, the line is also appended there.
+ */
+static void io_base_count(struct io_base *base, struct string *line,
+			  enum item_type type, time_t start, const char *mesg,
+			  enum io_base_side side, struct string *keep)
+{
+	uint64_t key[2];
+
+	io_item_keys(type, start, mesg, key);
+	io_base_add(base, io_line_hash(string_buf(line), line->len), key,
+		    side, 1);
+	if (keep) {
+		string_catn(keep, string_buf(line), line->len);
+		string_catc(keep, '\n');
+	}
+	line->len = 0;
+}
+
+/*
+ * Count the items in memory on one side of the merge. The lines of the
+ * appointments and of the todo items are kept in apts and todo if set.
+ */
+static void io_base_count_items(struct io_base *base, enum io_base_side side,
+				struct string *apts, struct string *todo)
+{
+	struct string line;
+	llist_item_t *i;
+
+	string_init(&line);
+	LLIST_FOREACH(&recur_elist, i) {
+		struct recur_event *rev = LLIST_GET_DATA(i);
+		recur_event_serialize(rev, &line);
+		io_base_count(base, &line, TYPE_RECUR_EVNT, rev->day,
+			      rev->mesg, side, apts);
+	}
+
+	LLIST_TS_LOCK(&recur_alist_p);
+	LLIST_TS_FOREACH(&recur_alist_p, i) {
+		struct recur_apoint *rapt = LLIST_GET_DATA(i);
+		recur_apoint_serialize(rapt, &line);
+		io_base_count(base, &line, TYPE_RECUR_APPT, rapt->start,
+			      rapt->mesg, side, apts);
+	}
+	LLIST_TS_UNLOCK(&recur_alist_p);
+
+	if (ui_mode == UI_CURSES)
+		LLIST_TS_LOCK(&alist_p);
+	LLIST_TS_FOREACH(&alist_p, i) {
+		struct apoint *apt = LLIST_TS_GET_DATA(i);
+		apoint_serialize(apt, &line);
+		io_base_count(base, &line, TYPE_APPT, apt->start, apt->mesg,
+			      side, apts);
+	}
+	if (ui_mode == UI_CURSES)
+		LLIST_TS_UNLOCK(&alist_p);
+
+	LLIST_FOREACH(&eventlist, i) {
+		struct event *ev = LLIST_GET_DATA(i);
+		event_serialize(ev, &line);
+		io_base_count(base, &line, TYPE_EVNT, ev->day, ev->mesg, side,
+			      apts);
+	}
+
+	LLIST_FOREACH(&todolist, i) {
+		struct todo *todo_item = LLIST_GET_DATA(i);
+		todo_serialize(todo_item, &line);
+		io_base_count(base, &line, TYPE_TODO, 0, todo_item->mesg, side,
+			      todo);
+	}
+	string_free(&line);
+}
+
+/*
+ * Record the items in memory as the base of a merge. Unless force is set,
+ * this is only done in the user interface.
+ */
+static void io_base_record_items(struct io_base *base, int force)
+{
+	io_base_free(base);
+	if ((ui_mode != UI_CURSES && !force) || io_split_apts())
+		return;
+	io_base_count_items(base, IO_BASE, NULL, NULL);
+	base->valid = 1;
+}
+
+/* Record the items in memory as the base of the next merge. */
+static void io_base_record(void)
+{
+	io_base_record_items(&io_base, 0);
+}
 
-	if (!io_files_equal(path_todo, path_todo_new)) {
-		const char *arg_todo[] = { conf.mergetool, path_todo,
-					   path_todo_new, NULL };
-		wins_launch_external(arg_todo);
+/* A merge implies a save operation and must be followed by reload of data. */
+static void io_merge_data(void)
+{
+	struct io_save_file *files;
+	char **path_new;
+	const char *new_ext = ".new";
+	unsigned n, k;
+
+	io_conflicts = 0;
+
+	/* The merge tool works on the data files alone. */
+	journal_compact(JOURNAL_APTS, path_apts, NULL);
+	journal_compact(JOURNAL_TODO, path_todo, NULL);
+
+	io_load_missing(0);
+	if (conf.year_shards)
+		io_make_shard_dir();
+	pthread_mutex_lock(&io_shard_mutex);
+	n = io_write_app_files(&files);
+	pthread_mutex_unlock(&io_shard_mutex);
+	files = mem_realloc(files, n + 1, sizeof(struct io_save_file));
+	files[n].path = path_todo;
+	string_init(&files[n].s);
+	io_write_todo(&files[n++].s, NULL);
+
+	path_new = mem_calloc(n, sizeof(char *));
+	for (k = 0; k < n; k++) {
+		asprintf(&path_new[k], "%s%s", files[k].path, new_ext);
+		io_replace_file(path_new[k], string_buf(&files[k].s),
+				files[k].s.len);
 	}
 
-	mem_free(path_apts_new);
-	mem_free(path_todo_new);
+	/*
+	 * We do not directly write to the data files here; however, the
+	 * external merge tool might incorporate changes from the new file into
+	 * the main data files.
+	 */
+	run_hook("pre-save");
+
+	for (k = 0; k < n; k++) {
+		/* Shards the data files do not have yet start out empty. */
+		if (!io_file_exists(files[k].path) && files[k].s.len > 0)
+			io_replace_file(files[k].path, "", 0);
+		if (io_file_exists(files[k].path) &&
+		    !io_files_equal(files[k].path, path_new[k])) {
+			const char *arg[] = { conf.mergetool, files[k].path,
+					      path_new[k], NULL };
+			wins_launch_external(arg);
+		}
+		mem_free(path_new[k]);
+	}
+	mem_free(path_new);
+	io_save_files_free(files, n);
 
 	/*
 	 * We do not directly write to the data files here; however, the
@@ -437,6 +1258,10 @@ static int resolve_save_conflict(void)
 		ret = IO_SAVE_CTINUE;
 		break;
 	case 2:
+		if (io_merge_items(1, NULL) >= 0) {
+			ret = IO_SAVE_MERGE;
+			break;
+		}
 		io_merge_data();
 		io_load_data(NULL, FORCE);
 		ret = IO_SAVE_RELOAD;
@@ -460,36 +1285,265 @@ static int resolve_save_conflict(void)
 #define TODO		(1 << 1)
 #define APTS_TODO	APTS | TODO
 #define NOKNOW		-1
+/*
+ * Check whether a data file differs from the given hash. The file is only
+ * read if its status does not match the stamp; if it turns out to be
+ * unchanged, the stamp is renewed. Return -1 if the file cannot be read.
+ */
+static int io_file_changed(const char *path, const char *sum,
+			   struct io_stamp *stamp)
+{
+	char sum_new[CHECKSUM_LEN * 2 + 1];
+	struct stat st;
+
+	if (stat(path, &st) == 0 && io_stamp_match(stamp, &st))
+		return 0;
+	if (!io_compute_hash(path, sum_new, &st))
+		return -1;
+	if (strncmp(sum_new, sum, CHECKSUM_LEN * 2) != 0)
+		return 1;
+	io_stamp_set(stamp, &st);
+
+	return 0;
+}
+
+/* Hash of an empty data file, which is what a missing shard amounts to. */
+static void io_empty_hash(char *sum)
+{
+	struct io_map map;
+
+	map.data = "";
+	map.len = 0;
+	map.mapped = 0;
+	io_map_hash(&map, sum);
+}
+
+/*
+ * Check whether any of the shards that have been loaded changed, see
+ * io_file_changed() for the return values.
+ */
+static int io_shards_changed(void)
+{
+	char empty[CHECKSUM_LEN * 2 + 1];
+	struct io_shard *shard;
+	unsigned k;
+	int ret = 0;
+
+	io_empty_hash(empty);
+	pthread_mutex_lock(&io_shard_mutex);
+	for (k = 0; k < io_nshards && ret == 0; k++) {
+		shard = io_shards[k];
+		if (!io_file_exists(shard->path))
+			ret = strcmp(shard->sum, empty) != 0;
+		else
+			ret = io_file_changed(shard->path, shard->sum,
+					      &shard->stamp);
+	}
+	pthread_mutex_unlock(&io_shard_mutex);
+
+	return ret;
+}
+
+/*
+ * Check whether the archive changed, see io_file_changed() for the return
+ * values. As long as its hash is unknown, any change to its status counts.
+ */
+static int io_archive_changed(void)
+{
+	struct stat st;
+	int ret;
+
+	pthread_mutex_lock(&io_shard_mutex);
+	if (stat(path_archive, &st) != 0)
+		ret = io_archive_end > 0;
+	else if (io_stamp_match(&archive_stamp, &st))
+		ret = 0;
+	else if (!archive_sum[0])
+		ret = 1;
+	else
+		ret = io_file_changed(path_archive, archive_sum,
+				      &archive_stamp);
+	pthread_mutex_unlock(&io_shard_mutex);
+
+	return ret;
+}
+
 static int new_data()
 {
-	char sha1_new[SHA1_DIGESTLEN * 2 + 1];
-	int ret = NONEW;
+	int ret = NONEW, changed;
+
+	if ((changed = io_file_changed(path_apts, apts_sum, &apts_stamp)) < 0)
+		return NOKNOW;
+	if (changed || journal_changed(JOURNAL_APTS, path_apts))
+		ret |= APTS;
+	if ((changed = io_shards_changed()) < 0)
+		return NOKNOW;
+	if (changed || io_archive_changed())
+		ret |= APTS;
+
+	if ((changed = io_file_changed(path_todo, todo_sum, &todo_stamp)) < 0)
+		return NOKNOW;
+	if (changed || journal_changed(JOURNAL_TODO, path_todo))
+		ret |= TODO;
 
-	if (io_compute_hash(path_apts, sha1_new)) {
-		if (strncmp(sha1_new, apts_sha1, SHA1_DIGESTLEN * 2) != 0) {
-			ret |= APTS;
-		}
-	} else {
-		ret = NOKNOW;
-		goto exit;
+	return ret;
+}
+
+/*
+ * Record the status of the data files after writing them. A stamp that cannot
+ * be trusted yet is verified by hashing on the next check.
+ */
+static void io_stamp_files(void)
+{
+	struct stat st;
+	unsigned k;
+
+	if (stat(path_apts, &st) == 0)
+		io_stamp_set(&apts_stamp, &st);
+	else
+		io_stamp_clear(&apts_stamp);
+
+	if (stat(path_todo, &st) == 0)
+		io_stamp_set(&todo_stamp, &st);
+	else
+		io_stamp_clear(&todo_stamp);
+
+	pthread_mutex_lock(&io_shard_mutex);
+	for (k = 0; k < io_nshards; k++) {
+		if (stat(io_shards[k]->path, &st) == 0)
+			io_stamp_set(&io_shards[k]->stamp, &st);
+		else
+			io_stamp_clear(&io_shards[k]->stamp);
 	}
+	/* The archive is only written once it has been loaded. */
+	if (io_archive_loaded && stat(path_archive, &st) == 0)
+		io_stamp_set(&archive_stamp, &st);
+	pthread_mutex_unlock(&io_shard_mutex);
+}
 
-	if (io_compute_hash(path_todo, sha1_new)) {
-		if (strncmp(sha1_new, todo_sha1, SHA1_DIGESTLEN * 2) != 0) {
-			ret |= TODO;
-		}
-	} else {
-		ret = NOKNOW;
-		goto exit;
+/* Thread used to fold the journals into the data files. */
+static void *io_compact_thread(void *arg)
+{
+	io_mutex_lock();
+	journal_compact(JOURNAL_APTS, path_apts, apts_sum);
+	journal_compact(JOURNAL_TODO, path_todo, todo_sum);
+	io_stamp_clear(&apts_stamp);
+	io_stamp_clear(&todo_stamp);
+	io_compact_done = 1;
+	io_mutex_unlock();
+
+	return NULL;
+}
+
+/*
+ * Fold the journals into the data files in the background, unless this is
+ * already being done. Must be called with the I/O mutex held.
+ */
+static void io_start_compact_thread(void)
+{
+	if (io_compact_started) {
+		if (!io_compact_done)
+			return;
+		pthread_join(io_t_compact, NULL);
 	}
-   exit:
-	return ret;
+
+	io_compact_done = 0;
+	io_compact_started = !pthread_create(&io_t_compact, NULL,
+					     io_compact_thread, NULL);
+	if (!io_compact_started) {
+		journal_compact(JOURNAL_APTS, path_apts, apts_sum);
+		journal_compact(JOURNAL_TODO, path_todo, todo_sum);
+		io_stamp_clear(&apts_stamp);
+		io_stamp_clear(&todo_stamp);
+	}
+}
+
+/* Wait for the journals to be folded into the data files. */
+void io_stop_compact_thread(void)
+{
+	if (!io_compact_started)
+		return;
+
+	pthread_join(io_t_compact, NULL);
+	io_compact_started = 0;
+}
+
+/*
+ * Append the changes to the journals. Return -1 if the data files need to be
+ * written in full instead, which is the case if the journals do not match the
+ * files or if the changes are too large.
+ */
+static int io_save_journal(void)
+{
+	off_t max = (off_t)conf.journal_size * 1024;
+	int ret;
+
+	if (!journal_indexed(JOURNAL_APTS) || !journal_indexed(JOURNAL_TODO))
+		return -1;
+
+	if ((ret = journal_save(JOURNAL_TODO, path_todo, todo_sum, max)) <= 0 ||
+	    (ret = journal_save(JOURNAL_APTS, path_apts, apts_sum, max)) <= 0)
+		return ret;
+
+	if (journal_size(JOURNAL_APTS) + journal_size(JOURNAL_TODO) > max)
+		io_start_compact_thread();
+
+	return 1;
+}
+
+/* Have all shards and the archive written on the next save. */
+static void io_clear_shard_hashes(void)
+{
+	unsigned k;
+
+	pthread_mutex_lock(&io_shard_mutex);
+	for (k = 0; k < io_nshards; k++)
+		io_shards[k]->sum[0] = '\0';
+	if (io_archive_loaded)
+		archive_sum[0] = '\0';
+	pthread_mutex_unlock(&io_shard_mutex);
+}
+
+/*
+ * Check whether the calendar data need to be saved, resolving a possible save
+ * conflict, see io_save_cal() for the return values. The data are to be saved
+ * if IO_SAVE_CTINUE is returned; new tells whether the data files changed.
+ * Must be called with the I/O mutex held.
+ */
+static int io_save_check(enum save_type s_t, int *new)
+{
+	int ret;
+
+	if ((*new = new_data()) == NOKNOW)
+		return IO_SAVE_ERROR;
+	if (*new) { /* New data */
+		if (s_t == periodic)
+			return IO_SAVE_CANCEL;
+		/* Interactively decide what to do. */
+		ret = resolve_save_conflict();
+		if (ret != IO_SAVE_CTINUE && ret != IO_SAVE_MERGE)
+			return ret;
+		/* Overwrite the data files even if the items are unchanged. */
+		apts_sum[0] = todo_sum[0] = '\0';
+		io_clear_shard_hashes();
+		return ret;
+	} else /* No new data */
+		if (!io_get_modified() && !io_archive_due)
+			return IO_SAVE_NOOP;
+
+	return IO_SAVE_CTINUE;
 }
 
 /*
  * Save the calendar data.
+ * In journal mode, the changes are appended to the journals, which are folded
+ * into the data files once they grow larger than the configured size. The
+ * data files are written in full if they changed and are to be overwritten,
+ * or if the changes themselves are larger than that size.
+ *
  * The return value tells how a possible save conflict should be/was resolved:
  * IO_SAVE_CTINUE: continue save operation and overwrite the data files
+ * IO_SAVE_MERGE: data files changed and merged with the items, then saved
  * IO_SAVE_RELOAD: cancel save operation (data files changed and reloaded)
  * IO_SAVE_CANCEL: cancel save operation (user's decision, keep data files, no reload)
  * IO_SAVE_NOOP: cancel save operation (nothing has changed)
@@ -497,335 +1551,2111 @@ static int new_data()
  */
 int io_save_cal(enum save_type s_t)
 {
-	int ret, new;
+	int ret, new, saved;
 
 	if (read_only)
 		return IO_SAVE_CANCEL;
 
 	io_mutex_lock();
-	if ((new = new_data()) == NOKNOW) {
-		ret = IO_SAVE_ERROR;
+	ret = io_save_check(s_t, &new);
+	if (ret != IO_SAVE_CTINUE && ret != IO_SAVE_MERGE)
+		goto cleanup;
+	/*
+	 * Items moved to years that have not been loaded yet cannot be saved
+	 * without loading those years, which is left to the next save
+	 * triggered by the user.
+	 */
+	if (s_t == periodic && !io_load_missing(1)) {
+		ret = IO_SAVE_NOOP;
 		goto cleanup;
 	}
-	if (new) { /* New data */
-		if (s_t == periodic) {
-			ret = IO_SAVE_CANCEL;
-			goto cleanup;
+
+	run_hook("pre-save");
+	saved = conf.journal && !io_split_apts() && !new ?
+		io_save_journal() : -1;
+	if (saved < 0 && io_save_todo(path_todo, todo_sum) &&
+	    io_save_apts(path_apts, apts_sum)) {
+		journal_reset(JOURNAL_APTS);
+		journal_reset(JOURNAL_TODO);
+		io_stamp_files();
+		if (conf.snapshot && !conf.journal && !io_split_apts()) {
+			snapshot_save(SNAPSHOT_APTS, path_apts, apts_sum);
+			snapshot_save(SNAPSHOT_TODO, path_todo, todo_sum);
 		}
-		/* Interactively decide what to do. */
-		if ((ret = resolve_save_conflict()))
-			goto cleanup;
-	} else /* No new data */
-		if (!io_get_modified()) {
-			ret = IO_SAVE_NOOP;
-			goto cleanup;
+		saved = 1;
+	}
+	if (saved > 0) {
+		io_unset_modified();
+		io_base_record();
+	} else {
+		ret = IO_SAVE_ERROR;
+	}
+	run_hook("post-save");
+
+cleanup:
+	io_mutex_unlock();
+	return ret;
+}
+
+/* Thread writing the data files of a background save. */
+static void *io_save_thread(void *arg)
+{
+	struct io_save_job *job = arg;
+
+	pthread_mutex_lock(&io_mutex);
+	run_hook("pre-save");
+	if (conf.year_shards)
+		io_make_shard_dir();
+	if (io_save_files_write(job->files, job->nfiles, 1)) {
+		if (!conf.year_shards) {
+			pthread_mutex_lock(&io_shard_mutex);
+			io_remove_shards();
+			pthread_mutex_unlock(&io_shard_mutex);
+		}
+		journal_reset(JOURNAL_APTS);
+		journal_reset(JOURNAL_TODO);
+		io_stamp_files();
+		/* The items in memory may have changed since. */
+		io_base_free(&io_base);
+		io_base = job->base;
+		job->base.entry = NULL;
+	} else {
+		/* The changes still have to be saved. */
+		io_set_modified();
+		job->ret = IO_SAVE_ERROR;
+	}
+	run_hook("post-save");
+	io_save_done = 1;
+	io_save_pending = 0;
+	pthread_cond_broadcast(&io_save_cond);
+	io_mutex_unlock();
+
+	if (job->ret == IO_SAVE_ERROR)
+		que_ins(_("Background save failed. Cannot write data files"),
+			now(), 2);
+	pthread_kill(job->target, SIGUSR2);
+
+	return NULL;
+}
+
+static void io_save_job_free(void)
+{
+	io_save_files_free(io_save_job->files, io_save_job->nfiles);
+	io_base_free(&io_save_job->base);
+	mem_free(io_save_job);
+	io_save_job = NULL;
+}
+
+/*
+ * Save the calendar data without waiting for the data files to be written.
+ * The save conflict is resolved and the items are serialized right away; the
+ * files are then written by a worker thread, which sends SIGUSR2 to the
+ * calling thread once done. Return IO_SAVE_BACKGROUND in that case, and
+ * otherwise the values described for io_save_cal(). In journal mode, saving
+ * is cheap anyway and io_save_cal() is used instead.
+ *
+ * Binary snapshots are not written by background saves: they would have to be
+ * built from the lists, which may have changed by then. The old snapshots no
+ * longer match the data files and are thus ignored.
+ */
+int io_save_cal_background(void)
+{
+	struct io_save_job *job;
+	int ret, new;
+
+	/* Archived items are moved while saving, see io_archive_old_items(). */
+	if (read_only || (conf.journal && !io_split_apts()) || io_archive_due)
+		return io_save_cal(interactive);
+
+	io_stop_save_thread();
+	io_mutex_lock();
+	ret = io_save_check(interactive, &new);
+	if (ret != IO_SAVE_CTINUE && ret != IO_SAVE_MERGE) {
+		io_mutex_unlock();
+		return ret;
+	}
+
+	job = mem_calloc(1, sizeof(struct io_save_job));
+	io_load_missing(0);
+	pthread_mutex_lock(&io_shard_mutex);
+	job->nfiles = io_write_app_files(&job->files);
+	pthread_mutex_unlock(&io_shard_mutex);
+	job->files = mem_realloc(job->files, job->nfiles + 1,
+				 sizeof(struct io_save_file));
+	job->files[job->nfiles].path = path_todo;
+	job->files[job->nfiles].sum = todo_sum;
+	string_init(&job->files[job->nfiles].s);
+	io_write_todo(&job->files[job->nfiles++].s, NULL);
+	io_base_record_items(&job->base, 0);
+	job->target = pthread_self();
+	job->ret = IO_SAVE_CTINUE;
+	io_unset_modified();
+
+	io_save_job = job;
+	io_save_done = 0;
+	io_save_pending = 1;
+	io_save_started = !pthread_create(&io_t_save, NULL, io_save_thread,
+					  job);
+	io_mutex_unlock();
+	if (!io_save_started)
+		io_save_thread(job);
+
+	return ret == IO_SAVE_MERGE ? ret : IO_SAVE_BACKGROUND;
+}
+
+/*
+ * Return the outcome of a background save that completed since the last call,
+ * that is, IO_SAVE_CTINUE or IO_SAVE_ERROR. Return -1 if there is none.
+ */
+int io_save_result(void)
+{
+	int ret = -1;
+
+	if (!io_save_job || pthread_mutex_trylock(&io_mutex) != 0)
+		return -1;
+	if (io_save_done) {
+		if (io_save_started)
+			pthread_join(io_t_save, NULL);
+		io_save_started = 0;
+		ret = io_save_job->ret;
+		io_save_job_free();
+	}
+	io_mutex_unlock();
+
+	return ret;
+}
+
+/* Wait for a background save to complete. */
+void io_stop_save_thread(void)
+{
+	if (!io_save_job)
+		return;
+
+	if (io_save_started)
+		pthread_join(io_t_save, NULL);
+	io_save_started = 0;
+	io_save_job_free();
+}
+
+static void io_load_error(const char *filename, unsigned line,
+			  const char *mesg)
+{
+	EXIT("%s:%u: %s", filename, line, mesg);
+}
+
+/*
+ * Compute the checksum of a mapped file before it is tokenized. It is only
+ * used to tell whether the file changed, so a fast checksum is used rather
+ * than SHA1.
+ */
+void io_map_hash(struct io_map *map, char *sum)
+{
+	checksum_ctx_t ctx;
+
+	if (!sum)
+		return;
+
+	checksum_init(&ctx);
+	checksum_update(&ctx, (const uint8_t *)map->data, map->len);
+	checksum_final_hex(&ctx, sum);
+}
+
+/*
+ * Map a data file into memory for parsing.
+ *
+ * The mapping is private and writable so that the parsers can terminate
+ * fields in place instead of copying them. Files that do not end with a
+ * newline (and files that cannot be mapped) are read into a buffer that has
+ * room for a terminating null byte. Return 0 if the file cannot be opened.
+ *
+ * If sum is not NULL, the checksum of the contents is stored there. It is
+ * computed from the buffer itself so that the file is only read once.
+ */
+int io_map_file(const char *path, struct io_map *map, char *sum)
+{
+	struct stat st;
+	char last;
+	ssize_t n;
+	size_t len;
+	int fd;
+
+	map->data = NULL;
+	map->len = 0;
+	map->mapped = 0;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return 0;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return 0;
+	}
+	map->st = st;
+	if (st.st_size == 0) {
+		close(fd);
+		io_map_hash(map, sum);
+		return 1;
+	}
+	map->len = st.st_size;
+
+	if (S_ISREG(st.st_mode) &&
+	    pread(fd, &last, 1, st.st_size - 1) == 1 && last == '\n') {
+		map->data = mmap(NULL, map->len, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE, fd, 0);
+		if (map->data != MAP_FAILED) {
+#ifdef POSIX_MADV_SEQUENTIAL
+			posix_madvise(map->data, map->len,
+				      POSIX_MADV_SEQUENTIAL);
+#endif
+			map->mapped = 1;
+			close(fd);
+			io_map_hash(map, sum);
+			return 1;
+		}
+	}
+
+	map->data = mem_malloc(map->len + 1);
+	for (len = 0; len < map->len; len += n) {
+		n = read(fd, map->data + len, map->len - len);
+		if (n < 0 && errno == EINTR) {
+			n = 0;
+		} else if (n <= 0) {
+			break;
+		}
+	}
+	map->len = len;
+	map->data[map->len] = '\0';
+	close(fd);
+	io_map_hash(map, sum);
+
+	return 1;
+}
+
+/*
+ * Record the status of a file. Timestamps only have a limited resolution, so
+ * a file that was modified very recently could change again without its
+ * status changing; such a stamp is not trusted until it is renewed later.
+ */
+void io_stamp_set(struct io_stamp *stamp, const struct stat *st)
+{
+	time_t now = time(NULL);
+
+	stamp->dev = st->st_dev;
+	stamp->ino = st->st_ino;
+	stamp->size = st->st_size;
+	stamp->mtime = st->st_mtime;
+	stamp->mtime_nsec = ST_MTIME_NSEC(st);
+	stamp->ctime = st->st_ctime;
+	stamp->ctime_nsec = ST_CTIME_NSEC(st);
+	stamp->valid = now - st->st_mtime > IO_STAMP_SLACK &&
+		       now - st->st_ctime > IO_STAMP_SLACK;
+}
+
+void io_stamp_clear(struct io_stamp *stamp)
+{
+	stamp->valid = 0;
+}
+
+/* Check whether a file is known to be unchanged since it was stamped. */
+int io_stamp_match(const struct io_stamp *stamp, const struct stat *st)
+{
+	return stamp->valid && stamp->dev == st->st_dev &&
+	       stamp->ino == st->st_ino && stamp->size == st->st_size &&
+	       stamp->mtime == st->st_mtime &&
+	       stamp->mtime_nsec == ST_MTIME_NSEC(st) &&
+	       stamp->ctime == st->st_ctime &&
+	       stamp->ctime_nsec == ST_CTIME_NSEC(st);
+}
+
+void io_unmap_file(struct io_map *map)
+{
+	if (map->mapped)
+		munmap(map->data, map->len);
+	else if (map->data)
+		mem_free(map->data);
+	map->data = NULL;
+	map->len = 0;
+	map->mapped = 0;
+}
+
+/*
+ * Split off the next line of a mapped data file: the line is null-terminated
+ * in place and *s is advanced to the beginning of the following line.
+ * Return NULL at the end of the data.
+ */
+char *io_map_getline(struct io_map *map, char **s)
+{
+	char *line = *s, *eol;
+	char *end = map->data + map->len;
+
+	if (!line || line >= end)
+		return NULL;
+
+	if ((eol = memchr(line, '\n', end - line))) {
+		*eol = '\0';
+		*s = eol + 1;
+	} else {
+		/* Unterminated last line, the buffer has room for a null. */
+		*end = '\0';
+		*s = end;
+	}
+
+	return line;
+}
+
+/*
+ * Scanner primitives for the data file parsers. Each function skips leading
+ * blanks, advances *s past the recognized token and returns 0 if the token
+ * is not found, mimicking the corresponding scanf(3) conversions.
+ */
+void io_scan_space(char **s)
+{
+	while (**s == ' ' || **s == '\t' || **s == '\r')
+		(*s)++;
+}
+
+int io_scan_char(char **s, int c)
+{
+	io_scan_space(s);
+	if (**s != c)
+		return 0;
+	(*s)++;
+	return 1;
+}
+
+int io_scan_int(char **s, int *val)
+{
+	char *p;
+	long n = 0;
+	int neg = 0;
+
+	io_scan_space(s);
+	p = *s;
+	if (*p == '-' || *p == '+')
+		neg = (*p++ == '-');
+	if (*p < '0' || *p > '9')
+		return 0;
+	for (; *p >= '0' && *p <= '9'; p++) {
+		n = n * 10 + (*p - '0');
+		if (n > INT_MAX)
+			return 0;
+	}
+
+	*val = neg ? -n : n;
+	*s = p;
+	return 1;
+}
+
+/* Scan a date in the data file format (mm/dd/yyyy). */
+int io_scan_date(char **s, int *mon, int *mday, int *year)
+{
+	return io_scan_int(s, mon) && io_scan_char(s, '/') &&
+	    io_scan_int(s, mday) && io_scan_char(s, '/') &&
+	    io_scan_int(s, year);
+}
+
+/* Scan a time of day in the data file format (hh:mm). */
+static int io_scan_time(char **s, int *hour, int *min)
+{
+	return io_scan_int(s, hour) && io_scan_char(s, ':') &&
+	    io_scan_int(s, min);
+}
+
+/*
+ * Parse one line of the appointment file: check what type of data is written
+ * and build either a new appointment, a new event, or a new recursive item
+ * (which can also be either an event or an appointment).
+ *
+ * The item is stored in *item without being added to the item lists; the item
+ * pointer is NULL if the line was skipped or the item did not pass the filter.
+ * Return an error message, or NULL if the line could be parsed.
+ */
+static char *io_load_app_line(char *p, struct tm lt,
+			      struct item_filter *filter,
+			      struct day_item *item)
+{
+	int c, is_appointment = 0, is_recursive = 0;
+	struct tm start, end, until;
+	struct rpt rpt;
+	int id = 0;
+	char state = 0L;
+	char *notep, *err;
+
+	start = end = until = lt;
+	item->item.apt = NULL;
+
+	/* Blank lines are skipped. */
+	io_scan_space(&p);
+	if (*p == '\0')
+		return NULL;
+
+	/* Read the date first: it is common to both events
+	 * and appointments.
+	 */
+	if (!io_scan_date(&p, &start.tm_mon, &start.tm_mday, &start.tm_year))
+		return _("syntax error in the item date");
+
+	/* Read the next character : if it is an '@' then we have
+	 * an appointment, else if it is an '[' we have en event.
+	 */
+	io_scan_space(&p);
+	c = *p++;
+
+	if (c == '@')
+		is_appointment = 1;
+	else if (c != '[')
+		return _("no event nor appointment found");
+
+	/* Read the remaining informations. */
+	if (is_appointment) {
+		if (!io_scan_time(&p, &start.tm_hour, &start.tm_min) ||
+		    !io_scan_char(&p, '-') || *p++ != '>' ||
+		    !io_scan_date(&p, &end.tm_mon, &end.tm_mday,
+				  &end.tm_year) ||
+		    !io_scan_char(&p, '@') ||
+		    !io_scan_time(&p, &end.tm_hour, &end.tm_min))
+			return _("syntax error in item time or duration");
+		io_scan_space(&p);
+	} else {
+		if (!io_scan_int(&p, &id) || !io_scan_char(&p, ']'))
+			return _("syntax error in item identifier");
+		while (*p == ' ')
+			p++;
+	}
+
+	/* Check if we have a recursive item. */
+	c = *p++;
+
+	if (c == '{') {
+		is_recursive = 1;
+		if (!io_scan_int(&p, &rpt.freq) || *p == '\0')
+			return _("syntax error in item repetition");
+		if (!strchr("DWMY", *p))
+			return _("unknown character");
+		rpt.type = recur_char2def(*p++);
+		io_scan_space(&p);
+		c = *p++;
+		/* Optional until date */
+		if (c == '-' && *p == '>') {
+			p++;
+			if (!io_scan_date(&p, &until.tm_mon, &until.tm_mday,
+					  &until.tm_year))
+				return _("syntax error in until date");
+			if (!check_date(until.tm_year, until.tm_mon,
+					until.tm_mday))
+				return _("until date error");
+			until.tm_hour = 0;
+			until.tm_min = 0;
+			until.tm_sec = 0;
+			until.tm_isdst = -1;
+			until.tm_year -= 1900;
+			until.tm_mon--;
+			rpt.until = mktime(&until);
+			io_scan_space(&p);
+			c = *p++;
+		} else
+			rpt.until = 0;
+		/* Optional bymonthday list */
+		if (c == 'd') {
+			if (rpt.type == RECUR_WEEKLY)
+				return _("BYMONTHDAY illegal with WEEKLY");
+			p--;
+			if ((err = recur_bymonthday(&rpt.bymonthday, &p)))
+				return err;
+			c = *p++;
+		} else
+			LLIST_INIT(&rpt.bymonthday);
+		/* Optional bywday list */
+		if (c == 'w') {
+			p--;
+			if ((err = recur_bywday(rpt.type, &rpt.bywday, &p)))
+				return err;
+			c = *p++;
+		} else
+			LLIST_INIT(&rpt.bywday);
+		/* Optional bymonth list */
+		if (c == 'm') {
+			p--;
+			if ((err = recur_bymonth(&rpt.bymonth, &p)))
+				return err;
+			c = *p++;
+		} else
+			LLIST_INIT(&rpt.bymonth);
+		/* Optional exception dates */
+		if (c == '!') {
+			p--;
+			if ((err = recur_exc_scan(&rpt.exc, &p)))
+				return err;
+			c = *p++;
+		} else
+			LLIST_INIT(&rpt.exc);
+		/* End of recurrence rule */
+		if (c != '}')
+			return _("missing end of recurrence");
+		while (*p == ' ')
+			p++;
+		c = *p++;
+	}
+
+	/* Check if a note is attached to the item. */
+	if (c == '>') {
+		notep = note_read(&p);
+		c = *p++;
+	} else
+		notep = NULL;
+
+	/* Last: read the item description and build the item. */
+	if (is_appointment) {
+		if (c == '!')
+			state = APOINT_NOTIFY;
+		else if (c != '|')
+			return _("syntax error in item state");
+
+		if (is_recursive) {
+			item->type = RECUR_APPT;
+			return recur_apoint_scan(p, start, end, state, notep,
+						 filter, &rpt,
+						 &item->item.rapt);
+		}
+		item->type = APPT;
+		return apoint_scan(p, start, end, state, notep, filter,
+				   &item->item.apt);
+	}
+
+	p--;
+	if (is_recursive) {
+		item->type = RECUR_EVNT;
+		return recur_event_scan(p, start, id, notep, filter, &rpt,
+					&item->item.rev);
+	}
+	item->type = EVNT;
+	return event_scan(p, start, id, notep, filter, &item->item.ev);
+}
+
+/* A part of the appointment file, parsed by a single loader thread. */
+struct io_load_chunk {
+	struct io_map map;	/* whole lines of the mapped file */
+	struct item_filter *filter;
+	struct tm lt;
+	struct day_item *items;	/* parsed items, in file order */
+	unsigned nitems;
+	unsigned size;
+	unsigned lines;		/* number of lines parsed */
+	char *error;		/* first error found, NULL if none */
+};
+
+static void *io_load_chunk_parse(void *arg)
+{
+	struct io_load_chunk *chunk = arg;
+	struct day_item item;
+	char *p, *next;
+
+	for (next = chunk->map.data; (p = io_map_getline(&chunk->map, &next)); ) {
+		chunk->lines++;
+		chunk->error = io_load_app_line(p, chunk->lt, chunk->filter,
+						&item);
+		if (chunk->error)
+			break;
+		if (!item.item.apt)
+			continue;
+		if (!chunk->items) {
+			chunk->size = 1024;
+			chunk->items = mem_malloc(chunk->size *
+						  sizeof(struct day_item));
+		} else if (chunk->nitems == chunk->size) {
+			chunk->size *= 2;
+			chunk->items = mem_realloc(chunk->items, chunk->size,
+						   sizeof(struct day_item));
+		}
+		chunk->items[chunk->nitems++] = item;
+	}
+
+	return NULL;
+}
+
+/*
+ * Number of threads used to parse the appointment file. Small files are not
+ * worth splitting, and the memory debugging allocator is not thread-safe.
+ */
+static unsigned io_load_nthreads(size_t len)
+{
+#ifdef CALCURSE_MEMORY_DEBUG
+	return 1;
+#else
+	long n = conf.load_threads;
+
+	if (n == 0)
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n > IO_LOAD_MAX_THREADS)
+		n = IO_LOAD_MAX_THREADS;
+	if ((size_t)n > len / IO_LOAD_CHUNK_MIN)
+		n = len / IO_LOAD_CHUNK_MIN;
+
+	return n > 1 ? n : 1;
+#endif
+}
+
+/*
+ * Add an item of the appointment file to its list. If a snapshot is being
+ * written, the item is recorded there first and filtered afterwards.
+ */
+static void io_load_app_add(struct day_item *item, struct snapshot *snap,
+			    struct item_filter *filter)
+{
+	union aptev_ptr *p = &item->item;
+
+	switch (item->type) {
+	case APPT:
+		if (snap)
+			snapshot_add_apoint(snap, p->apt);
+		if (filter && !apoint_filter(p->apt, filter))
+			apoint_free(p->apt);
+		else
+			apoint_add(p->apt);
+		break;
+	case RECUR_APPT:
+		if (snap)
+			snapshot_add_recur_apoint(snap, p->rapt);
+		if (filter && !recur_apoint_filter(p->rapt, filter))
+			recur_apoint_free(p->rapt);
+		else
+			recur_apoint_add(p->rapt);
+		break;
+	case EVNT:
+		if (snap)
+			snapshot_add_event(snap, p->ev);
+		if (filter && !event_filter(p->ev, filter))
+			event_free(p->ev);
+		else
+			event_add(p->ev);
+		break;
+	case RECUR_EVNT:
+		if (snap)
+			snapshot_add_recur_event(snap, p->rev);
+		if (filter && !recur_event_filter(p->rev, filter))
+			recur_event_free(p->rev);
+		else
+			recur_event_add(p->rev);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Load the appointment file.
+ *
+ * The file is mapped into memory and tokenized in place; each line holds
+ * exactly one item. Large files are split at line boundaries and the parts
+ * are parsed concurrently. The items are then added to the lists in file
+ * order, so that the result (and the first error reported) is the same as
+ * with a sequential load.
+ *
+ * If snapshots are enabled, a valid snapshot is used instead of the text
+ * file. Otherwise, a new snapshot is written from the parsed items; the
+ * filter is then applied when adding the items since the snapshot must hold
+ * all of them. Snapshots are not used in journal mode or while the file has a
+ * journal, which is replayed before parsing.
+ */
+void io_load_app(struct item_filter *filter)
+{
+	struct io_map map;
+	struct io_load_chunk *chunk;
+	struct snapshot *snap = NULL;
+	struct item_filter *chunk_filter = filter;
+	pthread_t *thread;
+	int *started, snapshot;
+	unsigned nthreads, i, j, line;
+	struct tm lt;
+	time_t t;
+	char *p, *end;
+
+	journal_clear(JOURNAL_APTS);
+	io_stamp_clear(&apts_stamp);
+	snapshot = conf.snapshot && !conf.journal && !conf.year_shards &&
+		   !journal_exists(path_apts);
+	if (snapshot &&
+	    snapshot_load(SNAPSHOT_APTS, path_apts, filter, apts_sum)) {
+		io_load_other_files(filter);
+		return;
+	}
+
+	t = time(NULL);
+	localtime_r(&t, &lt);
+
+	EXIT_IF(!io_map_file(path_apts, &map, apts_sum),
+		_("failed to open appointment file"));
+	io_stamp_set(&apts_stamp, &map.st);
+	journal_replay(JOURNAL_APTS, path_apts, &map, apts_sum,
+		       conf.journal && !filter);
+
+	if (snapshot &&
+	    (snap = snapshot_create(SNAPSHOT_APTS, path_apts, &map.st,
+				    apts_sum)))
+		chunk_filter = NULL;
+
+	nthreads = io_load_nthreads(map.len);
+	chunk = mem_calloc(nthreads, sizeof(struct io_load_chunk));
+	thread = mem_calloc(nthreads, sizeof(pthread_t));
+	started = mem_calloc(nthreads, sizeof(int));
+
+	/* Split the file into chunks of whole lines. */
+	for (i = 0, p = map.data; i < nthreads; i++, p = end) {
+		if (i == nthreads - 1) {
+			end = map.data + map.len;
+		} else {
+			end = map.data + map.len / nthreads * (i + 1);
+			if (end < p)
+				end = p;
+			end = memchr(end, '\n', map.data + map.len - end);
+			end = end ? end + 1 : map.data + map.len;
+		}
+		chunk[i].map.data = p;
+		chunk[i].map.len = end - p;
+		chunk[i].filter = chunk_filter;
+		chunk[i].lt = lt;
+	}
+
+	for (i = 1; i < nthreads; i++)
+		started[i] = !pthread_create(&thread[i], NULL,
+					     io_load_chunk_parse, &chunk[i]);
+	io_load_chunk_parse(&chunk[0]);
+	for (i = 1; i < nthreads; i++) {
+		if (started[i])
+			pthread_join(thread[i], NULL);
+		else
+			io_load_chunk_parse(&chunk[i]);
+	}
+
+	/* Merge the items, stopping at the first error. */
+	for (i = 0, line = 0; i < nthreads; i++) {
+		if (chunk[i].error) {
+			if (snap)
+				snapshot_abort(snap);
+			io_load_error(path_apts, line + chunk[i].lines,
+				      chunk[i].error);
+		}
+		line += chunk[i].lines;
+
+		for (j = 0; j < chunk[i].nitems; j++)
+			io_load_app_add(&chunk[i].items[j], snap,
+					snap ? filter : NULL);
+		if (chunk[i].items)
+			mem_free(chunk[i].items);
+	}
+	if (snap)
+		snapshot_commit(snap);
+
+	mem_free(started);
+	mem_free(thread);
+	mem_free(chunk);
+	io_unmap_file(&map);
+
+	io_load_other_files(filter);
+}
+
+/*
+ * Load a year shard, unless it has been loaded already. A missing shard is
+ * treated as empty. Must be called with the shard mutex held.
+ */
+static void io_load_shard(int year)
+{
+	struct io_shard *shard;
+	struct io_map map;
+	struct day_item item;
+	unsigned k, line = 0;
+	struct tm lt;
+	time_t t;
+	char *p, *next, *err;
+
+	k = io_shard_search(year);
+	if (k < io_nshards && io_shards[k]->year == year)
+		return;
+
+	shard = mem_malloc(sizeof(struct io_shard));
+	shard->year = year;
+	asprintf(&shard->path, "%s/%d", path_shards, year);
+	io_stamp_clear(&shard->stamp);
+
+	if (io_nshards == io_shards_size) {
+		io_shards_size = io_shards_size ? io_shards_size * 2 : 16;
+		io_shards = mem_realloc(io_shards, io_shards_size,
+					sizeof(struct io_shard *));
+	}
+	memmove(&io_shards[k + 1], &io_shards[k],
+		(io_nshards - k) * sizeof(struct io_shard *));
+	io_shards[k] = shard;
+	io_nshards++;
+
+	if (!io_map_file(shard->path, &map, shard->sum)) {
+		io_empty_hash(shard->sum);
+		return;
+	}
+	io_stamp_set(&shard->stamp, &map.st);
+
+	t = time(NULL);
+	localtime_r(&t, &lt);
+	for (next = map.data; (p = io_map_getline(&map, &next)); ) {
+		line++;
+		if ((err = io_load_app_line(p, lt, io_shard_filter, &item)))
+			io_load_error(shard->path, line, err);
+		if (item.item.apt)
+			io_load_app_add(&item, NULL, NULL);
+	}
+	io_unmap_file(&map);
+}
+
+/* Load all shards found in the shard directory. */
+static void io_load_all_shards(void)
+{
+	DIR *dir;
+	struct dirent *ent;
+	const char *c;
+
+	if (!(dir = opendir(path_shards)))
+		return;
+	pthread_mutex_lock(&io_shard_mutex);
+	while ((ent = readdir(dir))) {
+		for (c = ent->d_name; isdigit((unsigned char)*c); c++) ;
+		if (c != ent->d_name && *c == '\0')
+			io_load_shard(atoi(ent->d_name));
+	}
+	pthread_mutex_unlock(&io_shard_mutex);
+	closedir(dir);
+}
+
+/*
+ * Load the year shards after the apts data file. When loading on demand, the
+ * years that were loaded before are loaded again, or the current year at
+ * first. Otherwise, all shards are loaded; this is also done if year shards
+ * are disabled, so that their items are moved back into the apts data file on
+ * the next save.
+ */
+static void io_load_shards(struct item_filter *filter)
+{
+	int *years = NULL;
+	unsigned n, k;
+	time_t t;
+	struct tm lt;
+
+	pthread_mutex_lock(&io_shard_mutex);
+	n = io_nshards;
+	if (n > 0)
+		years = mem_calloc(n, sizeof(int));
+	for (k = 0; k < n; k++) {
+		years[k] = io_shards[k]->year;
+		io_shard_free(io_shards[k]);
+	}
+	io_nshards = 0;
+	io_shard_filter = filter;
+
+	if (conf.year_shards && io_shard_on_demand) {
+		if (n == 0) {
+			t = time(NULL);
+			localtime_r(&t, &lt);
+			io_load_shard(lt.tm_year + 1900);
+		}
+		for (k = 0; k < n; k++)
+			io_load_shard(years[k]);
+		pthread_mutex_unlock(&io_shard_mutex);
+	} else {
+		pthread_mutex_unlock(&io_shard_mutex);
+		io_load_all_shards();
+	}
+
+	if (years)
+		mem_free(years);
+}
+
+/*
+ * Read the header of the archive. It is loaded again right away if it was
+ * loaded before, or if items are not loaded on demand.
+ */
+static void io_open_archive(void)
+{
+	FILE *fp;
+	struct stat st;
+	char buf[BUFSIZ];
+	long end;
+	int loaded;
+
+	pthread_mutex_lock(&io_shard_mutex);
+	loaded = io_archive_loaded;
+	io_archive_loaded = 0;
+	io_archive_end = 0;
+	archive_sum[0] = '\0';
+	io_stamp_clear(&archive_stamp);
+
+	if ((fp = fopen(path_archive, "r"))) {
+		if (fstat(fileno(fp), &st) == 0)
+			io_stamp_set(&archive_stamp, &st);
+		if (!fgets(buf, BUFSIZ, fp) ||
+		    sscanf(buf, ARCHIVE_MAGIC " %ld", &end) != 1)
+			io_load_error(path_archive, 1,
+				      _("syntax error in the archive header"));
+		io_archive_end = end;
+		fclose(fp);
+	}
+
+	if (loaded || !io_shard_on_demand)
+		io_load_archive();
+	pthread_mutex_unlock(&io_shard_mutex);
+}
+
+/*
+ * Load the items of the archive, unless this has been done already. Must be
+ * called with the shard mutex held.
+ */
+static void io_load_archive(void)
+{
+	struct io_map map;
+	struct day_item item;
+	unsigned line = 1;
+	struct tm lt;
+	time_t t;
+	char *p, *next, *err;
+
+	if (io_archive_loaded)
+		return;
+	io_archive_loaded = 1;
+
+	if (!io_map_file(path_archive, &map, archive_sum)) {
+		archive_sum[0] = '\0';
+		return;
+	}
+	io_stamp_set(&archive_stamp, &map.st);
+
+	t = time(NULL);
+	localtime_r(&t, &lt);
+	next = map.data;
+	io_map_getline(&map, &next);
+	while ((p = io_map_getline(&map, &next))) {
+		line++;
+		if ((err = io_load_app_line(p, lt, io_shard_filter, &item)))
+			io_load_error(path_archive, line, err);
+		if (item.item.apt)
+			io_load_app_add(&item, NULL, NULL);
+	}
+	io_unmap_file(&map);
+}
+
+/*
+ * Check whether there are items that are older than the archiveage option, and
+ * have them moved to the archive on the next save. The data files are not
+ * written while loading, so that the save hooks see every write.
+ */
+static void io_archive_by_age(void)
+{
+	llist_item_t *i;
+	time_t end;
+
+	io_archive_due = 0;
+	if (read_only || !conf.archive_age || !io_shard_on_demand)
+		return;
+	end = date_sec_change(get_today(), 0, -(int)conf.archive_age);
+
+	pthread_mutex_lock(&io_shard_mutex);
+	if (end <= io_archive_end) {
+		pthread_mutex_unlock(&io_shard_mutex);
+		return;
+	}
+	if (ui_mode == UI_CURSES)
+		LLIST_TS_LOCK(&alist_p);
+	LLIST_TS_FOREACH(&alist_p, i) {
+		struct apoint *apt = LLIST_TS_GET_DATA(i);
+		if (apt->start + apt->dur < end)
+			io_archive_due = end;
+	}
+	if (ui_mode == UI_CURSES)
+		LLIST_TS_UNLOCK(&alist_p);
+	LLIST_FOREACH(&eventlist, i) {
+		struct event *ev = LLIST_TS_GET_DATA(i);
+		if (ev->day < end)
+			io_archive_due = end;
+	}
+	pthread_mutex_unlock(&io_shard_mutex);
+}
+
+/*
+ * Move the items that are older than the archiveage option to the archive,
+ * when saving. If the archive has not been loaded, only the moved items are
+ * serialized and the archive is copied as is. The archive is written before
+ * the apts data file and the shards, so that the items are never lost.
+ */
+static void io_archive_old_items(void)
+{
+	struct string s;
+	struct io_map map;
+	struct stat st;
+	llist_item_t *i;
+	time_t end = io_archive_due;
+	char *body;
+	int moved = 0;
+
+	if (!end)
+		return;
+	io_archive_due = 0;
+
+	pthread_mutex_lock(&io_shard_mutex);
+	if (end <= io_archive_end) {
+		pthread_mutex_unlock(&io_shard_mutex);
+		return;
+	}
+	if (io_archive_loaded) {
+		/* The items are written to the archive along with the others. */
+		io_archive_end = end;
+		pthread_mutex_unlock(&io_shard_mutex);
+		return;
+	}
+
+	string_init(&s);
+	string_printf(&s, "%s %ld\n", ARCHIVE_MAGIC, (long)end);
+	if (io_map_file(path_archive, &map, archive_sum)) {
+		body = memchr(map.data, '\n', map.len);
+		body = body ? body + 1 : map.data + map.len;
+		string_catn(&s, body, map.data + map.len - body);
+		io_unmap_file(&map);
+	}
+
+	if (ui_mode == UI_CURSES)
+		LLIST_TS_LOCK(&alist_p);
+	LLIST_TS_FOREACH(&alist_p, i) {
+		struct apoint *apt = LLIST_TS_GET_DATA(i);
+		if (apt->start + apt->dur < end) {
+			apoint_serialize(apt, &s);
+			io_end_line(&s, NULL);
+			moved = 1;
+		}
+	}
+	LLIST_FOREACH(&eventlist, i) {
+		struct event *ev = LLIST_TS_GET_DATA(i);
+		if (ev->day < end) {
+			event_serialize(ev, &s);
+			io_end_line(&s, NULL);
+			moved = 1;
+		}
+	}
+
+	archive_sum[0] = '\0';
+	if (moved && io_save_string(path_archive, &s, archive_sum)) {
+		io_archive_end = end;
+		if (stat(path_archive, &st) == 0)
+			io_stamp_set(&archive_stamp, &st);
+		LLIST_TS_FOREACH(&alist_p, i) {
+			struct apoint *apt = LLIST_TS_GET_DATA(i);
+			if (apt->start + apt->dur < end) {
+				apoint_free(apt);
+				i->data = NULL;
+			}
+		}
+		LLIST_FOREACH(&eventlist, i) {
+			struct event *ev = LLIST_TS_GET_DATA(i);
+			if (ev->day < end) {
+				event_free(ev);
+				i->data = NULL;
+			}
+		}
+		LLIST_TS_REMOVE_CLEARED(&alist_p);
+		LLIST_REMOVE_CLEARED(&eventlist);
+	}
+	if (ui_mode == UI_CURSES)
+		LLIST_TS_UNLOCK(&alist_p);
+	string_free(&s);
+	pthread_mutex_unlock(&io_shard_mutex);
+}
+
+/* Add the year of an item to a list of years whose shard is not loaded. */
+static void io_add_missing_year(int year, int **years, unsigned *n,
+				unsigned *size)
+{
+	unsigned k;
+
+	if (year < 0 || io_shard_index(year) >= 0)
+		return;
+	for (k = 0; k < *n; k++) {
+		if ((*years)[k] == year)
+			return;
+	}
+	if (*n == *size) {
+		*size = *size ? *size * 2 : 16;
+		*years = mem_realloc(*years, *size, sizeof(int));
+	}
+	(*years)[(*n)++] = year;
+}
+
+/*
+ * Load the files holding appointments besides the apts data file. Items are
+ * only archived by age after a full load.
+ */
+static void io_load_other_files(struct item_filter *filter)
+{
+	io_load_shards(filter);
+	io_open_archive();
+	if (!filter)
+		io_archive_by_age();
+}
+
+/*
+ * Make sure that the shards of all years holding items and the archive, if it
+ * holds some, have been loaded, since saving overwrites them. If defer is set,
+ * nothing is loaded. Return 1 if all those shards were loaded already.
+ */
+static int io_load_missing(int defer)
+{
+	llist_item_t *i;
+	int *years = NULL;
+	unsigned n = 0, size = 0, k;
+	int archive = 0;
+
+	if (!conf.year_shards && !io_archive_end)
+		return 1;
+
+	pthread_mutex_lock(&io_shard_mutex);
+	if (ui_mode == UI_CURSES)
+		LLIST_TS_LOCK(&alist_p);
+	LLIST_TS_FOREACH(&alist_p, i) {
+		struct apoint *apt = LLIST_TS_GET_DATA(i);
+		if (io_apoint_archived(apt))
+			archive = 1;
+		else if (conf.year_shards)
+			io_add_missing_year(io_shard_year(apt->start,
+							  apt->start + apt->dur),
+					    &years, &n, &size);
+	}
+	if (ui_mode == UI_CURSES)
+		LLIST_TS_UNLOCK(&alist_p);
+	LLIST_FOREACH(&eventlist, i) {
+		struct event *ev = LLIST_TS_GET_DATA(i);
+		if (io_event_archived(ev))
+			archive = 1;
+		else if (conf.year_shards)
+			io_add_missing_year(io_shard_year(ev->day, ev->day),
+					    &years, &n, &size);
+	}
+	archive = archive && !io_archive_loaded;
+	for (k = 0; k < n && !defer; k++)
+		io_load_shard(years[k]);
+	if (archive && !defer)
+		io_load_archive();
+	pthread_mutex_unlock(&io_shard_mutex);
+
+	if (years)
+		mem_free(years);
+	return n == 0 && !archive;
+}
+
+/*
+ * Make sure that the items of the given day have been loaded, which is only
+ * needed when loading year shards or the archive on demand. When called from
+ * another thread, such as the calendar date thread, which neither holds the
+ * list locks nor may be cancelled while reading a file, the day is only
+ * recorded.
+ */
+void io_load_date(time_t date)
+{
+	struct tm lt;
+
+	if (!io_shard_on_demand)
+		return;
+
+	pthread_mutex_lock(&io_shard_mutex);
+	if (!pthread_equal(pthread_self(), io_shard_thread)) {
+		if (!io_date_pending[0] || date < io_date_pending[0])
+			io_date_pending[0] = date;
+		if (date > io_date_pending[1])
+			io_date_pending[1] = date;
+	} else {
+		if (date < io_archive_end)
+			io_load_archive();
+		if (conf.year_shards) {
+			localtime_r(&date, &lt);
+			io_load_shard(lt.tm_year + 1900);
+		}
+	}
+	pthread_mutex_unlock(&io_shard_mutex);
+}
+
+/*
+ * Load the items of the days recorded by other threads. Return 1 if anything
+ * was loaded, in which case the screen needs to be updated.
+ */
+int io_load_pending(void)
+{
+	struct tm lt;
+	time_t from, to;
+	unsigned n;
+	int year, last, loaded;
+
+	pthread_mutex_lock(&io_shard_mutex);
+	from = io_date_pending[0];
+	to = io_date_pending[1];
+	io_date_pending[0] = io_date_pending[1] = 0;
+	if (!from) {
+		pthread_mutex_unlock(&io_shard_mutex);
+		return 0;
+	}
+
+	n = io_nshards;
+	loaded = io_archive_loaded;
+	if (from < io_archive_end)
+		io_load_archive();
+	if (conf.year_shards) {
+		localtime_r(&to, &lt);
+		last = lt.tm_year + 1900;
+		localtime_r(&from, &lt);
+		for (year = lt.tm_year + 1900; year <= last; year++)
+			io_load_shard(year);
+	}
+	loaded = io_nshards != n || io_archive_loaded != loaded;
+	pthread_mutex_unlock(&io_shard_mutex);
+
+	return loaded;
+}
+
+/*
+ * Move the non-recurring items that ended before the given date to the
+ * archive. They are written there on the next save.
+ */
+void io_archive(time_t date)
+{
+	pthread_mutex_lock(&io_shard_mutex);
+	if (date > io_archive_end) {
+		io_load_archive();
+		io_archive_end = date;
+	}
+	pthread_mutex_unlock(&io_shard_mutex);
+}
+
+/* Load year shards on demand rather than all at once from now on. */
+void io_load_on_demand(void)
+{
+	io_shard_thread = pthread_self();
+	io_shard_on_demand = 1;
+}
+
+/* Forget about the shards that have been loaded. */
+void io_free_shards(void)
+{
+	unsigned k;
+
+	pthread_mutex_lock(&io_shard_mutex);
+	for (k = 0; k < io_nshards; k++)
+		io_shard_free(io_shards[k]);
+	io_nshards = 0;
+	if (io_shards)
+		mem_free(io_shards);
+	io_shards = NULL;
+	io_shards_size = 0;
+	pthread_mutex_unlock(&io_shard_mutex);
+}
+
+/*
+ * Parse one line of the todo file. The description and the note of the item
+ * point into the line; the note is also stored in *notep, even if empty.
+ * Return an error message, or NULL if the line could be parsed.
+ */
+static char *io_load_todo_line(char *p, struct todo *todo, char **notep)
+{
+	if (*p == '[') {
+		/* new style with id */
+		p++;
+		if (*p == '-') {
+			todo->completed = 1;
+			p++;
+		} else {
+			todo->completed = 0;
+		}
+		if (!io_scan_int(&p, &todo->id) || !io_scan_char(&p, ']'))
+			return _("syntax error in item identifier");
+		while (*p == ' ')
+			p++;
+	} else {
+		todo->id = 9;
+		todo->completed = 0;
+	}
+	/* Now read the attached note, if any. */
+	if (*p == '>') {
+		p++;
+		*notep = note_read(&p);
+	} else {
+		*notep = NULL;
+	}
+	/* Then read todo description. */
+	while (*p == ' ' || *p == '\t')
+		p++;
+
+	todo->mesg = p;
+	todo->note = (*notep && **notep) ? *notep : NULL;
+	return NULL;
+}
+
+/* Load the todo data */
+void io_load_todo(struct item_filter *filter)
+{
+	struct io_map map;
+	struct snapshot *snap = NULL;
+	struct todo tmp;
+	char *p, *next, *notep, *err;
+	int snapshot;
+	unsigned line = 0;
+
+	journal_clear(JOURNAL_TODO);
+	io_stamp_clear(&todo_stamp);
+	snapshot = conf.snapshot && !conf.journal && !journal_exists(path_todo);
+	if (snapshot &&
+	    snapshot_load(SNAPSHOT_TODO, path_todo, filter, todo_sum))
+		return;
+
+	EXIT_IF(!io_map_file(path_todo, &map, todo_sum),
+		_("failed to open todo file"));
+	io_stamp_set(&todo_stamp, &map.st);
+	journal_replay(JOURNAL_TODO, path_todo, &map, todo_sum,
+		       conf.journal && !filter);
+	if (snapshot)
+		snap = snapshot_create(SNAPSHOT_TODO, path_todo, &map.st,
+				       todo_sum);
+
+	for (next = map.data; (p = io_map_getline(&map, &next)); ) {
+		line++;
+		if ((err = io_load_todo_line(p, &tmp, &notep))) {
+			if (snap)
+				snapshot_abort(snap);
+			io_load_error(path_todo, line, err);
+		}
+		if (snap)
+			snapshot_add_todo(snap, &tmp);
+
+		/* Filter item. */
+		if (filter && !todo_filter(&tmp, filter))
+			continue;
+
+		todo_add(tmp.mesg, tmp.id, tmp.completed, notep);
+	}
+	if (snap)
+		snapshot_commit(snap);
+	io_unmap_file(&map);
+}
+
+/*
+ * Items in memory, identified by the hash of their line in a data file. This
+ * is used to match the items with the lines of a data file being reloaded.
+ */
+struct io_diff_item {
+	uint8_t digest[SHA1_DIGESTLEN];
+	enum item_type type;
+	llist_item_t *i;
+	int kept;		/* a line of the data file matches the item */
+};
+
+struct io_diff {
+	struct io_diff_item *items;
+	unsigned n;
+	unsigned size;
+	struct string line;	/* item being recorded */
+};
+
+/* A line of the data file that does not match any item in memory. */
+struct io_diff_line {
+	char *p;
+	unsigned line;
+};
+
+static void io_diff_digest(const char *s, size_t len, uint8_t *digest)
+{
+	sha1_ctx_t ctx;
+
+	sha1_init(&ctx);
+	sha1_update(&ctx, (const uint8_t *)s, len);
+	sha1_final(&ctx, digest);
+}
+
+static int io_diff_cmp(const void *a, const void *b)
+{
+	return memcmp(((const struct io_diff_item *)a)->digest,
+		      ((const struct io_diff_item *)b)->digest,
+		      SHA1_DIGESTLEN);
+}
+
+/* Record the item that has been serialized into the line buffer. */
+static void io_diff_add(struct io_diff *diff, llist_item_t *i,
+			enum item_type type)
+{
+	struct io_diff_item *item;
+
+	if (!diff->items) {
+		diff->size = 1024;
+		diff->items = mem_malloc(diff->size *
+					 sizeof(struct io_diff_item));
+	} else if (diff->n == diff->size) {
+		diff->size *= 2;
+		diff->items = mem_realloc(diff->items, diff->size,
+					  sizeof(struct io_diff_item));
+	}
+
+	item = &diff->items[diff->n++];
+	io_diff_digest(string_buf(&diff->line), diff->line.len, item->digest);
+	item->type = type;
+	item->i = i;
+	item->kept = 0;
+	diff->line.len = 0;
+}
+
+/* Match a line with an item that has not been matched yet. */
+static int io_diff_match(struct io_diff *diff, const char *line)
+{
+	uint8_t digest[SHA1_DIGESTLEN];
+	unsigned lo = 0, hi = diff->n, mid;
+
+	io_diff_digest(line, strlen(line), digest);
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (memcmp(diff->items[mid].digest, digest,
+			   SHA1_DIGESTLEN) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo < diff->n; lo++) {
+		if (memcmp(diff->items[lo].digest, digest, SHA1_DIGESTLEN))
+			break;
+		if (!diff->items[lo].kept) {
+			diff->items[lo].kept = 1;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Match the lines of a mapped data file with the recorded items. The lines
+ * that do not match any item are returned in *lines. Return 0 if there are
+ * so many of them that loading the whole file is preferable.
+ */
+static int io_diff_map(struct io_diff *diff, struct io_map *map,
+		       struct io_diff_line **lines, unsigned *nlines)
+{
+	unsigned line = 0, size = 0;
+	char *p, *next;
+
+	qsort(diff->items, diff->n, sizeof(struct io_diff_item), io_diff_cmp);
+
+	*lines = NULL;
+	*nlines = 0;
+	for (next = map->data; (p = io_map_getline(map, &next)); ) {
+		line++;
+		if (io_diff_match(diff, p))
+			continue;
+		if (*nlines >= diff->n / IO_RELOAD_RATIO) {
+			if (*lines)
+				mem_free(*lines);
+			return 0;
+		}
+		if (!*lines) {
+			size = 64;
+			*lines = mem_malloc(size * sizeof(struct io_diff_line));
+		} else if (*nlines == size) {
+			size *= 2;
+			*lines = mem_realloc(*lines, size,
+					     sizeof(struct io_diff_line));
+		}
+		(*lines)[*nlines].p = p;
+		(*lines)[*nlines].line = line;
+		(*nlines)++;
+	}
+
+	return 1;
+}
+
+/*
+ * Release the items that did not match any line of the data file. Their list
+ * items are cleared, to be removed from the lists by the caller.
+ */
+static void io_diff_release(struct io_diff *diff)
+{
+	struct io_diff_item *item;
+	unsigned k;
+
+	for (k = 0; k < diff->n; k++) {
+		item = &diff->items[k];
+		if (item->kept)
+			continue;
+		switch (item->type) {
+		case TYPE_APPT:
+			apoint_free(item->i->data);
+			break;
+		case TYPE_RECUR_APPT:
+			recur_apoint_free(item->i->data);
+			break;
+		case TYPE_EVNT:
+			event_free(item->i->data);
+			break;
+		case TYPE_RECUR_EVNT:
+			recur_event_free(item->i->data);
+			break;
+		default:
+			todo_free(item->i->data);
+			break;
+		}
+		item->i->data = NULL;
+	}
+}
+
+static void io_diff_free(struct io_diff *diff)
+{
+	if (diff->items)
+		mem_free(diff->items);
+	string_free(&diff->line);
+}
+
+/*
+ * Reload the appointment file by applying the differences with the items in
+ * memory. The items are matched with the lines of the file by hash; items
+ * without a line are deleted, and only the lines that do not match an item
+ * are parsed. Unchanged items stay in place, so that the selection in the
+ * user interface is kept. Return 0 if the whole file should rather be loaded
+ * because there are no items yet or too much has changed, in which case the
+ * items in memory are left untouched.
+ */
+static int io_reload_app(void)
+{
+	struct io_diff diff;
+	struct io_diff_line *lines;
+	struct day_item *items;
+	struct io_map map;
+	llist_item_t *i;
+	unsigned nlines, k;
+	struct tm lt;
+	time_t t;
+	char *err;
+
+	if (!LLIST_FIRST(&recur_elist) && !LLIST_TS_FIRST(&recur_alist_p) &&
+	    !LLIST_TS_FIRST(&alist_p) && !LLIST_FIRST(&eventlist))
+		return 0;
+	/* Items move between the apts data file and the other files. */
+	if (io_split_apts())
+		return 0;
+
+	journal_clear(JOURNAL_APTS);
+	io_stamp_clear(&apts_stamp);
+	EXIT_IF(!io_map_file(path_apts, &map, apts_sum),
+		_("failed to open appointment file"));
+	io_stamp_set(&apts_stamp, &map.st);
+	journal_replay(JOURNAL_APTS, path_apts, &map, apts_sum, conf.journal);
+
+	diff.items = NULL;
+	diff.n = diff.size = 0;
+	string_init(&diff.line);
+
+	LLIST_FOREACH(&recur_elist, i) {
+		recur_event_serialize(LLIST_GET_DATA(i), &diff.line);
+		io_diff_add(&diff, i, TYPE_RECUR_EVNT);
+	}
+	LLIST_TS_FOREACH(&recur_alist_p, i) {
+		recur_apoint_serialize(LLIST_GET_DATA(i), &diff.line);
+		io_diff_add(&diff, i, TYPE_RECUR_APPT);
+	}
+	LLIST_TS_FOREACH(&alist_p, i) {
+		apoint_serialize(LLIST_TS_GET_DATA(i), &diff.line);
+		io_diff_add(&diff, i, TYPE_APPT);
+	}
+	LLIST_FOREACH(&eventlist, i) {
+		event_serialize(LLIST_GET_DATA(i), &diff.line);
+		io_diff_add(&diff, i, TYPE_EVNT);
+	}
+
+	if (!io_diff_map(&diff, &map, &lines, &nlines)) {
+		io_diff_free(&diff);
+		io_unmap_file(&map);
+		return 0;
+	}
+
+	/* Parse the new lines before changing anything. */
+	t = time(NULL);
+	localtime_r(&t, &lt);
+	items = mem_calloc(nlines ? nlines : 1, sizeof(struct day_item));
+	for (k = 0; k < nlines; k++) {
+		if ((err = io_load_app_line(lines[k].p, lt, NULL, &items[k])))
+			io_load_error(path_apts, lines[k].line, err);
+	}
+
+	LLIST_TS_LOCK(&recur_alist_p);
+	if (ui_mode == UI_CURSES)
+		LLIST_TS_LOCK(&alist_p);
+	io_diff_release(&diff);
+	LLIST_REMOVE_CLEARED(&recur_elist);
+	LLIST_TS_REMOVE_CLEARED(&recur_alist_p);
+	LLIST_TS_REMOVE_CLEARED(&alist_p);
+	LLIST_REMOVE_CLEARED(&eventlist);
+	if (ui_mode == UI_CURSES)
+		LLIST_TS_UNLOCK(&alist_p);
+	LLIST_TS_UNLOCK(&recur_alist_p);
+
+	for (k = 0; k < nlines; k++) {
+		if (items[k].item.apt)
+			io_load_app_add(&items[k], NULL, NULL);
+	}
+
+	mem_free(items);
+	if (lines)
+		mem_free(lines);
+	io_diff_free(&diff);
+	io_unmap_file(&map);
+	return 1;
+}
+
+/* Reload the todo file incrementally, see io_reload_app(). */
+static int io_reload_todo(void)
+{
+	struct io_diff diff;
+	struct io_diff_line *lines;
+	struct io_map map;
+	struct todo *todos;
+	char **notes, *err;
+	llist_item_t *i;
+	unsigned nlines, k;
+
+	if (!LLIST_FIRST(&todolist))
+		return 0;
+
+	journal_clear(JOURNAL_TODO);
+	io_stamp_clear(&todo_stamp);
+	EXIT_IF(!io_map_file(path_todo, &map, todo_sum),
+		_("failed to open todo file"));
+	io_stamp_set(&todo_stamp, &map.st);
+	journal_replay(JOURNAL_TODO, path_todo, &map, todo_sum, conf.journal);
+
+	diff.items = NULL;
+	diff.n = diff.size = 0;
+	string_init(&diff.line);
+
+	LLIST_FOREACH(&todolist, i) {
+		todo_serialize(LLIST_GET_DATA(i), &diff.line);
+		io_diff_add(&diff, i, TYPE_TODO);
+	}
+
+	if (!io_diff_map(&diff, &map, &lines, &nlines)) {
+		io_diff_free(&diff);
+		io_unmap_file(&map);
+		return 0;
+	}
+
+	todos = mem_calloc(nlines ? nlines : 1, sizeof(struct todo));
+	notes = mem_calloc(nlines ? nlines : 1, sizeof(char *));
+	for (k = 0; k < nlines; k++) {
+		if ((err = io_load_todo_line(lines[k].p, &todos[k], &notes[k])))
+			io_load_error(path_todo, lines[k].line, err);
+	}
+
+	io_diff_release(&diff);
+	LLIST_REMOVE_CLEARED(&todolist);
+	for (k = 0; k < nlines; k++)
+		todo_add(todos[k].mesg, todos[k].id, todos[k].completed,
+			 notes[k]);
+
+	mem_free(notes);
+	mem_free(todos);
+	if (lines)
+		mem_free(lines);
+	io_diff_free(&diff);
+	io_unmap_file(&map);
+	return 1;
+}
+
+/* Release an item of the given type, leaving its list item cleared. */
+static void io_merge_release(llist_item_t *i, enum item_type type)
+{
+	switch (type) {
+	case TYPE_APPT:
+		apoint_free(i->data);
+		break;
+	case TYPE_RECUR_APPT:
+		recur_apoint_free(i->data);
+		break;
+	case TYPE_EVNT:
+		event_free(i->data);
+		break;
+	case TYPE_RECUR_EVNT:
+		recur_event_free(i->data);
+		break;
+	default:
+		todo_free(i->data);
+		break;
+	}
+	i->data = NULL;
+}
+
+/*
+ * Drop the item serialized into the line buffer if the merge removes one more
+ * of its copies, and clear the buffer. The lines of the conflicting items
+ * dropped are appended to theirs.
+ */
+static void io_merge_drop(struct io_base *base, struct string *line,
+			  llist_item_t *i, enum item_type type,
+			  struct string *theirs)
+{
+	struct io_base_entry *e;
+
+	e = io_base_find(base, io_line_hash(string_buf(line), line->len));
+	if (e && e->count[IO_BASE] < 0) {
+		if (e->conflict) {
+			string_catn(theirs, string_buf(line), line->len);
+			string_catc(theirs, '\n');
 		}
+		io_merge_release(i, type);
+		e->count[IO_BASE]++;
+	}
+	line->len = 0;
+}
 
-	ret = IO_SAVE_CTINUE;
-	run_hook("pre-save");
-	if (io_save_todo(path_todo) &&
-	    io_save_apts(path_apts)) {
-		io_compute_hash(path_apts, apts_sha1);
-		io_compute_hash(path_todo, todo_sha1);
-		io_unset_modified();
-	} else
-		ret = IO_SAVE_ERROR;
-	run_hook("post-save");
+/* The changes made to a group of entries, see io_merge_mark(). */
+#define IO_MERGE_LOCAL	(1 << 0)
+#define IO_MERGE_REMOTE	(1 << 1)
+#define IO_MERGE_DIFFER	(1 << 2)
+#define IO_MERGE_BOTH	(IO_MERGE_LOCAL | IO_MERGE_REMOTE | IO_MERGE_DIFFER)
 
-cleanup:
-	io_mutex_unlock();
-	return ret;
+struct io_merge_key {
+	uint64_t key;
+	unsigned n;		/* index among the changed entries */
+};
+
+static int io_merge_key_cmp(const void *a, const void *b)
+{
+	uint64_t x = ((const struct io_merge_key *)a)->key;
+	uint64_t y = ((const struct io_merge_key *)b)->key;
+
+	return x < y ? -1 : x > y;
 }
 
-static void io_load_error(const char *filename, unsigned line,
-			  const char *mesg)
+static unsigned io_merge_group(unsigned *parent, unsigned n)
 {
-	EXIT("%s:%u: %s", filename, line, mesg);
+	while (parent[n] != n)
+		n = parent[n] = parent[parent[n]];
+	return n;
 }
 
 /*
- * Check what type of data is written in the appointment file,
- * and then load either: a new appointment, a new event, or a new
- * recursive item (which can also be either an event or an appointment).
+ * Mark the entries that conflict. The entries changed on either side are
+ * grouped by their keys, so that the versions of an edited item end up in
+ * the same group. A group conflicts if both sides changed it, but did not
+ * make the same changes. Return the number of conflicting groups.
  */
-void io_load_app(struct item_filter *filter)
+static int io_merge_mark(struct io_base *base)
 {
-	FILE *data_file;
-	int c, is_appointment, is_event, is_recursive;
-	struct tm start, end, until, lt;
-	struct rpt rpt;
+	struct io_base_entry **changed, *e;
+	struct io_merge_key *keys;
+	unsigned *parent, n = 0, nkeys = 0, k, g;
+	unsigned char *flags;
+	int conflicts = 0;
+
+	changed = mem_calloc(base->used + 1, sizeof(struct io_base_entry *));
+	for (k = 0; k < base->size; k++) {
+		e = &base->entry[k];
+		if (!e->hash)
+			continue;
+		e->conflict = 0;
+		if (e->count[IO_LOCAL] != e->count[IO_BASE] ||
+		    e->count[IO_REMOTE] != e->count[IO_BASE])
+			changed[n++] = e;
+	}
+
+	keys = mem_calloc(2 * n + 1, sizeof(struct io_merge_key));
+	for (k = 0; k < n; k++) {
+		for (g = 0; g < 2; g++) {
+			if (!changed[k]->key[g])
+				continue;
+			keys[nkeys].key = changed[k]->key[g];
+			keys[nkeys++].n = k;
+		}
+	}
+	qsort(keys, nkeys, sizeof(struct io_merge_key), io_merge_key_cmp);
+
+	parent = mem_calloc(n + 1, sizeof(unsigned));
+	for (k = 0; k < n; k++)
+		parent[k] = k;
+	for (k = 1; k < nkeys; k++) {
+		if (keys[k].key == keys[k - 1].key)
+			parent[io_merge_group(parent, keys[k].n)] =
+				io_merge_group(parent, keys[k - 1].n);
+	}
+
+	flags = mem_calloc(n + 1, 1);
+	for (k = 0; k < n; k++) {
+		e = changed[k];
+		g = io_merge_group(parent, k);
+		if (e->count[IO_LOCAL] != e->count[IO_BASE])
+			flags[g] |= IO_MERGE_LOCAL;
+		if (e->count[IO_REMOTE] != e->count[IO_BASE])
+			flags[g] |= IO_MERGE_REMOTE;
+		if (e->count[IO_LOCAL] != e->count[IO_REMOTE])
+			flags[g] |= IO_MERGE_DIFFER;
+	}
+	for (k = 0; k < n; k++) {
+		g = io_merge_group(parent, k);
+		if (flags[g] != IO_MERGE_BOTH)
+			continue;
+		changed[k]->conflict = 1;
+		if (g == k)
+			conflicts++;
+	}
+
+	mem_free(flags);
+	mem_free(parent);
+	mem_free(keys);
+	mem_free(changed);
+	return conflicts;
+}
+
+/* Add the items of the lines of a buffer, which is modified. */
+static void io_merge_add_lines(char *p, size_t len, int todo)
+{
+	struct day_item item;
+	struct todo tmp;
+	struct tm lt;
 	time_t t;
-	int id = 0;
-	char type, state = 0L;
-	char note[MAX_NOTESIZ + 1], *notep;
-	unsigned line = 0;
-	char *scan_error;
+	char *eol, *end, *note;
 
 	t = time(NULL);
 	localtime_r(&t, &lt);
-	start = end = until = lt;
+	for (end = p + len; p < end; p = eol + 1) {
+		if (!(eol = memchr(p, '\n', end - p)))
+			eol = end;
+		*eol = '\0';
+		if (todo) {
+			if (!io_load_todo_line(p, &tmp, &note))
+				todo_add(tmp.mesg, tmp.id, tmp.completed, note);
+		} else if (!io_load_app_line(p, lt, NULL, &item) &&
+			   item.item.apt) {
+			io_load_app_add(&item, NULL, NULL);
+		}
+	}
+}
 
-	data_file = fopen(path_apts, "r");
-	EXIT_IF(data_file == NULL, _("failed to open appointment file"));
+/*
+ * Have the conflicting items of a data file resolved with the merge tool. It
+ * is run on a file holding the versions of the data file and one holding the
+ * versions of memory, as for a whole data file, and the items left in the
+ * former are added. If the merge tool cannot be run, both versions are kept.
+ */
+static void io_merge_resolve(const char *path, struct string *theirs,
+			     struct string *ours, int todo)
+{
+	const char *arg[4];
+	char *path_theirs, *path_ours;
+	struct io_map map;
 
-	sha1_stream(data_file, apts_sha1);
-	rewind(data_file);
+	if (theirs->len == 0 && ours->len == 0)
+		return;
 
-	for (;;) {
-		is_appointment = is_event = is_recursive = 0;
-		line++;
-		scan_error = NULL;
+	asprintf(&path_theirs, "%s.conflict", path);
+	asprintf(&path_ours, "%s.conflict.new", path);
+	if (io_replace_file(path_theirs, string_buf(theirs), theirs->len) &&
+	    io_replace_file(path_ours, string_buf(ours), ours->len)) {
+		arg[0] = conf.mergetool;
+		arg[1] = path_theirs;
+		arg[2] = path_ours;
+		arg[3] = NULL;
+		wins_launch_external(arg);
+	}
 
-		c = getc(data_file);
-		if (c == EOF)
-			break;
-		ungetc(c, data_file);
+	if (io_map_file(path_theirs, &map, NULL)) {
+		io_merge_add_lines(map.data, map.len, todo);
+		io_unmap_file(&map);
+	} else {
+		io_merge_add_lines(string_buf(theirs), theirs->len, todo);
+		io_merge_add_lines(string_buf(ours), ours->len, todo);
+	}
 
-		/* Read the date first: it is common to both events
-		 * and appointments.
-		 */
-		if (fscanf(data_file, "%d / %d / %d ",
-			   &start.tm_mon, &start.tm_mday,
-			   &start.tm_year) != 3)
-			io_load_error(path_apts, line,
-				      _("syntax error in the item date"));
-
-		/* Read the next character : if it is an '@' then we have
-		 * an appointment, else if it is an '[' we have en event.
-		 */
-		c = getc(data_file);
+	unlink(path_theirs);
+	unlink(path_ours);
+	mem_free(path_theirs);
+	mem_free(path_ours);
+}
 
-		if (c == '@')
-			is_appointment = 1;
-		else if (c == '[')
-			is_event = 1;
-		else
-			io_load_error(path_apts, line,
-				      _("no event nor appointment found"));
-
-		/* Read the remaining informations. */
-		if (is_appointment) {
-			if (fscanf
-			    (data_file,
-			     " %d : %d -> %d / %d / %d @ %d : %d ",
-			     &start.tm_hour, &start.tm_min, &end.tm_mon,
-			     &end.tm_mday, &end.tm_year, &end.tm_hour,
-			     &end.tm_min) != 7)
-				io_load_error(path_apts, line,
-					      _("syntax error in item time or duration"));
-		} else if (is_event) {
-			if (fscanf(data_file, " %d ", &id) != 1
-			    || getc(data_file) != ']')
-				io_load_error(path_apts, line,
-					      _("syntax error in item identifier"));
-			while ((c = getc(data_file)) == ' ') ;
-			ungetc(c, data_file);
-		} else {
-			io_load_error(path_apts, line,
-				      _("wrong format in the appointment or event"));
-			/* NOTREACHED */
-		}
+/*
+ * Merge the items in memory with the data files, item by item. The items of
+ * the base, of memory and of the data files are counted by hash; for each
+ * item, the side that changed its count since the base wins. The data files
+ * are then loaded, and only the items whose merged count differs from the
+ * data files are added or removed, which takes time linear in the number of
+ * items.
+ *
+ * Items changed on both sides in different ways are conflicts, see
+ * io_merge_mark(). If resolve is set, they are handed to the merge tool, see
+ * io_merge_resolve(). Otherwise, the version of the data files is kept, and
+ * the lines of the versions of memory are appended to dropped.
+ *
+ * Return the number of conflicts, or -1 if there is no base, in which case
+ * nothing is changed.
+ */
+static int io_merge_items(int resolve, struct string *dropped)
+{
+	struct io_base base;
+	struct io_base_entry *e;
+	struct string apts, todo, line;
+	struct string ours[2], theirs[2];
+	llist_item_t *i;
+	unsigned k;
+	int b, l, r, target;
+	char *p, *eol, *end;
 
-		/* Check if we have a recursive item. */
-		c = getc(data_file);
-
-		if (c == '{') {
-			is_recursive = 1;
-			if (fscanf(data_file, " %d%c ", &rpt.freq, &type) != 2)
-				io_load_error(path_apts, line,
-					      _("syntax error in item repetition"));
-			else
-				rpt.type = recur_char2def(type);
-			c = getc(data_file);
-			/* Optional until date */
-			if (c == '-' && getc(data_file) == '>') {
-				if (fscanf
-				    (data_file, " %d / %d / %d ",
-				     &until.tm_mon, &until.tm_mday,
-				     &until.tm_year) != 3)
-					io_load_error(path_apts, line,
-						      _("syntax error in until date"));
-				if (!check_date(until.tm_year, until.tm_mon,
-						until.tm_mday))
-					io_load_error(path_apts, line,
-						      _("until date error"));
-				until.tm_hour = 0;
-				until.tm_min = 0;
-				until.tm_sec = 0;
-				until.tm_isdst = -1;
-				until.tm_year -= 1900;
-				until.tm_mon--;
-				rpt.until = mktime(&until);
-				c = getc(data_file);
-			} else
-				rpt.until = 0;
-			/* Optional bymonthday list */
-			if (c == 'd') {
-				if (rpt.type == RECUR_WEEKLY)
-					io_load_error(path_apts, line,
-						      _("BYMONTHDAY illegal with WEEKLY"));
-				ungetc(c, data_file);
-				recur_bymonthday(&rpt.bymonthday, data_file);
-				c = getc(data_file);
-			} else
-				LLIST_INIT(&rpt.bymonthday);
-			/* Optional bywday list */
-			if (c == 'w') {
-				ungetc(c, data_file);
-				recur_bywday(rpt.type, &rpt.bywday, data_file);
-				c = getc(data_file);
-			} else
-				LLIST_INIT(&rpt.bywday);
-			/* Optional bymonth list */
-			if (c == 'm') {
-				ungetc(c, data_file);
-				recur_bymonth(&rpt.bymonth, data_file);
-				c = getc(data_file);
-			} else
-				LLIST_INIT(&rpt.bymonth);
-			/* Optional exception dates */
-			if (c == '!') {
-				ungetc(c, data_file);
-				recur_exc_scan(&rpt.exc, data_file);
-				c = getc(data_file);
-			} else
-				LLIST_INIT(&rpt.exc);
-			/* End of recurrence rule */
-			if (c != '}')
-				io_load_error(path_apts, line,
-					      _("missing end of recurrence"));
-			while ((c = getc(data_file)) == ' ') ;
+	if (!io_base.valid || io_split_apts())
+		return -1;
+	base = io_base;
+	io_base.entry = NULL;
+	io_base_free(&io_base);
+
+	string_init(&apts);
+	string_init(&todo);
+	io_base_count_items(&base, IO_LOCAL, &apts, &todo);
+
+	/* The new base is the contents of the data files. */
+	io_load_data(NULL, FORCE);
+	if (io_base.valid) {
+		for (k = 0; k < io_base.size; k++) {
+			e = &io_base.entry[k];
+			if (e->hash)
+				io_base_add(&base, e->hash, e->key, IO_REMOTE,
+					    e->count[IO_BASE]);
+		}
+	} else {
+		if (io_archive_end > 0) {
+			pthread_mutex_lock(&io_shard_mutex);
+			io_load_archive();
+			pthread_mutex_unlock(&io_shard_mutex);
 		}
+		io_base_count_items(&base, IO_REMOTE, NULL, NULL);
+	}
 
-		/* Check if a note is attached to the item. */
-		if (c == '>') {
-			note_read(note, data_file);
-			c = getc(data_file);
-			notep = note;
-		} else
-			notep = NULL;
+	/* Compute the merged counts, stored as the difference to memory. */
+	io_conflicts = io_merge_mark(&base);
+	for (k = 0; k < base.size; k++) {
+		e = &base.entry[k];
+		if (!e->hash)
+			continue;
+		b = e->count[IO_BASE];
+		l = e->count[IO_LOCAL];
+		r = e->count[IO_REMOTE];
+		if (e->conflict)
+			target = resolve ? 0 : r;
+		else
+			target = l != b ? l : r;
+		e->count[IO_BASE] = target - r;
+	}
 
-		/*
-		 * Last: read the item description and load it into its
-		 * corresponding linked list, depending on the item type.
-		 */
-		if (is_appointment) {
-			if (c == '!')
-				state |= APOINT_NOTIFY;
-			else if (c == '|')
-				state = 0L;
-			else
-				io_load_error(path_apts, line,
-					      _("syntax error in item state"));
-
-			if (is_recursive)
-				scan_error = recur_apoint_scan(data_file, start, end, state,
-						  notep, filter, &rpt);
-			else
-				scan_error = apoint_scan(data_file, start, end, state,
-					    notep, filter);
-		} else if (is_event) {
-			ungetc(c, data_file);
-			if (is_recursive)
-				scan_error = recur_event_scan(data_file, start, id, notep,
-						 filter, &rpt);
-			else
-				scan_error = event_scan(data_file, start, id, notep, filter);
-		} else {
-			io_load_error(path_apts, line,
-				      _("wrong format in the appointment or event"));
-			/* NOTREACHED */
+	/* Remove the items the merge drops. */
+	for (k = 0; k < 2; k++) {
+		string_init(&ours[k]);
+		string_init(&theirs[k]);
+	}
+	string_init(&line);
+	LLIST_TS_LOCK(&recur_alist_p);
+	if (ui_mode == UI_CURSES)
+		LLIST_TS_LOCK(&alist_p);
+	LLIST_FOREACH(&recur_elist, i) {
+		recur_event_serialize(LLIST_GET_DATA(i), &line);
+		io_merge_drop(&base, &line, i, TYPE_RECUR_EVNT, &theirs[0]);
+	}
+	LLIST_TS_FOREACH(&recur_alist_p, i) {
+		recur_apoint_serialize(LLIST_GET_DATA(i), &line);
+		io_merge_drop(&base, &line, i, TYPE_RECUR_APPT, &theirs[0]);
+	}
+	LLIST_TS_FOREACH(&alist_p, i) {
+		apoint_serialize(LLIST_TS_GET_DATA(i), &line);
+		io_merge_drop(&base, &line, i, TYPE_APPT, &theirs[0]);
+	}
+	LLIST_FOREACH(&eventlist, i) {
+		event_serialize(LLIST_GET_DATA(i), &line);
+		io_merge_drop(&base, &line, i, TYPE_EVNT, &theirs[0]);
+	}
+	LLIST_FOREACH(&todolist, i) {
+		todo_serialize(LLIST_GET_DATA(i), &line);
+		io_merge_drop(&base, &line, i, TYPE_TODO, &theirs[1]);
+	}
+	LLIST_REMOVE_CLEARED(&recur_elist);
+	LLIST_TS_REMOVE_CLEARED(&recur_alist_p);
+	LLIST_TS_REMOVE_CLEARED(&alist_p);
+	LLIST_REMOVE_CLEARED(&eventlist);
+	LLIST_REMOVE_CLEARED(&todolist);
+	if (ui_mode == UI_CURSES)
+		LLIST_TS_UNLOCK(&alist_p);
+	LLIST_TS_UNLOCK(&recur_alist_p);
+	string_free(&line);
+
+	/*
+	 * Add the items of memory the merge keeps, and set the conflicting
+	 * ones aside.
+	 */
+	for (k = 0; k < 2; k++) {
+		struct string *s = k ? &todo : &apts;
+
+		p = string_buf(s);
+		for (end = p + s->len; p < end; p = eol + 1) {
+			eol = memchr(p, '\n', end - p);
+			e = io_base_find(&base, io_line_hash(p, eol - p));
+			if (e && e->conflict)
+				string_catn(&ours[k], p, eol - p + 1);
+			if (!e || e->count[IO_BASE] <= 0)
+				continue;
+			e->count[IO_BASE]--;
+			io_merge_add_lines(p, eol - p, k);
 		}
-		if (scan_error)
-			io_load_error(path_apts, line, scan_error);
 	}
-	file_close(data_file, __FILE_POS__);
-}
 
-/* Load the todo data */
-void io_load_todo(struct item_filter *filter)
-{
-	FILE *data_file;
-	char *newline;
-	int c, id, completed, cond;
-	char buf[BUFSIZ], e_todo[BUFSIZ], note[MAX_NOTESIZ + 1];
-	unsigned line = 0;
+	if (resolve) {
+		io_merge_resolve(path_apts, &theirs[0], &ours[0], 0);
+		io_merge_resolve(path_todo, &theirs[1], &ours[1], 1);
+	} else if (dropped) {
+		string_catn(dropped, string_buf(&ours[0]), ours[0].len);
+		string_catn(dropped, string_buf(&ours[1]), ours[1].len);
+	}
 
-	data_file = fopen(path_todo, "r");
-	EXIT_IF(data_file == NULL, _("failed to open todo file"));
+	for (k = 0; k < 2; k++) {
+		string_free(&ours[k]);
+		string_free(&theirs[k]);
+	}
+	string_free(&apts);
+	string_free(&todo);
+	io_base_free(&base);
+	io_set_modified();
+	return io_conflicts;
+}
 
-	sha1_stream(data_file, todo_sha1);
-	rewind(data_file);
+/* Number of conflicts in the last merge. */
+int io_merge_conflicts(void)
+{
+	return io_conflicts;
+}
 
-	for (;;) {
-		line++;
-		c = getc(data_file);
-		if (c == EOF) {
-			break;
-		} else if (c == '[') {
-			/* new style with id */
-			c = getc(data_file);
-			if (c == '-') {
-				completed = 1;
-			} else {
-				completed = 0;
-				ungetc(c, data_file);
-			}
-			if (fscanf(data_file, " %d ", &id) != 1
-			    || getc(data_file) != ']')
-				io_load_error(path_todo, line,
-					      _("syntax error in item identifier"));
-			while ((c = getc(data_file)) == ' ') ;
-			ungetc(c, data_file);
-		} else {
-			id = 9;
-			completed = 0;
-			ungetc(c, data_file);
-		}
-		/* Now read the attached note, if any. */
-		c = getc(data_file);
-		if (c == '>') {
-			note_read(note, data_file);
-		} else {
-			note[0] = '\0';
-			ungetc(c, data_file);
-		}
-		/* Then read todo description. */
-		if (!fgets(buf, sizeof buf, data_file))
-			buf[0] = '\0';
-		newline = strchr(buf, '\n');
-		if (newline)
-			*newline = '\0';
-		io_extract_data(e_todo, buf, sizeof buf);
+/* Record the items loaded in batch mode as the base of a merge on save. */
+void io_batch_base(void)
+{
+	io_base_record_items(&io_base, 1);
+}
 
-		/* Filter item. */
-		struct todo *todo = NULL;
-		if (filter) {
-			cond = (
-				!(filter->type_mask & TYPE_MASK_TODO) ||
-				(filter->regex && regexec(filter->regex, e_todo, 0, 0, 0)) ||
-				(filter->priority && id != filter->priority) ||
-				(filter->completed && !completed) ||
-				(filter->uncompleted && completed)
-			);
-			if (filter->hash) {
-				todo = todo_add(e_todo, id, completed, note);
-				char *hash = todo_hash(todo);
-				cond = cond || !hash_matches(filter->hash, hash);
-				mem_free(hash);
-			}
+/*
+ * Save the data files in batch mode. Changes made to the data files since
+ * they were loaded or saved are merged first, see io_merge_items(); the lines
+ * of the items of memory dropped in conflicts are appended to dropped. Return
+ * 0 if the data files could not be written, 2 if the items in memory were
+ * replaced by a merge, and 1 otherwise.
+ */
+int io_save_batch(struct string *dropped)
+{
+	int new, ret = 1;
 
-			if ((!filter->invert && cond) || (filter->invert && !cond)) {
-				if (filter->hash)
-					todo_delete(todo);
-				continue;
-			}
-		}
+	if ((new = new_data()) == NOKNOW)
+		return 0;
+	if (new && io_merge_items(0, dropped) >= 0)
+		ret = 2;
 
-		if (!todo)
-			todo = todo_add(e_todo, id, completed, note);
-	}
-	file_close(data_file, __FILE_POS__);
+	if (!io_save_todo(path_todo, todo_sum) ||
+	    !io_save_apts(path_apts, apts_sum))
+		return 0;
+	journal_reset(JOURNAL_APTS);
+	journal_reset(JOURNAL_TODO);
+	io_stamp_files();
+	io_batch_base();
+	return ret;
 }
 
 /*
@@ -845,7 +3675,7 @@ int io_load_data(struct item_filter *filter, int force)
 	if (force == NOKNOW)
 		goto exit;
 
-	if (force & APTS) {
+	if ((force & APTS) && (filter || !io_reload_app())) {
 		apoint_llist_free();
 		event_llist_free();
 		recur_apoint_llist_free();
@@ -856,18 +3686,84 @@ int io_load_data(struct item_filter *filter, int force)
 		recur_event_llist_init();
 		io_load_app(filter);
 	}
-	if (force & TODO) {
+	if ((force & TODO) && (filter || !io_reload_todo())) {
 		todo_free_list();
 		todo_init_list();
 		io_load_todo(filter);
 	}
 
 	io_unset_modified();
+	/* Changes merged from a journal that did not apply must be saved. */
+	if (journal_orphaned(JOURNAL_APTS) || journal_orphaned(JOURNAL_TODO))
+		io_set_modified();
+	if (filter)
+		io_base_free(&io_base);
+	else
+		io_base_record();
    exit:
 	run_hook("post-load");
 	return force;
 }
 
+/* Check whether the data files differ from what was last loaded or saved. */
+int io_data_changed(void)
+{
+	int new;
+
+	io_mutex_lock();
+	new = new_data();
+	io_mutex_unlock();
+
+	/* Files that are missing are probably being replaced. */
+	return new != NONEW && new != NOKNOW;
+}
+
+/*
+ * Drop the loaded items that do not pass a filter, as if the data had been
+ * loaded with it.
+ */
+void io_filter_data(struct item_filter *filter)
+{
+	llist_item_t *i;
+
+	for (i = LLIST_FIRST(&recur_elist); i; i = LLIST_NEXT(i)) {
+		if (!recur_event_filter(i->data, filter)) {
+			recur_event_free(i->data);
+			i->data = NULL;
+		}
+	}
+	for (i = LLIST_TS_FIRST(&recur_alist_p); i; i = LLIST_NEXT(i)) {
+		if (!recur_apoint_filter(i->data, filter)) {
+			recur_apoint_free(i->data);
+			i->data = NULL;
+		}
+	}
+	for (i = LLIST_TS_FIRST(&alist_p); i; i = LLIST_NEXT(i)) {
+		if (!apoint_filter(i->data, filter)) {
+			apoint_free(i->data);
+			i->data = NULL;
+		}
+	}
+	for (i = LLIST_FIRST(&eventlist); i; i = LLIST_NEXT(i)) {
+		if (!event_filter(i->data, filter)) {
+			event_free(i->data);
+			i->data = NULL;
+		}
+	}
+	for (i = LLIST_FIRST(&todolist); i; i = LLIST_NEXT(i)) {
+		if (!todo_filter(i->data, filter)) {
+			todo_free(i->data);
+			i->data = NULL;
+		}
+	}
+
+	LLIST_REMOVE_CLEARED(&recur_elist);
+	LLIST_TS_REMOVE_CLEARED(&recur_alist_p);
+	LLIST_TS_REMOVE_CLEARED(&alist_p);
+	LLIST_REMOVE_CLEARED(&eventlist);
+	LLIST_REMOVE_CLEARED(&todolist);
+}
+
 /*
  * The return codes reflect the user choice in case of unsaved in-memory changes.
  */
@@ -895,9 +3791,11 @@ int io_reload_data(void)
 			ret = IO_RELOAD_CTINUE;
 			break;
 		case 2:
+			ret = IO_RELOAD_MERGE;
+			if (io_merge_items(1, NULL) >= 0)
+				goto cleanup;
 			io_merge_data();
 			load = FORCE;
-			ret = IO_RELOAD_MERGE;
 			break;
 		case 3:
 			ret = IO_RELOAD_CANCEL;
@@ -1232,6 +4130,16 @@ void io_export_data(enum export_type type, int export_uid)
 	if (stream == NULL)
 		return;
 
+	/* Years that have not been looked at are exported as well. */
+	if (io_shard_on_demand) {
+		if (conf.year_shards)
+			io_load_all_shards();
+		pthread_mutex_lock(&io_shard_mutex);
+		if (io_archive_end > 0)
+			io_load_archive();
+		pthread_mutex_unlock(&io_shard_mutex);
+	}
+
 	if (type == IO_EXPORT_ICAL)
 		ical_export_data(stream, export_uid);
 	else if (type == IO_EXPORT_PCAL)
@@ -1278,9 +4186,9 @@ static FILE *get_import_stream(enum import_type type, char **stream_name)
  * and is cleared at the end.
  */
 int  io_import_data(enum import_type type, char *stream_name,
-		    const char *fmt_ev, const char *fmt_rev,
-		    const char *fmt_apt, const char *fmt_rapt,
-		    const char *fmt_todo)
+		    const struct format *fmt_ev, const struct format *fmt_rev,
+		    const struct format *fmt_apt, const struct format *fmt_rapt,
+		    const struct format *fmt_todo)
 {
 	const char *proc_report =
 	    _("Import process report: %04d lines read");
@@ -1453,45 +4361,269 @@ void io_log_free(struct io_file *log)
 	mem_free(log);
 }
 
+/*
+ * Periodic saves are driven by the edits: io_set_modified() counts them and
+ * wakes the thread, which otherwise sleeps without a timeout. Once an edit has
+ * been made, the data are saved 'periodic_save' minutes later at the latest,
+ * earlier if no further edit has been made for 'periodic_save_idle' seconds or
+ * if 'periodic_save_edits' edits have accumulated, so that bursts of edits are
+ * written at once.
+ */
+static pthread_cond_t io_psave_cond = PTHREAD_COND_INITIALIZER;
+static unsigned io_psave_edits;
+static unsigned io_psave_resets;
+static time_t io_psave_first, io_psave_last;
+static int io_psave_stop;
+
+/* Record an edit for the periodic save. */
+static void io_psave_edit(void)
+{
+	time_t t = time(NULL);
+
+	pthread_mutex_lock(&io_periodic_save_mutex);
+	if (io_psave_edits++ == 0)
+		io_psave_first = t;
+	io_psave_last = t;
+	pthread_cond_signal(&io_psave_cond);
+	pthread_mutex_unlock(&io_periodic_save_mutex);
+}
+
+/* Time at which the pending edits are due to be saved, 0 for right away. */
+static time_t io_psave_deadline(void)
+{
+	time_t deadline = io_psave_first + conf.periodic_save * MININSEC;
+
+	if (conf.periodic_save_edits > 0 &&
+	    io_psave_edits >= conf.periodic_save_edits)
+		return 0;
+	if (conf.periodic_save_idle > 0 &&
+	    io_psave_last + (time_t)conf.periodic_save_idle < deadline)
+		deadline = io_psave_last + conf.periodic_save_idle;
+
+	return deadline;
+}
+
 /* Thread used to periodically save data. */
 static void *io_psave_thread(void *arg)
 {
-	int delay = conf.periodic_save;
-	EXIT_IF(delay < 0, _("Invalid delay"));
 	char *mesg = _("Periodic save cancelled. Data files have changed. "
 		     "Save and merge interactively");
+	struct timespec ts;
+	unsigned edits, resets;
+	int ret;
 
-	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-	for (;;) {
-		sleep(delay * MININSEC);
-		pthread_mutex_lock(&io_periodic_save_mutex);
-		if (io_save_cal(periodic) == IO_SAVE_CANCEL)
-			que_ins(mesg, now(), 2);
+	pthread_mutex_lock(&io_periodic_save_mutex);
+	while (!io_psave_stop) {
+		if (io_psave_edits == 0) {
+			pthread_cond_wait(&io_psave_cond,
+					  &io_periodic_save_mutex);
+			continue;
+		}
+
+		ts.tv_sec = io_psave_deadline();
+		ts.tv_nsec = 0;
+		if (ts.tv_sec > time(NULL)) {
+			pthread_cond_timedwait(&io_psave_cond,
+					       &io_periodic_save_mutex, &ts);
+			continue;
+		}
+
+		edits = io_psave_edits;
+		resets = io_psave_resets;
 		pthread_mutex_unlock(&io_periodic_save_mutex);
+		ret = io_save_cal(periodic);
+		if (ret == IO_SAVE_CANCEL)
+			que_ins(mesg, now(), 2);
+		pthread_mutex_lock(&io_periodic_save_mutex);
+
+		/*
+		 * Edits made after the data were saved are left pending. A
+		 * save that did not succeed is retried after the next edit.
+		 */
+		if (io_psave_resets == resets)
+			io_psave_edits -= edits;
+		io_psave_first = io_psave_last;
 	}
+	pthread_mutex_unlock(&io_periodic_save_mutex);
+
+	return NULL;
 }
 
 /* Launch the thread which handles periodic saves. */
 void io_start_psave_thread(void)
 {
-	pthread_create(&io_t_psave, NULL, io_psave_thread, NULL);
+	pthread_mutex_lock(&io_periodic_save_mutex);
+	io_psave_stop = 0;
+	pthread_mutex_unlock(&io_periodic_save_mutex);
+
+	/* Changes made before are saved like new ones. */
+	if (io_get_modified())
+		io_psave_edit();
+
+	if (pthread_create(&io_t_psave, NULL, io_psave_thread, NULL) != 0)
+		io_t_psave = pthread_self();
 }
 
-/* Stop periodic data saves. */
+/* Stop periodic data saves, letting a save in progress complete. */
 void io_stop_psave_thread(void)
 {
 	/* Is the thread running? */
 	if (pthread_equal(io_t_psave, pthread_self()))
 		return;
 
-	/* Lock the mutex to avoid cancelling the thread during saving. */
 	pthread_mutex_lock(&io_periodic_save_mutex);
-	pthread_cancel(io_t_psave);
-	pthread_join(io_t_psave, NULL);
+	io_psave_stop = 1;
+	pthread_cond_signal(&io_psave_cond);
 	pthread_mutex_unlock(&io_periodic_save_mutex);
+	pthread_join(io_t_psave, NULL);
 	io_t_psave = pthread_self();
 }
 
+#ifdef HAVE_SYS_INOTIFY_H
+static int io_watch_fd = -1, io_watch_shards = -1;
+static pthread_t io_watch_target;
+
+/* Watch the directory containing a data file. */
+static int io_watch_dir(const char *path)
+{
+	char *dir = mem_strdup(path), *slash = strrchr(dir, '/');
+	int ret;
+
+	if (slash == dir)
+		slash[1] = '\0';
+	else if (slash)
+		*slash = '\0';
+	ret = inotify_add_watch(io_watch_fd, slash ? dir : ".",
+				IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE |
+				IN_DELETE) >= 0;
+	mem_free(dir);
+
+	return ret;
+}
+
+/*
+ * Check whether an event concerns a data file, its journal, the archive or a
+ * shard.
+ */
+static int io_watch_match(const struct inotify_event *ev)
+{
+	const char *paths[] = { path_apts, path_todo };
+	const char *base;
+	size_t len;
+	int i;
+
+	if (ev->mask & IN_Q_OVERFLOW)
+		return 1;
+	if (ev->len == 0)
+		return 0;
+
+	if (ev->wd == io_watch_shards) {
+		for (base = ev->name; isdigit((unsigned char)*base); base++) ;
+		return base != ev->name && *base == '\0';
+	}
+
+	for (i = 0; i < 2; i++) {
+		base = strrchr(paths[i], '/');
+		base = base ? base + 1 : paths[i];
+		len = strlen(base);
+		if (!strncmp(ev->name, base, len) &&
+		    (ev->name[len] == '\0' ||
+		     !strcmp(ev->name + len, JOURNAL_EXT) ||
+		     !strcmp(ev->name + len, ARCHIVE_EXT)))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Thread waiting for changes to the data files. Once a burst of changes is
+ * over, the thread that started the watcher is sent SIGUSR1 if the contents
+ * changed, which triggers the usual reload. Changes made by calcurse itself
+ * are recognized by their hashes.
+ */
+static void *io_watch_thread(void *arg)
+{
+	union {
+		struct inotify_event ev;
+		char buf[4096];
+	} u;
+	const struct inotify_event *ev;
+	struct pollfd pfd;
+	int pending = 0, n;
+	ssize_t len;
+	char *p;
+
+	pfd.fd = io_watch_fd;
+	pfd.events = POLLIN;
+	for (;;) {
+		n = poll(&pfd, 1, pending ? IO_WATCH_DELAY : -1);
+		if (n < 0 && errno != EINTR)
+			break;
+		if (n == 0) {
+			pending = 0;
+			pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+			if (io_data_changed())
+				pthread_kill(io_watch_target, SIGUSR1);
+			pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		}
+		if (n <= 0)
+			continue;
+
+		if ((len = read(io_watch_fd, u.buf, sizeof(u.buf))) <= 0)
+			continue;
+		for (p = u.buf; p < u.buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)p;
+			if (io_watch_match(ev))
+				pending = 1;
+		}
+	}
+
+	return NULL;
+}
+#endif
+
+/*
+ * Launch the thread which reloads the data files when they are changed by
+ * another program. This does nothing on systems without inotify.
+ */
+void io_start_watch_thread(void)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	if ((io_watch_fd = inotify_init1(IN_CLOEXEC)) < 0)
+		return;
+	io_watch_target = pthread_self();
+	if (conf.year_shards || io_dir_exists(path_shards)) {
+		io_make_shard_dir();
+		io_watch_shards = inotify_add_watch(io_watch_fd, path_shards,
+						    IN_CLOSE_WRITE |
+						    IN_MOVED_TO | IN_DELETE);
+	}
+	if (!io_watch_dir(path_apts) || !io_watch_dir(path_todo) ||
+	    pthread_create(&io_t_watch, NULL, io_watch_thread, NULL) != 0) {
+		close(io_watch_fd);
+		io_watch_fd = -1;
+		io_t_watch = pthread_self();
+	}
+#endif
+}
+
+/* Stop reloading the data files automatically. */
+void io_stop_watch_thread(void)
+{
+	/* Is the thread running? */
+	if (pthread_equal(io_t_watch, pthread_self()))
+		return;
+
+	pthread_cancel(io_t_watch);
+	pthread_join(io_t_watch, NULL);
+	io_t_watch = pthread_self();
+#ifdef HAVE_SYS_INOTIFY_H
+	close(io_watch_fd);
+	io_watch_fd = -1;
+#endif
+}
+
 /*
  * This sets a lock file to prevent from having two different instances of
  * calcurse running.
@@ -1579,29 +4711,21 @@ unsigned io_get_pid(char *file)
 }
 
 /*
- * Check whether two files are equal.
+ * Check whether two files are equal, by their sizes and checksums.
  */
 int io_files_equal(const char *file1, const char *file2)
 {
-	FILE *fp1, *fp2;
-	int ret = 0;
+	char sum1[CHECKSUM_LEN * 2 + 1], sum2[CHECKSUM_LEN * 2 + 1];
+	struct stat st1, st2;
 
 	if (!file1 || !file2)
 		return 0;
+	if (stat(file1, &st1) != 0 || stat(file2, &st2) != 0 ||
+	    st1.st_size != st2.st_size)
+		return 0;
 
-	fp1 = fopen(file1, "rb");
-	fp2 = fopen(file2, "rb");
-
-	while (!feof(fp1) && !feof(fp2)) {
-		if (fgetc(fp1) != fgetc(fp2))
-			goto cleanup;
-	}
-
-	ret = 1;
-cleanup:
-	fclose(fp1);
-	fclose(fp2);
-	return ret;
+	return io_compute_hash(file1, sum1, &st1) &&
+	       io_compute_hash(file2, sum2, &st2) && !strcmp(sum1, sum2);
 }
 
 /*
@@ -1638,11 +4762,18 @@ int io_file_cp(const char *src, const char *dst)
 void io_unset_modified(void)
 {
 	modified = 0;
+
+	/* There is nothing left for the periodic save to do. */
+	pthread_mutex_lock(&io_periodic_save_mutex);
+	io_psave_edits = 0;
+	io_psave_resets++;
+	pthread_mutex_unlock(&io_periodic_save_mutex);
 }
 
 void io_set_modified(void)
 {
 	modified = 1;
+	io_psave_edit();
 }
 
 int io_get_modified(void)
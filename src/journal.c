@@ -0,0 +1,744 @@
+/*
+ * Calcurse - text-based organizer
+ *
+ * Copyright (c) 2004-2020 calcurse Development Team <misc@calcurse.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the
+ *        following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the
+ *        following disclaimer in the documentation and/or other
+ *        materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Send your feedback or comments to : misc@calcurse.org
+ * Calcurse home page : http://calcurse.org
+ *
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "calcurse.h"
+#include "checksum.h"
+#include "sha1.h"
+
+/*
+ * Change journals of the data files.
+ *
+ * In journal mode, saving does not rewrite the data files. Instead, the
+ * differences between the items in memory and the lines of a data file are
+ * appended to a journal next to it, one record per line:
+ *
+ *   +<line>   add an item, given by its line in the data file
+ *   -<hash>   delete an item, given by the SHA1 hash of its line
+ *
+ * Editing an item, adding an exception to it or flagging it changes its line
+ * and is recorded as a deletion followed by an addition. The hashes are the
+ * ones used by --filter-hash.
+ *
+ * The first line of a journal holds the checksum of the data file it applies
+ * to. Once the journal has been folded into the data file, it is removed.
+ *
+ * If the data file has been rewritten by other means (a text editor, another
+ * program or a restore), the journal no longer matches it. Since it holds
+ * changes that were saved, it is not dropped: its records are merged item by
+ * item into the data file as if they were unsaved changes, deletions applying
+ * to the lines that are still there and additions to the lines that are not.
+ * The journal is kept with a `.orphan` suffix once the merged items are saved.
+ *
+ * Loading replays the journal over the data file. To compute the records, the
+ * hashes of the lines of the data file (with the journal applied) are kept in
+ * an index.
+ */
+
+#define JOURNAL_MAGIC		"calcurse-journal "
+#define JOURNAL_ORPHAN_EXT	".orphan"
+#define JOURNAL_INDEX_MIN	1024
+
+struct journal_entry {
+	uint8_t digest[SHA1_DIGESTLEN];
+	uint8_t used;
+	int count;		/* lines with that hash */
+	int aux;		/* items with that hash, when comparing */
+};
+
+/* Multiset of line hashes, using open addressing. */
+struct journal_index {
+	struct journal_entry *entry;
+	size_t size;		/* a power of two */
+	size_t used;
+};
+
+struct journal {
+	struct journal_index index;
+	int indexed;		/* the index matches the files */
+	int valid;		/* the journal applies to the data file */
+	char *orphan;		/* path of a journal that does not apply */
+	char sum[CHECKSUM_LEN * 2 + 1];		/* empty if there is none */
+	struct io_stamp stamp;
+	off_t size;
+};
+
+static struct journal journal[JOURNAL_TODO + 1];
+
+static char *journal_path(const char *path)
+{
+	char *jpath;
+
+	asprintf(&jpath, "%s%s", path, JOURNAL_EXT);
+	return jpath;
+}
+
+static void journal_digest(const char *s, size_t len, uint8_t *digest)
+{
+	sha1_ctx_t ctx;
+
+	sha1_init(&ctx);
+	sha1_update(&ctx, (const uint8_t *)s, len);
+	sha1_final(&ctx, digest);
+}
+
+static int journal_hexval(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+static int journal_parse_digest(const char *s, uint8_t *digest)
+{
+	int i, hi, lo;
+
+	for (i = 0; i < SHA1_DIGESTLEN; i++) {
+		if ((hi = journal_hexval(s[2 * i])) < 0 ||
+		    (lo = journal_hexval(s[2 * i + 1])) < 0)
+			return 0;
+		digest[i] = hi << 4 | lo;
+	}
+
+	return s[2 * SHA1_DIGESTLEN] == '\0';
+}
+
+static void journal_index_free(struct journal_index *idx)
+{
+	if (idx->entry)
+		mem_free(idx->entry);
+	idx->entry = NULL;
+	idx->size = idx->used = 0;
+}
+
+static struct journal_entry *journal_index_get(struct journal_index *,
+						const uint8_t *, int);
+
+/* Double the size of an index, dropping the entries that are not needed. */
+static void journal_index_grow(struct journal_index *idx)
+{
+	struct journal_index old = *idx;
+	struct journal_entry *e;
+	size_t i;
+
+	idx->size = old.size ? old.size * 2 : JOURNAL_INDEX_MIN;
+	idx->entry = mem_calloc(idx->size, sizeof(struct journal_entry));
+	idx->used = 0;
+
+	for (i = 0; i < old.size; i++) {
+		if (!old.entry[i].used ||
+		    (old.entry[i].count == 0 && old.entry[i].aux == 0))
+			continue;
+		e = journal_index_get(idx, old.entry[i].digest, 1);
+		e->count = old.entry[i].count;
+		e->aux = old.entry[i].aux;
+	}
+
+	if (old.entry)
+		mem_free(old.entry);
+}
+
+/* Look up a hash, adding it to the index if create is set. */
+static struct journal_entry *journal_index_get(struct journal_index *idx,
+						const uint8_t *digest,
+						int create)
+{
+	struct journal_entry *e;
+	uint32_t h;
+	size_t i, mask;
+
+	if (create && (idx->used + 1) * 4 > idx->size * 3)
+		journal_index_grow(idx);
+	if (!idx->size)
+		return NULL;
+
+	memcpy(&h, digest, sizeof(h));
+	mask = idx->size - 1;
+	for (i = h & mask;; i = (i + 1) & mask) {
+		e = &idx->entry[i];
+		if (!e->used)
+			break;
+		if (!memcmp(e->digest, digest, SHA1_DIGESTLEN))
+			return e;
+	}
+	if (!create)
+		return NULL;
+
+	memcpy(e->digest, digest, SHA1_DIGESTLEN);
+	e->used = 1;
+	e->count = e->aux = 0;
+	idx->used++;
+
+	return e;
+}
+
+/*
+ * Apply the records of a journal, starting at next, to the contents of its
+ * data file. If there are any, the contents are replaced with the result.
+ * Records only depend on the number of lines with a given hash, so they can
+ * be summed up first. If idx is not NULL, the resulting lines are added to
+ * it. The journal may be NULL to only build the index. If merge is set, lines
+ * that are already in the data file are not added again.
+ */
+static void journal_apply(struct io_map *map, struct io_map *jmap, char *next,
+			  struct journal_index *idx, int merge)
+{
+	struct journal_index delta = { NULL, 0, 0 };
+	struct journal_entry *e;
+	uint8_t digest[SHA1_DIGESTLEN];
+	char **add = NULL, *line, *p, *eol, *end, *buf = NULL;
+	size_t nadd = 0, records = 0, len = 0, n, i;
+
+	while (jmap && (line = io_map_getline(jmap, &next))) {
+		if (*line == '+') {
+			line++;
+			journal_digest(line, strlen(line), digest);
+			journal_index_get(&delta, digest, 1)->count++;
+			if (!add)
+				add = mem_malloc(sizeof(char *));
+			else if (!(nadd & (nadd - 1)))
+				add = mem_realloc(add, nadd * 2,
+						  sizeof(char *));
+			add[nadd++] = line;
+		} else if (*line == '-' &&
+			   journal_parse_digest(line + 1, digest)) {
+			journal_index_get(&delta, digest, 1)->count--;
+		} else {
+			continue;
+		}
+		records++;
+	}
+
+	if (records) {
+		n = map->len + 1;
+		for (i = 0; i < nadd; i++)
+			n += strlen(add[i]) + 1;
+		buf = mem_malloc(n + 1);
+	} else if (!idx) {
+		return;
+	}
+
+	/* Lines of the data file, less the deleted ones. */
+	p = map->data;
+	end = map->len ? map->data + map->len : p;
+	for (; p < end; p = eol ? eol + 1 : end) {
+		eol = memchr(p, '\n', end - p);
+		n = eol ? (size_t)(eol - p) : (size_t)(end - p);
+		journal_digest(p, n, digest);
+		if (records && (e = journal_index_get(&delta, digest, 0))) {
+			if (e->count < 0) {
+				e->count++;
+				continue;
+			}
+			if (merge && e->count > 0)
+				e->count--;
+		}
+		if (records) {
+			memcpy(buf + len, p, n);
+			len += n;
+			buf[len++] = '\n';
+		}
+		if (idx)
+			journal_index_get(idx, digest, 1)->count++;
+	}
+
+	/* Added lines, in the order of the journal. */
+	for (i = 0; i < nadd; i++) {
+		n = strlen(add[i]);
+		journal_digest(add[i], n, digest);
+		e = journal_index_get(&delta, digest, 0);
+		if (!e || e->count <= 0)
+			continue;
+		e->count--;
+		memcpy(buf + len, add[i], n);
+		len += n;
+		buf[len++] = '\n';
+		if (idx)
+			journal_index_get(idx, digest, 1)->count++;
+	}
+
+	if (records) {
+		buf[len] = '\0';
+		io_unmap_file(map);
+		map->data = buf;
+		map->len = len;
+	}
+
+	if (add)
+		mem_free(add);
+	journal_index_free(&delta);
+}
+
+/*
+ * Check whether the first line of a journal refers to a data file, given by
+ * its contents and checksum. Older journals refer to the data file by its
+ * SHA1 hash instead.
+ */
+static int journal_header_valid(const char *line, const char *sum,
+				struct io_map *map)
+{
+	char sha1[SHA1_DIGESTLEN * 2 + 1];
+	const uint8_t *p = (const uint8_t *)map->data;
+	size_t left = map->len, n;
+	sha1_ctx_t ctx;
+
+	if (!line || !starts_with(line, JOURNAL_MAGIC))
+		return 0;
+	line += strlen(JOURNAL_MAGIC);
+	if (strlen(line) != SHA1_DIGESTLEN * 2)
+		return !strcmp(line, sum);
+
+	sha1_init(&ctx);
+	for (; left > 0; p += n, left -= n) {
+		n = left < UINT_MAX ? left : UINT_MAX;
+		sha1_update(&ctx, p, n);
+	}
+	sha1_final_hex(&ctx, sha1);
+
+	return !strcmp(line, sha1);
+}
+
+/* Forget what is known about the journal of a data file. */
+void journal_clear(enum journal_type type)
+{
+	struct journal *j = &journal[type];
+
+	journal_index_free(&j->index);
+	j->indexed = 0;
+	j->valid = 0;
+	if (j->orphan)
+		mem_free(j->orphan);
+	j->orphan = NULL;
+	j->sum[0] = '\0';
+	io_stamp_clear(&j->stamp);
+	j->size = 0;
+}
+
+/* Check whether a data file has a journal. */
+int journal_exists(const char *path)
+{
+	char *jpath = journal_path(path);
+	int ret = access(jpath, F_OK) == 0;
+
+	mem_free(jpath);
+	return ret;
+}
+
+/*
+ * Move a journal that does not apply to its data file out of the way, after
+ * its changes have been merged and saved. An older one is appended to.
+ */
+static void journal_set_aside(struct journal *j)
+{
+	struct io_map jmap;
+	char *opath;
+	FILE *fp;
+	int ret = 0;
+
+	asprintf(&opath, "%s%s", j->orphan, JOURNAL_ORPHAN_EXT);
+	if (access(opath, F_OK) != 0) {
+		ret = rename(j->orphan, opath) == 0;
+	} else if (io_map_file(j->orphan, &jmap, NULL)) {
+		if ((fp = fopen(opath, "a"))) {
+			fwrite(jmap.data, 1, jmap.len, fp);
+			ret = !ferror(fp);
+			ret = fclose(fp) == 0 && ret;
+		}
+		io_unmap_file(&jmap);
+		ret = ret && unlink(j->orphan) == 0;
+	}
+	if (!ret)
+		WARN_MSG(_("Could not move journal %s to %s: %s"), j->orphan,
+			 opath, strerror(errno));
+	mem_free(opath);
+	mem_free(j->orphan);
+	j->orphan = NULL;
+}
+
+/*
+ * Replay the journal of a data file over its contents, which have been mapped
+ * by the caller; sum is the checksum of the data file. If the journal holds any
+ * records, the mapping is replaced with the resulting contents. If index is
+ * set, the lines are recorded so that changes can later be saved to the
+ * journal. A journal that does not apply to the data file is merged into the
+ * contents, but not into the index, so that its changes are saved again.
+ */
+void journal_replay(enum journal_type type, const char *path,
+		    struct io_map *map, const char *sum, int index)
+{
+	struct journal *j = &journal[type];
+	struct io_map jmap;
+	char *jpath = journal_path(path), *next = NULL;
+	int found;
+
+	journal_clear(type);
+
+	if ((found = io_map_file(jpath, &jmap, j->sum))) {
+		io_stamp_set(&j->stamp, &jmap.st);
+		j->size = jmap.len;
+		next = jmap.data;
+		j->valid = journal_header_valid(io_map_getline(&jmap, &next),
+						sum, map);
+	}
+
+	journal_apply(map, j->valid ? &jmap : NULL, next,
+		      index ? &j->index : NULL, 0);
+	j->indexed = index;
+
+	if (found && !j->valid) {
+		WARN_MSG(_("%s does not match %s, its changes were merged"),
+			 jpath, path);
+		journal_apply(map, &jmap, next, NULL, 1);
+		j->orphan = jpath;
+		jpath = NULL;
+	}
+
+	if (found)
+		io_unmap_file(&jmap);
+	if (jpath)
+		mem_free(jpath);
+}
+
+/* Check whether a journal that does not apply to its data file was merged. */
+int journal_orphaned(enum journal_type type)
+{
+	return journal[type].orphan != NULL;
+}
+
+/* Check whether the journal of a data file changed since it was last read. */
+int journal_changed(enum journal_type type, const char *path)
+{
+	struct journal *j = &journal[type];
+	char sum[CHECKSUM_LEN * 2 + 1] = "";
+	char *jpath = journal_path(path);
+	struct stat st;
+	FILE *fp;
+	int ret;
+
+	if (stat(jpath, &st) == 0 && io_stamp_match(&j->stamp, &st)) {
+		mem_free(jpath);
+		return 0;
+	}
+
+	if ((fp = fopen(jpath, "r"))) {
+		if (fstat(fileno(fp), &st) == 0)
+			checksum_stream(fp, sum);
+		fclose(fp);
+	}
+	mem_free(jpath);
+
+	ret = strcmp(sum, j->sum) != 0;
+	if (!ret && sum[0])
+		io_stamp_set(&j->stamp, &st);
+	return ret;
+}
+
+/* Check whether changes to a data file can be saved to its journal. */
+int journal_indexed(enum journal_type type)
+{
+	return journal[type].indexed;
+}
+
+/* Size of the journal of a data file, as of the last load or save. */
+off_t journal_size(enum journal_type type)
+{
+	return journal[type].size;
+}
+
+/*
+ * Compare a serialized item with the lines of the data file, and empty the
+ * line buffer for the next item. If it is not found, a record adding it is
+ * appended to add.
+ */
+static void journal_diff_item(struct journal_index *idx, struct string *line,
+			      struct string *add)
+{
+	uint8_t digest[SHA1_DIGESTLEN];
+	struct journal_entry *e;
+
+	journal_digest(string_buf(line), line->len, digest);
+	e = journal_index_get(idx, digest, 1);
+	if (++e->aux > e->count && add) {
+		string_catc(add, '+');
+		string_catn(add, string_buf(line), line->len);
+		string_catc(add, '\n');
+	}
+	line->len = 0;
+}
+
+/*
+ * Compare the items in memory with the lines of a data file and its journal,
+ * and update the index to match the items. Unless add and del are NULL, the
+ * records needed to bring the files up to date are appended to them.
+ */
+static void journal_diff(enum journal_type type, struct string *add,
+			 struct string *del)
+{
+	struct journal_index *idx = &journal[type].index;
+	struct journal_entry *e;
+	struct string line;
+	llist_item_t *i;
+	size_t k;
+	int n, b;
+
+	string_init(&line);
+	if (type == JOURNAL_APTS) {
+		LLIST_FOREACH(&recur_elist, i) {
+			struct recur_event *rev = LLIST_GET_DATA(i);
+			recur_event_serialize(rev, &line);
+			journal_diff_item(idx, &line, add);
+		}
+
+		LLIST_TS_LOCK(&recur_alist_p);
+		LLIST_TS_FOREACH(&recur_alist_p, i) {
+			struct recur_apoint *rapt = LLIST_GET_DATA(i);
+			recur_apoint_serialize(rapt, &line);
+			journal_diff_item(idx, &line, add);
+		}
+		LLIST_TS_UNLOCK(&recur_alist_p);
+
+		if (ui_mode == UI_CURSES)
+			LLIST_TS_LOCK(&alist_p);
+		LLIST_TS_FOREACH(&alist_p, i) {
+			struct apoint *apt = LLIST_TS_GET_DATA(i);
+			apoint_serialize(apt, &line);
+			journal_diff_item(idx, &line, add);
+		}
+		if (ui_mode == UI_CURSES)
+			LLIST_TS_UNLOCK(&alist_p);
+
+		LLIST_FOREACH(&eventlist, i) {
+			struct event *ev = LLIST_TS_GET_DATA(i);
+			event_serialize(ev, &line);
+			journal_diff_item(idx, &line, add);
+		}
+	} else {
+		LLIST_FOREACH(&todolist, i) {
+			struct todo *todo = LLIST_TS_GET_DATA(i);
+			todo_serialize(todo, &line);
+			journal_diff_item(idx, &line, add);
+		}
+	}
+	string_free(&line);
+
+	/* Lines that are left over belong to deleted items. */
+	for (k = 0; k < idx->size; k++) {
+		e = &idx->entry[k];
+		if (!e->used)
+			continue;
+		for (n = e->count - e->aux; del && n > 0; n--) {
+			string_catf(del, "-");
+			for (b = 0; b < SHA1_DIGESTLEN; b++)
+				string_catf(del, "%02x", e->digest[b]);
+			string_catf(del, "\n");
+		}
+		e->count = e->aux;
+		e->aux = 0;
+	}
+}
+
+/*
+ * Append the changes made to the items of a data file since it was last
+ * loaded or saved to its journal, starting a new journal if the current one
+ * does not apply to the data file; sum is the checksum of the data file.
+ *
+ * Return 0 on failure and -1 if the records would be larger than max, in
+ * which case the data file should rather be written in full. This happens
+ * for large changes, and when saving a data file that was not written by
+ * calcurse for the first time, since all of its lines are then rewritten.
+ */
+int journal_save(enum journal_type type, const char *path, const char *sum,
+		 off_t max)
+{
+	struct journal *j = &journal[type];
+	struct string add, del;
+	struct stat st;
+	char *jpath = journal_path(path);
+	FILE *fp;
+	int ret = 1;
+
+	string_init(&add);
+	string_init(&del);
+	journal_diff(type, &add, &del);
+	if (add.len == 0 && del.len == 0)
+		goto cleanup;
+	if ((off_t)add.len + del.len > max) {
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (j->orphan)
+		journal_set_aside(j);
+	if ((fp = fopen(jpath, j->valid ? "a" : "w"))) {
+		if (!j->valid)
+			fprintf(fp, "%s%s\n", JOURNAL_MAGIC, sum);
+		fwrite(del.buf, 1, del.len, fp);
+		fwrite(add.buf, 1, add.len, fp);
+		ret = !ferror(fp);
+		ret = fclose(fp) == 0 && ret;
+	} else {
+		ret = 0;
+	}
+
+	if (ret && (fp = fopen(jpath, "r"))) {
+		checksum_stream(fp, j->sum);
+		if (fstat(fileno(fp), &st) == 0) {
+			io_stamp_set(&j->stamp, &st);
+			j->size = st.st_size;
+		} else {
+			io_stamp_clear(&j->stamp);
+			j->size = 0;
+		}
+		j->valid = 1;
+		fclose(fp);
+	} else {
+		/* The index no longer matches the files. */
+		journal_index_free(&j->index);
+		j->indexed = 0;
+		ret = 0;
+	}
+
+cleanup:
+	mem_free(add.buf);
+	mem_free(del.buf);
+	mem_free(jpath);
+	return ret;
+}
+
+/*
+ * Remove the journal of a data file that has been written in full. A journal
+ * that did not apply to the data file is set aside instead.
+ */
+void journal_remove(const char *path)
+{
+	char *jpath = journal_path(path);
+	int type;
+
+	for (type = JOURNAL_APTS; type <= JOURNAL_TODO; type++) {
+		if (journal[type].orphan &&
+		    !strcmp(journal[type].orphan, jpath)) {
+			journal_set_aside(&journal[type]);
+			mem_free(jpath);
+			return;
+		}
+	}
+	if (unlink(jpath) != 0 && errno != ENOENT)
+		WARN_MSG(_("Could not remove journal %s: %s"), jpath,
+			 strerror(errno));
+	mem_free(jpath);
+}
+
+/*
+ * Update the journal state of a data file that has been written in full. In
+ * journal mode, the index is rebuilt from the items that were written.
+ */
+void journal_reset(enum journal_type type)
+{
+	journal_clear(type);
+	if (conf.journal) {
+		journal_diff(type, NULL, NULL);
+		journal[type].indexed = 1;
+	}
+}
+
+/*
+ * Fold the journal of a data file into the data file and remove the journal.
+ * This only works on the files, so the items can be edited meanwhile.
+ *
+ * If sum is not NULL, nothing is done unless the data file still has that
+ * checksum and the journal is the one that was last read or written; the
+ * checksum is updated once the journal has been folded. Return 0 if the data
+ * file could not be written.
+ */
+int journal_compact(enum journal_type type, const char *path, char *sum)
+{
+	struct journal *j = &journal[type];
+	struct io_map map, jmap;
+	char cur[CHECKSUM_LEN * 2 + 1], jsum[CHECKSUM_LEN * 2 + 1];
+	char *jpath, *next;
+	int ret = 1;
+
+	if (read_only || (sum && !j->valid))
+		return 1;
+
+	jpath = journal_path(path);
+	if (!io_map_file(path, &map, cur))
+		goto cleanup_path;
+	if (!io_map_file(jpath, &jmap, jsum))
+		goto cleanup_map;
+	if (sum && (strcmp(cur, sum) || strcmp(jsum, j->sum)))
+		goto cleanup;
+
+	next = jmap.data;
+	if (!journal_header_valid(io_map_getline(&jmap, &next), cur, &map)) {
+		/*
+		 * The journal does not apply to the data file. It is merged
+		 * into the items when loading and set aside when saving them.
+		 */
+		goto done;
+	}
+	journal_apply(&map, &jmap, next, NULL, 0);
+	if (!io_replace_file(path, map.data, map.len)) {
+		ret = 0;
+		goto cleanup;
+	}
+	journal_remove(path);
+	if (sum)
+		io_map_hash(&map, sum);
+
+done:
+	j->valid = 0;
+	j->sum[0] = '\0';
+	io_stamp_clear(&j->stamp);
+	j->size = 0;
+cleanup:
+	io_unmap_file(&jmap);
+cleanup_map:
+	io_unmap_file(&map);
+cleanup_path:
+	mem_free(jpath);
+	return ret;
+}
@@ -291,6 +291,31 @@ void llist_remove(llist_t * l, llist_item_t * i)
 	}
 }
 
+/*
+ * Remove all items whose data has been cleared (set to NULL) in a single
+ * pass, which is faster than removing them one at a time.
+ */
+void llist_remove_cleared(llist_t * l)
+{
+	llist_item_t *i, *prev = NULL, *next;
+
+	for (i = l->head; i; i = next) {
+		next = i->next;
+		if (i->data) {
+			prev = i;
+			continue;
+		}
+
+		if (prev)
+			prev->next = next;
+		else
+			l->head = next;
+		if (i == l->tail)
+			l->tail = prev;
+		mem_free(i);
+	}
+}
+
 /*
  * Find the first item matched by some filter callback.
  */
@@ -36,13 +36,48 @@
 
 #include <unistd.h>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "calcurse.h"
 #include "sha1.h"
 
+/*
+ * The note pack. With the notepack option, notes are appended to a single
+ * pack file instead of being stored in one file each. The index starts with a
+ * header line holding the inode of the pack it describes, followed by a line
+ * per note:
+ *
+ *   <SHA1> <offset> <length>
+ *
+ * Both files are only ever appended to, under a lock on the index, until the
+ * garbage collector compacts them. The pack is memory-mapped for reading, and
+ * the index is read into a sorted table, new lines being picked up as needed.
+ * Note files take precedence over the pack, so that both can be used side by
+ * side; external tools only ever see the note files.
+ */
+#define NOTE_PACK_MAGIC "calcurse-notes"
+
+struct note_pack_entry {
+	char hash[SHA1_DIGESTLEN * 2 + 1];
+	off_t off;
+	size_t len;
+};
+
+static struct note_pack_entry *note_pack;
+static unsigned note_pack_n, note_pack_size;
+static long note_pack_indexed;	/* bytes of the index read so far */
+static ino_t note_pack_ino;	/* pack described by the index */
+static char *note_pack_map;
+static size_t note_pack_maplen;
+static ino_t note_pack_mapino;
+
 struct note_gc_hash {
 	char *hash;
 	char buf[MAX_NOTESIZ + 1];
+	unsigned refs;
 	 HTABLE_ENTRY(note_gc_hash);
 };
 
@@ -54,23 +89,438 @@ HTABLE_HEAD(htp, NOTE_GC_HSIZE, note_gc_hash);
 HTABLE_PROTOTYPE(htp, note_gc_hash)
     HTABLE_GENERATE(htp, note_gc_hash, note_gc_extract_key, note_gc_cmp)
 
-/* Create note file from a string and return a newly allocated string that
- * contains its name. */
-char *generate_note(const char *str)
+/*
+ * Number of items referring to each note. Notes whose count dropped to zero
+ * stay in the table until the next garbage collection, which only needs to
+ * look at those.
+ */
+static struct htp note_refs = HTABLE_INITIALIZER(&note_refs);
+static unsigned note_refs_dropped;
+static pthread_mutex_t note_refs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Cache of note contents. Notes are named after the hash of their contents,
+ * so cached notes never go stale. Note files are mapped into memory, notes
+ * from the pack are copied. The least recently used notes are evicted once
+ * the cache holds more than NOTE_CACHE_SIZE bytes or NOTE_CACHE_ENTRIES notes.
+ */
+struct note_cache_entry {
+	char *hash;
+	char buf[MAX_NOTESIZ + 1];
+	struct io_map map;
+	struct note_cache_entry *lru_prev, *lru_next;
+	 HTABLE_ENTRY(note_cache_entry);
+};
+
+static void note_cache_extract_key(struct note_cache_entry *, const char **,
+				   int *);
+static int note_cache_cmp(struct note_cache_entry *,
+			  struct note_cache_entry *);
+
+HTABLE_HEAD(htc, NOTE_CACHE_HSIZE, note_cache_entry);
+HTABLE_PROTOTYPE(htc, note_cache_entry)
+    HTABLE_GENERATE(htc, note_cache_entry, note_cache_extract_key,
+		    note_cache_cmp)
+
+static struct htc note_cache = HTABLE_INITIALIZER(&note_cache);
+static struct note_cache_entry *note_cache_head, *note_cache_tail;
+static size_t note_cache_bytes;
+static unsigned note_cache_n;
+
+static void note_pack_unmap(void)
+{
+	if (note_pack_map)
+		munmap(note_pack_map, note_pack_maplen);
+	note_pack_map = NULL;
+	note_pack_maplen = 0;
+}
+
+/* Forget about the index, so that it is read again from the start. */
+static void note_pack_reset(void)
+{
+	note_pack_n = 0;
+	note_pack_indexed = 0;
+	note_pack_ino = 0;
+}
+
+/* Position of a note in the index table, or where it would be inserted. */
+static unsigned note_pack_search(const char *hash)
+{
+	unsigned lo = 0, hi = note_pack_n, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strcmp(note_pack[mid].hash, hash) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static void note_pack_insert(const char *hash, off_t off, size_t len)
+{
+	unsigned k = note_pack_search(hash);
+
+	if (k < note_pack_n && !strcmp(note_pack[k].hash, hash))
+		return;
+
+	if (note_pack_n == note_pack_size) {
+		note_pack_size = note_pack_size ? note_pack_size * 2 : 256;
+		note_pack = mem_realloc(note_pack, note_pack_size,
+					sizeof(struct note_pack_entry));
+	}
+	memmove(&note_pack[k + 1], &note_pack[k],
+		(note_pack_n - k) * sizeof(struct note_pack_entry));
+	strncpy(note_pack[k].hash, hash, SHA1_DIGESTLEN * 2);
+	note_pack[k].hash[SHA1_DIGESTLEN * 2] = '\0';
+	note_pack[k].off = off;
+	note_pack[k].len = len;
+	note_pack_n++;
+}
+
+/*
+ * Read the lines that were added to the index since it was last read. The
+ * index is read from the start if the pack was replaced. An index that does
+ * not describe the current pack is ignored.
+ */
+static void note_pack_read_index(void)
+{
+	FILE *fp;
+	struct stat st;
+	char buf[BUFSIZ], hash[SHA1_DIGESTLEN * 2 + 1];
+	unsigned long ino, len;
+	long long off;
+
+	if (stat(path_notes_pack, &st) != 0) {
+		note_pack_reset();
+		return;
+	}
+	if (st.st_ino != note_pack_ino)
+		note_pack_reset();
+	if (!(fp = fopen(path_notes_index, "r")))
+		return;
+
+	if (note_pack_indexed == 0) {
+		if (!fgets(buf, BUFSIZ, fp) ||
+		    sscanf(buf, NOTE_PACK_MAGIC " %lu", &ino) != 1 ||
+		    ino != (unsigned long)st.st_ino) {
+			fclose(fp);
+			return;
+		}
+		note_pack_ino = st.st_ino;
+		note_pack_indexed = ftell(fp);
+	} else if (fseek(fp, note_pack_indexed, SEEK_SET) != 0) {
+		fclose(fp);
+		return;
+	}
+
+	/* A line that is not terminated yet is read on the next call. */
+	while (fgets(buf, BUFSIZ, fp) && buf[strlen(buf) - 1] == '\n') {
+		if (sscanf(buf, "%40s %lld %lu", hash, &off, &len) == 3 &&
+		    strlen(hash) == SHA1_DIGESTLEN * 2)
+			note_pack_insert(hash, off, len);
+		note_pack_indexed = ftell(fp);
+	}
+	fclose(fp);
+}
+
+/*
+ * Look up a note in the pack and return a pointer to its contents, which
+ * remains valid until the pack is accessed again, or NULL if it is not there.
+ */
+static const char *note_pack_get(const char *hash, size_t *len)
+{
+	struct stat st;
+	unsigned k;
+	int fd;
+
+	if (stat(path_notes_pack, &st) != 0)
+		return NULL;
+
+	k = note_pack_search(hash);
+	if (st.st_ino != note_pack_ino || k >= note_pack_n ||
+	    strcmp(note_pack[k].hash, hash) != 0) {
+		note_pack_read_index();
+		k = note_pack_search(hash);
+		if (k >= note_pack_n || strcmp(note_pack[k].hash, hash) != 0)
+			return NULL;
+	}
+	if (note_pack[k].off + (off_t)note_pack[k].len > st.st_size)
+		return NULL;
+
+	if (!note_pack_map || st.st_ino != note_pack_mapino ||
+	    note_pack[k].off + note_pack[k].len > note_pack_maplen) {
+		note_pack_unmap();
+		if ((fd = open(path_notes_pack, O_RDONLY)) < 0)
+			return NULL;
+		note_pack_map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED,
+				     fd, 0);
+		close(fd);
+		if (note_pack_map == MAP_FAILED) {
+			note_pack_map = NULL;
+			return NULL;
+		}
+		note_pack_maplen = st.st_size;
+		note_pack_mapino = st.st_ino;
+	}
+
+	*len = note_pack[k].len;
+	return note_pack_map + note_pack[k].off;
+}
+
+static int note_write_all(int fd, const char *data, size_t len)
+{
+	ssize_t n;
+
+	for (; len > 0; data += n, len -= n) {
+		if ((n = write(fd, data, len)) < 0) {
+			if (errno != EINTR)
+				return 0;
+			n = 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Open and lock the index, creating it if needed. The lock is released by
+ * closing the returned descriptor. Return -1 on failure.
+ */
+static int note_pack_lock(void)
+{
+	struct flock fl;
+	struct stat st1, st2;
+	int fd;
+
+	for (;;) {
+		fd = open(path_notes_index, O_RDWR | O_CREAT | O_APPEND, 0600);
+		if (fd < 0)
+			return -1;
+		fl.l_type = F_WRLCK;
+		fl.l_whence = SEEK_SET;
+		fl.l_start = 0;
+		fl.l_len = 0;
+		while (fcntl(fd, F_SETLKW, &fl) != 0) {
+			if (errno != EINTR) {
+				close(fd);
+				return -1;
+			}
+		}
+		/* The garbage collector may have replaced the index. */
+		if (fstat(fd, &st1) == 0 && stat(path_notes_index, &st2) == 0 &&
+		    st1.st_ino == st2.st_ino)
+			return fd;
+		close(fd);
+	}
+}
+
+/* Add a note to the pack, unless it is there already. */
+static int note_pack_add(const char *hash, const char *data, size_t len)
+{
+	struct stat st;
+	char *line;
+	size_t n;
+	int fd, pack, ret = 0;
+
+	if (note_pack_get(hash, &n))
+		return 1;
+	if ((fd = note_pack_lock()) < 0)
+		return 0;
+	if ((pack = open(path_notes_pack, O_WRONLY | O_CREAT | O_APPEND,
+			 0600)) < 0 || fstat(pack, &st) != 0)
+		goto cleanup;
+
+	/* Another instance may have added the note meanwhile. */
+	if (note_pack_get(hash, &n)) {
+		ret = 1;
+		goto cleanup;
+	}
+	if (note_pack_ino != st.st_ino) {
+		/* The index is missing or describes another pack. */
+		if (ftruncate(fd, 0) != 0)
+			goto cleanup;
+		note_pack_reset();
+		asprintf(&line, "%s %lu\n", NOTE_PACK_MAGIC,
+			 (unsigned long)st.st_ino);
+		ret = note_write_all(fd, line, strlen(line));
+		note_pack_ino = st.st_ino;
+		note_pack_indexed = strlen(line);
+		mem_free(line);
+		if (!ret)
+			goto cleanup;
+	}
+
+	ret = note_write_all(pack, data, len) && fsync(pack) == 0;
+	if (ret) {
+		asprintf(&line, "%s %lld %lu\n", hash, (long long)st.st_size,
+			 (unsigned long)len);
+		ret = note_write_all(fd, line, strlen(line));
+		if (ret) {
+			note_pack_insert(hash, st.st_size, len);
+			note_pack_indexed += strlen(line);
+		}
+		mem_free(line);
+	}
+
+cleanup:
+	if (pack >= 0)
+		close(pack);
+	close(fd);
+	return ret;
+}
+
+static void
+note_cache_extract_key(struct note_cache_entry *data, const char **key,
+		       int *len)
+{
+	*key = data->hash;
+	*len = strlen(data->hash);
+}
+
+static int note_cache_cmp(struct note_cache_entry *a,
+			  struct note_cache_entry *b)
+{
+	return strcmp(a->hash, b->hash);
+}
+
+static void note_cache_unlink(struct note_cache_entry *c)
+{
+	if (c->lru_prev)
+		c->lru_prev->lru_next = c->lru_next;
+	else
+		note_cache_head = c->lru_next;
+	if (c->lru_next)
+		c->lru_next->lru_prev = c->lru_prev;
+	else
+		note_cache_tail = c->lru_prev;
+}
+
+static void note_cache_push(struct note_cache_entry *c)
+{
+	c->lru_prev = NULL;
+	c->lru_next = note_cache_head;
+	if (note_cache_head)
+		note_cache_head->lru_prev = c;
+	else
+		note_cache_tail = c;
+	note_cache_head = c;
+}
+
+/* Evict the least recently used notes, except the most recent one. */
+static void note_cache_evict(void)
+{
+	struct note_cache_entry *c;
+
+	while (note_cache_tail != note_cache_head &&
+	       (note_cache_bytes > NOTE_CACHE_SIZE ||
+		note_cache_n > NOTE_CACHE_ENTRIES)) {
+		c = note_cache_tail;
+		note_cache_unlink(c);
+		HTABLE_REMOVE(htc, &note_cache, c);
+		note_cache_bytes -= c->map.len;
+		note_cache_n--;
+		io_unmap_file(&c->map);
+		mem_free(c);
+	}
+}
+
+/*
+ * Return the contents of a note and store their length in len, or return NULL
+ * if the note cannot be found. The contents are not null-terminated and
+ * remain valid until the next call.
+ */
+const char *note_get(const char *note, size_t *len)
+{
+	struct note_cache_entry tmpc, *c;
+	const char *data;
+	char *notepath;
+	int found;
+
+	tmpc.hash = (char *)note;
+	if ((c = HTABLE_LOOKUP(htc, &note_cache, &tmpc))) {
+		note_cache_unlink(c);
+		note_cache_push(c);
+		*len = c->map.len;
+		return c->map.data ? c->map.data : "";
+	}
+
+	c = mem_malloc(sizeof(struct note_cache_entry));
+	asprintf(&notepath, "%s%s", path_notes, note);
+	found = io_map_file(notepath, &c->map, NULL);
+	mem_free(notepath);
+	if (!found) {
+		if (!(data = note_pack_get(note, len))) {
+			mem_free(c);
+			return NULL;
+		}
+		c->map.data = mem_malloc(*len + 1);
+		memcpy(c->map.data, data, *len);
+		c->map.len = *len;
+		c->map.mapped = 0;
+	}
+
+	strncpy(c->buf, note, MAX_NOTESIZ + 1);
+	c->buf[MAX_NOTESIZ] = '\0';
+	c->hash = c->buf;
+	HTABLE_INSERT(htc, &note_cache, c);
+	note_cache_push(c);
+	note_cache_bytes += c->map.len;
+	note_cache_n++;
+	note_cache_evict();
+
+	*len = c->map.len;
+	return c->map.data ? c->map.data : "";
+}
+
+/*
+ * Append the contents of a note to a string. Return 0 if the note cannot be
+ * found.
+ */
+int note_load(const char *note, struct string *s)
+{
+	const char *data;
+	size_t len;
+
+	if (!(data = note_get(note, &len)))
+		return 0;
+	string_catn(s, data, len);
+	return 1;
+}
+
+/* Store a note, either in the pack or in a file of its own. */
+static void note_store(const char *sha1, const char *str, size_t len)
 {
-	char *sha1 = mem_malloc(SHA1_DIGESTLEN * 2 + 1);
 	char *notepath;
 	FILE *fp;
 
-	sha1_digest(str, sha1);
+	if (conf.note_pack) {
+		EXIT_IF(!note_pack_add(sha1, str, len),
+			_("Warning: could not write to %s, Aborting..."),
+			path_notes_pack);
+		return;
+	}
+
 	asprintf(&notepath, "%s%s", path_notes, sha1);
 	fp = fopen(notepath, "w");
 	EXIT_IF(fp == NULL, _("Warning: could not open %s, Aborting..."),
 		notepath);
-	fputs(str, fp);
+	fwrite(str, 1, len, fp);
 	file_close(fp, __FILE_POS__);
-
 	mem_free(notepath);
+}
+
+/* Create note file from a string and return a newly allocated string that
+ * contains its name. */
+char *generate_note(const char *str)
+{
+	char *sha1 = mem_malloc(SHA1_DIGESTLEN * 2 + 1);
+
+	sha1_digest(str, sha1);
+	note_store(sha1, str, strlen(str));
+
 	return sha1;
 }
 
@@ -78,31 +528,38 @@ char *generate_note(const char *str)
 void edit_note(char **note, const char *editor)
 {
 	char *tmpprefix = NULL, *tmppath = NULL;
-	char *notepath = NULL;
-	char *sha1 = mem_malloc(SHA1_DIGESTLEN * 2 + 1);
+	char *sha1, buf[BUFSIZ];
+	struct string s;
+	size_t n;
 	FILE *fp;
 
 	asprintf(&tmpprefix, "%s/calcurse-note", get_tempdir());
 	if ((tmppath = new_tempfile(tmpprefix)) == NULL)
 		goto cleanup;
 
-	if (*note != NULL) {
-		asprintf(&notepath, "%s%s", path_notes, *note);
-		io_file_cp(notepath, tmppath);
+	string_init(&s);
+	if (*note != NULL && note_load(*note, &s) && (fp = fopen(tmppath, "w"))) {
+		fwrite(string_buf(&s), 1, s.len, fp);
+		file_close(fp, __FILE_POS__);
 	}
+	string_free(&s);
 
 	const char *arg[] = { editor, tmppath, NULL };
 	wins_launch_external(arg);
 
 	if ((fp = fopen(tmppath, "r"))) {
-		sha1_stream(fp, sha1);
+		string_init(&s);
+		while ((n = fread(buf, 1, BUFSIZ, fp)) > 0)
+			string_catn(&s, buf, n);
 		fclose(fp);
-		*note = sha1;
 
-		mem_free(notepath);
-		asprintf(&notepath, "%s%s", path_notes, *note);
-		io_file_cp(tmppath, notepath);
-		mem_free(notepath);
+		sha1 = mem_malloc(SHA1_DIGESTLEN * 2 + 1);
+		sha1_digest(string_buf(&s), sha1);
+		note_store(sha1, string_buf(&s), s.len);
+		string_free(&s);
+		note_ref(sha1);
+		erase_note(note);
+		*note = sha1;
 	}
 
 	unlink(tmppath);
@@ -115,16 +572,37 @@ cleanup:
 /* View a note in an external pager. */
 void view_note(const char *note, const char *pager)
 {
-	char *fullname;
+	char *fullname, *tmpprefix = NULL, *tmppath = NULL;
+	struct string s;
+	FILE *fp;
 
 	if (note == NULL)
 		return;
 	asprintf(&fullname, "%s%s", path_notes, note);
 
-	const char *arg[] = { pager, fullname, NULL };
+	/* Notes stored in the pack are shown from a temporary copy. */
+	if (access(fullname, F_OK) != 0) {
+		asprintf(&tmpprefix, "%s/calcurse-note", get_tempdir());
+		if ((tmppath = new_tempfile(tmpprefix)) == NULL)
+			goto cleanup;
+		string_init(&s);
+		if (note_load(note, &s) && (fp = fopen(tmppath, "w"))) {
+			fwrite(string_buf(&s), 1, s.len, fp);
+			file_close(fp, __FILE_POS__);
+		}
+		string_free(&s);
+	}
+
+	const char *arg[] = { pager, tmppath ? tmppath : fullname, NULL };
 	wins_launch_external(arg);
 
+	if (tmppath)
+		unlink(tmppath);
+
+cleanup:
 	mem_free(fullname);
+	mem_free(tmpprefix);
+	mem_free(tmppath);
 }
 
 /* Erase a note previously attached to an item. */
@@ -132,35 +610,95 @@ void erase_note(char **note)
 {
 	if (*note == NULL)
 		return;
+	note_unref(*note);
 	mem_free(*note);
 	*note = NULL;
 }
 
-/* Read a serialized note file name from a stream and deserialize it. */
-void note_read(char *buffer, FILE * fp)
+/* Count a new reference to a note. */
+void note_ref(const char *note)
 {
-	int i;
+	struct note_gc_hash tmph, *hp;
 
-	for (i = 0; i < MAX_NOTESIZ; i++) {
-		buffer[i] = getc(fp);
-		if (buffer[i] == ' ') {
-			buffer[i] = '\0';
-			return;
-		}
+	if (!note)
+		return;
+
+	pthread_mutex_lock(&note_refs_mutex);
+	tmph.hash = (char *)note;
+	if ((hp = HTABLE_LOOKUP(htp, &note_refs, &tmph))) {
+		if (hp->refs++ == 0)
+			note_refs_dropped--;
+	} else {
+		hp = mem_malloc(sizeof(struct note_gc_hash));
+		strncpy(hp->buf, note, MAX_NOTESIZ + 1);
+		hp->buf[MAX_NOTESIZ] = '\0';
+		hp->hash = hp->buf;
+		hp->refs = 1;
+		HTABLE_INSERT(htp, &note_refs, hp);
 	}
+	pthread_mutex_unlock(&note_refs_mutex);
+}
+
+/* Drop a reference to a note. */
+void note_unref(const char *note)
+{
+	struct note_gc_hash tmph, *hp;
 
-	while (getc(fp) != ' ') ;
-	buffer[MAX_NOTESIZ] = '\0';
+	if (!note)
+		return;
+
+	pthread_mutex_lock(&note_refs_mutex);
+	tmph.hash = (char *)note;
+	hp = HTABLE_LOOKUP(htp, &note_refs, &tmph);
+	if (hp && hp->refs > 0 && --hp->refs == 0)
+		note_refs_dropped++;
+	pthread_mutex_unlock(&note_refs_mutex);
 }
 
-/* Read the contents of a note file */
-void note_read_contents(char *buffer, size_t buffer_len, FILE * fp)
+/* Duplicate the note name of an item that is being copied or created. */
+char *note_dup(const char *note)
 {
-	size_t read_count = fread(buffer, 1, buffer_len, fp);
-	if (read_count != buffer_len)
-		buffer[read_count] = '\0';
-	else
+	if (!note)
+		return NULL;
+	note_ref(note);
+	return mem_strdup(note);
+}
+
+/*
+ * Read a serialized note file name from a data file line and deserialize it.
+ * The name is terminated in place and *s is advanced past the separator.
+ */
+char *note_read(char **s)
+{
+	char *note = *s, *p;
+
+	for (p = note; *p != ' ' && *p != '\0'; p++) ;
+	*s = (*p == ' ') ? p + 1 : p;
+	if (p - note > MAX_NOTESIZ)
+		p = note + MAX_NOTESIZ;
+	*p = '\0';
+
+	return note;
+}
+
+/*
+ * Read the contents of a note into a buffer, truncating them if needed. The
+ * buffer is left empty if the note cannot be found.
+ */
+void note_read_contents(char *buffer, size_t buffer_len, const char *note)
+{
+	struct string s;
+
+	string_init(&s);
+	note_load(note, &s);
+	if ((size_t)s.len < buffer_len) {
+		memcpy(buffer, string_buf(&s), s.len);
+		buffer[s.len] = '\0';
+	} else {
+		memcpy(buffer, string_buf(&s), buffer_len - 4);
 		memcpy(&buffer[buffer_len - 4], "...\0", 4);
+	}
+	string_free(&s);
 }
 
 
@@ -176,81 +714,208 @@ static int note_gc_cmp(struct note_gc_hash *a, struct note_gc_hash *b)
 	return strcmp(a->hash, b->hash);
 }
 
-/* Spot and unlink unused note files. */
-void note_gc(void)
+/* Tell whether a note is in use. The reference table must be locked. */
+static int note_gc_used(const char *note)
 {
-	struct htp gc_htable = HTABLE_INITIALIZER(&gc_htable);
-	struct note_gc_hash *hp;
-	DIR *dirp;
-	struct dirent *dp;
-	llist_item_t *i;
-	struct note_gc_hash tmph;
-	char *notepath;
+	struct note_gc_hash tmph, *hp;
 
-	if (!(dirp = opendir(path_notes)))
-		return;
+	tmph.hash = (char *)note;
+	hp = HTABLE_LOOKUP(htp, &note_refs, &tmph);
+	return hp && hp->refs > 0;
+}
 
-	/* Insert all note file names into a hash table. */
-	do {
-		if ((dp = readdir(dirp)) && *(dp->d_name) != '.') {
-			hp = mem_malloc(sizeof(struct note_gc_hash));
+/*
+ * Tell whether a note can be dropped. A full collection drops all notes that
+ * are not in use, an incremental one only those whose last reference went
+ * away since the previous collection.
+ */
+static int note_gc_dead(const char *note, int full)
+{
+	struct note_gc_hash tmph, *hp;
 
-			strncpy(hp->buf, dp->d_name, MAX_NOTESIZ + 1);
-			hp->buf[MAX_NOTESIZ] = '\0';
-			hp->hash = hp->buf;
+	if (full)
+		return !note_gc_used(note);
 
-			HTABLE_INSERT(htp, &gc_htable, hp);
-		}
+	tmph.hash = (char *)note;
+	hp = HTABLE_LOOKUP(htp, &note_refs, &tmph);
+	return hp && hp->refs == 0;
+}
+
+/* Remove the notes that are no longer in use from the reference table. */
+static void note_refs_prune(int all)
+{
+	struct note_gc_hash *hp, *next;
+
+	for (hp = HTABLE_FIRST(htp, &note_refs); hp; hp = next) {
+		next = HTABLE_NEXT(htp, &note_refs, hp);
+		if (all || hp->refs == 0)
+			mem_free(HTABLE_REMOVE(htp, &note_refs, hp));
 	}
-	while (dp);
+	note_refs_dropped = 0;
+}
+
+/* Count the references of all items from scratch. */
+static void note_refs_recount(void)
+{
+	llist_item_t *i;
 
-	closedir(dirp);
+	pthread_mutex_lock(&note_refs_mutex);
+	note_refs_prune(1);
+	pthread_mutex_unlock(&note_refs_mutex);
 
-	/* Remove hashes that are actually in use. */
 	LLIST_TS_FOREACH(&alist_p, i) {
 		struct apoint *apt = LLIST_GET_DATA(i);
-		if (apt->note) {
-			tmph.hash = apt->note;
-			mem_free(HTABLE_REMOVE(htp, &gc_htable, &tmph));
-		}
+		note_ref(apt->note);
 	}
 
 	LLIST_FOREACH(&eventlist, i) {
 		struct event *ev = LLIST_GET_DATA(i);
-		if (ev->note) {
-			tmph.hash = ev->note;
-			mem_free(HTABLE_REMOVE(htp, &gc_htable, &tmph));
-		}
+		note_ref(ev->note);
 	}
 
 	LLIST_TS_FOREACH(&recur_alist_p, i) {
 		struct recur_apoint *rapt = LLIST_GET_DATA(i);
-		if (rapt->note) {
-			tmph.hash = rapt->note;
-			mem_free(HTABLE_REMOVE(htp, &gc_htable, &tmph));
-		}
+		note_ref(rapt->note);
 	}
 
 	LLIST_FOREACH(&recur_elist, i) {
 		struct recur_event *rev = LLIST_GET_DATA(i);
-		if (rev->note) {
-			tmph.hash = rev->note;
-			mem_free(HTABLE_REMOVE(htp, &gc_htable, &tmph));
-		}
+		note_ref(rev->note);
 	}
 
 	LLIST_FOREACH(&todolist, i) {
 		struct todo *todo = LLIST_GET_DATA(i);
-		if (todo->note) {
-			tmph.hash = todo->note;
-			mem_free(HTABLE_REMOVE(htp, &gc_htable, &tmph));
-		}
+		note_ref(todo->note);
+	}
+}
+
+/*
+ * Rewrite the pack without the notes that can be dropped. Nothing is done
+ * unless there is something to drop, or if the index does not describe the
+ * pack.
+ */
+static void note_gc_pack(int full)
+{
+	struct string pack, index;
+	struct stat st;
+	const char *data;
+	size_t len;
+	unsigned k, nused = 0;
+	int fd;
+
+	if ((fd = note_pack_lock()) < 0)
+		return;
+
+	note_pack_read_index();
+	for (k = 0; k < note_pack_n; k++) {
+		if (!note_gc_dead(note_pack[k].hash, full))
+			nused++;
+	}
+	if (note_pack_ino == 0 || nused == note_pack_n)
+		goto cleanup;
+
+	if (nused == 0) {
+		unlink(path_notes_pack);
+		unlink(path_notes_index);
+		note_pack_unmap();
+		note_pack_reset();
+		goto cleanup;
+	}
+
+	string_init(&pack);
+	string_init(&index);
+	for (k = 0; k < note_pack_n; k++) {
+		if (note_gc_dead(note_pack[k].hash, full))
+			continue;
+		if (!(data = note_pack_get(note_pack[k].hash, &len)))
+			continue;
+		string_catf(&index, "%s %d %lu\n", note_pack[k].hash, pack.len,
+			    (unsigned long)len);
+		string_catn(&pack, data, len);
 	}
 
-	/* Unlink unused note files. */
-	HTABLE_FOREACH(hp, htp, &gc_htable) {
-		asprintf(&notepath, "%s%s", path_notes, hp->hash);
+	/*
+	 * The new index names the new pack, so that readers ignore it until
+	 * both files have been replaced.
+	 */
+	if (io_replace_file(path_notes_pack, string_buf(&pack), pack.len) &&
+	    stat(path_notes_pack, &st) == 0) {
+		string_printf(&pack, "%s %lu\n", NOTE_PACK_MAGIC,
+			      (unsigned long)st.st_ino);
+		string_catn(&pack, string_buf(&index), index.len);
+		io_replace_file(path_notes_index, string_buf(&pack), pack.len);
+	}
+	note_pack_unmap();
+	note_pack_reset();
+	string_free(&pack);
+	string_free(&index);
+
+cleanup:
+	close(fd);
+}
+
+/* Move the note files that are still in use into the pack. */
+static void note_gc_migrate(const char *note, const char *notepath)
+{
+	struct string s;
+
+	if (strlen(note) != SHA1_DIGESTLEN * 2)
+		return;
+
+	string_init(&s);
+	if (note_load(note, &s) && note_pack_add(note, string_buf(&s), s.len))
 		unlink(notepath);
-		mem_free(notepath);
+	string_free(&s);
+}
+
+/*
+ * Unlink the notes that are no longer in use and drop them from the pack.
+ *
+ * By default, only the notes whose reference count dropped to zero are
+ * looked at. A full collection recounts the references of all items first,
+ * and scans the notes directory, unlinking all note files that are not in
+ * use. With the notepack option, it also moves the remaining note files into
+ * the pack.
+ */
+void note_gc(int full)
+{
+	struct note_gc_hash *hp;
+	DIR *dirp;
+	struct dirent *dp;
+	char *notepath;
+
+	if (full)
+		note_refs_recount();
+	else if (note_refs_dropped == 0)
+		return;
+
+	pthread_mutex_lock(&note_refs_mutex);
+
+	if (!full) {
+		HTABLE_FOREACH(hp, htp, &note_refs) {
+			if (hp->refs > 0)
+				continue;
+			asprintf(&notepath, "%s%s", path_notes, hp->hash);
+			unlink(notepath);
+			mem_free(notepath);
+		}
+	} else if ((dirp = opendir(path_notes))) {
+		while ((dp = readdir(dirp))) {
+			if (*(dp->d_name) == '.')
+				continue;
+			asprintf(&notepath, "%s%s", path_notes, dp->d_name);
+			if (!note_gc_used(dp->d_name))
+				unlink(notepath);
+			else if (conf.note_pack)
+				note_gc_migrate(dp->d_name, notepath);
+			mem_free(notepath);
+		}
+		closedir(dirp);
 	}
+
+	if (access(path_notes_pack, F_OK) == 0)
+		note_gc_pack(full);
+
+	note_refs_prune(0);
+	pthread_mutex_unlock(&note_refs_mutex);
 }
@@ -609,7 +609,7 @@ print_option(WINDOW * win, unsigned x, unsigned y, char *name,
 static void print_config_option(int i, WINDOW *win, int y, int hilt, void *cb_data)
 {
 	enum { SHOW, DATE, CLOCK, WARN, CMD, NOTIFYALL, DMON, DMON_LOG,
-		    NB_OPT };
+		    DMON_SOCKET, NB_OPT };
 
 	struct opt_s {
 		char *name;
@@ -650,6 +650,10 @@ static void print_config_option(int i, WINDOW *win, int y, int hilt, void *cb_da
 	opt[DMON_LOG].desc =
 	    _("(Log activity when running in background)");
 
+	opt[DMON_SOCKET].name = "daemon.socket = ";
+	opt[DMON_SOCKET].desc =
+	    _("(Answer command-line queries when running in background)");
+
 	pthread_mutex_lock(&nbar.mutex);
 
 	/* String value options */
@@ -664,9 +668,10 @@ static void print_config_option(int i, WINDOW *win, int y, int hilt, void *cb_da
 
 	opt[DMON].valnum = dmon.enable;
 	opt[DMON_LOG].valnum = dmon.log;
+	opt[DMON_SOCKET].valnum = dmon.socket;
 
 	opt[SHOW].valstr[0] = opt[DMON].valstr[0] =
-		opt[DMON_LOG].valstr[0] = '\0';
+		opt[DMON_LOG].valstr[0] = opt[DMON_SOCKET].valstr[0] = '\0';
 
 	opt[NOTIFYALL].valnum = nbar.notify_all;
 	if (opt[NOTIFYALL].valnum == NOTIFY_FLAGGED_ONLY)
@@ -785,6 +790,9 @@ static void config_option_edit(int i)
 	case 7:
 		dmon.log = !dmon.log;
 		break;
+	case 8:
+		dmon.socket = !dmon.socket;
+		break;
 	}
 
 	mem_free(buf);
@@ -803,7 +811,7 @@ void notify_config_bar(void)
 	listbox_init(&lb, 0, 0, notify_bar() ? row - 3 : row - 2, col,
 		     _("notification options"), config_option_row_type,
 		     config_option_height, print_config_option);
-	listbox_load_items(&lb, 8);
+	listbox_load_items(&lb, 9);
 	listbox_draw_deco(&lb, 0);
 	listbox_display(&lb, NOHILT);
 	wins_set_bindings(bindings, ARRAY_SIZE(bindings));
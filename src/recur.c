@@ -90,6 +90,15 @@ void recur_free_exc_list(llist_t * exc)
 	LLIST_FREE(exc);
 }
 
+/* Free the lists of a recurrence rule that was not handed over to an item. */
+void recur_free_rpt_lists(struct rpt *rpt)
+{
+	recur_free_int_list(&rpt->bymonth);
+	recur_free_int_list(&rpt->bywday);
+	recur_free_int_list(&rpt->bymonthday);
+	recur_free_exc_list(&rpt->exc);
+}
+
 static int exc_cmp_day(struct excp *a, struct excp *b)
 {
 	return a->st < b->st ? -1 : (a->st == b->st ? 0 : 1);
@@ -198,10 +207,7 @@ struct recur_event *recur_event_dup(struct recur_event *in)
 
 	recur_exc_dup(&rev->exc, &in->exc);
 
-	if (in->note)
-		rev->note = mem_strdup(in->note);
-	else
-		rev->note = NULL;
+	rev->note = note_dup(in->note);
 
 	return rev;
 }
@@ -230,10 +236,7 @@ struct recur_apoint *recur_apoint_dup(struct recur_apoint *in)
 
 	recur_exc_dup(&rapt->exc, &in->exc);
 
-	if (in->note)
-		rapt->note = mem_strdup(in->note);
-	else
-		rapt->note = NULL;
+	rapt->note = note_dup(in->note);
 
 	return rapt;
 }
@@ -251,8 +254,7 @@ void recur_event_llist_init(void)
 void recur_apoint_free(struct recur_apoint *rapt)
 {
 	mem_free(rapt->mesg);
-	if (rapt->note)
-		mem_free(rapt->note);
+	erase_note(&rapt->note);
 	if (rapt->rpt)
 		mem_free(rapt->rpt);
 	recur_free_exc_list(&rapt->exc);
@@ -262,8 +264,7 @@ void recur_apoint_free(struct recur_apoint *rapt)
 void recur_event_free(struct recur_event *rev)
 {
 	mem_free(rev->mesg);
-	if (rev->note)
-		mem_free(rev->note);
+	erase_note(&rev->note);
 	if (rev->rpt)
 		mem_free(rev->rpt);
 	recur_free_exc_list(&rev->exc);
@@ -307,15 +308,15 @@ static int recur_event_cmp(struct recur_event *a, struct recur_event *b)
 	return strcmp(a->mesg, b->mesg);
 }
 
-/* Insert a new recursive appointment in the general linked list */
-struct recur_apoint *recur_apoint_new(char *mesg, char *note, time_t start,
-				      long dur, char state, struct rpt *rpt)
+static struct recur_apoint *recur_apoint_alloc(char *mesg, char *note,
+					       time_t start, long dur,
+					       char state, struct rpt *rpt)
 {
 	struct recur_apoint *rapt =
 	    mem_malloc(sizeof(struct recur_apoint));
 
 	rapt->mesg = mem_strdup(mesg);
-	rapt->note = (note != NULL) ? mem_strdup(note) : 0;
+	rapt->note = note_dup(note);
 	rapt->start = start;
 	rapt->dur = dur;
 	rapt->state = state;
@@ -335,21 +336,37 @@ struct recur_apoint *recur_apoint_new(char *mesg, char *note, time_t start,
 	recur_free_exc_list(&rpt->exc);
 	LLIST_INIT(&rapt->rpt->exc);
 
+	return rapt;
+}
+
+/* Insert a recursive appointment into the general linked list. */
+void recur_apoint_add(struct recur_apoint *rapt)
+{
 	LLIST_TS_LOCK(&recur_alist_p);
 	LLIST_TS_ADD_SORTED(&recur_alist_p, rapt, recur_apoint_cmp);
 	LLIST_TS_UNLOCK(&recur_alist_p);
+}
+
+/* Insert a new recursive appointment in the general linked list */
+struct recur_apoint *recur_apoint_new(char *mesg, char *note, time_t start,
+				      long dur, char state, struct rpt *rpt)
+{
+	struct recur_apoint *rapt =
+	    recur_apoint_alloc(mesg, note, start, dur, state, rpt);
+
+	recur_apoint_add(rapt);
 
 	return rapt;
 }
 
-/* Insert a new recursive event in the general linked list */
-struct recur_event *recur_event_new(char *mesg, char *note, time_t day,
-				    int id, struct rpt *rpt)
+static struct recur_event *recur_event_alloc(char *mesg, char *note,
+					     time_t day, int id,
+					     struct rpt *rpt)
 {
 	struct recur_event *rev = mem_malloc(sizeof(struct recur_event));
 
 	rev->mesg = mem_strdup(mesg);
-	rev->note = (note != NULL) ? mem_strdup(note) : 0;
+	rev->note = note_dup(note);
 	rev->day = day;
 	rev->id = id;
 	rev->rpt = mem_malloc(sizeof(struct rpt));
@@ -365,7 +382,22 @@ struct recur_event *recur_event_new(char *mesg, char *note, time_t day,
 	recur_free_exc_list(&rpt->exc);
 	LLIST_INIT(&rev->rpt->exc);
 
+	return rev;
+}
+
+/* Insert a recursive event into the general linked list. */
+void recur_event_add(struct recur_event *rev)
+{
 	LLIST_ADD_SORTED(&recur_elist, rev, recur_event_cmp);
+}
+
+/* Insert a new recursive event in the general linked list */
+struct recur_event *recur_event_new(char *mesg, char *note, time_t day,
+				    int id, struct rpt *rpt)
+{
+	struct recur_event *rev = recur_event_alloc(mesg, note, day, id, rpt);
+
+	recur_event_add(rev);
 
 	return rev;
 }
@@ -433,7 +465,8 @@ static void bymonthday_append(struct string *s, llist_t *l)
 
 	LLIST_FOREACH(l, i) {
 		int *day = LLIST_GET_DATA(i);
-		string_catf(s, " d%d", *day);
+		string_catn(s, " d", 2);
+		string_catint(s, *day);
 	}
 }
 
@@ -444,7 +477,8 @@ static void bywday_append(struct string *s, llist_t *l)
 
 	LLIST_FOREACH(l, i) {
 		int *wday = LLIST_GET_DATA(i);
-		string_catf(s, " w%d", *wday);
+		string_catn(s, " w", 2);
+		string_catint(s, *wday);
 	}
 }
 
@@ -455,7 +489,8 @@ static void bymonth_append(struct string *s, llist_t *l)
 
 	LLIST_FOREACH(l, i) {
 		int *mon = LLIST_GET_DATA(i);
-		string_catf(s, " m%d", *mon);
+		string_catn(s, " m", 2);
+		string_catint(s, *mon);
 	}
 }
 
@@ -465,29 +500,75 @@ static void recur_exc_append(struct string *s, llist_t *lexc)
 	llist_item_t *i;
 	struct tm lt;
 	time_t t;
-	int st_mon, st_day, st_year;
 
 	LLIST_FOREACH(lexc, i) {
 		struct excp *exc = LLIST_GET_DATA(i);
 		t = exc->st;
 		localtime_r(&t, &lt);
-		st_mon = lt.tm_mon + 1;
-		st_day = lt.tm_mday;
-		st_year = lt.tm_year + 1900;
-		string_catf(s, " !%02u/%02u/%04u", st_mon, st_day, st_year);
+		string_catn(s, " !", 2);
+		string_catdate(s, &lt);
+	}
+}
+
+/* Check whether a recursive appointment is selected by a filter. */
+int recur_apoint_filter(struct recur_apoint *rapt, struct item_filter *filter)
+{
+	time_t tstart = rapt->start, tend = rapt->start + rapt->dur;
+	int cond;
+
+	cond = (
+	    !(filter->type_mask & TYPE_MASK_RECUR_APPT) ||
+	    (filter->regex && regexec(filter->regex, rapt->mesg, 0, 0, 0)) ||
+	    (filter->start_from != -1 && tstart < filter->start_from) ||
+	    (filter->start_to != -1 && tstart > filter->start_to) ||
+	    (filter->end_from != -1 && tend < filter->end_from) ||
+	    (filter->end_to != -1 && tend > filter->end_to)
+	);
+	if (!cond && filter->hash) {
+		char *hash = recur_apoint_hash(rapt);
+		cond = !hash_matches(filter->hash, hash);
+		mem_free(hash);
 	}
+
+	return filter->invert ? cond : !cond;
 }
 
-/* Load the recursive appointment description */
-char *recur_apoint_scan(FILE *f, struct tm start, struct tm end,
+/* Check whether a recursive event is selected by a filter. */
+int recur_event_filter(struct recur_event *rev, struct item_filter *filter)
+{
+	time_t tstart = rev->day, tend = ENDOFDAY(rev->day);
+	int cond;
+
+	cond = (
+	    !(filter->type_mask & TYPE_MASK_RECUR_EVNT) ||
+	    (filter->regex && regexec(filter->regex, rev->mesg, 0, 0, 0)) ||
+	    (filter->start_from != -1 && tstart < filter->start_from) ||
+	    (filter->start_to != -1 && tstart > filter->start_to) ||
+	    (filter->end_from != -1 && tend < filter->end_from) ||
+	    (filter->end_to != -1 && tend > filter->end_to)
+	);
+	if (!cond && filter->hash) {
+		char *hash = recur_event_hash(rev);
+		cond = !hash_matches(filter->hash, hash);
+		mem_free(hash);
+	}
+
+	return filter->invert ? cond : !cond;
+}
+
+/*
+ * Build a recursive appointment from its parsed fields and description. The
+ * item is returned in *res without being added to the list.
+ */
+char *recur_apoint_scan(char *buf, struct tm start, struct tm end,
 				       char state, char *note,
 				       struct item_filter *filter,
-				       struct rpt *rpt)
+				       struct rpt *rpt,
+				       struct recur_apoint **res)
 {
-	char buf[BUFSIZ], *nl;
 	time_t tstart, tend;
-	struct recur_apoint *rapt = NULL;
-	int cond;
+
+	*res = NULL;
 
 	if (!check_date(start.tm_year, start.tm_mon, start.tm_mday) ||
 	    !check_date(end.tm_year, end.tm_mon, end.tm_mday) ||
@@ -495,14 +576,6 @@ char *recur_apoint_scan(FILE *f, struct tm start, struct tm end,
 	    !check_time(end.tm_hour, end.tm_min))
 		return _("illegal date in appointment");
 
-	/* Read the appointment description */
-	if (!fgets(buf, sizeof buf, f))
-		return _("error in appointment description");
-
-	nl = strchr(buf, '\n');
-	if (nl) {
-		*nl = '\0';
-	}
 	start.tm_sec = end.tm_sec = 0;
 	start.tm_isdst = end.tm_isdst = -1;
 	start.tm_year -= 1900;
@@ -524,57 +597,41 @@ char *recur_apoint_scan(FILE *f, struct tm start, struct tm end,
 
 	/* Filter item. */
 	if (filter) {
-		cond = (
-		    !(filter->type_mask & TYPE_MASK_RECUR_APPT) ||
-		    (filter->regex && regexec(filter->regex, buf, 0, 0, 0)) ||
-		    (filter->start_from != -1 && tstart < filter->start_from) ||
-		    (filter->start_to != -1 && tstart > filter->start_to) ||
-		    (filter->end_from != -1 && tend < filter->end_from) ||
-		    (filter->end_to != -1 && tend > filter->end_to)
-		);
-		if (filter->hash) {
-			rapt = recur_apoint_new(buf, note, tstart,
-						 tend - tstart, state,
-						 rpt);
-			char *hash = recur_apoint_hash(rapt);
-			cond = cond || !hash_matches(filter->hash, hash);
-			mem_free(hash);
-		}
-
-		if ((!filter->invert && cond) || (filter->invert && !cond)) {
-			if (filter->hash)
-				recur_apoint_erase(rapt);
+		struct recur_apoint tmp;
+
+		tmp.rpt = rpt;
+		tmp.exc = rpt->exc;
+		tmp.start = tstart;
+		tmp.dur = tend - tstart;
+		tmp.state = state;
+		tmp.mesg = buf;
+		tmp.note = note;
+		if (!recur_apoint_filter(&tmp, filter)) {
+			recur_free_rpt_lists(rpt);
 			return NULL;
 		}
 	}
-	if (!rapt)
-		rapt = recur_apoint_new(buf, note, tstart, tend - tstart, state,
-					 rpt);
+	*res = recur_apoint_alloc(buf, note, tstart, tend - tstart, state,
+				  rpt);
 	return NULL;
 }
 
-/* Load the recursive events from file */
-char *recur_event_scan(FILE * f, struct tm start, int id,
+/*
+ * Build a recursive event from its parsed fields and description. The item
+ * is returned in *res without being added to the list.
+ */
+char *recur_event_scan(char *buf, struct tm start, int id,
 				     char *note, struct item_filter *filter,
-				     struct rpt *rpt)
+				     struct rpt *rpt, struct recur_event **res)
 {
-	char buf[BUFSIZ], *nl;
-	time_t tstart, tend;
-	struct recur_event *rev = NULL;
-	int cond;
+	time_t tstart;
+
+	*res = NULL;
 
 	if (!check_date(start.tm_year, start.tm_mon, start.tm_mday) ||
 	    !check_time(start.tm_hour, start.tm_min))
 		return _("illegel date in event");
 
-	/* Read the event description */
-	if (!fgets(buf, sizeof buf, f))
-		return _("error in appointment description");
-
-	nl = strchr(buf, '\n');
-	if (nl) {
-		*nl = '\0';
-	}
 	start.tm_hour = 0;
 	start.tm_min = 0;
 	start.tm_sec = 0;
@@ -585,7 +642,6 @@ char *recur_event_scan(FILE * f, struct tm start, int id,
 	tstart = mktime(&start);
 	if (tstart == -1)
 		return _("date error in event");
-	tend = ENDOFDAY(tstart);
 
 	/* Does it occur on the start day? */
 	if (!recur_item_find_occurrence(tstart, -1, rpt, NULL,
@@ -596,171 +652,172 @@ char *recur_event_scan(FILE * f, struct tm start, int id,
 
 	/* Filter item. */
 	if (filter) {
-		cond = (
-		    !(filter->type_mask & TYPE_MASK_RECUR_EVNT) ||
-		    (filter->regex && regexec(filter->regex, buf, 0, 0, 0)) ||
-		    (filter->start_from != -1 && tstart < filter->start_from) ||
-		    (filter->start_to != -1 && tstart > filter->start_to) ||
-		    (filter->end_from != -1 && tend < filter->end_from) ||
-		    (filter->end_to != -1 && tend > filter->end_to)
-		);
-		if (filter->hash) {
-			rev = recur_event_new(buf, note, tstart, id,
-					       rpt);
-			char *hash = recur_event_hash(rev);
-			cond = cond || !hash_matches(filter->hash, hash);
-			mem_free(hash);
-		}
-
-		if ((!filter->invert && cond) || (filter->invert && !cond)) {
-			if (filter->hash)
-				recur_event_erase(rev);
+		struct recur_event tmp;
+
+		tmp.rpt = rpt;
+		tmp.exc = rpt->exc;
+		tmp.id = id;
+		tmp.day = tstart;
+		tmp.mesg = buf;
+		tmp.note = note;
+		if (!recur_event_filter(&tmp, filter)) {
+			recur_free_rpt_lists(rpt);
 			return NULL;
 		}
 	}
-	if (!rev)
-		rev = recur_event_new(buf, note, tstart, id, rpt);
+	*res = recur_event_alloc(buf, note, tstart, id, rpt);
 	return NULL;
 }
 
-char *recur_apoint_tostr(struct recur_apoint *o)
+/* Append the recurrence rule and exceptions shared by recurrent items. */
+static void recur_rpt_serialize(struct rpt *rpt, llist_t *exc,
+				struct string *s)
 {
-	struct string s;
 	struct tm lt;
 	time_t t;
 
-	string_init(&s);
+	string_catn(s, " {", 2);
+	string_catint(s, rpt->freq);
+	string_catc(s, recur_def2char(rpt->type));
+	t = rpt->until;
+	if (t != 0) {
+		localtime_r(&t, &lt);
+		string_catn(s, " -> ", 4);
+		string_catdate(s, &lt);
+	}
+	bymonthday_append(s, &rpt->bymonthday);
+	bywday_append(s, &rpt->bywday);
+	bymonth_append(s, &rpt->bymonth);
+	recur_exc_append(s, exc);
+	string_catn(s, "} ", 2);
+}
+
+/* Append the data file line of a recurrent appointment to a string. */
+void recur_apoint_serialize(struct recur_apoint *o, struct string *s)
+{
+	struct tm lt;
+	time_t t;
 
 	t = o->start;
 	localtime_r(&t, &lt);
-	string_catf(&s, "%02u/%02u/%04u @ %02u:%02u", lt.tm_mon + 1,
-		lt.tm_mday, 1900 + lt.tm_year, lt.tm_hour, lt.tm_min);
+	string_catdate(s, &lt);
+	string_catn(s, " @ ", 3);
+	string_cattime(s, &lt);
 
 	t = o->start + o->dur;
 	localtime_r(&t, &lt);
-	string_catf(&s, " -> %02u/%02u/%04u @ %02u:%02u", lt.tm_mon + 1,
-		lt.tm_mday, 1900 + lt.tm_year, lt.tm_hour, lt.tm_min);
-
-	t = o->rpt->until;
-	if (t == 0) {
-		/* We have an endless recurrent appointment. */
-		string_catf(&s, " {%d%c", o->rpt->freq,
-			recur_def2char(o->rpt->type));
-	} else {
-		localtime_r(&t, &lt);
-		string_catf(&s, " {%d%c -> %02u/%02u/%04u", o->rpt->freq,
-			recur_def2char(o->rpt->type), lt.tm_mon + 1,
-			lt.tm_mday, 1900 + lt.tm_year);
+	string_catn(s, " -> ", 4);
+	string_catdate(s, &lt);
+	string_catn(s, " @ ", 3);
+	string_cattime(s, &lt);
+
+	recur_rpt_serialize(o->rpt, &o->exc, s);
+	if (o->note) {
+		string_catc(s, '>');
+		string_cats(s, o->note);
+		string_catc(s, ' ');
 	}
-	bymonthday_append(&s, &o->rpt->bymonthday);
-	bywday_append(&s, &o->rpt->bywday);
-	bymonth_append(&s, &o->rpt->bymonth);
-	recur_exc_append(&s, &o->exc);
-	string_catf(&s, "} ");
-	if (o->note)
-		string_catf(&s, ">%s ", o->note);
-	if (o->state & APOINT_NOTIFY)
-		string_catf(&s, "%c", '!');
-	else
-		string_catf(&s, "%c", '|');
-	string_catf(&s, "%s", o->mesg);
+	string_catc(s, (o->state & APOINT_NOTIFY) ? '!' : '|');
+	string_cats(s, o->mesg);
+}
+
+char *recur_apoint_tostr(struct recur_apoint *o)
+{
+	struct string s;
+
+	string_init(&s);
+	recur_apoint_serialize(o, &s);
 
 	return string_buf(&s);
 }
 
 char *recur_apoint_hash(struct recur_apoint *rapt)
 {
-	char *raw = recur_apoint_tostr(rapt);
-	char *sha1 = mem_malloc(SHA1_DIGESTLEN * 2 + 1);
-	sha1_digest(raw, sha1);
-	mem_free(raw);
+	char buf[STRING_LOCAL_BUFSIZE];
+	char *sha1 = item_hash_lookup(rapt);
+	struct string s;
+
+	if (sha1)
+		return sha1;
+	sha1 = mem_malloc(SHA1_DIGESTLEN * 2 + 1);
+	string_init_buf(&s, buf, sizeof(buf));
+	recur_apoint_serialize(rapt, &s);
+	sha1_digest(string_buf(&s), sha1);
+	string_free(&s);
 
 	return sha1;
 }
 
 void recur_apoint_write(struct recur_apoint *o, FILE * f)
 {
-	char *str = recur_apoint_tostr(o);
-	fprintf(f, "%s\n", str);
-	mem_free(str);
+	char buf[STRING_LOCAL_BUFSIZE];
+	struct string s;
+
+	string_init_buf(&s, buf, sizeof(buf));
+	recur_apoint_serialize(o, &s);
+	string_catc(&s, '\n');
+	fwrite(string_buf(&s), 1, s.len, f);
+	string_free(&s);
 }
 
-char *recur_event_tostr(struct recur_event *o)
+/* Append the data file line of a recurrent event to a string. */
+void recur_event_serialize(struct recur_event *o, struct string *s)
 {
-	struct string s;
 	struct tm lt;
 	time_t t;
-	int st_mon, st_day, st_year;
-	int end_mon, end_day, end_year;
-
-	string_init(&s);
 
 	t = o->day;
 	localtime_r(&t, &lt);
-	st_mon = lt.tm_mon + 1;
-	st_day = lt.tm_mday;
-	st_year = lt.tm_year + 1900;
-	t = o->rpt->until;
-	if (t == 0) {
-		/* We have an endless recurrent event. */
-		string_catf(&s, "%02u/%02u/%04u [%d] {%d%c", st_mon, st_day,
-			st_year, o->id, o->rpt->freq,
-			recur_def2char(o->rpt->type));
-	} else {
-		localtime_r(&t, &lt);
-		end_mon = lt.tm_mon + 1;
-		end_day = lt.tm_mday;
-		end_year = lt.tm_year + 1900;
-		string_catf(&s, "%02u/%02u/%04u [%d] {%d%c -> %02u/%02u/%04u",
-			st_mon, st_day, st_year, o->id, o->rpt->freq,
-			recur_def2char(o->rpt->type), end_mon, end_day,
-			end_year);
+	string_catdate(s, &lt);
+	string_catn(s, " [", 2);
+	string_catint(s, o->id);
+	string_catc(s, ']');
+	recur_rpt_serialize(o->rpt, &o->exc, s);
+	if (o->note) {
+		string_catc(s, '>');
+		string_cats(s, o->note);
+		string_catc(s, ' ');
 	}
-	bymonthday_append(&s, &o->rpt->bymonthday);
-	bywday_append(&s, &o->rpt->bywday);
-	bymonth_append(&s, &o->rpt->bymonth);
-	recur_exc_append(&s, &o->exc);
-	string_catf(&s, "} ");
-	if (o->note)
-		string_catf(&s, ">%s ", o->note);
-	string_catf(&s, "%s", o->mesg);
+	string_cats(s, o->mesg);
+}
+
+char *recur_event_tostr(struct recur_event *o)
+{
+	struct string s;
+
+	string_init(&s);
+	recur_event_serialize(o, &s);
 
 	return string_buf(&s);
 }
 
 char *recur_event_hash(struct recur_event *rev)
 {
-	char *raw = recur_event_tostr(rev);
-	char *sha1 = mem_malloc(SHA1_DIGESTLEN * 2 + 1);
-	sha1_digest(raw, sha1);
-	mem_free(raw);
+	char buf[STRING_LOCAL_BUFSIZE];
+	char *sha1 = item_hash_lookup(rev);
+	struct string s;
+
+	if (sha1)
+		return sha1;
+	sha1 = mem_malloc(SHA1_DIGESTLEN * 2 + 1);
+	string_init_buf(&s, buf, sizeof(buf));
+	recur_event_serialize(rev, &s);
+	sha1_digest(string_buf(&s), sha1);
+	string_free(&s);
 
 	return sha1;
 }
 
 void recur_event_write(struct recur_event *o, FILE * f)
 {
-	char *str = recur_event_tostr(o);
-	fprintf(f, "%s\n", str);
-	mem_free(str);
-}
-
-/* Write recursive items to file. */
-void recur_save_data(FILE * f)
-{
-	llist_item_t *i;
-
-	LLIST_FOREACH(&recur_elist, i) {
-		struct recur_event *rev = LLIST_GET_DATA(i);
-		recur_event_write(rev, f);
-	}
+	char buf[STRING_LOCAL_BUFSIZE];
+	struct string s;
 
-	LLIST_TS_LOCK(&recur_alist_p);
-	LLIST_TS_FOREACH(&recur_alist_p, i) {
-		struct recur_apoint *rapt = LLIST_GET_DATA(i);
-		recur_apoint_write(rapt, f);
-	}
-	LLIST_TS_UNLOCK(&recur_alist_p);
+	string_init_buf(&s, buf, sizeof(buf));
+	recur_event_serialize(o, &s);
+	string_catc(&s, '\n');
+	fwrite(string_buf(&s), 1, s.len, f);
+	string_free(&s);
 }
 
 /*
@@ -1612,81 +1669,91 @@ void recur_apoint_erase(struct recur_apoint *rapt)
 	LLIST_TS_UNLOCK(&recur_alist_p);
 }
 
+/*
+ * The list readers below parse the optional parts of a recurrence rule. They
+ * return an error message (NULL on success) so that the caller can report the
+ * offending line; the list is left initialized in either case.
+ */
+
 /* Read monthday list. */
-void recur_bymonthday(llist_t *l, FILE *data_file)
+char *recur_bymonthday(llist_t *l, char **s)
 {
-	int c = 0, d;
+	int d;
 
 	LLIST_INIT(l);
-	while ((c = getc(data_file)) == 'd') {
-		ungetc(c, data_file);
-		if (fscanf(data_file, "d%d ", &d) != 1)
-			EXIT(_("syntax error in bymonthday"));
+	while (**s == 'd') {
+		(*s)++;
+		if (!io_scan_int(s, &d))
+			return _("syntax error in bymonthday");
+		io_scan_space(s);
 		int *i = mem_malloc(sizeof(int));
 		*i = d;
 		LLIST_ADD(l, i);
 	}
-	ungetc(c, data_file);
+	return NULL;
 }
 
 /* Read weekday list. */
-void recur_bywday(enum recur_type type, llist_t *l, FILE *data_file)
+char *recur_bywday(enum recur_type type, llist_t *l, char **s)
 {
-	int c = 0, w;
+	int w;
 
 	type = !(type == RECUR_MONTHLY || type == RECUR_YEARLY);
 
 	LLIST_INIT(l);
-	while ((c = getc(data_file)) == 'w') {
-		ungetc(c, data_file);
-		if (fscanf(data_file, "w%d ", &w) != 1)
-			EXIT(_("syntax error in bywday"));
+	while (**s == 'w') {
+		(*s)++;
+		if (!io_scan_int(s, &w))
+			return _("syntax error in bywday");
+		io_scan_space(s);
 		if (type && (w < 0 || w > 6))
-			EXIT(_("illegal BYDAY value"));
+			return _("illegal BYDAY value");
 		int *i = mem_malloc(sizeof(int));
 		*i = w;
 		LLIST_ADD(l, i);
 	}
-	ungetc(c, data_file);
+	return NULL;
 }
 
 /* Read month list. */
-void recur_bymonth(llist_t *l, FILE *data_file)
+char *recur_bymonth(llist_t *l, char **s)
 {
-	int c = 0, m;
+	int m;
 
 	LLIST_INIT(l);
-	while ((c = getc(data_file)) == 'm') {
-		ungetc(c, data_file);
-		if (fscanf(data_file, "m%d ", &m) != 1)
-			EXIT(_("syntax error in bymonth"));
-		EXIT_IF(m < 1 || m > 12, _("illegal bymonth value"));
+	while (**s == 'm') {
+		(*s)++;
+		if (!io_scan_int(s, &m))
+			return _("syntax error in bymonth");
+		io_scan_space(s);
+		if (m < 1 || m > 12)
+			return _("illegal bymonth value");
 		int *i = mem_malloc(sizeof(int));
 		*i = m;
 		LLIST_ADD(l, i);
 	}
-	ungetc(c, data_file);
+	return NULL;
 }
 
 /*
  * Read days for which recurrent items must not be repeated
  * (such days are called exceptions).
  */
-void recur_exc_scan(llist_t * lexc, FILE * data_file)
+char *recur_exc_scan(llist_t * lexc, char **s)
 {
-	int c = 0;
 	struct tm day;
 
 	LLIST_INIT(lexc);
-	while ((c = getc(data_file)) == '!') {
-		ungetc(c, data_file);
-		if (fscanf(data_file, "!%d / %d / %d ",
-			   &day.tm_mon, &day.tm_mday, &day.tm_year) != 3) {
-			EXIT(_("syntax error in item date"));
+	while (**s == '!') {
+		(*s)++;
+		if (!io_scan_date(s, &day.tm_mon, &day.tm_mday,
+				  &day.tm_year)) {
+			return _("syntax error in item date");
 		}
+		io_scan_space(s);
 
-		EXIT_IF(!check_date(day.tm_year, day.tm_mon, day.tm_mday),
-			_("date error in item exception"));
+		if (!check_date(day.tm_year, day.tm_mon, day.tm_mday))
+			return _("date error in item exception");
 
 		day.tm_hour = 0;
 		day.tm_min = day.tm_sec = 0;
@@ -1697,7 +1764,7 @@ void recur_exc_scan(llist_t * lexc, FILE * data_file)
 		exc->st = mktime(&day);
 		LLIST_ADD(lexc, exc);
 	}
-	ungetc(c, data_file);
+	return NULL;
 }
 
 /*
@@ -39,10 +39,24 @@
  *
  */
 
+#include "config.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef HAVE_SHA1_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+#ifdef HAVE_SHA1_ARM
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA1
+#define HWCAP_SHA1 (1 << 5)
+#endif
+#endif
+
 #include "sha1.h"
 
 #define rol(val, n) (((val) << (n)) | ((val) >> (32 - (n))))
@@ -68,20 +82,23 @@
 #define R4(v, w, x, y, z, i) z += (w ^ x ^ y) + blk (i) + 0xCA62C1D6 + \
     rol (v, 5); w = rol (w, 30);
 
-static void sha1_transform(uint32_t state[5], const uint8_t buffer[64])
+static void sha1_block_generic(uint32_t state[5], const uint8_t buffer[64])
 {
 	typedef union {
 		uint8_t c[64];
 		uint32_t l[16];
 	} b64_t;
 
-	b64_t *block = (b64_t *) buffer;
+	b64_t blk, *block = &blk;
 	uint32_t a = state[0];
 	uint32_t b = state[1];
 	uint32_t c = state[2];
 	uint32_t d = state[3];
 	uint32_t e = state[4];
 
+	/* The message schedule is built in place, do not touch the input. */
+	memcpy(block, buffer, SHA1_BLOCKLEN);
+
 	R0(a, b, c, d, e, 0);
 	R0(e, a, b, c, d, 1);
 	R0(d, e, a, b, c, 2);
@@ -170,6 +187,349 @@ static void sha1_transform(uint32_t state[5], const uint8_t buffer[64])
 	state[4] += e;
 
 	a = b = c = d = e = 0;
+	memset(block, 0, SHA1_BLOCKLEN);
+}
+
+static void sha1_transform_generic(uint32_t state[5], const uint8_t *data,
+				   size_t nblocks)
+{
+	for (; nblocks > 0; nblocks--, data += SHA1_BLOCKLEN)
+		sha1_block_generic(state, data);
+}
+
+static const uint32_t sha1_k[4] = {
+	0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6
+};
+
+/* Round functions, for the variants that do not use the macros above. */
+#define R0_F(x, y, z) (((x) & ((y) ^ (z))) ^ (z))
+#define R2_F(x, y, z) ((x) ^ (y) ^ (z))
+#define R3_F(x, y, z) ((((x) | (y)) & (z)) | ((x) & (y)))
+
+#ifdef HAVE_SHA1_X86
+
+/*
+ * Four rounds with the SHA extensions, interleaved with the computation of the
+ * message schedule for the following rounds. m0 holds the message words of
+ * the current rounds, e0 receives the fifth state word for the next ones.
+ */
+#define SHANI_ROUNDS(f, e0, e1, m0, m1, m2, m3) \
+	e0 = _mm_sha1nexte_epu32(e0, m0); \
+	e1 = abcd; \
+	m1 = _mm_sha1msg2_epu32(m1, m0); \
+	abcd = _mm_sha1rnds4_epu32(abcd, e0, f); \
+	m3 = _mm_sha1msg1_epu32(m3, m0); \
+	m2 = _mm_xor_si128(m2, m0);
+
+__attribute__((target("sha,sse4.1")))
+static void sha1_transform_shani(uint32_t state[5], const uint8_t *data,
+				 size_t nblocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+					    0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e0, e0_save, e1;
+	__m128i msg0, msg1, msg2, msg3;
+
+	abcd = _mm_loadu_si128((const __m128i *)state);
+	abcd = _mm_shuffle_epi32(abcd, 0x1B);
+	e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+	for (; nblocks > 0; nblocks--, data += SHA1_BLOCKLEN) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		/* Rounds 0-11 only consume the message words. */
+		msg0 = _mm_loadu_si128((const __m128i *)data);
+		msg0 = _mm_shuffle_epi8(msg0, mask);
+		e0 = _mm_add_epi32(e0, msg0);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+		msg1 = _mm_loadu_si128((const __m128i *)(data + 16));
+		msg1 = _mm_shuffle_epi8(msg1, mask);
+		e1 = _mm_sha1nexte_epu32(e1, msg1);
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+		msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+		msg2 = _mm_loadu_si128((const __m128i *)(data + 32));
+		msg2 = _mm_shuffle_epi8(msg2, mask);
+		e0 = _mm_sha1nexte_epu32(e0, msg2);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+		msg0 = _mm_xor_si128(msg0, msg2);
+
+		msg3 = _mm_loadu_si128((const __m128i *)(data + 48));
+		msg3 = _mm_shuffle_epi8(msg3, mask);
+
+		/* Rounds 12-67. */
+		SHANI_ROUNDS(0, e1, e0, msg3, msg0, msg1, msg2);
+		SHANI_ROUNDS(0, e0, e1, msg0, msg1, msg2, msg3);
+		SHANI_ROUNDS(1, e1, e0, msg1, msg2, msg3, msg0);
+		SHANI_ROUNDS(1, e0, e1, msg2, msg3, msg0, msg1);
+		SHANI_ROUNDS(1, e1, e0, msg3, msg0, msg1, msg2);
+		SHANI_ROUNDS(1, e0, e1, msg0, msg1, msg2, msg3);
+		SHANI_ROUNDS(1, e1, e0, msg1, msg2, msg3, msg0);
+		SHANI_ROUNDS(2, e0, e1, msg2, msg3, msg0, msg1);
+		SHANI_ROUNDS(2, e1, e0, msg3, msg0, msg1, msg2);
+		SHANI_ROUNDS(2, e0, e1, msg0, msg1, msg2, msg3);
+		SHANI_ROUNDS(2, e1, e0, msg1, msg2, msg3, msg0);
+		SHANI_ROUNDS(2, e0, e1, msg2, msg3, msg0, msg1);
+		SHANI_ROUNDS(3, e1, e0, msg3, msg0, msg1, msg2);
+		SHANI_ROUNDS(3, e0, e1, msg0, msg1, msg2, msg3);
+
+		/* Rounds 68-79 finish off the message schedule. */
+		e1 = _mm_sha1nexte_epu32(e1, msg1);
+		e0 = abcd;
+		msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+		msg3 = _mm_xor_si128(msg3, msg1);
+
+		e0 = _mm_sha1nexte_epu32(e0, msg2);
+		e1 = abcd;
+		msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+		e1 = _mm_sha1nexte_epu32(e1, msg3);
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+		e0 = _mm_sha1nexte_epu32(e0, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+	}
+
+	abcd = _mm_shuffle_epi32(abcd, 0x1B);
+	_mm_storeu_si128((__m128i *)state, abcd);
+	state[4] = _mm_extract_epi32(e0, 3);
+}
+
+/*
+ * Compute the message schedule four words at a time, with the round constants
+ * added in. The last word of each group of four depends on the first one,
+ * which is patched in afterwards.
+ */
+__attribute__((target("ssse3")))
+static inline void sha1_schedule_ssse3(__m128i w[20], uint32_t wk[80], int i)
+{
+	__m128i x, fix;
+
+	if (i >= 20)
+		return;
+
+	x = _mm_xor_si128(w[i - 4], _mm_alignr_epi8(w[i - 3], w[i - 4], 8));
+	x = _mm_xor_si128(x, w[i - 2]);
+	x = _mm_xor_si128(x, _mm_srli_si128(w[i - 1], 4));
+	x = _mm_or_si128(_mm_slli_epi32(x, 1), _mm_srli_epi32(x, 31));
+	fix = _mm_slli_si128(x, 12);
+	fix = _mm_or_si128(_mm_slli_epi32(fix, 1), _mm_srli_epi32(fix, 31));
+	w[i] = _mm_xor_si128(x, fix);
+
+	x = _mm_add_epi32(w[i], _mm_set1_epi32(sha1_k[i / 5]));
+	_mm_storeu_si128((__m128i *)&wk[4 * i], x);
+}
+
+/*
+ * Four rounds on the precomputed schedule. The schedule of the words needed
+ * four groups later is computed in between, so that it overlaps with the
+ * rounds.
+ */
+#define WK_ROUND(f, v, w, x, y, z, i) \
+	z += f(w, x, y) + wk[i] + rol(v, 5); w = rol(w, 30);
+#define WK_GROUP(f, j, v, w, x, y, z) \
+	sha1_schedule_ssse3(ws, wk, (j) + 4); \
+	WK_ROUND(f, v, w, x, y, z, 4 * (j)); \
+	WK_ROUND(f, z, v, w, x, y, 4 * (j) + 1); \
+	WK_ROUND(f, y, z, v, w, x, 4 * (j) + 2); \
+	WK_ROUND(f, x, y, z, v, w, 4 * (j) + 3);
+#define WK_GROUPS(f, j) \
+	WK_GROUP(f, j, a, b, c, d, e) \
+	WK_GROUP(f, j + 1, b, c, d, e, a) \
+	WK_GROUP(f, j + 2, c, d, e, a, b) \
+	WK_GROUP(f, j + 3, d, e, a, b, c) \
+	WK_GROUP(f, j + 4, e, a, b, c, d)
+
+__attribute__((target("ssse3")))
+static void sha1_transform_ssse3(uint32_t state[5], const uint8_t *data,
+				 size_t nblocks)
+{
+	const __m128i mask = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+					  4, 5, 6, 7, 0, 1, 2, 3);
+	__m128i ws[20], x;
+	uint32_t wk[80], a, b, c, d, e;
+	int i;
+
+	for (; nblocks > 0; nblocks--, data += SHA1_BLOCKLEN) {
+		for (i = 0; i < 4; i++) {
+			ws[i] = _mm_loadu_si128((const __m128i *)(data + 16 * i));
+			ws[i] = _mm_shuffle_epi8(ws[i], mask);
+			x = _mm_add_epi32(ws[i], _mm_set1_epi32(sha1_k[0]));
+			_mm_storeu_si128((__m128i *)&wk[4 * i], x);
+		}
+
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
+		e = state[4];
+		WK_GROUPS(R0_F, 0);
+		WK_GROUPS(R2_F, 5);
+		WK_GROUPS(R3_F, 10);
+		WK_GROUPS(R2_F, 15);
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+	}
+
+	memset(wk, 0, sizeof(wk));
+}
+
+static int sha1_have_shani(void)
+{
+	unsigned a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSE4_1))
+		return 0;
+	if (__get_cpuid_max(0, NULL) < 7)
+		return 0;
+	__cpuid_count(7, 0, a, b, c, d);
+	return (b & bit_SHA) != 0;
+}
+
+static int sha1_have_ssse3(void)
+{
+	unsigned a, b, c, d;
+
+	return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSSE3);
+}
+
+#endif
+
+#ifdef HAVE_SHA1_ARM
+
+/*
+ * The crypto extensions run four rounds per instruction. Each group of rounds
+ * also adds the round constants to the message words two groups ahead and
+ * advances the message schedule.
+ */
+__attribute__((target("+crypto")))
+static void sha1_transform_armv8(uint32_t state[5], const uint8_t *data,
+				 size_t nblocks)
+{
+	uint32x4_t abcd, abcd_save, msg[4], tmp[2], k[4];
+	uint32_t e, e_save, e_next;
+	int g;
+
+	for (g = 0; g < 4; g++)
+		k[g] = vdupq_n_u32(sha1_k[g]);
+
+	abcd = vld1q_u32(state);
+	e = state[4];
+
+	for (; nblocks > 0; nblocks--, data += SHA1_BLOCKLEN) {
+		abcd_save = abcd;
+		e_save = e;
+
+		for (g = 0; g < 4; g++)
+			msg[g] = vreinterpretq_u32_u8(vrev32q_u8(
+			    vld1q_u8(data + 16 * g)));
+		tmp[0] = vaddq_u32(msg[0], k[0]);
+		tmp[1] = vaddq_u32(msg[1], k[0]);
+
+		for (g = 0; g < 20; g++) {
+			e_next = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+			if (g < 5)
+				abcd = vsha1cq_u32(abcd, e, tmp[g & 1]);
+			else if (g >= 10 && g < 15)
+				abcd = vsha1mq_u32(abcd, e, tmp[g & 1]);
+			else
+				abcd = vsha1pq_u32(abcd, e, tmp[g & 1]);
+			if (g < 18)
+				tmp[g & 1] = vaddq_u32(msg[(g + 2) & 3],
+						       k[(g + 2) / 5]);
+			if (g >= 1 && g <= 16)
+				msg[(g - 1) & 3] =
+				    vsha1su1q_u32(msg[(g - 1) & 3],
+						  msg[(g + 2) & 3]);
+			if (g <= 15)
+				msg[g & 3] = vsha1su0q_u32(msg[g & 3],
+							   msg[(g + 1) & 3],
+							   msg[(g + 2) & 3]);
+			e = e_next;
+		}
+
+		abcd = vaddq_u32(abcd, abcd_save);
+		e += e_save;
+	}
+
+	vst1q_u32(state, abcd);
+	state[4] = e;
+}
+
+static int sha1_have_armv8(void)
+{
+	return (getauxval(AT_HWCAP) & HWCAP_SHA1) != 0;
+}
+
+#endif
+
+/* Implementations of the compression function, fastest first. */
+static const struct sha1_impl {
+	const char *name;
+	void (*transform)(uint32_t *, const uint8_t *, size_t);
+	int (*supported)(void);
+} sha1_impls[] = {
+#ifdef HAVE_SHA1_X86
+	{ "shani", sha1_transform_shani, sha1_have_shani },
+	{ "ssse3", sha1_transform_ssse3, sha1_have_ssse3 },
+#endif
+#ifdef HAVE_SHA1_ARM
+	{ "armv8", sha1_transform_armv8, sha1_have_armv8 },
+#endif
+	{ "generic", sha1_transform_generic, NULL }
+};
+
+#define SHA1_NIMPLS (sizeof(sha1_impls) / sizeof(sha1_impls[0]))
+
+static const struct sha1_impl *sha1_impl;
+
+/*
+ * Select the implementation of the compression function with the given name,
+ * or the fastest one the processor supports if name is NULL. Return 0 if the
+ * implementation is not available.
+ */
+int sha1_impl_set(const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < SHA1_NIMPLS; i++) {
+		if (name && strcmp(sha1_impls[i].name, name) != 0)
+			continue;
+		if (sha1_impls[i].supported && !sha1_impls[i].supported())
+			continue;
+		sha1_impl = &sha1_impls[i];
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Return the name of the implementation in use. */
+const char *sha1_impl_name(void)
+{
+	if (!sha1_impl)
+		sha1_impl_set(NULL);
+	return sha1_impl->name;
+}
+
+static void sha1_transform(uint32_t state[5], const uint8_t *data,
+			   size_t nblocks)
+{
+	if (!sha1_impl)
+		sha1_impl_set(NULL);
+	sha1_impl->transform(state, data, nblocks);
 }
 
 void sha1_init(sha1_ctx_t * ctx)
@@ -194,9 +554,9 @@ void sha1_update(sha1_ctx_t * ctx, const uint8_t * data, unsigned int len)
 
 	if (j + len > 63) {
 		memcpy(&ctx->buffer[j], data, (i = 64 - j));
-		sha1_transform(ctx->state, ctx->buffer);
-		for (; i + 63 < len; i += 64)
-			sha1_transform(ctx->state, &data[i]);
+		sha1_transform(ctx->state, ctx->buffer, 1);
+		sha1_transform(ctx->state, &data[i], (len - i) / 64);
+		i += (len - i) / 64 * 64;
 		j = 0;
 	} else {
 		i = 0;
@@ -232,23 +592,27 @@ void sha1_final(sha1_ctx_t * ctx, uint8_t digest[SHA1_DIGESTLEN])
 	memset(&finalcount, 0, 8);
 }
 
-void sha1_digest(const char *data, char *buffer)
+/* Finalize the computation and write the digest in hexadecimal notation. */
+void sha1_final_hex(sha1_ctx_t * ctx, char *buffer)
 {
-	char *buf = strdup(data);
-	sha1_ctx_t ctx;
 	uint8_t digest[SHA1_DIGESTLEN];
 	int i;
 
-	sha1_init(&ctx);
-	sha1_update(&ctx, (const uint8_t *)buf, strlen(buf));
-	sha1_final(&ctx, (uint8_t *) digest);
+	sha1_final(ctx, (uint8_t *) digest);
 
 	for (i = 0; i < SHA1_DIGESTLEN; i++) {
 		snprintf(buffer, 3, "%02x", digest[i]);
 		buffer += sizeof(char) * 2;
 	}
+}
 
-	free(buf);
+void sha1_digest(const char *data, char *buffer)
+{
+	sha1_ctx_t ctx;
+
+	sha1_init(&ctx);
+	sha1_update(&ctx, (const uint8_t *)data, strlen(data));
+	sha1_final_hex(&ctx, buffer);
 }
 
 void sha1_stream(FILE * fp, char *buffer)
@@ -256,8 +620,6 @@ void sha1_stream(FILE * fp, char *buffer)
 	sha1_ctx_t ctx;
 	uint8_t data[BUFSIZ];
 	size_t bytes_read;
-	uint8_t digest[SHA1_DIGESTLEN];
-	int i;
 
 	sha1_init(&ctx);
 
@@ -266,10 +628,231 @@ void sha1_stream(FILE * fp, char *buffer)
 		sha1_update(&ctx, data, bytes_read);
 	}
 
-	sha1_final(&ctx, (uint8_t *) digest);
+	sha1_final_hex(&ctx, buffer);
+}
 
-	for (i = 0; i < SHA1_DIGESTLEN; i++) {
-		snprintf(buffer, 3, "%02x", digest[i]);
-		buffer += sizeof(char) * 2;
+/*
+ * Hash many short messages at once. Each lane of a vector works on its own
+ * message, so that the rounds of SHA1_LANES messages run side by side; a lane
+ * that is done with its message picks up the next one. This pays off for item
+ * hashes, where the messages are only a few blocks long and hashing them one
+ * after the other leaves most of the processor idle.
+ */
+#ifdef __GNUC__
+
+#define SHA1_LANES 8
+
+typedef uint32_t sha1_vec_t __attribute__((vector_size(SHA1_LANES * 4)));
+
+#define VSPLAT(k) ((sha1_vec_t){ k, k, k, k, k, k, k, k })
+#define VROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define MB_ROUND(f, k, v, w, x, y, z, i) \
+	if ((i) >= 16) \
+		m[(i) & 15] = VROL(m[((i) - 3) & 15] ^ m[((i) - 8) & 15] ^ \
+				   m[((i) - 14) & 15] ^ m[(i) & 15], 1); \
+	z += f(w, x, y) + VSPLAT(k) + m[(i) & 15] + VROL(v, 5); \
+	w = VROL(w, 30);
+#define MB_ROUNDS(f, k, i) \
+	MB_ROUND(f, k, a, b, c, d, e, i) \
+	MB_ROUND(f, k, e, a, b, c, d, (i) + 1) \
+	MB_ROUND(f, k, d, e, a, b, c, (i) + 2) \
+	MB_ROUND(f, k, c, d, e, a, b, (i) + 3) \
+	MB_ROUND(f, k, b, c, d, e, a, (i) + 4)
+
+/* State of the lanes, one row per state word. */
+struct sha1_mb {
+	uint32_t state[5][SHA1_LANES];
+	const uint8_t *block[SHA1_LANES];
+	uint8_t tail[SHA1_LANES][2 * SHA1_BLOCKLEN];
+	const uint8_t *data[SHA1_LANES];
+	size_t full[SHA1_LANES], nblocks[SHA1_LANES], pos[SHA1_LANES];
+	unsigned msg[SHA1_LANES];
+};
+
+static __inline__ __attribute__((always_inline))
+void sha1_mb_block(struct sha1_mb *mb)
+{
+	sha1_vec_t a, b, c, d, e, a0, b0, c0, d0, e0, m[16];
+	uint32_t w[SHA1_LANES];
+	const uint8_t *p;
+	int i, l;
+
+	for (i = 0; i < 16; i++) {
+		for (l = 0; l < SHA1_LANES; l++) {
+			p = mb->block[l] + 4 * i;
+			w[l] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+			       (uint32_t)p[2] << 8 | p[3];
+		}
+		memcpy(&m[i], w, sizeof(w));
+	}
+	memcpy(&a, mb->state[0], sizeof(a));
+	memcpy(&b, mb->state[1], sizeof(b));
+	memcpy(&c, mb->state[2], sizeof(c));
+	memcpy(&d, mb->state[3], sizeof(d));
+	memcpy(&e, mb->state[4], sizeof(e));
+	a0 = a;
+	b0 = b;
+	c0 = c;
+	d0 = d;
+	e0 = e;
+
+	for (i = 0; i < 20; i += 5) {
+		MB_ROUNDS(R0_F, 0x5A827999, i);
+	}
+	for (; i < 40; i += 5) {
+		MB_ROUNDS(R2_F, 0x6ED9EBA1, i);
+	}
+	for (; i < 60; i += 5) {
+		MB_ROUNDS(R3_F, 0x8F1BBCDC, i);
+	}
+	for (; i < 80; i += 5) {
+		MB_ROUNDS(R2_F, 0xCA62C1D6, i);
 	}
+
+	a += a0;
+	b += b0;
+	c += c0;
+	d += d0;
+	e += e0;
+	memcpy(mb->state[0], &a, sizeof(a));
+	memcpy(mb->state[1], &b, sizeof(b));
+	memcpy(mb->state[2], &c, sizeof(c));
+	memcpy(mb->state[3], &d, sizeof(d));
+	memcpy(mb->state[4], &e, sizeof(e));
+}
+
+/* Set up a lane for a message, padding its last block(s) on the side. */
+static void sha1_mb_start(struct sha1_mb *mb, int l, unsigned msg,
+			  const char *data, size_t len)
+{
+	static const uint32_t iv[5] = {
+		0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0
+	};
+	uint8_t *tail = mb->tail[l];
+	size_t rem = len % SHA1_BLOCKLEN, ntail;
+	uint64_t bits = (uint64_t)len << 3;
+	int i;
+
+	ntail = rem + 9 <= SHA1_BLOCKLEN ? 1 : 2;
+	memcpy(tail, data + len - rem, rem);
+	tail[rem] = 0x80;
+	memset(tail + rem + 1, 0, ntail * SHA1_BLOCKLEN - rem - 1);
+	for (i = 0; i < 8; i++)
+		tail[ntail * SHA1_BLOCKLEN - 1 - i] = (bits >> (8 * i)) & 0xff;
+
+	for (i = 0; i < 5; i++)
+		mb->state[i][l] = iv[i];
+	mb->data[l] = (const uint8_t *)data;
+	mb->full[l] = len / SHA1_BLOCKLEN;
+	mb->nblocks[l] = mb->full[l] + ntail;
+	mb->pos[l] = 0;
+	mb->msg[l] = msg;
+}
+
+static void sha1_mb_finish(struct sha1_mb *mb, int l, char *out)
+{
+	static const char hex[] = "0123456789abcdef";
+	uint32_t v;
+	int i, j;
+
+	for (i = 0; i < 5; i++) {
+		v = mb->state[i][l];
+		for (j = 7; j >= 0; j--, v >>= 4)
+			out[8 * i + j] = hex[v & 15];
+	}
+	out[SHA1_DIGESTLEN * 2] = '\0';
+}
+
+static __inline__ __attribute__((always_inline))
+void sha1_mb_run(unsigned n, const char *const *data, const size_t *len,
+		 char **out)
+{
+	static const uint8_t idle[SHA1_BLOCKLEN];
+	struct sha1_mb mb;
+	unsigned next = 0, active = 0;
+	size_t pos;
+	int l;
+
+	for (l = 0; l < SHA1_LANES; l++) {
+		mb.msg[l] = n;
+		if (next < n) {
+			sha1_mb_start(&mb, l, next, data[next], len[next]);
+			next++;
+			active++;
+		}
+	}
+
+	while (active > 0) {
+		for (l = 0; l < SHA1_LANES; l++) {
+			pos = mb.pos[l];
+			if (mb.msg[l] == n)
+				mb.block[l] = idle;
+			else if (pos < mb.full[l])
+				mb.block[l] = mb.data[l] + pos * SHA1_BLOCKLEN;
+			else
+				mb.block[l] = mb.tail[l] +
+				    (pos - mb.full[l]) * SHA1_BLOCKLEN;
+		}
+
+		sha1_mb_block(&mb);
+
+		for (l = 0; l < SHA1_LANES; l++) {
+			if (mb.msg[l] == n || ++mb.pos[l] < mb.nblocks[l])
+				continue;
+			sha1_mb_finish(&mb, l, out[mb.msg[l]]);
+			mb.msg[l] = n;
+			active--;
+			if (next < n) {
+				sha1_mb_start(&mb, l, next, data[next],
+					      len[next]);
+				next++;
+				active++;
+			}
+		}
+	}
+}
+
+static void sha1_mb_generic(unsigned n, const char *const *data,
+			    const size_t *len, char **out)
+{
+	sha1_mb_run(n, data, len, out);
+}
+
+#ifdef HAVE_SHA1_X86
+__attribute__((target("avx2")))
+static void sha1_mb_avx2(unsigned n, const char *const *data,
+			 const size_t *len, char **out)
+{
+	sha1_mb_run(n, data, len, out);
+}
+#endif
+
+#endif
+
+/*
+ * Compute the digests of n messages, given with their lengths, and write them
+ * in hexadecimal notation to out.
+ */
+void sha1_digest_many(unsigned n, const char *const *data, const size_t *len,
+		      char **out)
+{
+#ifdef __GNUC__
+#ifdef HAVE_SHA1_X86
+	if (__builtin_cpu_supports("avx2")) {
+		sha1_mb_avx2(n, data, len, out);
+		return;
+	}
+#endif
+	sha1_mb_generic(n, data, len, out);
+#else
+	sha1_ctx_t ctx;
+	unsigned i;
+
+	for (i = 0; i < n; i++) {
+		sha1_init(&ctx);
+		sha1_update(&ctx, (const uint8_t *)data[i], len[i]);
+		sha1_final_hex(&ctx, out[i]);
+	}
+#endif
 }
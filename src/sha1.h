@@ -39,6 +39,7 @@
  *
  */
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define SHA1_BLOCKLEN   64
@@ -53,5 +54,9 @@ typedef struct {
 void sha1_init(sha1_ctx_t *);
 void sha1_update(sha1_ctx_t *, const uint8_t *, unsigned int);
 void sha1_final(sha1_ctx_t *, uint8_t *);
+void sha1_final_hex(sha1_ctx_t *, char *);
 void sha1_digest(const char *, char *);
 void sha1_stream(FILE *, char *);
+void sha1_digest_many(unsigned, const char *const *, const size_t *, char **);
+int sha1_impl_set(const char *);
+const char *sha1_impl_name(void);
@@ -0,0 +1,698 @@
+/*
+ * Calcurse - text-based organizer
+ *
+ * Copyright (c) 2004-2020 calcurse Development Team <misc@calcurse.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the
+ *        following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the
+ *        following disclaimer in the documentation and/or other
+ *        materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Send your feedback or comments to : misc@calcurse.org
+ * Calcurse home page : http://calcurse.org
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "calcurse.h"
+#include "checksum.h"
+
+/*
+ * Binary snapshots of the data files.
+ *
+ * A snapshot holds the items of a data file in a form that can be loaded
+ * without parsing dates or calling mktime(3). It is only a cache: the text
+ * file stays the reference and the snapshot is ignored as soon as the text
+ * file, the snapshot format or the time zone rules do not match anymore.
+ *
+ * The file starts with a header identifying the text file (size, mtime,
+ * ctime, inode and checksum), followed by one record per item. Numbers are
+ * stored in host byte order; strings are stored with their length and a
+ * trailing null byte so that they can be used directly from the mapping.
+ */
+
+#define SNAPSHOT_MAGIC		"CALCSNAP"
+#define SNAPSHOT_VERSION	2
+#define SNAPSHOT_BYTEORDER	0x01020304
+#define SNAPSHOT_EXT		".snap"
+#define SNAPSHOT_NULLSTR	UINT32_MAX
+
+/* Record types. */
+#define SNAPSHOT_REC_APOINT		'a'
+#define SNAPSHOT_REC_EVENT		'e'
+#define SNAPSHOT_REC_RECUR_APOINT	'A'
+#define SNAPSHOT_REC_RECUR_EVENT	'E'
+#define SNAPSHOT_REC_TODO		't'
+
+struct snapshot_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t type;
+	uint32_t byteorder;
+	uint32_t timesize;
+	uint64_t size;		/* size of the text file */
+	uint64_t ino;		/* inode of the text file */
+	uint64_t dev;		/* device of the text file */
+	int64_t mtime_sec;	/* modification time of the text file */
+	int64_t mtime_nsec;
+	int64_t ctime_sec;	/* status change time of the text file */
+	int64_t ctime_nsec;
+	int64_t written;	/* time the snapshot was written */
+	int64_t tz[4];		/* time zone fingerprint */
+	uint64_t len;		/* length of the records */
+	uint32_t count;		/* number of records */
+	char sum[CHECKSUM_LEN * 2 + 1];
+};
+
+struct snapshot {
+	FILE *fp;
+	char *path;
+	char *tmppath;
+	struct snapshot_header hdr;
+};
+
+/* Cursor used to read the records of a mapped snapshot. */
+struct snapshot_reader {
+	const char *p;
+	const char *end;
+};
+
+/*
+ * Local times of a few reference dates. Snapshots store item dates as
+ * timestamps, which are only valid for the time zone they were computed in.
+ */
+static void snapshot_tz(int64_t tz[4])
+{
+	struct tm tm;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		memset(&tm, 0, sizeof(tm));
+		tm.tm_year = i < 2 ? 100 : 130;
+		tm.tm_mon = i % 2 ? 6 : 0;
+		tm.tm_mday = 1;
+		tm.tm_hour = 12;
+		tm.tm_isdst = -1;
+		tz[i] = mktime(&tm);
+	}
+}
+
+static void snapshot_header_init(struct snapshot_header *hdr,
+				 enum snapshot_type type, struct stat *st,
+				 const char *sum)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic));
+	hdr->version = SNAPSHOT_VERSION;
+	hdr->type = type;
+	hdr->byteorder = SNAPSHOT_BYTEORDER;
+	hdr->timesize = sizeof(time_t);
+	hdr->size = st->st_size;
+	hdr->ino = st->st_ino;
+	hdr->dev = st->st_dev;
+	hdr->mtime_sec = st->st_mtime;
+	hdr->mtime_nsec = ST_MTIME_NSEC(st);
+	hdr->ctime_sec = st->st_ctime;
+	hdr->ctime_nsec = ST_CTIME_NSEC(st);
+	hdr->written = time(NULL);
+	snapshot_tz(hdr->tz);
+	strncpy(hdr->sum, sum, CHECKSUM_LEN * 2);
+}
+
+static char *snapshot_path(const char *src)
+{
+	char *path;
+
+	asprintf(&path, "%s%s", src, SNAPSHOT_EXT);
+	return path;
+}
+
+/*
+ * Start writing a snapshot of the text file src, which was in the state
+ * described by st and had the checksum sum when its items were read. Return
+ * NULL if the snapshot cannot be created.
+ */
+struct snapshot *snapshot_create(enum snapshot_type type, const char *src,
+				 struct stat *st, const char *sum)
+{
+	struct snapshot *snap;
+	int fd;
+
+	if (read_only)
+		return NULL;
+
+	snap = mem_malloc(sizeof(struct snapshot));
+	snap->path = snapshot_path(src);
+	asprintf(&snap->tmppath, "%s.XXXXXX", snap->path);
+	if ((fd = mkstemp(snap->tmppath)) < 0 ||
+	    !(snap->fp = fdopen(fd, "w"))) {
+		if (fd >= 0) {
+			close(fd);
+			unlink(snap->tmppath);
+		}
+		mem_free(snap->tmppath);
+		mem_free(snap->path);
+		mem_free(snap);
+		return NULL;
+	}
+
+	snapshot_header_init(&snap->hdr, type, st, sum);
+	fwrite(&snap->hdr, sizeof(snap->hdr), 1, snap->fp);
+
+	return snap;
+}
+
+static void snapshot_free(struct snapshot *snap)
+{
+	mem_free(snap->tmppath);
+	mem_free(snap->path);
+	mem_free(snap);
+}
+
+/* Discard a snapshot that is being written. */
+void snapshot_abort(struct snapshot *snap)
+{
+	fclose(snap->fp);
+	unlink(snap->tmppath);
+	snapshot_free(snap);
+}
+
+/* Finish writing a snapshot and move it into place. */
+int snapshot_commit(struct snapshot *snap)
+{
+	int ret;
+
+	ret = fseek(snap->fp, 0, SEEK_SET) == 0 &&
+	    fwrite(&snap->hdr, sizeof(snap->hdr), 1, snap->fp) == 1 &&
+	    !ferror(snap->fp);
+	ret = (fclose(snap->fp) == 0) && ret;
+	ret = ret && rename(snap->tmppath, snap->path) == 0;
+	if (!ret)
+		unlink(snap->tmppath);
+	snapshot_free(snap);
+
+	return ret;
+}
+
+static void snapshot_write(struct snapshot *snap, const void *data, size_t len)
+{
+	fwrite(data, len, 1, snap->fp);
+	snap->hdr.len += len;
+}
+
+static void snapshot_write_u8(struct snapshot *snap, uint8_t val)
+{
+	snapshot_write(snap, &val, sizeof(val));
+}
+
+static void snapshot_write_i32(struct snapshot *snap, int32_t val)
+{
+	snapshot_write(snap, &val, sizeof(val));
+}
+
+static void snapshot_write_i64(struct snapshot *snap, int64_t val)
+{
+	snapshot_write(snap, &val, sizeof(val));
+}
+
+static void snapshot_write_str(struct snapshot *snap, const char *s)
+{
+	uint32_t len = s ? strlen(s) : SNAPSHOT_NULLSTR;
+
+	snapshot_write(snap, &len, sizeof(len));
+	if (s)
+		snapshot_write(snap, s, len + 1);
+}
+
+static void snapshot_write_int_list(struct snapshot *snap, llist_t *l)
+{
+	llist_item_t *i;
+	uint32_t n = 0;
+
+	LLIST_FOREACH(l, i)
+		n++;
+	snapshot_write(snap, &n, sizeof(n));
+	LLIST_FOREACH(l, i)
+		snapshot_write_i32(snap, *(int *)LLIST_GET_DATA(i));
+}
+
+static void snapshot_write_rpt(struct snapshot *snap, struct rpt *rpt,
+			       llist_t *exc)
+{
+	llist_item_t *i;
+	uint32_t n = 0;
+
+	snapshot_write_i32(snap, rpt->type);
+	snapshot_write_i32(snap, rpt->freq);
+	snapshot_write_i64(snap, rpt->until);
+	snapshot_write_int_list(snap, &rpt->bymonth);
+	snapshot_write_int_list(snap, &rpt->bywday);
+	snapshot_write_int_list(snap, &rpt->bymonthday);
+
+	LLIST_FOREACH(exc, i)
+		n++;
+	snapshot_write(snap, &n, sizeof(n));
+	LLIST_FOREACH(exc, i) {
+		struct excp *e = LLIST_GET_DATA(i);
+		snapshot_write_i64(snap, e->st);
+	}
+}
+
+void snapshot_add_apoint(struct snapshot *snap, struct apoint *apt)
+{
+	snapshot_write_u8(snap, SNAPSHOT_REC_APOINT);
+	snapshot_write_i64(snap, apt->start);
+	snapshot_write_i64(snap, apt->dur);
+	snapshot_write_i32(snap, apt->state & APOINT_NOTIFY);
+	snapshot_write_str(snap, apt->note);
+	snapshot_write_str(snap, apt->mesg);
+	snap->hdr.count++;
+}
+
+void snapshot_add_event(struct snapshot *snap, struct event *ev)
+{
+	snapshot_write_u8(snap, SNAPSHOT_REC_EVENT);
+	snapshot_write_i64(snap, ev->day);
+	snapshot_write_i32(snap, ev->id);
+	snapshot_write_str(snap, ev->note);
+	snapshot_write_str(snap, ev->mesg);
+	snap->hdr.count++;
+}
+
+void snapshot_add_recur_apoint(struct snapshot *snap,
+			       struct recur_apoint *rapt)
+{
+	snapshot_write_u8(snap, SNAPSHOT_REC_RECUR_APOINT);
+	snapshot_write_i64(snap, rapt->start);
+	snapshot_write_i64(snap, rapt->dur);
+	snapshot_write_i32(snap, rapt->state & APOINT_NOTIFY);
+	snapshot_write_rpt(snap, rapt->rpt, &rapt->exc);
+	snapshot_write_str(snap, rapt->note);
+	snapshot_write_str(snap, rapt->mesg);
+	snap->hdr.count++;
+}
+
+void snapshot_add_recur_event(struct snapshot *snap, struct recur_event *rev)
+{
+	snapshot_write_u8(snap, SNAPSHOT_REC_RECUR_EVENT);
+	snapshot_write_i64(snap, rev->day);
+	snapshot_write_i32(snap, rev->id);
+	snapshot_write_rpt(snap, rev->rpt, &rev->exc);
+	snapshot_write_str(snap, rev->note);
+	snapshot_write_str(snap, rev->mesg);
+	snap->hdr.count++;
+}
+
+void snapshot_add_todo(struct snapshot *snap, struct todo *todo)
+{
+	snapshot_write_u8(snap, SNAPSHOT_REC_TODO);
+	snapshot_write_i32(snap, todo->id);
+	snapshot_write_i32(snap, todo->completed);
+	snapshot_write_str(snap, todo->note);
+	snapshot_write_str(snap, todo->mesg);
+	snap->hdr.count++;
+}
+
+/* Write a snapshot of a data file from the items currently loaded. */
+void snapshot_save(enum snapshot_type type, const char *src, const char *sum)
+{
+	struct snapshot *snap;
+	struct stat st;
+	llist_item_t *i;
+
+	if (stat(src, &st) < 0 ||
+	    !(snap = snapshot_create(type, src, &st, sum)))
+		return;
+
+	if (type == SNAPSHOT_TODO) {
+		LLIST_FOREACH(&todolist, i)
+			snapshot_add_todo(snap, LLIST_GET_DATA(i));
+		snapshot_commit(snap);
+		return;
+	}
+
+	LLIST_FOREACH(&recur_elist, i)
+		snapshot_add_recur_event(snap, LLIST_GET_DATA(i));
+	LLIST_TS_LOCK(&recur_alist_p);
+	LLIST_TS_FOREACH(&recur_alist_p, i)
+		snapshot_add_recur_apoint(snap, LLIST_TS_GET_DATA(i));
+	LLIST_TS_UNLOCK(&recur_alist_p);
+	LLIST_FOREACH(&eventlist, i)
+		snapshot_add_event(snap, LLIST_GET_DATA(i));
+	LLIST_TS_LOCK(&alist_p);
+	LLIST_TS_FOREACH(&alist_p, i)
+		snapshot_add_apoint(snap, LLIST_TS_GET_DATA(i));
+	LLIST_TS_UNLOCK(&alist_p);
+	snapshot_commit(snap);
+}
+
+static int snapshot_read(struct snapshot_reader *r, void *data, size_t len)
+{
+	if ((size_t)(r->end - r->p) < len)
+		return 0;
+	memcpy(data, r->p, len);
+	r->p += len;
+	return 1;
+}
+
+static int snapshot_read_str(struct snapshot_reader *r, char **s)
+{
+	uint32_t len;
+
+	if (!snapshot_read(r, &len, sizeof(len)))
+		return 0;
+	if (len == SNAPSHOT_NULLSTR) {
+		*s = NULL;
+		return 1;
+	}
+	if ((size_t)(r->end - r->p) <= len || r->p[len] != '\0')
+		return 0;
+	*s = (char *)r->p;
+	r->p += len + 1;
+	return 1;
+}
+
+static int snapshot_read_int_list(struct snapshot_reader *r, llist_t *l)
+{
+	uint32_t n;
+	int32_t val;
+
+	LLIST_INIT(l);
+	if (!snapshot_read(r, &n, sizeof(n)))
+		return 0;
+	while (n-- > 0) {
+		if (!snapshot_read(r, &val, sizeof(val)))
+			return 0;
+		int *i = mem_malloc(sizeof(int));
+		*i = val;
+		LLIST_ADD(l, i);
+	}
+	return 1;
+}
+
+static int snapshot_read_exc_list(struct snapshot_reader *r, llist_t *l)
+{
+	uint32_t n;
+	int64_t val;
+
+	LLIST_INIT(l);
+	if (!snapshot_read(r, &n, sizeof(n)))
+		return 0;
+	while (n-- > 0) {
+		if (!snapshot_read(r, &val, sizeof(val)))
+			return 0;
+		struct excp *exc = mem_malloc(sizeof(struct excp));
+		exc->st = val;
+		LLIST_ADD(l, exc);
+	}
+	return 1;
+}
+
+static int snapshot_read_rpt(struct snapshot_reader *r, struct rpt *rpt)
+{
+	int32_t type, freq;
+	int64_t until;
+
+	LLIST_INIT(&rpt->bymonth);
+	LLIST_INIT(&rpt->bywday);
+	LLIST_INIT(&rpt->bymonthday);
+	LLIST_INIT(&rpt->exc);
+	if (!snapshot_read(r, &type, sizeof(type)) ||
+	    !snapshot_read(r, &freq, sizeof(freq)) ||
+	    !snapshot_read(r, &until, sizeof(until)) ||
+	    !snapshot_read_int_list(r, &rpt->bymonth) ||
+	    !snapshot_read_int_list(r, &rpt->bywday) ||
+	    !snapshot_read_int_list(r, &rpt->bymonthday) ||
+	    !snapshot_read_exc_list(r, &rpt->exc)) {
+		recur_free_rpt_lists(rpt);
+		return 0;
+	}
+	rpt->type = type;
+	rpt->freq = freq;
+	rpt->until = until;
+	return 1;
+}
+
+/*
+ * Read the next record of a snapshot of the given type. If build is set, the
+ * item is added to its list unless it is rejected by the filter; otherwise,
+ * the record is only checked.
+ */
+static int snapshot_read_item(struct snapshot_reader *r,
+			      enum snapshot_type type,
+			      struct item_filter *filter, int build)
+{
+	uint8_t tag;
+	int32_t state, id, completed;
+	int64_t start, dur;
+	struct rpt rpt;
+	char *note, *mesg;
+
+	if (!snapshot_read(r, &tag, sizeof(tag)) ||
+	    (tag == SNAPSHOT_REC_TODO) != (type == SNAPSHOT_TODO))
+		return 0;
+
+	switch (tag) {
+	case SNAPSHOT_REC_APOINT:
+		if (!snapshot_read(r, &start, sizeof(start)) ||
+		    !snapshot_read(r, &dur, sizeof(dur)) ||
+		    !snapshot_read(r, &state, sizeof(state)) ||
+		    !snapshot_read_str(r, &note) ||
+		    !snapshot_read_str(r, &mesg) || !mesg)
+			return 0;
+		if (build) {
+			struct apoint apt;
+
+			apt.start = start;
+			apt.dur = dur;
+			apt.state = state;
+			apt.note = note;
+			apt.mesg = mesg;
+			if (!filter || apoint_filter(&apt, filter))
+				apoint_new(mesg, note, start, dur, state);
+		}
+		return 1;
+	case SNAPSHOT_REC_EVENT:
+		if (!snapshot_read(r, &start, sizeof(start)) ||
+		    !snapshot_read(r, &id, sizeof(id)) ||
+		    !snapshot_read_str(r, &note) ||
+		    !snapshot_read_str(r, &mesg) || !mesg)
+			return 0;
+		if (build) {
+			struct event ev;
+
+			ev.day = start;
+			ev.id = id;
+			ev.note = note;
+			ev.mesg = mesg;
+			if (!filter || event_filter(&ev, filter))
+				event_new(mesg, note, start, id);
+		}
+		return 1;
+	case SNAPSHOT_REC_RECUR_APOINT:
+		if (!snapshot_read(r, &start, sizeof(start)) ||
+		    !snapshot_read(r, &dur, sizeof(dur)) ||
+		    !snapshot_read(r, &state, sizeof(state)) ||
+		    !snapshot_read_rpt(r, &rpt))
+			return 0;
+		if (!snapshot_read_str(r, &note) ||
+		    !snapshot_read_str(r, &mesg) || !mesg) {
+			recur_free_rpt_lists(&rpt);
+			return 0;
+		}
+		if (build) {
+			struct recur_apoint rapt;
+
+			rapt.rpt = &rpt;
+			rapt.exc = rpt.exc;
+			rapt.start = start;
+			rapt.dur = dur;
+			rapt.state = state;
+			rapt.note = note;
+			rapt.mesg = mesg;
+			if (!filter || recur_apoint_filter(&rapt, filter)) {
+				recur_apoint_new(mesg, note, start, dur, state,
+						 &rpt);
+				return 1;
+			}
+		}
+		recur_free_rpt_lists(&rpt);
+		return 1;
+	case SNAPSHOT_REC_RECUR_EVENT:
+		if (!snapshot_read(r, &start, sizeof(start)) ||
+		    !snapshot_read(r, &id, sizeof(id)) ||
+		    !snapshot_read_rpt(r, &rpt))
+			return 0;
+		if (!snapshot_read_str(r, &note) ||
+		    !snapshot_read_str(r, &mesg) || !mesg) {
+			recur_free_rpt_lists(&rpt);
+			return 0;
+		}
+		if (build) {
+			struct recur_event rev;
+
+			rev.rpt = &rpt;
+			rev.exc = rpt.exc;
+			rev.day = start;
+			rev.id = id;
+			rev.note = note;
+			rev.mesg = mesg;
+			if (!filter || recur_event_filter(&rev, filter)) {
+				recur_event_new(mesg, note, start, id, &rpt);
+				return 1;
+			}
+		}
+		recur_free_rpt_lists(&rpt);
+		return 1;
+	case SNAPSHOT_REC_TODO:
+		if (!snapshot_read(r, &id, sizeof(id)) ||
+		    !snapshot_read(r, &completed, sizeof(completed)) ||
+		    !snapshot_read_str(r, &note) ||
+		    !snapshot_read_str(r, &mesg) || !mesg)
+			return 0;
+		if (build) {
+			struct todo todo;
+
+			todo.id = id;
+			todo.completed = completed;
+			todo.note = note;
+			todo.mesg = mesg;
+			if (!filter || todo_filter(&todo, filter))
+				todo_add(mesg, id, completed, note);
+		}
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* Check whether a snapshot header still describes the text file. */
+static int snapshot_header_valid(struct snapshot_header *hdr,
+				 enum snapshot_type type, const char *src,
+				 size_t len)
+{
+	struct stat st;
+	int64_t tz[4];
+	char sum[CHECKSUM_LEN * 2 + 1];
+	FILE *fp;
+
+	if (len < sizeof(*hdr) || len - sizeof(*hdr) != hdr->len ||
+	    memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != SNAPSHOT_VERSION || hdr->type != type ||
+	    hdr->byteorder != SNAPSHOT_BYTEORDER ||
+	    hdr->timesize != sizeof(time_t) ||
+	    hdr->sum[CHECKSUM_LEN * 2] != '\0')
+		return 0;
+
+	if (stat(src, &st) < 0 || hdr->size != (uint64_t)st.st_size ||
+	    hdr->ino != (uint64_t)st.st_ino ||
+	    hdr->dev != (uint64_t)st.st_dev ||
+	    hdr->mtime_sec != st.st_mtime ||
+	    hdr->mtime_nsec != ST_MTIME_NSEC(&st) ||
+	    hdr->ctime_sec != st.st_ctime ||
+	    hdr->ctime_nsec != ST_CTIME_NSEC(&st))
+		return 0;
+
+	snapshot_tz(tz);
+	if (memcmp(tz, hdr->tz, sizeof(tz)))
+		return 0;
+
+	/*
+	 * The mtime can be set back by other programs, but the ctime cannot.
+	 * If the text file was changed in the same second the snapshot was
+	 * written, a later change might not be visible in its ctime. Compare
+	 * the checksums in that case.
+	 */
+	if (hdr->ctime_sec >= hdr->written) {
+		if (!(fp = fopen(src, "r")))
+			return 0;
+		checksum_stream(fp, sum);
+		fclose(fp);
+		if (strcmp(sum, hdr->sum))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Load the items of the text file src from its snapshot, applying the filter.
+ * The checksum of the text file is stored in sum. Return 0 without loading
+ * anything if there is no valid snapshot.
+ */
+int snapshot_load(enum snapshot_type type, const char *src,
+		  struct item_filter *filter, char *sum)
+{
+	struct snapshot_header hdr;
+	struct snapshot_reader r;
+	struct stat st;
+	char *path, *data;
+	uint32_t n;
+	int fd, ret = 0;
+
+	path = snapshot_path(src);
+	fd = open(path, O_RDONLY);
+	mem_free(path);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(hdr)) {
+		close(fd);
+		return 0;
+	}
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return 0;
+
+	memcpy(&hdr, data, sizeof(hdr));
+	if (!snapshot_header_valid(&hdr, type, src, st.st_size))
+		goto cleanup;
+
+	/* Check all records before adding anything to the lists. */
+	r.p = data + sizeof(hdr);
+	r.end = data + st.st_size;
+	for (n = 0; n < hdr.count; n++) {
+		if (!snapshot_read_item(&r, type, NULL, 0))
+			goto cleanup;
+	}
+	if (r.p != r.end)
+		goto cleanup;
+
+	r.p = data + sizeof(hdr);
+	for (n = 0; n < hdr.count; n++)
+		snapshot_read_item(&r, type, filter, 1);
+	strncpy(sum, hdr.sum, CHECKSUM_LEN * 2 + 1);
+	ret = 1;
+
+cleanup:
+	munmap(data, st.st_size);
+	return ret;
+}
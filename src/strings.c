@@ -45,25 +45,52 @@ void string_init(struct string *sb)
 	sb->buf = mem_malloc(STRING_INITIAL_BUFSIZE);
 	sb->bufsize = STRING_INITIAL_BUFSIZE;
 	sb->len = 0;
+	sb->local = NULL;
 	*sb->buf = '\0';
 }
 
-void string_reset(struct string *sb)
+/*
+ * Initialize a string using the given storage, typically a buffer on the
+ * stack. The string only moves to the heap if it outgrows that buffer.
+ */
+void string_init_buf(struct string *sb, char *buf, int size)
 {
-	if (sb->buf)
+	sb->buf = buf;
+	sb->bufsize = size;
+	sb->len = 0;
+	sb->local = buf;
+	*sb->buf = '\0';
+}
+
+void string_free(struct string *sb)
+{
+	if (sb->buf && sb->buf != sb->local)
 		mem_free(sb->buf);
+	sb->buf = NULL;
+}
+
+void string_reset(struct string *sb)
+{
+	string_free(sb);
 	string_init(sb);
 }
 
 int string_grow(struct string *sb, int minsize)
 {
+	int oldsize = sb->bufsize;
+
 	if (sb->bufsize >= minsize)
 		return 0;
 
 	while (sb->bufsize < minsize)
 		sb->bufsize *= 2;
 
-	sb->buf = mem_realloc(sb->buf, 1, sb->bufsize);
+	if (sb->buf == sb->local) {
+		sb->buf = mem_malloc(sb->bufsize);
+		memcpy(sb->buf, sb->local, oldsize);
+	} else {
+		sb->buf = mem_realloc(sb->buf, 1, sb->bufsize);
+	}
 	return 1;
 }
 
@@ -133,3 +160,74 @@ int string_strftime(struct string *sb, const char *format, const struct tm *tm)
 	string_reset(sb);
 	return string_catftime(sb, format, tm);
 }
+
+/*
+ * The following emitters append to a string without going through the printf
+ * machinery. They are used to serialize items in the data file format.
+ */
+void string_catc(struct string *sb, char c)
+{
+	string_grow(sb, sb->len + 2);
+	sb->buf[sb->len++] = c;
+	sb->buf[sb->len] = '\0';
+}
+
+void string_catn(struct string *sb, const char *s, int n)
+{
+	string_grow(sb, sb->len + n + 1);
+	memcpy(sb->buf + sb->len, s, n);
+	sb->len += n;
+	sb->buf[sb->len] = '\0';
+}
+
+void string_cats(struct string *sb, const char *s)
+{
+	string_catn(sb, s, strlen(s));
+}
+
+/* Append an unsigned integer, padded with zeros to at least width digits. */
+void string_catuint(struct string *sb, unsigned val, int width)
+{
+	char digits[16];
+	int n = 0;
+
+	do {
+		digits[n++] = '0' + val % 10;
+		val /= 10;
+	} while (val);
+	while (n < width && n < (int)sizeof(digits))
+		digits[n++] = '0';
+
+	string_grow(sb, sb->len + n + 1);
+	while (n > 0)
+		sb->buf[sb->len++] = digits[--n];
+	sb->buf[sb->len] = '\0';
+}
+
+void string_catint(struct string *sb, int val)
+{
+	if (val < 0) {
+		string_catc(sb, '-');
+		string_catuint(sb, -(unsigned)val, 0);
+	} else {
+		string_catuint(sb, val, 0);
+	}
+}
+
+/* Append a date in the mm/dd/yyyy format of the data files. */
+void string_catdate(struct string *sb, const struct tm *tm)
+{
+	string_catuint(sb, tm->tm_mon + 1, 2);
+	string_catc(sb, '/');
+	string_catuint(sb, tm->tm_mday, 2);
+	string_catc(sb, '/');
+	string_catuint(sb, tm->tm_year + 1900, 4);
+}
+
+/* Append a time in the hh:mm format of the data files. */
+void string_cattime(struct string *sb, const struct tm *tm)
+{
+	string_catuint(sb, tm->tm_hour, 2);
+	string_catc(sb, ':');
+	string_catuint(sb, tm->tm_min, 2);
+}
@@ -93,42 +93,87 @@ struct todo *todo_add(char *mesg, int id, int completed, char *note)
 	todo->id = id;
 	todo->completed = completed;
 	todo->note = (note != NULL
-		      && note[0] != '\0') ? mem_strdup(note) : NULL;
+		      && note[0] != '\0') ? note_dup(note) : NULL;
 
 	LLIST_ADD_SORTED(&todolist, todo, todo_cmp);
 
 	return todo;
 }
 
+/* Check whether a todo item is selected by a filter. */
+int todo_filter(struct todo *todo, struct item_filter *filter)
+{
+	int cond;
+
+	cond = (
+		!(filter->type_mask & TYPE_MASK_TODO) ||
+		(filter->regex && regexec(filter->regex, todo->mesg, 0, 0, 0)) ||
+		(filter->priority && todo->id != filter->priority) ||
+		(filter->completed && !todo->completed) ||
+		(filter->uncompleted && todo->completed)
+	);
+	if (!cond && filter->hash) {
+		char *hash = todo_hash(todo);
+		cond = !hash_matches(filter->hash, hash);
+		mem_free(hash);
+	}
+
+	return filter->invert ? cond : !cond;
+}
+
+/* Append the data file line of a todo item to a string. */
+void todo_serialize(struct todo *todo, struct string *s)
+{
+	string_catc(s, '[');
+	if (todo->completed)
+		string_catc(s, '-');
+	string_catint(s, todo->id);
+	string_catc(s, ']');
+	if (todo->note) {
+		string_catc(s, '>');
+		string_cats(s, todo->note);
+	}
+	string_catc(s, ' ');
+	string_cats(s, todo->mesg);
+}
+
 char *todo_tostr(struct todo *todo)
 {
-	char *res;
-	const char *cstr = todo->completed ? "-" : "";
+	struct string s;
 
-	if (todo->note)
-		asprintf(&res, "[%s%d]>%s %s", cstr, todo->id, todo->note,
-			 todo->mesg);
-	else
-		asprintf(&res, "[%s%d] %s", cstr, todo->id, todo->mesg);
+	string_init(&s);
+	todo_serialize(todo, &s);
 
-	return res;
+	return string_buf(&s);
 }
 
 char *todo_hash(struct todo *todo)
 {
-	char *raw = todo_tostr(todo);
-	char *sha1 = mem_malloc(SHA1_DIGESTLEN * 2 + 1);
-	sha1_digest(raw, sha1);
-	mem_free(raw);
+	char buf[STRING_LOCAL_BUFSIZE];
+	char *sha1 = item_hash_lookup(todo);
+	struct string s;
+
+	if (sha1)
+		return sha1;
+	sha1 = mem_malloc(SHA1_DIGESTLEN * 2 + 1);
+	string_init_buf(&s, buf, sizeof(buf));
+	todo_serialize(todo, &s);
+	sha1_digest(string_buf(&s), sha1);
+	string_free(&s);
 
 	return sha1;
 }
 
 void todo_write(struct todo *todo, FILE * f)
 {
-	char *str = todo_tostr(todo);
-	fprintf(f, "%s\n", str);
-	mem_free(str);
+	char buf[STRING_LOCAL_BUFSIZE];
+	struct string s;
+
+	string_init_buf(&s, buf, sizeof(buf));
+	todo_serialize(todo, &s);
+	string_catc(&s, '\n');
+	fwrite(string_buf(&s), 1, s.len, f);
+	string_free(&s);
 }
 
 /* Delete a note previously attached to a todo item. */
@@ -39,13 +39,13 @@
 
 static unsigned ui_todo_view = 0;
 
-static struct todo *ui_todo_selitem(void)
+struct todo *ui_todo_selitem(void)
 {
 	return todo_get_item(listbox_get_sel(&lb_todo),
 			     ui_todo_view == TODO_HIDE_COMPLETED_VIEW);
 }
 
-static void ui_todo_set_selitem(struct todo *todo)
+void ui_todo_set_selitem(struct todo *todo)
 {
 	int n = todo_get_position(todo,
 				  ui_todo_view == TODO_HIDE_COMPLETED_VIEW);
@@ -53,6 +53,37 @@ static void ui_todo_set_selitem(struct todo *todo)
 		listbox_set_sel(&lb_todo, n);
 }
 
+/*
+ * Return the hash of the selected item, or NULL if there is none. Unlike the
+ * item itself, the hash remains valid when the data files are reloaded.
+ */
+char *ui_todo_selhash(void)
+{
+	struct todo *todo = ui_todo_selitem();
+
+	return todo ? todo_hash(todo) : NULL;
+}
+
+/* Select the item with the given hash, if there is one. */
+void ui_todo_set_selhash(const char *hash)
+{
+	llist_item_t *i;
+	char *h;
+	int found;
+
+	LLIST_FOREACH(&todolist, i) {
+		struct todo *todo = LLIST_GET_DATA(i);
+
+		h = todo_hash(todo);
+		found = !strcmp(h, hash);
+		mem_free(h);
+		if (found) {
+			ui_todo_set_selitem(todo);
+			return;
+		}
+	}
+}
+
 /* Request user to enter a new todo item. */
 void ui_todo_add(void)
 {
@@ -320,14 +351,9 @@ void ui_todo_popup_item(void)
 		const char *note_heading = _("Note:");
 		size_t note_size = 3500;
 		char note[note_size];
-		char *notepath, *msg;
-		FILE *fp;
-
-		asprintf(&notepath, "%s%s", path_notes, item->note);
-		fp = fopen(notepath, "r");
-		note_read_contents(note, note_size, fp);
-		fclose(fp);
-		mem_free(notepath);
+		char *msg;
+
+		note_read_contents(note, note_size, item->note);
 
 		asprintf(&msg, "%s\n\n%s\n%s", item->mesg, note_heading, note);
 		item_in_popup(NULL, NULL, msg, _("TODO:"));
@@ -66,7 +66,20 @@ enum format_specifier {
 	FS_HASH,
 	FS_PSIGN,
 	FS_EOF,
-	FS_UNKNOWN
+	FS_UNKNOWN,
+	FS_TEXT,
+	FS_JSON
+};
+
+/*
+ * A step of a compiled format string: either a span of literal text or an
+ * item field, with its extended format resolved.
+ */
+struct format_op {
+	enum format_specifier fs;
+	int epoch;		/* print dates and durations in seconds */
+	int off;		/* text or extended format in the buffer, or -1 */
+	int len;		/* length of the text */
 };
 
 /* General routine to exit calcurse properly. */
@@ -78,6 +91,9 @@ void exit_calcurse(int status)
 		notify_stop_main_thread();
 		ui_calendar_stop_date_thread();
 		io_stop_psave_thread();
+		io_stop_watch_thread();
+		io_stop_save_thread();
+		io_stop_compact_thread();
 
 		clear();
 		wins_refresh();
@@ -116,6 +132,7 @@ void free_user_data(void)
 		ui_day_item_cut_free(i);
 	todo_free_list();
 	notify_free_app();
+	io_free_shards();
 }
 
 /* Function to exit on internal error. */
@@ -1461,12 +1478,10 @@ void press_any_key(void)
  */
 static void print_notefile(FILE * out, const char *filename, int nbtab)
 {
-	char *path_to_notefile;
-	FILE *notefile;
 	char linestarter[BUFSIZ];
-	char buffer[BUFSIZ];
+	const char *p, *end, *eol;
+	size_t len;
 	int i;
-	int printlinestarter = 1;
 
 	if (nbtab < BUFSIZ) {
 		for (i = 0; i < nbtab; i++)
@@ -1476,70 +1491,69 @@ static void print_notefile(FILE * out, const char *filename, int nbtab)
 		linestarter[0] = '\0';
 	}
 
-	asprintf(&path_to_notefile, "%s/%s", path_notes, filename);
-	notefile = fopen(path_to_notefile, "r");
-	mem_free(path_to_notefile);
-	if (notefile) {
-		while (fgets(buffer, BUFSIZ, notefile) != 0) {
-			if (printlinestarter) {
-				fputs(linestarter, out);
-				printlinestarter = 0;
-			}
-			fputs(buffer, out);
-			if (buffer[strlen(buffer) - 1] == '\n')
-				printlinestarter = 1;
+	if (filename && (p = note_get(filename, &len))) {
+		end = p + len;
+		for (; p < end; p = eol) {
+			eol = memchr(p, '\n', end - p);
+			eol = eol ? eol + 1 : end;
+			fputs(linestarter, out);
+			fwrite(p, 1, eol - p, out);
 		}
 		fputs("\n", out);
-		file_close(notefile, __FILE_POS__);
 	} else {
 		fputs(linestarter, out);
 		fputs(_("No note file found\n"), out);
 	}
 }
 
-/* Print an escape sequence and return its length. */
-static int print_escape(const char *s)
+/*
+ * Parse an escape sequence and return its length. The character is stored
+ * in c, or -1 if the sequence does not stand for any.
+ */
+static int parse_escape(const char *s, int *c)
 {
 	switch (*(s + 1)) {
 	case 'a':
-		putchar('\a');
+		*c = '\a';
 		return 1;
 	case 'b':
-		putchar('\b');
+		*c = '\b';
 		return 1;
 	case 'f':
-		putchar('\f');
+		*c = '\f';
 		return 1;
 	case 'n':
-		putchar('\n');
+		*c = '\n';
 		return 1;
 	case 'r':
-		putchar('\r');
+		*c = '\r';
 		return 1;
 	case 't':
-		putchar('\t');
+		*c = '\t';
 		return 1;
 	case 'v':
-		putchar('\v');
+		*c = '\v';
 		return 1;
 	case '0':
-		putchar('\0');
+		*c = '\0';
 		return 1;
 	case '\'':
-		putchar('\'');
+		*c = '\'';
 		return 1;
 	case '"':
-		putchar('"');
+		*c = '"';
 		return 1;
 	case '\?':
-		putchar('?');
+		*c = '?';
 		return 1;
 	case '\\':
-		putchar('\\');
+		*c = '\\';
 		return 1;
 	case '\0':
+		*c = -1;
 		return 0;
 	default:
+		*c = -1;
 		return 1;
 	}
 }
@@ -1632,15 +1646,141 @@ static enum format_specifier parse_fs(const char **s, char *extformat)
 	}
 }
 
+/* Append a step to a compiled format string. */
+static struct format_op *format_add(struct format *fmt, int *size,
+				    enum format_specifier fs)
+{
+	struct format_op *op;
+
+	if (fmt->n == *size) {
+		*size = *size ? *size * 2 : 8;
+		fmt->ops = mem_realloc(fmt->ops, *size,
+				       sizeof(struct format_op));
+	}
+	op = &fmt->ops[fmt->n++];
+	op->fs = fs;
+	op->epoch = 0;
+	op->off = -1;
+	op->len = 0;
+
+	return op;
+}
+
+/* Append a literal character, extending the preceding text if possible. */
+static void format_add_char(struct format *fmt, int *size, struct string *s,
+			    char c)
+{
+	struct format_op *op = fmt->n ? &fmt->ops[fmt->n - 1] : NULL;
+
+	if (!op || op->fs != FS_TEXT) {
+		op = format_add(fmt, size, FS_TEXT);
+		op->off = s->len;
+	}
+	string_catn(s, &c, 1);
+	op->len++;
+}
+
+/*
+ * Compile a format string. Escape sequences and format specifiers are parsed
+ * once here, so that printing an item only runs through the resulting steps.
+ */
+void format_compile(struct format *fmt, const char *format)
+{
+	char extformat[FS_EXT_MAXLEN];
+	enum format_specifier fs;
+	struct format_op *op;
+	struct string s;
+	const char *p;
+	int size = 0, c;
+
+	fmt->ops = NULL;
+	fmt->n = 0;
+	string_init(&s);
+
+	for (p = format; *p; p++) {
+		c = *p;
+		if (*p == '%') {
+			p++;
+			fs = parse_fs(&p, extformat);
+			if (fs == FS_EOF)
+				break;
+			if (fs == FS_PSIGN) {
+				c = '%';
+			} else if (fs == FS_UNKNOWN) {
+				c = '?';
+			} else {
+				op = format_add(fmt, &size, fs);
+				/* Backwards compatibility: Durations are
+				 * printed in seconds by default. */
+				if (!strcmp(extformat, "epoch") ||
+				    (fs == FS_DURATION && *extformat == '\0')) {
+					op->epoch = 1;
+				} else if (*extformat != '\0' &&
+					   strcmp(extformat, "default")) {
+					op->off = s.len;
+					string_catn(&s, extformat,
+						    strlen(extformat) + 1);
+				}
+				continue;
+			}
+		} else if (*p == '\\') {
+			p += parse_escape(p, &c);
+			if (c < 0)
+				continue;
+		}
+		format_add_char(fmt, &size, &s, c);
+	}
+
+	fmt->buf = string_buf(&s);
+}
+
+/*
+ * Compile a format that prints each item as a JSON object on a line of its
+ * own, see print_apoint_json() and friends.
+ */
+void format_compile_json(struct format *fmt)
+{
+	struct string s;
+	int size = 0;
+
+	fmt->ops = NULL;
+	fmt->n = 0;
+	format_add(fmt, &size, FS_JSON);
+	string_init(&s);
+	fmt->buf = string_buf(&s);
+}
+
+void format_free(struct format *fmt)
+{
+	mem_free(fmt->ops);
+	mem_free(fmt->buf);
+}
+
+/* Return the extended format of a step, or NULL for the default one. */
+static const char *format_ext(const struct format *fmt,
+			      const struct format_op *op)
+{
+	return op->off < 0 ? NULL : fmt->buf + op->off;
+}
+
+/* Print the literal text of a step. */
+static void format_print_text(const struct format *fmt,
+			      const struct format_op *op)
+{
+	fwrite(fmt->buf + op->off, 1, op->len, stdout);
+}
+
 /*
  * Print date to stdout, formatted to be displayed for day.
  * The "day" argument may be any time belonging to that day.
  */
-static void print_date(time_t date, time_t day, const char *extformat)
+static void print_date(time_t date, time_t day, const struct format *fmt,
+		       const struct format_op *op)
 {
+	const char *extformat = format_ext(fmt, op);
 	char buf[BUFSIZ];
 
-	if (!strcmp(extformat, "epoch")) {
+	if (op->epoch) {
 		printf("%ld", (long)date);
 	} else {
 		time_t day_start = DAY(day);
@@ -1649,7 +1789,7 @@ static void print_date(time_t date, time_t day, const char *extformat)
 
 		localtime_r((time_t *) &date, &lt);
 
-		if (extformat[0] == '\0' || !strcmp(extformat, "default")) {
+		if (!extformat) {
 			if (date >= day_start && date <= day_end)
 				strftime(buf, BUFSIZ, "%H:%M", &lt);
 			else
@@ -1663,22 +1803,20 @@ static void print_date(time_t date, time_t day, const char *extformat)
 }
 
 /* Print a time difference to stdout. */
-static void print_datediff(long difference, const char *extformat)
+static void print_datediff(long difference, const struct format *fmt,
+			   const struct format_op *op)
 {
 	const char *p;
 	const char *numfmt;
 	bool usetotal;
 	long value;
 
-	if (!strcmp(extformat, "epoch")) {
+	if (op->epoch) {
 		printf("%ld", difference);
 	} else {
-		if (extformat[0] == '\0' || !strcmp(extformat, "default")) {
-			/* Set a default format if none specified. */
+		/* Set a default format if none specified. */
+		if (!(p = format_ext(fmt, op)))
 			p = "%EH:%M";
-		} else {
-			p = extformat;
-		}
 		while (*p) {
 			if (*p == '%') {
 				p++;
@@ -1735,139 +1873,244 @@ static void print_datediff(long difference, const char *extformat)
 	}
 }
 
+/* Append a JSON string, escaping quotes, backslashes and control characters. */
+static void json_cat_str(struct string *s, const char *str)
+{
+	const unsigned char *p, *q;
+
+	string_catc(s, '"');
+	for (p = (const unsigned char *)str; *p; p = q + 1) {
+		for (q = p; *q >= 0x20 && *q != '"' && *q != '\\'; q++) ;
+		string_catn(s, (const char *)p, q - p);
+		switch (*q) {
+		case '\0':
+			string_catc(s, '"');
+			return;
+		case '"':
+		case '\\':
+			string_catc(s, '\\');
+			string_catc(s, *q);
+			break;
+		case '\n':
+			string_cats(s, "\\n");
+			break;
+		case '\t':
+			string_cats(s, "\\t");
+			break;
+		default:
+			string_catf(s, "\\u%04x", *q);
+			break;
+		}
+	}
+	string_catc(s, '"');
+}
+
+/* Start a JSON object with the type and the hash of an item. */
+static void json_cat_head(struct string *s, const char *type, char *hash)
+{
+	string_catf(s, "{\"type\":\"%s\",\"hash\":\"%s\"", type, hash);
+	mem_free(hash);
+}
+
+/* Append the message and the note of an item to a JSON object. */
+static void json_cat_text(struct string *s, const char *mesg,
+			  const char *note)
+{
+	string_cats(s, ",\"message\":");
+	json_cat_str(s, mesg);
+	string_cats(s, ",\"note\":");
+	if (note)
+		json_cat_str(s, note);
+	else
+		string_cats(s, "null");
+}
+
+static void json_cat_rpt(struct string *s, struct rpt *rpt)
+{
+	static const char *types[NBRECUR] =
+	    { "daily", "weekly", "monthly", "yearly" };
+
+	string_catf(s, ",\"recurrence\":{\"type\":\"%s\",\"freq\":%d,",
+		    types[rpt->type], rpt->freq);
+	if (rpt->until)
+		string_catf(s, "\"until\":%ld}", (long)rpt->until);
+	else
+		string_cats(s, "\"until\":null}");
+}
+
+/* Terminate a JSON object and write it out as one line. */
+static void json_print(struct string *s)
+{
+	string_cats(s, "}\n");
+	fwrite(s->buf, 1, s->len, stdout);
+	string_free(s);
+}
+
+/* Print an appointment or one of its occurrences as a JSON object. */
+static void print_apoint_json(struct apoint *apt, struct recur_apoint *rapt)
+{
+	char buf[STRING_LOCAL_BUFSIZE];
+	struct string s;
+
+	string_init_buf(&s, buf, sizeof(buf));
+	if (rapt)
+		json_cat_head(&s, "recur-apt", recur_apoint_hash(rapt));
+	else
+		json_cat_head(&s, "apt", apoint_hash(apt));
+	string_catf(&s, ",\"start\":%ld,\"end\":%ld", (long)apt->start,
+		    (long)(apt->start + apt->dur));
+	json_cat_text(&s, apt->mesg, apt->note);
+	if (rapt)
+		json_cat_rpt(&s, rapt->rpt);
+	json_print(&s);
+}
+
+/* Print an event or one of its occurrences as a JSON object. */
+static void print_event_json(time_t day, struct event *ev,
+			     struct recur_event *rev)
+{
+	char buf[STRING_LOCAL_BUFSIZE];
+	struct string s;
+
+	string_init_buf(&s, buf, sizeof(buf));
+	if (rev)
+		json_cat_head(&s, "recur-event", recur_event_hash(rev));
+	else
+		json_cat_head(&s, "event", event_hash(ev));
+	string_catf(&s, ",\"start\":%ld", (long)day);
+	json_cat_text(&s, ev->mesg, ev->note);
+	if (rev)
+		json_cat_rpt(&s, rev->rpt);
+	json_print(&s);
+}
+
+/* Print a todo item as a JSON object. */
+static void print_todo_json(struct todo *todo)
+{
+	char buf[STRING_LOCAL_BUFSIZE];
+	struct string s;
+
+	string_init_buf(&s, buf, sizeof(buf));
+	json_cat_head(&s, "todo", todo_hash(todo));
+	string_catf(&s, ",\"priority\":%d,\"completed\":%s",
+		    abs(todo->id), todo->completed ? "true" : "false");
+	json_cat_text(&s, todo->mesg, todo->note);
+	json_print(&s);
+}
+
 /* Print a formatted appointment to stdout. */
-static void print_apoint_helper(const char *format, time_t day,
+static void print_apoint_helper(const struct format *fmt, time_t day,
 				struct apoint *apt, struct recur_apoint *rapt)
 {
-	const char *p;
-	char extformat[FS_EXT_MAXLEN];
-
-	for (p = format; *p; p++) {
-		if (*p == '%') {
-			p++;
-			switch (parse_fs(&p, extformat)) {
-			case FS_STARTDATE:
-				print_date(apt->start, day, extformat);
-				break;
-			case FS_DURATION:
-				/* Backwards compatibility: Use epoch by
-				 * default. */
-				if (*extformat == '\0')
-					strcpy(extformat, "epoch");
-				print_datediff(apt->dur, extformat);
-				break;
-			case FS_ENDDATE:
-				print_date(apt->start + apt->dur, day,
-					   extformat);
-				break;
-			case FS_REMAINING:
-				print_datediff(difftime(apt->start, now()),
-				               extformat);
-				break;
-			case FS_MESSAGE:
-				printf("%s", apt->mesg);
-				break;
-			case FS_NOTE:
-				printf("%s", apt->note);
-				break;
-			case FS_NOTEFILE:
-				print_notefile(stdout, apt->note, 1);
-				break;
-			case FS_RAW:
-				if (rapt)
-					recur_apoint_write(rapt, stdout);
-				else
-					apoint_write(apt, stdout);
-				break;
-			case FS_HASH:
-				if (rapt)
-					printf("%s", recur_apoint_hash(rapt));
-				else
-					printf("%s", apoint_hash(apt));
-				break;
-			case FS_PSIGN:
-				putchar('%');
-				break;
-			case FS_EOF:
-				return;
-				break;
-			default:
-				putchar('?');
-				break;
-			}
-		} else if (*p == '\\') {
-			p += print_escape(p);
-		} else {
-			putchar(*p);
+	const struct format_op *op;
+	char *hash;
+
+	for (op = fmt->ops; op < fmt->ops + fmt->n; op++) {
+		switch (op->fs) {
+		case FS_TEXT:
+			format_print_text(fmt, op);
+			break;
+		case FS_JSON:
+			print_apoint_json(apt, rapt);
+			break;
+		case FS_STARTDATE:
+			print_date(apt->start, day, fmt, op);
+			break;
+		case FS_DURATION:
+			print_datediff(apt->dur, fmt, op);
+			break;
+		case FS_ENDDATE:
+			print_date(apt->start + apt->dur, day, fmt, op);
+			break;
+		case FS_REMAINING:
+			print_datediff(difftime(apt->start, now()), fmt, op);
+			break;
+		case FS_MESSAGE:
+			printf("%s", apt->mesg);
+			break;
+		case FS_NOTE:
+			printf("%s", apt->note);
+			break;
+		case FS_NOTEFILE:
+			print_notefile(stdout, apt->note, 1);
+			break;
+		case FS_RAW:
+			if (rapt)
+				recur_apoint_write(rapt, stdout);
+			else
+				apoint_write(apt, stdout);
+			break;
+		case FS_HASH:
+			hash = rapt ? recur_apoint_hash(rapt) :
+			    apoint_hash(apt);
+			printf("%s", hash);
+			mem_free(hash);
+			break;
+		default:
+			putchar('?');
+			break;
 		}
 	}
 }
 
 /* Print a formatted event to stdout. */
-static void print_event_helper(const char *format, time_t day, struct event *ev,
-			       struct recur_event *rev)
-{
-	const char *p;
-	char extformat[FS_EXT_MAXLEN];
-
-	for (p = format; *p; p++) {
-		if (*p == '%') {
-			p++;
-			switch (parse_fs(&p, extformat)) {
-			case FS_MESSAGE:
-				printf("%s", ev->mesg);
-				break;
-			case FS_NOTE:
-				printf("%s", ev->note);
-				break;
-			case FS_NOTEFILE:
-				print_notefile(stdout, ev->note, 1);
-				break;
-			case FS_PSIGN:
-				putchar('%');
-				break;
-			case FS_RAW:
-				if (rev)
-					recur_event_write(rev, stdout);
-				else
-					event_write(ev, stdout);
-				break;
-			case FS_HASH:
-				if (rev)
-					printf("%s", recur_event_hash(rev));
-				else
-					printf("%s", event_hash(ev));
-				break;
-			case FS_EOF:
-				return;
-				break;
-			default:
-				putchar('?');
-				break;
-			}
-		} else if (*p == '\\') {
-			p += print_escape(p);
-		} else {
-			putchar(*p);
+static void print_event_helper(const struct format *fmt, time_t day,
+			       struct event *ev, struct recur_event *rev)
+{
+	const struct format_op *op;
+	char *hash;
+
+	for (op = fmt->ops; op < fmt->ops + fmt->n; op++) {
+		switch (op->fs) {
+		case FS_TEXT:
+			format_print_text(fmt, op);
+			break;
+		case FS_JSON:
+			print_event_json(day, ev, rev);
+			break;
+		case FS_MESSAGE:
+			printf("%s", ev->mesg);
+			break;
+		case FS_NOTE:
+			printf("%s", ev->note);
+			break;
+		case FS_NOTEFILE:
+			print_notefile(stdout, ev->note, 1);
+			break;
+		case FS_RAW:
+			if (rev)
+				recur_event_write(rev, stdout);
+			else
+				event_write(ev, stdout);
+			break;
+		case FS_HASH:
+			hash = rev ? recur_event_hash(rev) :
+			    event_hash(ev);
+			printf("%s", hash);
+			mem_free(hash);
+			break;
+		default:
+			putchar('?');
+			break;
 		}
 	}
 }
 
 /* Print a formatted appointment to stdout. */
-void print_apoint(const char *format, time_t day, struct apoint *apt)
+void print_apoint(const struct format *fmt, time_t day, struct apoint *apt)
 {
-	print_apoint_helper(format, day, apt, NULL);
+	print_apoint_helper(fmt, day, apt, NULL);
 }
 
 /* Print a formatted event to stdout. */
-void print_event(const char *format, time_t day, struct event *ev)
+void print_event(const struct format *fmt, time_t day, struct event *ev)
 {
-	print_event_helper(format, day, ev, NULL);
+	print_event_helper(fmt, day, ev, NULL);
 }
 
 /* Print a formatted recurrent appointment to stdout. */
 void
-print_recur_apoint(const char *format, time_t day, time_t occurrence,
+print_recur_apoint(const struct format *fmt, time_t day, time_t occurrence,
 		   struct recur_apoint *rapt)
 {
 	struct apoint apt;
@@ -1877,11 +2120,11 @@ print_recur_apoint(const char *format, time_t day, time_t occurrence,
 	apt.mesg = rapt->mesg;
 	apt.note = rapt->note;
 
-	print_apoint_helper(format, day, &apt, rapt);
+	print_apoint_helper(fmt, day, &apt, rapt);
 }
 
 /* Print a formatted recurrent event to stdout. */
-void print_recur_event(const char *format, time_t day,
+void print_recur_event(const struct format *fmt, time_t day,
 		       struct recur_event *rev)
 {
 	struct event ev;
@@ -1889,51 +2132,46 @@ void print_recur_event(const char *format, time_t day,
 	ev.mesg = rev->mesg;
 	ev.note = rev->note;
 
-	print_event_helper(format, day, &ev, rev);
+	print_event_helper(fmt, day, &ev, rev);
 }
 
 /* Print a formatted todo item to stdout. */
-void print_todo(const char *format, struct todo *todo)
-{
-	const char *p;
-	char extformat[FS_EXT_MAXLEN];
-
-	for (p = format; *p; p++) {
-		if (*p == '%') {
-			p++;
-			switch (parse_fs(&p, extformat)) {
-			case FS_PRIORITY:
-				printf("%d", abs(todo->id));
-				break;
-			case FS_MESSAGE:
-				printf("%s", todo->mesg);
-				break;
-			case FS_NOTE:
-				printf("%s", todo->note);
-				break;
-			case FS_NOTEFILE:
-				print_notefile(stdout, todo->note, 1);
-				break;
-			case FS_RAW:
-				todo_write(todo, stdout);
-				break;
-			case FS_HASH:
-				printf("%s", todo_hash(todo));
-				break;
-			case FS_PSIGN:
-				putchar('%');
-				break;
-			case FS_EOF:
-				return;
-				break;
-			default:
-				putchar('?');
-				break;
-			}
-		} else if (*p == '\\') {
-			p += print_escape(p);
-		} else {
-			putchar(*p);
+void print_todo(const struct format *fmt, struct todo *todo)
+{
+	const struct format_op *op;
+	char *hash;
+
+	for (op = fmt->ops; op < fmt->ops + fmt->n; op++) {
+		switch (op->fs) {
+		case FS_TEXT:
+			format_print_text(fmt, op);
+			break;
+		case FS_JSON:
+			print_todo_json(todo);
+			break;
+		case FS_PRIORITY:
+			printf("%d", abs(todo->id));
+			break;
+		case FS_MESSAGE:
+			printf("%s", todo->mesg);
+			break;
+		case FS_NOTE:
+			printf("%s", todo->note);
+			break;
+		case FS_NOTEFILE:
+			print_notefile(stdout, todo->note, 1);
+			break;
+		case FS_RAW:
+			todo_write(todo, stdout);
+			break;
+		case FS_HASH:
+			hash = todo_hash(todo);
+			printf("%s", hash);
+			mem_free(hash);
+			break;
+		default:
+			putchar('?');
+			break;
 		}
 	}
 }
@@ -1978,6 +2216,124 @@ int hash_matches(const char *pattern, const char *hash)
 	return (starts_with(hash, pattern) != invert);
 }
 
+/*
+ * Hashes of all items, computed in one batch. Commands that print the hash of
+ * every item (such as the hash listings used by the synchronization scripts)
+ * fill this in beforehand, so that the *_hash() functions find the digests
+ * ready instead of hashing one item at a time. It must be dropped before any
+ * item is modified.
+ */
+struct item_hash {
+	const void *item;
+	char sha1[SHA1_DIGESTLEN * 2 + 1];
+};
+
+static struct item_hash *item_hashes;
+static unsigned item_hashes_n;
+
+static int item_hash_cmp(const void *a, const void *b)
+{
+	uintptr_t x = (uintptr_t)((const struct item_hash *)a)->item;
+	uintptr_t y = (uintptr_t)((const struct item_hash *)b)->item;
+
+	return (x > y) - (x < y);
+}
+
+static void item_hashes_add(const void *item, struct string *s, size_t **off,
+			    unsigned *size)
+{
+	if (item_hashes_n == *size) {
+		*size = *size ? 2 * *size : 256;
+		item_hashes = mem_realloc(item_hashes, *size,
+					  sizeof(struct item_hash));
+		*off = mem_realloc(*off, *size + 1, sizeof(size_t));
+	}
+	item_hashes[item_hashes_n++].item = item;
+	(*off)[item_hashes_n] = s->len;
+}
+
+void item_hashes_prefetch(void)
+{
+	struct string s;
+	llist_item_t *i;
+	size_t *off = NULL, *len;
+	const char **data;
+	char **out;
+	unsigned size = 0, n;
+
+	item_hashes_free();
+	string_init(&s);
+
+	LLIST_FOREACH(&recur_elist, i) {
+		struct recur_event *rev = LLIST_GET_DATA(i);
+		recur_event_serialize(rev, &s);
+		item_hashes_add(rev, &s, &off, &size);
+	}
+	LLIST_TS_FOREACH(&recur_alist_p, i) {
+		struct recur_apoint *rapt = LLIST_GET_DATA(i);
+		recur_apoint_serialize(rapt, &s);
+		item_hashes_add(rapt, &s, &off, &size);
+	}
+	LLIST_TS_FOREACH(&alist_p, i) {
+		struct apoint *apt = LLIST_TS_GET_DATA(i);
+		apoint_serialize(apt, &s);
+		item_hashes_add(apt, &s, &off, &size);
+	}
+	LLIST_FOREACH(&eventlist, i) {
+		struct event *ev = LLIST_GET_DATA(i);
+		event_serialize(ev, &s);
+		item_hashes_add(ev, &s, &off, &size);
+	}
+	LLIST_FOREACH(&todolist, i) {
+		struct todo *todo = LLIST_GET_DATA(i);
+		todo_serialize(todo, &s);
+		item_hashes_add(todo, &s, &off, &size);
+	}
+
+	if (item_hashes_n > 0) {
+		data = mem_malloc(item_hashes_n * sizeof(char *));
+		len = mem_malloc(item_hashes_n * sizeof(size_t));
+		out = mem_malloc(item_hashes_n * sizeof(char *));
+		off[0] = 0;
+		for (n = 0; n < item_hashes_n; n++) {
+			data[n] = string_buf(&s) + off[n];
+			len[n] = off[n + 1] - off[n];
+			out[n] = item_hashes[n].sha1;
+		}
+		sha1_digest_many(item_hashes_n, data, len, out);
+		mem_free(data);
+		mem_free(len);
+		mem_free(out);
+		qsort(item_hashes, item_hashes_n, sizeof(struct item_hash),
+		      item_hash_cmp);
+	}
+
+	mem_free(off);
+	string_free(&s);
+}
+
+void item_hashes_free(void)
+{
+	if (!item_hashes)
+		return;
+	mem_free(item_hashes);
+	item_hashes = NULL;
+	item_hashes_n = 0;
+}
+
+/* Return a copy of the prefetched hash of an item, or NULL if there is none. */
+char *item_hash_lookup(const void *item)
+{
+	struct item_hash key, *found;
+
+	if (item_hashes_n == 0)
+		return NULL;
+	key.item = item;
+	found = bsearch(&key, item_hashes, item_hashes_n,
+			sizeof(struct item_hash), item_hash_cmp);
+	return found ? mem_strdup(found->sha1) : NULL;
+}
+
 /*
  * Overflow check for addition with positive second term.
  */
@@ -83,11 +83,16 @@ char *path_ddir = NULL;
 char *path_cdir = NULL;
 char *path_todo = NULL;
 char *path_apts = NULL;
+char *path_shards = NULL;
+char *path_archive = NULL;
 char *path_conf = NULL;
 char *path_notes = NULL;
+char *path_notes_pack = NULL;
+char *path_notes_index = NULL;
 char *path_keys = NULL;
 char *path_cpid = NULL;
 char *path_dpid = NULL;
+char *path_dsock = NULL;
 char *path_dmon_log = NULL;
 char *path_hooks = NULL;
 
@@ -110,7 +115,7 @@ struct dmon_conf dmon;
  * one of the threads is not running, the corresponding variable is assigned
  * the identifier of the main thread instead.
  */
-pthread_t notify_t_main, io_t_psave, ui_calendar_t_date;
+pthread_t notify_t_main, io_t_psave, io_t_watch, ui_calendar_t_date;
 
 /*
  * Variables init
@@ -133,6 +138,16 @@ void vars_init(void)
 	conf.auto_save = 1;
 	conf.auto_gc = 0;
 	conf.periodic_save = 0;
+	conf.periodic_save_idle = 0;
+	conf.periodic_save_edits = 0;
+	conf.load_threads = 0;
+	conf.snapshot = 0;
+	conf.journal = 0;
+	conf.journal_size = 1024;
+	conf.year_shards = 0;
+	conf.archive_age = 0;
+	conf.note_pack = 0;
+	conf.autoreload = 0;
 	conf.systemevents = 1;
 	conf.default_panel = CAL;
 	conf.compact_panels = 0;
@@ -185,5 +200,6 @@ void vars_init(void)
 	ui_calendar_init_slctd_day();
 
 	/* Threads not yet running. */
-	notify_t_main = io_t_psave = ui_calendar_t_date = pthread_self();
+	notify_t_main = io_t_psave = io_t_watch = ui_calendar_t_date =
+	    pthread_self();
 }
@@ -0,0 +1,37 @@
+#!/bin/sh
+
+. "${TEST_INIT:-./test-init.sh}"
+
+if [ "$1" = 'actual' ]; then
+  tmpdir=$(mktemp -d)
+  cp "$DATA_DIR/conf" "$tmpdir" || exit 1
+  : > "$tmpdir/todo"
+  cat > "$tmpdir/apts" <<EOD
+01/01/2015 @ 10:00 -> 01/01/2015 @ 11:00|Archived
+03/04/2016 [1] Archived event
+06/01/2016 [1] {1Y} Recurring
+12/31/2037 @ 10:00 -> 12/31/2037 @ 11:00|Kept
+EOD
+  "$CALCURSE" -D "$tmpdir" --archive=30
+  cat "$tmpdir/apts"
+  head -n 1 "$tmpdir/apts.archive" | cut -d ' ' -f 1
+  tail -n +2 "$tmpdir/apts.archive"
+  "$CALCURSE" -D "$tmpdir" -Q --from 01/01/2015
+  "$CALCURSE" -D "$tmpdir" -G --filter-pattern Archived
+  rm -rf "$tmpdir" || exit 1
+elif [ "$1" = 'expected' ]; then
+  cat <<EOD
+06/01/2016 [1] {1Y} Recurring
+12/31/2037 @ 10:00 -> 12/31/2037 @ 11:00|Kept
+calcurse-archive
+01/01/2015 @ 10:00 -> 01/01/2015 @ 11:00|Archived
+03/04/2016 [1] Archived event
+01/01/15:
+ - 10:00 -> 11:00
+	Archived
+01/01/2015 @ 10:00 -> 01/01/2015 @ 11:00|Archived
+03/04/2016 [1] Archived event
+EOD
+else
+  ./run-test "$0"
+fi
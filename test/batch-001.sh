@@ -0,0 +1,61 @@
+#!/bin/sh
+
+. "${TEST_INIT:-./test-init.sh}"
+
+if [ "$1" = 'actual' ]; then
+  tmpdir=$(mktemp -d)
+  cp "$DATA_DIR/conf" "$tmpdir" || exit 1
+  cat > "$tmpdir/apts" <<EOD
+01/01/2030 @ 10:00 -> 01/01/2030 @ 11:00|Meeting
+EOD
+  cat > "$tmpdir/todo" <<EOD
+[1] Keep
+[2] Drop
+EOD
+  ical='BEGIN:VCALENDAR
+VERSION:2.0
+BEGIN:VTODO
+PRIORITY:3
+SUMMARY:New
+END:VTODO
+END:VCALENDAR'
+  {
+    echo 'hashes todo'
+    echo 'export 5ed6b45cef60b7f45969bdcae2cdc36bfbea52d1'
+    echo 'remove 5ed6b45cef60b7f45969bdcae2cdc36bfbea52d1'
+    echo 'remove 5ed6b45cef60b7f45969bdcae2cdc36bfbea52d1'
+    echo "import $(printf '%s\n' "$ical" | wc -c)"
+    printf '%s\n' "$ical"
+    echo 'frobnicate'
+    echo 'quit'
+  } | "$CALCURSE" -D "$tmpdir" --batch |
+    sed -e "/^PRODID:/d" -e "s/^OK [0-9]\{3,\}$/OK (export)/"
+  cat "$tmpdir/apts" "$tmpdir/todo"
+  rm -rf "$tmpdir" || exit 1
+elif [ "$1" = 'expected' ]; then
+  cat <<EOD
+OK 82
+63948f70c6160b05dcb9357884cbc221f725303e
+5ed6b45cef60b7f45969bdcae2cdc36bfbea52d1
+OK (export)
+BEGIN:VCALENDAR
+VERSION:2.0
+BEGIN:VTODO
+UID:5ed6b45cef60b7f45969bdcae2cdc36bfbea52d1
+PRIORITY:2
+SUMMARY:Drop
+END:VTODO
+END:VCALENDAR
+OK 0
+ERR no such item
+OK 41
+4ecc15e9fe049f6aa60abf9c1d726957f8064f62
+ERR invalid command
+OK 0
+01/01/2030 @ 10:00 -> 01/01/2030 @ 11:00|Meeting
+[1] Keep
+[3] New
+EOD
+else
+  ./run-test "$0"
+fi
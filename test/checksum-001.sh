@@ -0,0 +1,5 @@
+#!/bin/sh
+
+. "${TEST_INIT:-./test-init.sh}"
+
+./checksum-test
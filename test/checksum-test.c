@@ -0,0 +1,187 @@
+/*
+ * Calcurse - text-based organizer
+ *
+ * Copyright (c) 2004-2020 calcurse Development Team <misc@calcurse.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the
+ *        following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the
+ *        following disclaimer in the documentation and/or other
+ *        materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Send your feedback or comments to : misc@calcurse.org
+ * Calcurse home page : http://calcurse.org
+ *
+ */
+
+
+/*
+ * Checks for the data file checksum, and a throughput benchmark.
+ *
+ * Without arguments, the checksums of a few messages are compared against
+ * fixed values (journals and snapshots store them, so they must not change),
+ * and feeding data in chunks of any size is checked to give the same result
+ * as feeding it at once. With -b, the throughput of checksum_update() is
+ * measured on a large buffer instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "checksum.h"
+
+#define SUMLEN (CHECKSUM_LEN * 2 + 1)
+#define BUFLEN 8192
+#define BENCHLEN (256 << 20)
+
+static const struct {
+	const char *msg;
+	unsigned repeat;
+	const char *sum;
+} kat[] = {
+	{ "", 1, "df5c443bbc3098ba8aaf1e31d3b3cbcf" },
+	{ "abc", 1, "79c29f00498200091d706862a8e26f33" },
+	{ "The quick brown fox jumps over the lazy dog", 1,
+	  "dc80266c96514d95e990a0c4b435ea19" },
+	{ "0123456701234567012345670123456701234567012345670123456701234567",
+	  1, "c8244ce13381b7e06c6b1ab836472c6e" },
+	{ "a", 1000000, "55ca58908c3bbe0e288ef3018e523552" }
+};
+
+#define NKATS (sizeof(kat) / sizeof(kat[0]))
+
+static void sum(const uint8_t *data, size_t len, size_t chunk, char *out)
+{
+	checksum_ctx_t ctx;
+	size_t n;
+
+	checksum_init(&ctx);
+	for (; len > 0; data += n, len -= n) {
+		n = len < chunk ? len : chunk;
+		checksum_update(&ctx, data, n);
+	}
+	checksum_final_hex(&ctx, out);
+}
+
+static int check_kat(void)
+{
+	checksum_ctx_t ctx;
+	char out[SUMLEN];
+	unsigned i, j;
+	int ret = 1;
+
+	for (i = 0; i < NKATS; i++) {
+		checksum_init(&ctx);
+		for (j = 0; j < kat[i].repeat; j++)
+			checksum_update(&ctx, (const uint8_t *)kat[i].msg,
+					strlen(kat[i].msg));
+		checksum_final_hex(&ctx, out);
+		if (strcmp(out, kat[i].sum) != 0) {
+			printf("vector %u: got %s, expected %s\n", i, out,
+			       kat[i].sum);
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Feed data in chunks of various sizes. Trailing zeros must change the
+ * checksum, since the last stripe is padded with zeros.
+ */
+static int check_chunks(const uint8_t *buf)
+{
+	static const size_t chunks[] = { 1, 7, 64, 1000, 1024, BUFLEN };
+	char out[SUMLEN], ref[SUMLEN], prev[SUMLEN] = "";
+	size_t len, i;
+	int ret = 1;
+
+	for (len = 0; len <= BUFLEN; len += len < 2100 ? 1 : 97) {
+		sum(buf, len, BUFLEN, ref);
+		for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+			sum(buf, len, chunks[i], out);
+			if (strcmp(out, ref) != 0) {
+				printf("%lu bytes in chunks of %lu: got %s, "
+				       "expected %s\n", (unsigned long)len,
+				       (unsigned long)chunks[i], out, ref);
+				ret = 0;
+			}
+		}
+		if (!strcmp(ref, prev)) {
+			printf("%lu bytes: same checksum as one byte less\n",
+			       (unsigned long)len);
+			ret = 0;
+		}
+		strcpy(prev, ref);
+	}
+
+	return ret;
+}
+
+static int test(void)
+{
+	uint8_t buf[BUFLEN];
+	unsigned i;
+
+	srand(1);
+	for (i = 0; i < BUFLEN; i++)
+		buf[i] = i % 3 ? rand() & 0xff : 0;
+
+	return check_kat() && check_chunks(buf);
+}
+
+static void bench(void)
+{
+	uint8_t *buf;
+	char out[SUMLEN];
+	clock_t start;
+	double secs;
+	unsigned i;
+
+	if (!(buf = malloc(BENCHLEN))) {
+		fprintf(stderr, "cannot set up the benchmark\n");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < BENCHLEN; i++)
+		buf[i] = i * 2654435761U >> 24;
+
+	start = clock();
+	sum(buf, BENCHLEN, BENCHLEN, out);
+	secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+	printf("%8.1f MB/s  %s\n",
+	       BENCHLEN / 1048576.0 / (secs > 0 ? secs : 1e-9), out);
+	free(buf);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && !strcmp(argv[1], "-b")) {
+		bench();
+		return EXIT_SUCCESS;
+	}
+
+	return test() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,69 @@
+#!/bin/sh
+
+. "${TEST_INIT:-./test-init.sh}"
+
+if [ "$1" = 'actual' ]; then
+  tmpdir=$(mktemp -d)
+  cp "$DATA_DIR/conf" "$tmpdir" || exit 1
+  echo 'daemon.socket=yes' >> "$tmpdir/conf"
+  echo 'daemon.log=yes' >> "$tmpdir/conf"
+  cat > "$tmpdir/apts" <<EOD
+01/01/2030 @ 10:00 -> 01/01/2030 @ 11:00|Meeting
+01/01/2030 [1] Holiday
+EOD
+  cat > "$tmpdir/todo" <<EOD
+[1] Keep
+EOD
+  "$CALCURSE" -D "$tmpdir" --daemon
+  for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S "$tmpdir/.daemon.sock" ] && break
+    sleep 1
+  done
+  "$CALCURSE" -D "$tmpdir" -Q --from 01/01/2030
+  "$CALCURSE" -D "$tmpdir" -G --filter-pattern Meet
+  echo '[2] Added' >> "$tmpdir/todo"
+  "$CALCURSE" -D "$tmpdir" -t
+  echo '01/01/2030 [1] Other' > "$tmpdir/other"
+  "$CALCURSE" -D "$tmpdir" -c "$tmpdir/other" -Q --from 01/01/2030
+  "$CALCURSE" -D "$tmpdir" -c "$tmpdir/other" --read-only -G
+  grep -c '^answered query' "$tmpdir/daemon.log"
+  grep -c '^declined query' "$tmpdir/daemon.log"
+  kill "$(cat "$tmpdir/.daemon.pid")"
+  for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S "$tmpdir/.daemon.sock" ] || break
+    sleep 1
+  done
+  "$CALCURSE" -D "$tmpdir" -Q --from 01/01/2030 --filter-type cal
+  rm -rf "$tmpdir" || exit 1
+elif [ "$1" = 'expected' ]; then
+  cat <<EOD
+to do:
+1. Keep
+
+01/01/30:
+ * Holiday
+ - 10:00 -> 11:00
+	Meeting
+01/01/2030 @ 10:00 -> 01/01/2030 @ 11:00|Meeting
+to do:
+1. Keep
+2. Added
+to do:
+1. Keep
+2. Added
+
+01/01/30:
+ * Other
+[1] Keep
+[2] Added
+01/01/2030 [1] Other
+3
+2
+01/01/30:
+ * Holiday
+ - 10:00 -> 11:00
+	Meeting
+EOD
+else
+  ./run-test "$0"
+fi
@@ -0,0 +1,44 @@
+#!/bin/sh
+
+. "${TEST_INIT:-./test-init.sh}"
+
+if [ "$1" = 'actual' ]; then
+  tmpdir=$(mktemp -d)
+  cp "$DATA_DIR/conf" "$tmpdir" || exit 1
+  : > "$tmpdir/todo"
+  cat > "$tmpdir/apts" <<EOD
+01/01/2030 @ 10:00 -> 01/01/2030 @ 11:00|Kept
+01/02/2030 @ 10:00 -> 01/02/2030 @ 11:00|Deleted
+EOD
+  cat > "$tmpdir/apts.journal" <<EOD
+calcurse-journal 0a45e454d6823c819e20a61b1df966ce3696f616
++01/03/2030 @ 10:00 -> 01/03/2030 @ 11:00|Added
+-2036f41156002d9bedad684686237bdbc9baa779
+EOD
+  "$CALCURSE" -D "$tmpdir" -G
+  cat > "$tmpdir/apts.journal" <<EOD
+calcurse-journal 0000000000000000000000000000000000000000
++01/03/2030 @ 10:00 -> 01/03/2030 @ 11:00|Added
++01/01/2030 @ 10:00 -> 01/01/2030 @ 11:00|Kept
+-2036f41156002d9bedad684686237bdbc9baa779
+-0000000000000000000000000000000000000000
+EOD
+  "$CALCURSE" -D "$tmpdir" -G 2>/dev/null
+  [ -f "$tmpdir/apts.journal" ] || echo 'journal dropped'
+  "$CALCURSE" -D "$tmpdir" -P --filter-pattern NoSuchItem 2>/dev/null
+  cat "$tmpdir/apts"
+  [ -f "$tmpdir/apts.journal" ] && echo 'journal kept'
+  [ -f "$tmpdir/apts.journal.orphan" ] || echo 'orphan journal missing'
+  rm -rf "$tmpdir" || exit 1
+elif [ "$1" = 'expected' ]; then
+  cat <<EOD
+01/01/2030 @ 10:00 -> 01/01/2030 @ 11:00|Kept
+01/03/2030 @ 10:00 -> 01/03/2030 @ 11:00|Added
+01/01/2030 @ 10:00 -> 01/01/2030 @ 11:00|Kept
+01/03/2030 @ 10:00 -> 01/03/2030 @ 11:00|Added
+01/01/2030 @ 10:00 -> 01/01/2030 @ 11:00|Kept
+01/03/2030 @ 10:00 -> 01/03/2030 @ 11:00|Added
+EOD
+else
+  ./run-test "$0"
+fi
@@ -0,0 +1,36 @@
+#!/bin/sh
+
+. "${TEST_INIT:-./test-init.sh}"
+
+if [ "$1" = 'actual' ]; then
+  tmpdir=$(mktemp -d)
+  cp "$DATA_DIR/conf" "$tmpdir" || exit 1
+  printf '%s\n' \
+    '01/01/2030 @ 10:00 -> 01/01/2030 @ 11:00|Say "hi" \ bye' \
+    '01/01/2030 @ 09:00 -> 01/01/2030 @ 09:30 {2W -> 03/01/2030}|Weekly' \
+    '01/01/2030 [1] Holiday' \
+    '01/01/2030 [1] {1Y} Birthday' > "$tmpdir/apts"
+  printf '[1] Keep\ttabbed\n[-2] Done\n' > "$tmpdir/todo"
+  TZ=UTC "$CALCURSE" -D "$tmpdir" -Q --from 01/01/2030 --days 2 \
+    --filter-type cal --output=jsonl
+  echo
+  TZ=UTC "$CALCURSE" -D "$tmpdir" -G --filter-type todo --output=jsonl
+  echo
+  TZ=UTC "$CALCURSE" -D "$tmpdir" -G --output=jsonl --format-todo='%m' 2>/dev/null ||
+    echo 'rejected'
+  rm -rf "$tmpdir" || exit 1
+elif [ "$1" = 'expected' ]; then
+  cat <<EOD
+{"type":"recur-event","hash":"e1dcf420375f16beaed66689df77c0fa596a7fce","start":1893456000,"message":"Birthday","note":null,"recurrence":{"type":"yearly","freq":1,"until":null}}
+{"type":"event","hash":"0eb1e8007bc5f2b7c3fe98ebabc8d5c91109b5f5","start":1893456000,"message":"Holiday","note":null}
+{"type":"recur-apt","hash":"3e102e1036b7c561549fc8caf942ed830f68933a","start":1893488400,"end":1893490200,"message":"Weekly","note":null,"recurrence":{"type":"weekly","freq":2,"until":1898553600}}
+{"type":"apt","hash":"59bc9bf30b3915e55405df8c989e17e22ab213d4","start":1893492000,"end":1893495600,"message":"Say \\"hi\\" \\\\ bye","note":null}
+
+{"type":"todo","hash":"5ca14c7b9b63f89fa6b63d36513e8eddea2edd2a","priority":1,"completed":false,"message":"Keep\\ttabbed","note":null}
+{"type":"todo","hash":"a1abc2a74557c681e780b63cd8388969e3812152","priority":2,"completed":true,"message":"Done","note":null}
+
+rejected
+EOD
+else
+  ./run-test "$0"
+fi
@@ -0,0 +1,76 @@
+#!/bin/sh
+
+. "${TEST_INIT:-./test-init.sh}"
+
+# Wait until the batch has sent the given number of replies.
+wait_replies() {
+  for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ "$(grep -c '^OK \|^ERR ' "$tmpdir/out")" -ge "$1" ] && break
+    sleep 1
+  done
+}
+
+if [ "$1" = 'actual' ]; then
+  tmpdir=$(mktemp -d)
+  cp "$DATA_DIR/conf" "$tmpdir" || exit 1
+  cat > "$tmpdir/apts" <<EOD
+01/01/2030 @ 10:00 -> 01/01/2030 @ 11:00|Meeting
+01/02/2030 [1] Holiday
+01/03/2030 [1] Party
+EOD
+  cat > "$tmpdir/todo" <<EOD
+[1] Keep
+EOD
+  ical='BEGIN:VCALENDAR
+VERSION:2.0
+BEGIN:VEVENT
+DTSTART:20300101T120000
+DTEND:20300101T130000
+SUMMARY:Meeting
+END:VEVENT
+BEGIN:VEVENT
+DTSTART;VALUE=DATE:20300105
+SUMMARY:Lunch
+END:VEVENT
+END:VCALENDAR'
+  mkfifo "$tmpdir/in"
+  "$CALCURSE" -D "$tmpdir" --batch < "$tmpdir/in" > "$tmpdir/out" &
+  exec 3> "$tmpdir/in"
+
+  # Remove an event, and move the meeting to another time.
+  echo 'remove a359ce0489f2188f9375520feb6119ee230e5b98' >&3
+  echo 'remove 2ab93577d57f0c8596370e809f358f154ff5d58b' >&3
+  echo "import $(printf '%s\n' "$ical" | wc -c)" >&3
+  printf '%s\n' "$ical" >&3
+  wait_replies 3
+
+  # Meanwhile, another instance removes an event, adds one, and extends the
+  # meeting.
+  cat > "$tmpdir/apts" <<EOD
+01/01/2030 @ 10:00 -> 01/01/2030 @ 13:00|Meeting
+01/02/2030 [1] Holiday
+01/04/2030 [1] Dinner
+EOD
+  echo 'save' >&3
+  exec 3>&-
+  wait
+  cat "$tmpdir/out"
+  cat "$tmpdir/apts" "$tmpdir/todo"
+  rm -rf "$tmpdir" || exit 1
+elif [ "$1" = 'expected' ]; then
+  cat <<EOD
+OK 0
+OK 0
+OK 82
+068cdf110b449d6db2be090215f58250f2e31a34
+a7eca942f9a4c1fbab607724ac3611c09aadf8fa
+OK 41
+068cdf110b449d6db2be090215f58250f2e31a34
+01/01/2030 @ 10:00 -> 01/01/2030 @ 13:00|Meeting
+01/04/2030 [1] Dinner
+01/05/2030 [1] Lunch
+[1] Keep
+EOD
+else
+  ./run-test "$0"
+fi
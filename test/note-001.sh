@@ -0,0 +1,44 @@
+#!/bin/sh
+
+. "${TEST_INIT:-./test-init.sh}"
+
+if [ "$1" = 'actual' ]; then
+  tmpdir=$(mktemp -d)
+  cp "$DATA_DIR/conf" "$tmpdir" || exit 1
+  echo 'general.notepack=yes' >> "$tmpdir/conf"
+  mkdir "$tmpdir/notes"
+  printf 'First note\n' > "$tmpdir/notes/5bcb8ac0a8c2e8a34dc4d3bb6bf2b26f42f4c4a8"
+  printf 'Second note\n' > "$tmpdir/notes/0bd3f6e4acb6c1c53a7c5b07ab2e1d6d8d2b3c01"
+  printf 'Unused note\n' > "$tmpdir/notes/0000000000000000000000000000000000000000"
+  cat > "$tmpdir/todo" <<EOD
+[1]>5bcb8ac0a8c2e8a34dc4d3bb6bf2b26f42f4c4a8 First
+[2]>0bd3f6e4acb6c1c53a7c5b07ab2e1d6d8d2b3c01 Second
+EOD
+  : > "$tmpdir/apts"
+  "$CALCURSE" -D "$tmpdir" --gc
+  ls "$tmpdir/notes" | wc -l
+  "$CALCURSE" -D "$tmpdir" -t --format-todo '%m: %N\n'
+  echo '[1]>0bd3f6e4acb6c1c53a7c5b07ab2e1d6d8d2b3c01 Second' > "$tmpdir/todo"
+  "$CALCURSE" -D "$tmpdir" --gc
+  wc -c < "$tmpdir/notes.pack"
+  "$CALCURSE" -D "$tmpdir" -t --format-todo '%m: %N\n'
+  rm -rf "$tmpdir" || exit 1
+elif [ "$1" = 'expected' ]; then
+  cat <<EOD
+0
+to do:
+First: 	First note
+
+
+Second: 	Second note
+
+
+12
+to do:
+Second: 	Second note
+
+
+EOD
+else
+  ./run-test "$0"
+fi
@@ -0,0 +1,237 @@
+/*
+ * Calcurse - text-based organizer
+ *
+ * Copyright (c) 2004-2020 calcurse Development Team <misc@calcurse.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the
+ *        following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the
+ *        following disclaimer in the documentation and/or other
+ *        materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Send your feedback or comments to : misc@calcurse.org
+ * Calcurse home page : http://calcurse.org
+ *
+ */
+
+/*
+ * Known-answer tests for the SHA1 implementations, and a throughput
+ * benchmark.
+ *
+ * Without arguments, every implementation the processor supports is checked
+ * against the reference digests and against the generic implementation, and
+ * sha1_digest_many() against sha1_digest(). With -b, the throughput of
+ * sha1_stream() is measured on a large file instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sha1.h"
+
+static const char *impls[] = { "generic", "ssse3", "shani", "armv8" };
+
+#define NIMPLS (sizeof(impls) / sizeof(impls[0]))
+
+static const struct {
+	const char *msg;
+	unsigned repeat;
+	const char *digest;
+} kat[] = {
+	{ "", 1, "da39a3ee5e6b4b0d3255bfef95601890afd80709" },
+	{ "abc", 1, "a9993e364706816aba3e25717850c26c9cd0d89d" },
+	{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+	  "84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+	{ "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+	  "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu", 1,
+	  "a49b2446a02c645bf419f995b67091253a04a259" },
+	{ "The quick brown fox jumps over the lazy dog", 1,
+	  "2fd4e1c67a2d28fced849ee1bb76e7391b93eb12" },
+	{ "a", 1000000, "34aa973cd4c4daa4f61eeb2bdbad27316534016f" },
+	{ "0123456701234567012345670123456701234567012345670123456701234567",
+	  10, "dea356a2cddd90c7a7ecedc5ebb563934f460452" }
+};
+
+#define NKATS (sizeof(kat) / sizeof(kat[0]))
+
+#define BUFLEN 4096
+#define BENCHLEN (256 << 20)
+#define BATCHLEN 1000
+
+static void digest(const uint8_t *data, size_t len, size_t chunk, char *out)
+{
+	sha1_ctx_t ctx;
+	size_t n;
+
+	sha1_init(&ctx);
+	for (; len > 0; data += n, len -= n) {
+		n = len < chunk ? len : chunk;
+		sha1_update(&ctx, data, n);
+	}
+	sha1_final_hex(&ctx, out);
+}
+
+static int check_kat(const char *impl)
+{
+	sha1_ctx_t ctx;
+	char out[SHA1_DIGESTLEN * 2 + 1];
+	unsigned i, j;
+	int ret = 1;
+
+	for (i = 0; i < NKATS; i++) {
+		sha1_init(&ctx);
+		for (j = 0; j < kat[i].repeat; j++)
+			sha1_update(&ctx, (const uint8_t *)kat[i].msg,
+				    strlen(kat[i].msg));
+		sha1_final_hex(&ctx, out);
+		if (strcmp(out, kat[i].digest) != 0) {
+			printf("%s: vector %u: got %s, expected %s\n", impl,
+			       i, out, kat[i].digest);
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
+/* Compare an implementation against the generic one on random data. */
+static int check_generic(const char *impl, const uint8_t *buf)
+{
+	static const size_t chunks[] = { 1, 13, 64, 100, BUFLEN };
+	char out[SHA1_DIGESTLEN * 2 + 1], ref[SHA1_DIGESTLEN * 2 + 1];
+	size_t len, i;
+	int ret = 1;
+
+	for (len = 0; len <= BUFLEN; len += len < 256 ? 1 : 61) {
+		for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+			sha1_impl_set("generic");
+			digest(buf, len, chunks[i], ref);
+			sha1_impl_set(impl);
+			digest(buf, len, chunks[i], out);
+			if (strcmp(out, ref) != 0) {
+				printf("%s: %lu bytes in chunks of %lu: got %s, "
+				       "expected %s\n", impl,
+				       (unsigned long)len,
+				       (unsigned long)chunks[i], out, ref);
+				ret = 0;
+			}
+		}
+	}
+
+	return ret;
+}
+
+/* Hash messages of many different lengths in one batch. */
+static int check_many(const uint8_t *buf)
+{
+	const char *data[BATCHLEN];
+	size_t len[BATCHLEN];
+	char *out[BATCHLEN], ref[SHA1_DIGESTLEN * 2 + 1];
+	unsigned i;
+	int ret = 1;
+
+	for (i = 0; i < BATCHLEN; i++) {
+		len[i] = (i * 37) % 300;
+		data[i] = (const char *)buf + i;
+		out[i] = malloc(SHA1_DIGESTLEN * 2 + 1);
+	}
+	sha1_digest_many(BATCHLEN, data, len, out);
+	for (i = 0; i < BATCHLEN; i++) {
+		digest(buf + i, len[i], len[i] + 1, ref);
+		if (strcmp(out[i], ref) != 0) {
+			printf("batch: message %u (%lu bytes): got %s, "
+			       "expected %s\n", i, (unsigned long)len[i],
+			       out[i], ref);
+			ret = 0;
+		}
+		free(out[i]);
+	}
+
+	return ret;
+}
+
+static int test(void)
+{
+	uint8_t buf[BUFLEN];
+	unsigned i;
+	int ret = 1;
+
+	srand(1);
+	for (i = 0; i < BUFLEN; i++)
+		buf[i] = rand() & 0xff;
+
+	for (i = 0; i < NIMPLS; i++) {
+		if (!sha1_impl_set(impls[i]))
+			continue;
+		if (!check_kat(impls[i]) || !check_generic(impls[i], buf))
+			ret = 0;
+	}
+	if (!check_many(buf))
+		ret = 0;
+
+	return ret;
+}
+
+static void bench(void)
+{
+	FILE *fp;
+	uint8_t *buf;
+	char out[SHA1_DIGESTLEN * 2 + 1];
+	clock_t start;
+	double secs;
+	unsigned i;
+
+	buf = malloc(BENCHLEN);
+	if (!buf || !(fp = tmpfile())) {
+		fprintf(stderr, "cannot set up the benchmark\n");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < BENCHLEN; i++)
+		buf[i] = i * 2654435761U >> 24;
+	fwrite(buf, 1, BENCHLEN, fp);
+	free(buf);
+
+	for (i = 0; i < NIMPLS; i++) {
+		if (!sha1_impl_set(impls[i]))
+			continue;
+		rewind(fp);
+		start = clock();
+		sha1_stream(fp, out);
+		secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+		printf("%-8s %8.1f MB/s  %s\n", impls[i],
+		       BENCHLEN / 1048576.0 / (secs > 0 ? secs : 1e-9), out);
+	}
+	fclose(fp);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && !strcmp(argv[1], "-b")) {
+		bench();
+		return EXIT_SUCCESS;
+	}
+
+	return test() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
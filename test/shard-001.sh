@@ -0,0 +1,39 @@
+#!/bin/sh
+
+. "${TEST_INIT:-./test-init.sh}"
+
+if [ "$1" = 'actual' ]; then
+  tmpdir=$(mktemp -d)
+  cp "$DATA_DIR/conf" "$tmpdir" || exit 1
+  echo 'general.yearshards=yes' >> "$tmpdir/conf"
+  : > "$tmpdir/todo"
+  cat > "$tmpdir/apts" <<EOD
+12/31/2029 @ 23:00 -> 01/01/2030 @ 01:00|Core
+01/01/2030 @ 10:00 -> 01/01/2030 @ 11:00|Year 2030
+06/01/2030 [1] {1Y} Recurring
+03/04/2031 [1] Year 2031
+EOD
+  "$CALCURSE" -D "$tmpdir" -P --filter-pattern none
+  cat "$tmpdir/apts" "$tmpdir/apts.d/2030" "$tmpdir/apts.d/2031"
+  "$CALCURSE" -D "$tmpdir" -Q --from 03/04/2031
+  sed -i '/yearshards/d' "$tmpdir/conf"
+  "$CALCURSE" -D "$tmpdir" -P --filter-pattern none
+  cat "$tmpdir/apts"
+  [ -d "$tmpdir/apts.d" ] && echo 'Shards left'
+  rm -rf "$tmpdir" || exit 1
+elif [ "$1" = 'expected' ]; then
+  cat <<EOD
+06/01/2030 [1] {1Y} Recurring
+12/31/2029 @ 23:00 -> 01/01/2030 @ 01:00|Core
+01/01/2030 @ 10:00 -> 01/01/2030 @ 11:00|Year 2030
+03/04/2031 [1] Year 2031
+03/04/31:
+ * Year 2031
+06/01/2030 [1] {1Y} Recurring
+12/31/2029 @ 23:00 -> 01/01/2030 @ 01:00|Core
+01/01/2030 @ 10:00 -> 01/01/2030 @ 11:00|Year 2030
+03/04/2031 [1] Year 2031
+EOD
+else
+  ./run-test "$0"
+fi
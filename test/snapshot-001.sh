@@ -0,0 +1,32 @@
+#!/bin/sh
+
+. "${TEST_INIT:-./test-init.sh}"
+
+if [ "$1" = 'actual' ]; then
+  tmpdir=$(mktemp -d)
+  cp "$DATA_DIR/conf" "$DATA_DIR/todo" "$tmpdir" || exit 1
+  cp "$DATA_DIR/apts-recur" "$tmpdir/apts" || exit 1
+  echo 'general.snapshot=yes' >> "$tmpdir/conf"
+  touch -t 200101010000 "$tmpdir/apts" "$tmpdir/todo"
+  "$CALCURSE" -D "$tmpdir" -G >/dev/null
+  [ -f "$tmpdir/apts.snap" ] || echo 'missing snapshot'
+  "$CALCURSE" -D "$tmpdir" -G
+  "$CALCURSE" -D "$tmpdir" -G --filter-type recur-event
+  echo '01/01/2030 [1] Added' >> "$tmpdir/apts"
+  "$CALCURSE" -D "$tmpdir" -G --filter-pattern Added
+  touch -t 200101010000 "$tmpdir/apts"
+  "$CALCURSE" -D "$tmpdir" -G >/dev/null
+  sed 's/Added/Bravo/' "$tmpdir/apts" > "$tmpdir/new"
+  touch -r "$tmpdir/apts" "$tmpdir/new"
+  cp -p "$tmpdir/new" "$tmpdir/apts"
+  "$CALCURSE" -D "$tmpdir" -G --filter-pattern Bravo
+  rm -rf "$tmpdir" || exit 1
+elif [ "$1" = 'expected' ]; then
+  "$CALCURSE" --read-only -D "$DATA_DIR" -c "$DATA_DIR/apts-recur" -G
+  "$CALCURSE" --read-only -D "$DATA_DIR" -c "$DATA_DIR/apts-recur" -G \
+    --filter-type recur-event
+  echo '01/01/2030 [1] Added'
+  echo '01/01/2030 [1] Bravo'
+else
+  ./run-test "$0"
+fi